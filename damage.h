@@ -0,0 +1,152 @@
+#ifndef DAMAGE_H
+#define DAMAGE_H
+// This is a header-only implementation of a damage region: a small set of
+// rectangles covering the parts of an image that need to be redrawn.
+//
+// Rectangles are merged as they're added. A new rectangle that overlaps or
+// touches an existing one is combined with it into their bounding box, and if
+// the set is full, the two rectangles whose bounding box adds the least extra
+// area are combined. So, the region may cover somewhat more than what was
+// marked dirty, but never less, and never more than MAX_DAMAGE_RECTS
+// rectangles.
+
+#include <stdint.h>
+#include <string.h>
+
+// Compositors typically limit the number of damage rectangles too, and
+// combine them once there are more than a handful.
+#define MAX_DAMAGE_RECTS (8)
+
+typedef struct {
+  uint32_t x;
+  uint32_t y;
+  uint32_t w;
+  uint32_t h;
+} DamageRect;
+
+typedef struct {
+  // Has one extra slot, used while merging when the region is full.
+  DamageRect rects[MAX_DAMAGE_RECTS + 1];
+  uint32_t count;
+} DamageRegion;
+
+static void DamageRegionClear(DamageRegion *d) {
+  d->count = 0;
+}
+
+static uint64_t DamageRectArea(const DamageRect *r) {
+  return ((uint64_t) r->w) * r->h;
+}
+
+// Returns the total area of the rectangles in the region. They never overlap,
+// so this is the number of pixels the region covers.
+static uint64_t DamageRegionArea(const DamageRegion *d) {
+  uint64_t to_return = 0;
+  uint32_t i;
+  for (i = 0; i < d->count; i++) to_return += DamageRectArea(d->rects + i);
+  return to_return;
+}
+
+// Sets *dst to the smallest rectangle containing both a and b.
+static void DamageRectUnion(const DamageRect *a, const DamageRect *b,
+  DamageRect *dst) {
+  uint32_t left = a->x < b->x ? a->x : b->x;
+  uint32_t top = a->y < b->y ? a->y : b->y;
+  uint32_t right = (a->x + a->w) > (b->x + b->w) ? (a->x + a->w) :
+    (b->x + b->w);
+  uint32_t bottom = (a->y + a->h) > (b->y + b->h) ? (a->y + a->h) :
+    (b->y + b->h);
+  dst->x = left;
+  dst->y = top;
+  dst->w = right - left;
+  dst->h = bottom - top;
+}
+
+// Returns nonzero if the rectangles overlap or share an edge.
+static int DamageRectsTouch(const DamageRect *a, const DamageRect *b) {
+  if ((a->x + a->w) < b->x) return 0;
+  if ((b->x + b->w) < a->x) return 0;
+  if ((a->y + a->h) < b->y) return 0;
+  if ((b->y + b->h) < a->y) return 0;
+  return 1;
+}
+
+// Removes the rectangle at the given index, replacing it with the last one.
+static void DamageRegionRemove(DamageRegion *d, uint32_t index) {
+  d->count--;
+  d->rects[index] = d->rects[d->count];
+}
+
+// Finds the two rectangles whose bounding box is the smallest increase over
+// their combined area, removes them, and sets *merged to their bounding box.
+// The region must contain at least two rectangles.
+static void DamageRegionTakeCheapestPair(DamageRegion *d,
+  DamageRect *merged) {
+  uint32_t i, j, best_i = 0, best_j = 1;
+  uint64_t cost, best_cost = UINT64_MAX;
+  for (i = 0; i < d->count; i++) {
+    for (j = i + 1; j < d->count; j++) {
+      DamageRectUnion(d->rects + i, d->rects + j, merged);
+      cost = DamageRectArea(merged) - DamageRectArea(d->rects + i) -
+        DamageRectArea(d->rects + j);
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_i = i;
+        best_j = j;
+      }
+    }
+  }
+  DamageRectUnion(d->rects + best_i, d->rects + best_j, merged);
+  // Remove the higher index first, so the other one doesn't get moved.
+  DamageRegionRemove(d, best_j);
+  DamageRegionRemove(d, best_i);
+}
+
+// Adds the rectangle to the region, clipped to a width x height image. Empty
+// rectangles are ignored.
+static void DamageRegionAdd(DamageRegion *d, uint32_t x, uint32_t y,
+  uint32_t w, uint32_t h, uint32_t width, uint32_t height) {
+  DamageRect r;
+  uint32_t i;
+  int merged;
+  if ((x >= width) || (y >= height)) return;
+  if (w > (width - x)) w = width - x;
+  if (h > (height - y)) h = height - y;
+  if ((w == 0) || (h == 0)) return;
+  r.x = x;
+  r.y = y;
+  r.w = w;
+  r.h = h;
+  // Keep absorbing existing rectangles into the new one until it doesn't
+  // touch any of them. This keeps the rectangles in the region disjoint.
+  do {
+    merged = 0;
+    for (i = 0; i < d->count; i++) {
+      if (!DamageRectsTouch(&r, d->rects + i)) continue;
+      DamageRectUnion(&r, d->rects + i, &r);
+      DamageRegionRemove(d, i);
+      merged = 1;
+      break;
+    }
+  } while (merged);
+  d->rects[d->count] = r;
+  d->count++;
+  if (d->count <= MAX_DAMAGE_RECTS) return;
+  // The merged rectangle may touch others, so add it again rather than
+  // putting it straight back into the region.
+  DamageRegionTakeCheapestPair(d, &r);
+  DamageRegionAdd(d, r.x, r.y, r.w, r.h, width, height);
+}
+
+// Adds every rectangle in src to dst.
+static void DamageRegionAddRegion(DamageRegion *dst, const DamageRegion *src,
+  uint32_t width, uint32_t height) {
+  uint32_t i;
+  const DamageRect *r = NULL;
+  for (i = 0; i < src->count; i++) {
+    r = src->rects + i;
+    DamageRegionAdd(dst, r->x, r->y, r->w, r->h, width, height);
+  }
+}
+
+#endif  // DAMAGE_H
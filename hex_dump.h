@@ -1,90 +1,154 @@
 #ifndef HEX_DUMP_H
 #define HEX_DUMP_H
-// This is a header-only implementation of a function that prints a hex dump
-// to stdout, similar to the 'hd' utility.
+// This is a header-only implementation of a hex dump, similar to the 'hd'
+// utility.
 //
-// To use it, call PrintHexDump(buffer, size, start_address)
+// To print one to stdout, call PrintHexDump(buffer, size, start_address)
 // The start_address just determines the "addresses" that are printed at the
-// start of each line; it does not change the offset in the buffer.
+// start of each line; it does not change the offset in the buffer. Bytes are
+// shifted right on the first line to line up with their address.
+//
+// Each line is formatted with a lookup table rather than printf, into a block
+// of lines that's passed to a single write(). HexDumpFormat formats into a
+// caller-supplied buffer instead, and WriteHexDump writes to any fd.
 
+#include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
-// Converts any nonprintable char to a '.'
-static char ByteToAscii(uint8_t b) {
-  if ((b < ' ') || (b > '~')) return '.';
-  return (char) b;
-}
+// The longest a line can be: an 8-digit address, two spaces, 16 hex bytes
+// with a gap between the two halves, " |", 16 characters and "|\n".
+#define HEX_DUMP_LINE_SIZE (8 + 2 + 49 + 2 + 16 + 2)
+// The number of lines WriteHexDump formats before each write().
+#define HEX_DUMP_LINES_PER_WRITE (64)
 
-static void AppendHexBytes(char *dst, uint32_t *dst_offset, uint8_t v) {
-  snprintf(dst + *dst_offset, 4, "%02x ", v);
-  *dst_offset += 3;
-}
+// Each entry holds a byte's two hex digits, a space, and the byte as it's
+// shown in the text column, with anything nonprintable shown as a '.'
+#define HEX_DUMP_DIGIT(d) ((char) (((d) < 10) ? ('0' + (d)) : ('a' + (d) - 10)))
+#define HEX_DUMP_TEXT(b) ((char) ((((b) < ' ') || ((b) > '~')) ? '.' : (b)))
+#define HEX_DUMP_ENTRY(b) {HEX_DUMP_DIGIT((b) >> 4), \
+  HEX_DUMP_DIGIT((b) & 0xf), ' ', HEX_DUMP_TEXT(b)}
+#define HEX_DUMP_ROW(h) HEX_DUMP_ENTRY((h) * 16 + 0), \
+  HEX_DUMP_ENTRY((h) * 16 + 1), HEX_DUMP_ENTRY((h) * 16 + 2), \
+  HEX_DUMP_ENTRY((h) * 16 + 3), HEX_DUMP_ENTRY((h) * 16 + 4), \
+  HEX_DUMP_ENTRY((h) * 16 + 5), HEX_DUMP_ENTRY((h) * 16 + 6), \
+  HEX_DUMP_ENTRY((h) * 16 + 7), HEX_DUMP_ENTRY((h) * 16 + 8), \
+  HEX_DUMP_ENTRY((h) * 16 + 9), HEX_DUMP_ENTRY((h) * 16 + 10), \
+  HEX_DUMP_ENTRY((h) * 16 + 11), HEX_DUMP_ENTRY((h) * 16 + 12), \
+  HEX_DUMP_ENTRY((h) * 16 + 13), HEX_DUMP_ENTRY((h) * 16 + 14), \
+  HEX_DUMP_ENTRY((h) * 16 + 15)
 
-static void AppendTextByte(char *dst, uint32_t *dst_offset, uint8_t v) {
-  dst[*dst_offset] = ByteToAscii(v);
-  *dst_offset += 1;
+static const char hex_dump_table[256][4] = {
+  HEX_DUMP_ROW(0), HEX_DUMP_ROW(1), HEX_DUMP_ROW(2), HEX_DUMP_ROW(3),
+  HEX_DUMP_ROW(4), HEX_DUMP_ROW(5), HEX_DUMP_ROW(6), HEX_DUMP_ROW(7),
+  HEX_DUMP_ROW(8), HEX_DUMP_ROW(9), HEX_DUMP_ROW(10), HEX_DUMP_ROW(11),
+  HEX_DUMP_ROW(12), HEX_DUMP_ROW(13), HEX_DUMP_ROW(14), HEX_DUMP_ROW(15),
+};
+
+// Formats the line of the dump starting at line_address, which must be
+// aligned to 16, into dst. buffer holds the bytes from start_address up to
+// end_address. Returns the length of the line.
+static uint32_t HexDumpFormatLine(char *dst, const uint8_t *buffer,
+  uint32_t line_address, uint32_t start_address, uint32_t end_address) {
+  char *hex = dst + 10, *text = dst + 10 + 49 + 2;
+  const char *entry = NULL;
+  uint32_t i, first = 0, last = 16;
+  for (i = 0; i < 4; i++) {
+    entry = hex_dump_table[(line_address >> (24 - i * 8)) & 0xff];
+    dst[i * 2] = entry[0];
+    dst[i * 2 + 1] = entry[1];
+  }
+  memset(dst + 8, ' ', 2 + 49 + 1);
+  text[-1] = '|';
+  if (start_address > line_address) first = start_address - line_address;
+  if ((end_address - line_address) < 16) last = end_address - line_address;
+  memset(text, ' ', first);
+  buffer += line_address + first - start_address;
+  for (i = first; i < last; i++) {
+    entry = hex_dump_table[*buffer++];
+    // There's an extra space between the two groups of 8 bytes.
+    memcpy(hex + i * 3 + (i >= 8), entry, 3);
+    text[i] = entry[3];
+  }
+  text[last] = '|';
+  text[last + 1] = '\n';
+  return (text + last + 2) - dst;
 }
 
-// The top-level function to print the hex dump.
-static void PrintHexDump(uint8_t *buffer, uint32_t size_bytes,
+// Returns the size of the buffer HexDumpFormat needs for a dump of size_bytes
+// starting at start_address.
+static inline size_t HexDumpMaxLength(uint32_t size_bytes,
   uint32_t start_address) {
-  char hex_buffer[128];
-  char text_buffer[64];
-  // We'll always align the addresses we print to 16 bytes.
-  uint32_t current_address = start_address & ~((uint32_t) 0xf);
-  uint32_t hex_offset = 0, text_offset = 0, byte_offset = 0;
+  size_t lines = ((start_address & 0xf) + ((size_t) size_bytes) + 15) / 16;
+  return lines * HEX_DUMP_LINE_SIZE;
+}
+
+// Formats the hex dump into dst, which must be at least HexDumpMaxLength
+// bytes. Returns the length of the text, which isn't null-terminated.
+static size_t HexDumpFormat(char *dst, const uint8_t *buffer,
+  uint32_t size_bytes, uint32_t start_address) {
+  uint32_t line = start_address & ~((uint32_t) 0xf);
   uint32_t end_address = start_address + size_bytes;
-  uint8_t b;
-  memset(hex_buffer, 0, sizeof(hex_buffer));
-  memset(text_buffer, 0, sizeof(text_buffer));
+  size_t length = 0;
+  for (; line < end_address; line += 16) {
+    length += HexDumpFormatLine(dst + length, buffer, line, start_address,
+      end_address);
+    // Stop if the address wrapped around.
+    if (line > (UINT32_MAX - 16)) break;
+  }
+  return length;
+}
 
-  while (current_address < end_address) {
-    // We're at the start of a new line if our current address is aligned to 16
-    if ((current_address & 0xf) == 0) {
-      printf("%08x  ", current_address);
+// Writes all of the given bytes to fd. Returns 0 on error.
+static int HexDumpWriteAll(int fd, const char *data, size_t size) {
+  ssize_t result;
+  while (size > 0) {
+    result = write(fd, data, size);
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      return 0;
     }
-    // Note that current_address and byte_offset are tracked _separately_. We
-    // have not yet incremented the byte offset here.
-    current_address++;
-    if (current_address < start_address) {
-      // We're before the requested start address, output whitespace.
-      memset(hex_buffer + hex_offset, ' ', 3);
-      hex_offset += 3;
-      AppendTextByte(text_buffer, &text_offset, ' ');
-      // One space of padding between the two 8-byte hex columns.
-      if ((current_address & 0xf) == 8) {
-        AppendTextByte(hex_buffer, &hex_offset, ' ');
-      }
-    } else {
-      // We're past the requested start address, so print the hex bytes.
-      b = buffer[byte_offset];
-      byte_offset++;
-      AppendHexBytes(hex_buffer, &hex_offset, b);
-      AppendTextByte(text_buffer, &text_offset, b);
-      if ((current_address & 0xf) == 8) {
-        AppendTextByte(hex_buffer, &hex_offset, ' ');
-      }
+    data += result;
+    size -= result;
+  }
+  return 1;
+}
+
+// Writes the hex dump to fd, a block of lines at a time. Returns 0 on error.
+static int WriteHexDump(int fd, const uint8_t *buffer, uint32_t size_bytes,
+  uint32_t start_address) {
+  char block[HEX_DUMP_LINES_PER_WRITE * HEX_DUMP_LINE_SIZE];
+  uint32_t block_start = start_address, block_end, chunk;
+  uint32_t end_address = start_address + size_bytes;
+  const uint32_t block_bytes = HEX_DUMP_LINES_PER_WRITE * 16;
+  while (block_start < end_address) {
+    // Blocks after the first start on a line boundary.
+    block_end = (block_start & ~((uint32_t) 0xf)) + block_bytes;
+    if ((block_end > end_address) || (block_end < block_start)) {
+      block_end = end_address;
     }
-    // Output the formatted line every 16 bytes of address.
-    if ((current_address & 0xf) == 0) {
-      hex_buffer[hex_offset] = 0;
-      text_buffer[text_offset] = 0;
-      printf("%s |%s|\n", hex_buffer, text_buffer);
-      hex_offset = 0;
-      text_offset = 0;
+    chunk = block_end - block_start;
+    if (!HexDumpWriteAll(fd, block, HexDumpFormat(block, buffer, chunk,
+      block_start))) {
+      return 0;
     }
+    buffer += chunk;
+    block_start = block_end;
   }
+  return 1;
+}
 
-  // If the number of bytes was not an exact multiple of 16, we'll still have
-  // some bytes left to print on the final line.
-  if ((current_address & 0xf) != 0) {
-    hex_buffer[hex_offset] = 0;
-    text_buffer[text_offset] = 0;
-    printf("%-49s |%s|\n", hex_buffer, text_buffer);
+// The top-level function to print the hex dump to stdout.
+static void PrintHexDump(const uint8_t *buffer, uint32_t size_bytes,
+  uint32_t start_address) {
+  // Anything already printed through stdio must come first.
+  fflush(stdout);
+  if (!WriteHexDump(STDOUT_FILENO, buffer, size_bytes, start_address)) {
+    printf("Error writing hex dump: %s\n", strerror(errno));
   }
 }
 
 #endif  // HEX_DUMP_H
-
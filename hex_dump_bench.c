@@ -0,0 +1,196 @@
+// This program measures the throughput of the hex dump in hex_dump.h, in MB
+// of input dumped per second. For reference it also measures the old
+// PrintHexDump, which called snprintf for every byte and printf for every
+// line. Output goes to /dev/null, and the results are printed to stderr.
+//
+// Before measuring anything, it checks that both versions produce the same
+// text for a range of sizes.
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hex_dump.h"
+
+// Each measurement repeats the dump until at least this much time has passed.
+#define MIN_BENCHMARK_SECONDS (0.25)
+// The size of the buffer that's dumped in each benchmark.
+#define DUMP_SIZE (1024 * 1024)
+// Output is checked for every size up to this.
+#define MAX_CHECKED_SIZE (300)
+
+static double CurrentSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec) + ((double) ts.tv_nsec) * 1e-9;
+}
+
+static char LegacyByteToAscii(uint8_t b) {
+  if ((b < ' ') || (b > '~')) return '.';
+  return (char) b;
+}
+
+static void LegacyAppendHexBytes(char *dst, uint32_t *dst_offset, uint8_t v) {
+  snprintf(dst + *dst_offset, 4, "%02x ", v);
+  *dst_offset += 3;
+}
+
+static void LegacyAppendTextByte(char *dst, uint32_t *dst_offset, uint8_t v) {
+  dst[*dst_offset] = LegacyByteToAscii(v);
+  *dst_offset += 1;
+}
+
+// PrintHexDump as it was before it used a lookup table, minus support for
+// unaligned start addresses, which it got wrong.
+static void LegacyPrintHexDump(const uint8_t *buffer, uint32_t size_bytes,
+  uint32_t start_address) {
+  char hex_buffer[128];
+  char text_buffer[64];
+  uint32_t current_address = start_address;
+  uint32_t hex_offset = 0, text_offset = 0, byte_offset = 0;
+  uint32_t end_address = start_address + size_bytes;
+  uint8_t b;
+  while (current_address < end_address) {
+    if ((current_address & 0xf) == 0) {
+      printf("%08x  ", current_address);
+    }
+    current_address++;
+    b = buffer[byte_offset];
+    byte_offset++;
+    LegacyAppendHexBytes(hex_buffer, &hex_offset, b);
+    LegacyAppendTextByte(text_buffer, &text_offset, b);
+    if ((current_address & 0xf) == 8) {
+      LegacyAppendTextByte(hex_buffer, &hex_offset, ' ');
+    }
+    if ((current_address & 0xf) == 0) {
+      hex_buffer[hex_offset] = 0;
+      text_buffer[text_offset] = 0;
+      printf("%s |%s|\n", hex_buffer, text_buffer);
+      hex_offset = 0;
+      text_offset = 0;
+    }
+  }
+  if ((current_address & 0xf) != 0) {
+    hex_buffer[hex_offset] = 0;
+    text_buffer[text_offset] = 0;
+    printf("%-49s |%s|\n", hex_buffer, text_buffer);
+  }
+}
+
+// Reads the whole file into a new buffer and sets *size. Returns NULL on
+// error.
+static char* ReadWholeFile(FILE *f, size_t *size) {
+  char *data = NULL;
+  long length;
+  fseek(f, 0, SEEK_END);
+  length = ftell(f);
+  rewind(f);
+  data = (char *) malloc(length + 1);
+  if (!data) return NULL;
+  *size = fread(data, 1, length, f);
+  return data;
+}
+
+// Returns 0 if the two versions disagree about the dump of any size up to
+// MAX_CHECKED_SIZE, or at any of a few start addresses.
+static int CheckOutput(const uint8_t *buffer, int stdout_copy) {
+  static const uint32_t start_addresses[] = {0, 0x10, 0xfff0, 0x12345670};
+  FILE *legacy = tmpfile(), *current = tmpfile();
+  char *legacy_text = NULL, *current_text = NULL;
+  size_t legacy_size = 0, current_size = 0;
+  uint32_t size, i;
+  int result = 0;
+  if (!legacy || !current) {
+    fprintf(stderr, "Failed creating temporary files.\n");
+    goto done;
+  }
+  // Point stdout at the file the legacy version writes to.
+  fflush(stdout);
+  dup2(fileno(legacy), STDOUT_FILENO);
+  for (i = 0; i < (sizeof(start_addresses) / sizeof(uint32_t)); i++) {
+    for (size = 0; size <= MAX_CHECKED_SIZE; size++) {
+      LegacyPrintHexDump(buffer, size, start_addresses[i]);
+      fflush(stdout);
+      WriteHexDump(fileno(current), buffer, size, start_addresses[i]);
+    }
+  }
+  dup2(stdout_copy, STDOUT_FILENO);
+  legacy_text = ReadWholeFile(legacy, &legacy_size);
+  current_text = ReadWholeFile(current, &current_size);
+  if (!legacy_text || !current_text) {
+    fprintf(stderr, "Failed reading the dumps back.\n");
+    goto done;
+  }
+  if ((legacy_size != current_size) || (memcmp(legacy_text, current_text,
+    legacy_size) != 0)) {
+    fprintf(stderr, "The new hex dump differs from the old one (%lu vs %lu "
+      "bytes).\n", (unsigned long) current_size, (unsigned long) legacy_size);
+    goto done;
+  }
+  result = 1;
+done:
+  free(legacy_text);
+  free(current_text);
+  if (legacy) fclose(legacy);
+  if (current) fclose(current);
+  return result;
+}
+
+static void DumpLegacy(const uint8_t *buffer, char *scratch) {
+  LegacyPrintHexDump(buffer, DUMP_SIZE, 0);
+  fflush(stdout);
+}
+
+static void DumpToMemory(const uint8_t *buffer, char *scratch) {
+  HexDumpFormat(scratch, buffer, DUMP_SIZE, 0);
+}
+
+static void DumpToStdout(const uint8_t *buffer, char *scratch) {
+  PrintHexDump(buffer, DUMP_SIZE, 0);
+}
+
+// Prints the throughput of one way of dumping buffer.
+static void RunBenchmark(const char *name, void (*dump)(const uint8_t*,
+  char*), const uint8_t *buffer, char *scratch) {
+  double start, elapsed;
+  uint64_t iterations = 0;
+  start = CurrentSeconds();
+  do {
+    dump(buffer, scratch);
+    iterations++;
+    elapsed = CurrentSeconds() - start;
+  } while (elapsed < MIN_BENCHMARK_SECONDS);
+  fprintf(stderr, "%-22s %8.1f MB/s %10.1f us/MB\n", name,
+    (((double) DUMP_SIZE) * iterations) / elapsed / 1e6,
+    elapsed / iterations * 1e6 / (DUMP_SIZE / 1e6));
+}
+
+int main(int argc, char **argv) {
+  uint8_t *buffer = (uint8_t *) malloc(DUMP_SIZE);
+  char *scratch = (char *) malloc(HexDumpMaxLength(DUMP_SIZE, 0));
+  int null_fd = open("/dev/null", O_WRONLY);
+  int stdout_copy = dup(STDOUT_FILENO);
+  uint32_t i;
+  if (!buffer || !scratch || (null_fd < 0) || (stdout_copy < 0)) {
+    fprintf(stderr, "Failed setting up the benchmark.\n");
+    return 1;
+  }
+  srand(1);
+  for (i = 0; i < DUMP_SIZE; i++) buffer[i] = rand();
+  if (!CheckOutput(buffer, stdout_copy)) return 1;
+
+  // Send everything written to stdout to /dev/null while benchmarking.
+  fflush(stdout);
+  dup2(null_fd, STDOUT_FILENO);
+  RunBenchmark("printf per line", DumpLegacy, buffer, scratch);
+  RunBenchmark("table, to memory", DumpToMemory, buffer, scratch);
+  RunBenchmark("table, write per block", DumpToStdout, buffer, scratch);
+  dup2(stdout_copy, STDOUT_FILENO);
+  free(buffer);
+  free(scratch);
+  close(null_fd);
+  close(stdout_copy);
+  return 0;
+}
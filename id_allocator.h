@@ -0,0 +1,113 @@
+#ifndef ID_ALLOCATOR_H
+#define ID_ALLOCATOR_H
+// This is a header-only implementation of an allocator for client-side
+// wayland object IDs.
+//
+// The spec requires client IDs to be densely packed, and the server tells us
+// when an ID may be reused using wl_display.delete_id. Released IDs are kept
+// in a min-heap so the lowest free ID is always handed out first, which keeps
+// the IDs (and anything indexed by them) as compact as possible.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// IDs above this are reserved for the server.
+#define MAX_CLIENT_ID (0xfeffffff)
+
+typedef struct {
+  // The lowest ID that has never been handed out.
+  uint32_t next_new_id;
+  // A min-heap of released IDs.
+  uint32_t *free_ids;
+  uint32_t free_count;
+  uint32_t free_capacity;
+  // The number of IDs currently in use, and the most that were ever in use at
+  // the same time.
+  uint32_t live_count;
+  uint32_t peak_live_count;
+  // The number of IDs handed out in total, and how many of them were reused.
+  uint64_t allocated_count;
+  uint64_t reused_count;
+} IDAllocator;
+
+// Initializes the allocator. The first ID it hands out will be first_id.
+static void IDAllocatorInit(IDAllocator *a, uint32_t first_id) {
+  memset(a, 0, sizeof(*a));
+  a->next_new_id = first_id;
+}
+
+static void IDAllocatorDestroy(IDAllocator *a) {
+  free(a->free_ids);
+  memset(a, 0, sizeof(*a));
+}
+
+// Removes and returns the smallest ID in the heap, which must not be empty.
+static uint32_t IDAllocatorPopFree(IDAllocator *a) {
+  uint32_t to_return = a->free_ids[0];
+  uint32_t i = 0, child, tmp;
+  a->free_count--;
+  a->free_ids[0] = a->free_ids[a->free_count];
+  while (1) {
+    child = i * 2 + 1;
+    if (child >= a->free_count) break;
+    if (((child + 1) < a->free_count) &&
+      (a->free_ids[child + 1] < a->free_ids[child])) {
+      child++;
+    }
+    if (a->free_ids[i] <= a->free_ids[child]) break;
+    tmp = a->free_ids[i];
+    a->free_ids[i] = a->free_ids[child];
+    a->free_ids[child] = tmp;
+    i = child;
+  }
+  return to_return;
+}
+
+// Returns a new ID, preferring the lowest released ID. Returns 0 if every
+// client ID is in use.
+static uint32_t IDAllocatorAllocate(IDAllocator *a) {
+  uint32_t to_return;
+  if (a->free_count != 0) {
+    to_return = IDAllocatorPopFree(a);
+    a->reused_count++;
+  } else {
+    if (a->next_new_id > MAX_CLIENT_ID) return 0;
+    to_return = a->next_new_id;
+    a->next_new_id++;
+  }
+  a->allocated_count++;
+  a->live_count++;
+  if (a->live_count > a->peak_live_count) a->peak_live_count = a->live_count;
+  return to_return;
+}
+
+// Makes the ID available to be handed out again. The caller must make sure
+// the ID is currently allocated. Returns 0 if growing the heap failed.
+static int IDAllocatorRelease(IDAllocator *a, uint32_t id) {
+  uint32_t new_capacity, i, parent, tmp;
+  uint32_t *new_ids = NULL;
+  if (a->free_count >= a->free_capacity) {
+    new_capacity = a->free_capacity ? a->free_capacity * 2 : 64;
+    new_ids = (uint32_t *) realloc(a->free_ids, new_capacity *
+      sizeof(uint32_t));
+    if (!new_ids) return 0;
+    a->free_ids = new_ids;
+    a->free_capacity = new_capacity;
+  }
+  i = a->free_count;
+  a->free_ids[i] = id;
+  a->free_count++;
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (a->free_ids[parent] <= a->free_ids[i]) break;
+    tmp = a->free_ids[i];
+    a->free_ids[i] = a->free_ids[parent];
+    a->free_ids[parent] = tmp;
+    i = parent;
+  }
+  a->live_count--;
+  return 1;
+}
+
+#endif  // ID_ALLOCATOR_H
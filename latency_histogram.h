@@ -0,0 +1,86 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+// This is a header-only implementation of a fixed-size latency histogram,
+// similar to HdrHistogram. Recording a value is a few instructions and never
+// allocates, so it's safe to use on every frame.
+//
+// Values are in nanoseconds. Below LATENCY_SUB_BUCKETS they're counted
+// exactly. Above that, each power of two is split into LATENCY_SUB_BUCKETS
+// equal buckets, so a percentile is never off by more than 1 part in
+// LATENCY_SUB_BUCKETS (under 1%). Values of 2^LATENCY_MAX_BITS ns (about 18
+// minutes) or more are counted in the last bucket.
+
+#include <stdint.h>
+#include <time.h>
+
+#define LATENCY_SUB_BUCKET_BITS (7)
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_BITS (40)
+#define LATENCY_BUCKET_COUNT ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) \
+  * LATENCY_SUB_BUCKETS)
+
+// A zeroed histogram is empty.
+typedef struct {
+  uint64_t counts[LATENCY_BUCKET_COUNT];
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+} LatencyHistogram;
+
+// Returns the current CLOCK_MONOTONIC time in nanoseconds.
+static uint64_t MonotonicNanoseconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// Returns the index of the bucket that counts the given value.
+static uint32_t LatencyBucketIndex(uint64_t v) {
+  uint32_t shift;
+  if (v < LATENCY_SUB_BUCKETS) return v;
+  if (v >= (1ull << LATENCY_MAX_BITS)) v = (1ull << LATENCY_MAX_BITS) - 1;
+  // The number of low bits dropped to leave LATENCY_SUB_BUCKET_BITS + 1
+  // significant bits, the top one of which is always set.
+  shift = 63 - __builtin_clzll(v) - LATENCY_SUB_BUCKET_BITS;
+  return (shift + 1) * LATENCY_SUB_BUCKETS + (v >> shift) -
+    LATENCY_SUB_BUCKETS;
+}
+
+// Returns the highest value counted by the bucket at the given index.
+static uint64_t LatencyBucketValue(uint32_t index) {
+  uint32_t shift;
+  uint64_t significand;
+  if (index < LATENCY_SUB_BUCKETS) return index;
+  shift = index / LATENCY_SUB_BUCKETS - 1;
+  significand = (index % LATENCY_SUB_BUCKETS) + LATENCY_SUB_BUCKETS;
+  return ((significand + 1) << shift) - 1;
+}
+
+static void LatencyHistogramRecord(LatencyHistogram *h, uint64_t v) {
+  h->counts[LatencyBucketIndex(v)]++;
+  if ((h->total == 0) || (v < h->min)) h->min = v;
+  if (v > h->max) h->max = v;
+  h->total++;
+}
+
+// Returns the value that the given fraction (e.g. 0.99) of recorded values
+// are less than or equal to, or 0 if nothing has been recorded.
+static uint64_t LatencyHistogramPercentile(const LatencyHistogram *h,
+  double fraction) {
+  uint64_t target = (uint64_t) (fraction * h->total + 0.5);
+  uint64_t seen = 0, to_return;
+  uint32_t i;
+  if (h->total == 0) return 0;
+  if (target == 0) target = 1;
+  for (i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+    seen += h->counts[i];
+    if (seen >= target) break;
+  }
+  to_return = LatencyBucketValue(i);
+  // The top bucket of a value may extend past anything actually recorded.
+  if (to_return > h->max) to_return = h->max;
+  if (to_return < h->min) to_return = h->min;
+  return to_return;
+}
+
+#endif  // LATENCY_HISTOGRAM_H
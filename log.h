@@ -0,0 +1,496 @@
+#ifndef LOG_H
+#define LOG_H
+// This is a header-only implementation of leveled logging that keeps
+// formatting and stdout off the hot path.
+//
+// Messages below LOG_MIN_LEVEL are removed at compile time: the call is still
+// type-checked, but the compiler drops it along with its format string. Build
+// with e.g. -DLOG_MIN_LEVEL=LOG_LEVEL_DEBUG to keep everything.
+//
+// Once LogInit has been called, LOG_DEBUG, LOG_INFO and LOG_WARNING only copy
+// the format string pointer and the raw arguments into a fixed-size record in
+// a lock-free ring. A background thread turns the records into text and
+// writes them to stdout LOG_FLUSH_INTERVAL_MS after the first of a batch is
+// logged, or sooner if the ring fills up. While the ring is empty it sleeps
+// without any timeout, so logging costs nothing while idle. If the ring is
+// full, the message is dropped and counted rather than blocking the caller.
+// LOG_ERROR flushes the ring and writes its message immediately, so nothing
+// is lost if the program exits right after. Before LogInit and after
+// LogShutdown, every message is written immediately.
+//
+// Format strings must be string literals, since only the pointer is kept.
+// Strings passed for %s are copied into the record, and are truncated if
+// they don't fit.
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_LEVEL_DEBUG (0)
+#define LOG_LEVEL_INFO (1)
+#define LOG_LEVEL_WARNING (2)
+#define LOG_LEVEL_ERROR (3)
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+// The number of records in the ring. Must be a power of two.
+#define LOG_RING_SLOTS (1024)
+// The most arguments, counting * widths and precisions, a deferred message
+// may have. Messages with more are formatted immediately.
+#define LOG_MAX_ARGS (8)
+// The space in each record for copies of %s arguments, or for the text of a
+// message that had to be formatted immediately.
+#define LOG_TEXT_SIZE (160)
+#define LOG_FLUSH_INTERVAL_MS (10)
+
+// The C type an argument was passed as, as determined by its conversion.
+typedef enum {
+  LOG_ARG_NONE,
+  LOG_ARG_INT,
+  LOG_ARG_LONG,
+  LOG_ARG_LONG_LONG,
+  LOG_ARG_SIZE,
+  LOG_ARG_INTMAX,
+  LOG_ARG_PTRDIFF,
+  LOG_ARG_DOUBLE,
+  LOG_ARG_POINTER,
+  LOG_ARG_STRING,
+  // A conversion the ring can't defer, such as %n or %Lf.
+  LOG_ARG_UNSUPPORTED,
+} LogArgType;
+
+typedef union {
+  long long i;
+  double d;
+  void *p;
+} LogArg;
+
+// One conversion in a format string, e.g. "%-8.*s".
+typedef struct {
+  const char *start;
+  uint32_t length;
+  // The number of * widths and precisions, each taking an int argument.
+  uint32_t star_count;
+  LogArgType type;
+} LogConversion;
+
+typedef struct {
+  // The position in the ring this record holds once it's been written, plus
+  // one. The consumer waits for this before reading the record.
+  uint64_t sequence;
+  // NULL if text holds the already-formatted message.
+  const char *format;
+  uint32_t arg_count;
+  uint32_t text_used;
+  LogArg args[LOG_MAX_ARGS];
+  char text[LOG_TEXT_SIZE];
+} LogRecord;
+
+typedef struct {
+  LogRecord records[LOG_RING_SLOTS];
+  // The next position to write, claimed by producers with a compare-and-swap.
+  uint64_t write_position;
+  // The next position to read. Only changed with flush_lock held.
+  uint64_t read_position;
+  // Messages dropped because the ring was full.
+  uint64_t dropped;
+  int running;
+  int stopping;
+  pthread_t thread;
+  pthread_mutex_t flush_lock;
+  pthread_mutex_t wake_lock;
+  pthread_cond_t wake;
+} LogState;
+
+// wake is initialized by LogInit, to use CLOCK_MONOTONIC for timed waits.
+static LogState log_state = {
+  .flush_lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void LogWrite(int level, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+// The "" makes passing anything but a string literal a compile error.
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LogWrite(LOG_LEVEL_DEBUG, "" __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do { \
+  if (0) LogWrite(LOG_LEVEL_DEBUG, "" __VA_ARGS__); \
+} while (0)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LogWrite(LOG_LEVEL_INFO, "" __VA_ARGS__)
+#else
+#define LOG_INFO(...) do { \
+  if (0) LogWrite(LOG_LEVEL_INFO, "" __VA_ARGS__); \
+} while (0)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARNING
+#define LOG_WARNING(...) LogWrite(LOG_LEVEL_WARNING, "" __VA_ARGS__)
+#else
+#define LOG_WARNING(...) do { \
+  if (0) LogWrite(LOG_LEVEL_WARNING, "" __VA_ARGS__); \
+} while (0)
+#endif
+// Errors are never compiled out.
+#define LOG_ERROR(...) LogWrite(LOG_LEVEL_ERROR, "" __VA_ARGS__)
+
+// Returns nonzero if messages at the given level are compiled in, for
+// guarding extra work done only to produce them.
+#define LOG_ENABLED(level) ((level) >= LOG_MIN_LEVEL)
+
+// Parses the conversion starting at the '%' at c->start, and sets the rest of
+// c. Returns a pointer past the end of the conversion.
+static const char* LogParseConversion(LogConversion *c) {
+  const char *p = c->start + 1;
+  int length_modifier = 0;
+  c->star_count = 0;
+  while (*p && strchr("-+ #0", *p)) p++;
+  if (*p == '*') {
+    c->star_count++;
+    p++;
+  }
+  while ((*p >= '0') && (*p <= '9')) p++;
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      c->star_count++;
+      p++;
+    }
+    while ((*p >= '0') && (*p <= '9')) p++;
+  }
+  // Encode the length modifier as the letter, doubled letters as uppercase.
+  if ((p[0] == 'h') || (p[0] == 'l')) {
+    length_modifier = (p[1] == p[0]) ? p[0] - 'a' + 'A' : p[0];
+    p += (p[1] == p[0]) ? 2 : 1;
+  } else if (*p && strchr("jztL", *p)) {
+    length_modifier = *p;
+    p++;
+  }
+  c->type = LOG_ARG_UNSUPPORTED;
+  switch (*p) {
+  case '%':
+    c->type = LOG_ARG_NONE;
+    break;
+  case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+    switch (length_modifier) {
+    case 0: case 'h': case 'H': c->type = LOG_ARG_INT; break;
+    case 'l': c->type = LOG_ARG_LONG; break;
+    case 'L': c->type = LOG_ARG_LONG_LONG; break;
+    case 'z': c->type = LOG_ARG_SIZE; break;
+    case 'j': c->type = LOG_ARG_INTMAX; break;
+    case 't': c->type = LOG_ARG_PTRDIFF; break;
+    }
+    break;
+  case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a':
+  case 'A':
+    // 'L' here means long double, which isn't supported.
+    if ((length_modifier == 0) || (length_modifier == 'l')) {
+      c->type = LOG_ARG_DOUBLE;
+    }
+    break;
+  case 'p':
+    c->type = LOG_ARG_POINTER;
+    break;
+  case 's':
+    if (length_modifier == 0) c->type = LOG_ARG_STRING;
+    break;
+  }
+  if (*p) p++;
+  c->length = p - c->start;
+  return p;
+}
+
+// Copies the arguments in args into r, per r->format. Returns 0 if the
+// message can't be deferred.
+static int LogCaptureArgs(LogRecord *r, va_list args) {
+  LogConversion c;
+  const char *p = r->format, *s = NULL;
+  uint32_t i, length;
+  while ((p = strchr(p, '%')) != NULL) {
+    c.start = p;
+    p = LogParseConversion(&c);
+    if (c.type == LOG_ARG_UNSUPPORTED) return 0;
+    if (c.type == LOG_ARG_NONE) continue;
+    if ((r->arg_count + c.star_count + 1) > LOG_MAX_ARGS) return 0;
+    for (i = 0; i < c.star_count; i++) {
+      r->args[r->arg_count++].i = va_arg(args, int);
+    }
+    switch (c.type) {
+    case LOG_ARG_INT: r->args[r->arg_count].i = va_arg(args, int); break;
+    case LOG_ARG_LONG: r->args[r->arg_count].i = va_arg(args, long); break;
+    case LOG_ARG_LONG_LONG:
+      r->args[r->arg_count].i = va_arg(args, long long);
+      break;
+    case LOG_ARG_SIZE: r->args[r->arg_count].i = va_arg(args, size_t); break;
+    case LOG_ARG_INTMAX:
+      r->args[r->arg_count].i = va_arg(args, intmax_t);
+      break;
+    case LOG_ARG_PTRDIFF:
+      r->args[r->arg_count].i = va_arg(args, ptrdiff_t);
+      break;
+    case LOG_ARG_DOUBLE: r->args[r->arg_count].d = va_arg(args, double); break;
+    case LOG_ARG_POINTER: r->args[r->arg_count].p = va_arg(args, void*); break;
+    case LOG_ARG_STRING:
+      // Store the offset of the copy in text. If an earlier string used up
+      // the space, format the message now instead, so it's truncated as a
+      // whole.
+      if (r->text_used >= (LOG_TEXT_SIZE - 1)) return 0;
+      s = va_arg(args, const char*);
+      if (!s) s = "(null)";
+      length = strlen(s);
+      if (length >= (LOG_TEXT_SIZE - r->text_used)) {
+        length = LOG_TEXT_SIZE - r->text_used - 1;
+      }
+      memcpy(r->text + r->text_used, s, length);
+      r->text[r->text_used + length] = 0;
+      r->args[r->arg_count].i = r->text_used;
+      r->text_used += length + 1;
+      break;
+    default:
+      break;
+    }
+    r->arg_count++;
+  }
+  return 1;
+}
+
+// Writes a single conversion, using the arguments starting at args.
+static void LogFormatConversion(FILE *f, const LogRecord *r,
+  const LogConversion *c, const LogArg *args) {
+  char spec[32];
+  const LogArg *v = args + c->star_count;
+  int w = 0, p = 0;
+  if (c->length >= sizeof(spec)) return;
+  memcpy(spec, c->start, c->length);
+  spec[c->length] = 0;
+  if (c->star_count > 0) w = args[0].i;
+  if (c->star_count > 1) p = args[1].i;
+  // Each type needs a separate call so the value is passed as what the
+  // conversion expects. The * arguments precede it.
+#define LOG_PRINT_VALUE(value) do { \
+  if (c->star_count == 0) fprintf(f, spec, value); \
+  if (c->star_count == 1) fprintf(f, spec, w, value); \
+  if (c->star_count == 2) fprintf(f, spec, w, p, value); \
+} while (0)
+  switch (c->type) {
+  case LOG_ARG_INT: LOG_PRINT_VALUE((int) v->i); break;
+  case LOG_ARG_LONG: LOG_PRINT_VALUE((long) v->i); break;
+  case LOG_ARG_LONG_LONG: LOG_PRINT_VALUE(v->i); break;
+  case LOG_ARG_SIZE: LOG_PRINT_VALUE((size_t) v->i); break;
+  case LOG_ARG_INTMAX: LOG_PRINT_VALUE((intmax_t) v->i); break;
+  case LOG_ARG_PTRDIFF: LOG_PRINT_VALUE((ptrdiff_t) v->i); break;
+  case LOG_ARG_DOUBLE: LOG_PRINT_VALUE(v->d); break;
+  case LOG_ARG_POINTER: LOG_PRINT_VALUE(v->p); break;
+  case LOG_ARG_STRING: LOG_PRINT_VALUE(r->text + v->i); break;
+  default: break;
+  }
+#undef LOG_PRINT_VALUE
+}
+
+// Formats the record's message and writes it to f.
+static void LogFormatRecord(FILE *f, const LogRecord *r) {
+  LogConversion c;
+  const char *p = r->format, *next = NULL;
+  uint32_t arg = 0;
+  if (!p) {
+    fputs(r->text, f);
+    return;
+  }
+  while ((next = strchr(p, '%')) != NULL) {
+    fwrite(p, 1, next - p, f);
+    c.start = next;
+    p = LogParseConversion(&c);
+    if (c.type == LOG_ARG_NONE) {
+      fputc('%', f);
+      continue;
+    }
+    LogFormatConversion(f, r, &c, r->args + arg);
+    arg += c.star_count + 1;
+  }
+  fputs(p, f);
+}
+
+// Writes every message in the ring to stdout. Safe to call from any thread.
+static void LogFlush(void) {
+  LogState *l = &log_state;
+  LogRecord *r = NULL;
+  uint64_t dropped;
+  pthread_mutex_lock(&l->flush_lock);
+  while (1) {
+    r = l->records + (l->read_position & (LOG_RING_SLOTS - 1));
+    if (__atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE) !=
+      (l->read_position + 1)) {
+      break;
+    }
+    LogFormatRecord(stdout, r);
+    // Hand the record back to producers for its next lap of the ring.
+    __atomic_store_n(&r->sequence, l->read_position + LOG_RING_SLOTS,
+      __ATOMIC_RELEASE);
+    __atomic_store_n(&l->read_position, l->read_position + 1,
+      __ATOMIC_RELEASE);
+  }
+  dropped = __atomic_exchange_n(&l->dropped, 0, __ATOMIC_RELAXED);
+  if (dropped) printf("(Dropped %llu log messages.)\n",
+    (unsigned long long) dropped);
+  fflush(stdout);
+  pthread_mutex_unlock(&l->flush_lock);
+}
+
+static void LogWake(void) {
+  pthread_mutex_lock(&log_state.wake_lock);
+  pthread_cond_signal(&log_state.wake);
+  pthread_mutex_unlock(&log_state.wake_lock);
+}
+
+// Returns nonzero if no records have been claimed since the last flush.
+static int LogRingEmpty(LogState *l) {
+  return __atomic_load_n(&l->write_position, __ATOMIC_ACQUIRE) ==
+    __atomic_load_n(&l->read_position, __ATOMIC_ACQUIRE);
+}
+
+static void* LogThread(void *arg) {
+  LogState *l = &log_state;
+  struct timespec deadline;
+  pthread_mutex_lock(&l->wake_lock);
+  while (!l->stopping) {
+    // LogWrite wakes us when it adds a record to the empty ring. It does so
+    // with wake_lock held, so the wakeup can't be missed between this check
+    // and the wait.
+    if (LogRingEmpty(l)) {
+      pthread_cond_wait(&l->wake, &l->wake_lock);
+      continue;
+    }
+    // Give the rest of the batch time to arrive, so it's written at once.
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&l->wake, &l->wake_lock, &deadline);
+    pthread_mutex_unlock(&l->wake_lock);
+    LogFlush();
+    pthread_mutex_lock(&l->wake_lock);
+  }
+  pthread_mutex_unlock(&l->wake_lock);
+  return NULL;
+}
+
+// Starts the thread that writes out logged messages. Until this is called,
+// messages are written immediately. Returns 0 on error. Marked unused, along
+// with LogShutdown, since programs that only log through the helper headers
+// never start the thread.
+__attribute__((unused))
+static int LogInit(void) {
+  LogState *l = &log_state;
+  pthread_condattr_t attributes;
+  uint64_t i;
+  if (l->running) return 1;
+  for (i = 0; i < LOG_RING_SLOTS; i++) l->records[i].sequence = i;
+  l->write_position = 0;
+  l->read_position = 0;
+  l->stopping = 0;
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&l->wake, &attributes);
+  pthread_condattr_destroy(&attributes);
+  if (pthread_create(&l->thread, NULL, LogThread, NULL) != 0) {
+    printf("Failed starting the logging thread.\n");
+    pthread_cond_destroy(&l->wake);
+    return 0;
+  }
+  __atomic_store_n(&l->running, 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Writes out everything in the ring and stops the logging thread. Messages
+// logged after this are written immediately. Does nothing if LogInit wasn't
+// called.
+__attribute__((unused))
+static void LogShutdown(void) {
+  LogState *l = &log_state;
+  if (!l->running) return;
+  __atomic_store_n(&l->running, 0, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&l->wake_lock);
+  l->stopping = 1;
+  pthread_cond_signal(&l->wake);
+  pthread_mutex_unlock(&l->wake_lock);
+  pthread_join(l->thread, NULL);
+  pthread_cond_destroy(&l->wake);
+  LogFlush();
+}
+
+// Claims the next record in the ring, or returns NULL if it's full.
+static LogRecord* LogClaimRecord(uint64_t *position) {
+  LogState *l = &log_state;
+  LogRecord *r = NULL;
+  uint64_t pos = __atomic_load_n(&l->write_position, __ATOMIC_RELAXED);
+  int64_t difference;
+  while (1) {
+    r = l->records + (pos & (LOG_RING_SLOTS - 1));
+    difference = (int64_t) (__atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE) -
+      pos);
+    // The consumer hasn't finished with this record's previous lap.
+    if (difference < 0) return NULL;
+    if ((difference == 0) && __atomic_compare_exchange_n(&l->write_position,
+      &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+    // Another producer claimed it first; the CAS updated pos on failure.
+    if (difference > 0) {
+      pos = __atomic_load_n(&l->write_position, __ATOMIC_RELAXED);
+    }
+  }
+  *position = pos;
+  return r;
+}
+
+static void LogWrite(int level, const char *format, ...) {
+  LogState *l = &log_state;
+  LogRecord *r = NULL;
+  uint64_t position, pending;
+  va_list args;
+  if ((level >= LOG_LEVEL_ERROR) || !__atomic_load_n(&l->running,
+    __ATOMIC_ACQUIRE)) {
+    // Keep the order of anything already in the ring.
+    if (l->running) LogFlush();
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    fflush(stdout);
+    return;
+  }
+  r = LogClaimRecord(&position);
+  if (!r) {
+    __atomic_fetch_add(&l->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  r->format = format;
+  r->arg_count = 0;
+  r->text_used = 0;
+  va_start(args, format);
+  if (!LogCaptureArgs(r, args)) {
+    // Fall back to formatting it now.
+    va_end(args);
+    va_start(args, format);
+    vsnprintf(r->text, LOG_TEXT_SIZE, format, args);
+    r->format = NULL;
+  }
+  va_end(args);
+  __atomic_store_n(&r->sequence, position + 1, __ATOMIC_RELEASE);
+  // Wake the thread if this is the only record, since it's sleeping until
+  // there is one, and again once the ring is half full, only once per lap.
+  pending = position + 1 - __atomic_load_n(&l->read_position,
+    __ATOMIC_ACQUIRE);
+  if ((pending == 1) || (pending == (LOG_RING_SLOTS / 2))) LogWake();
+}
+
+#endif  // LOG_H
@@ -0,0 +1,1343 @@
+// This is a minimal stand-in for a Wayland compositor, so that wayland_display
+// can be run and measured on machines without a display.
+//
+// It listens on the same socket path clients connect to, i.e.
+// $XDG_RUNTIME_DIR/$WAYLAND_DISPLAY, or wayland-0 if WAYLAND_DISPLAY isn't
+// set, and implements just enough of wl_display, wl_registry, wl_compositor,
+// wl_shm and xdg_wm_base for a client to bind the globals, get configured, and
+// attach and commit shm buffers. Every committed buffer is checksummed, and
+// each client's throughput is printed when it disconnects. There's also a
+// wl_seat with a keyboard, which never sends anything but its keymap, so
+// clients receive an FD.
+//
+// Usage: mock_compositor [-f frames] [-n clients] [-r hz] [-s WxH] [-v]
+//   -f: Disconnect each client after it commits this many buffers.
+//   -n: Exit after this many clients have disconnected.
+//   -r: Send frame callbacks at this refresh rate, rather than right after
+//       each commit.
+//   -s: The size to configure toplevels with. Defaults to 0x0, which lets the
+//       client pick.
+//   -v: Print the checksum of every committed buffer.
+
+// Needed for SCM_RIGHTS handling in sys/socket.h.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "wayland_protocol.h"
+
+#define WAYLAND_DISPLAY_OBJECT_ID (1)
+// Client IDs above this are refused, to bound the size of the object table.
+#define MAX_CLIENT_OBJECT_ID (0x100000)
+#define MAX_CLIENTS (16)
+#define RECEIVE_BUFFER_SIZE (0x10000)
+#define SEND_BUFFER_SIZE (0x10000)
+// The most FDs the client may send before we've processed the messages they
+// belong to.
+#define MAX_RECEIVED_FDS (28)
+// The most FDs we'll queue to send along with events.
+#define MAX_SENT_FDS (28)
+
+// The names we advertise our globals under.
+#define COMPOSITOR_GLOBAL_NAME (1)
+#define SHM_GLOBAL_NAME (2)
+#define XDG_WM_BASE_GLOBAL_NAME (3)
+#define SEAT_GLOBAL_NAME (4)
+// A wl_output that's announced and then removed straight away, as if the
+// monitor were unplugged.
+#define UNPLUGGED_OUTPUT_GLOBAL_NAME (5)
+
+// wl_display.error codes.
+#define WL_DISPLAY_ERROR_INVALID_OBJECT (0)
+#define WL_DISPLAY_ERROR_INVALID_METHOD (1)
+#define WL_DISPLAY_ERROR_NO_MEMORY (2)
+#define WL_DISPLAY_ERROR_IMPLEMENTATION (3)
+
+// The wl_shm formats every compositor must support.
+#define WL_SHM_FORMAT_ARGB8888 (0)
+#define WL_SHM_FORMAT_XRGB8888 (1)
+
+// From the wl_seat and wl_keyboard enums.
+#define WL_SEAT_CAPABILITY_KEYBOARD (2)
+#define WL_SEAT_ERROR_MISSING_CAPABILITY (0)
+#define WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1 (1)
+
+// Sent as every client's keymap. Not a usable keymap, just something to fill
+// the FD with.
+static const char mock_keymap[] = "xkb_keymap {\n"
+  "  xkb_keycodes { include \"evdev\" };\n"
+  "  xkb_types { include \"complete\" };\n"
+  "  xkb_compat { include \"complete\" };\n"
+  "  xkb_symbols { include \"pc+us\" };\n"
+  "};\n";
+
+static int should_exit = 0;
+
+typedef enum {
+  MOCK_OBJECT_NONE = 0,
+  MOCK_OBJECT_DISPLAY,
+  MOCK_OBJECT_REGISTRY,
+  MOCK_OBJECT_CALLBACK,
+  MOCK_OBJECT_COMPOSITOR,
+  MOCK_OBJECT_REGION,
+  MOCK_OBJECT_SHM,
+  MOCK_OBJECT_SHM_POOL,
+  MOCK_OBJECT_BUFFER,
+  MOCK_OBJECT_SURFACE,
+  MOCK_OBJECT_XDG_WM_BASE,
+  MOCK_OBJECT_XDG_POSITIONER,
+  MOCK_OBJECT_XDG_SURFACE,
+  MOCK_OBJECT_XDG_TOPLEVEL,
+  MOCK_OBJECT_SEAT,
+  MOCK_OBJECT_KEYBOARD,
+} MockObjectType;
+
+// The memory behind a wl_shm_pool. Buffers keep it mapped even after the pool
+// object is destroyed, so it's reference counted.
+typedef struct {
+  int fd;
+  uint8_t *data;
+  uint32_t size;
+  uint32_t references;
+} MockPool;
+
+// An object created by the client. Which fields are used depends on the type.
+typedef struct {
+  MockObjectType type;
+  uint32_t version;
+  // Pools and buffers: the pool's memory.
+  MockPool *pool;
+  // Buffers: where the pixels are in the pool.
+  uint32_t offset;
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  // Surfaces: the buffer attached since the last commit, if buffer_attached
+  // is nonzero, and the buffer the compositor is currently "displaying".
+  uint32_t pending_buffer;
+  int buffer_attached;
+  uint32_t current_buffer;
+  // Callbacks: the surface the callback was requested on, and whether that
+  // surface has been committed since, so the callback is due at the next
+  // refresh. Surfaces and xdg_toplevels: their xdg_surface. xdg_surfaces:
+  // their wl_surface.
+  uint32_t link;
+  int due;
+  // xdg_surfaces: their xdg_toplevel, and whether the initial configure has
+  // been sent.
+  uint32_t role;
+  int configured;
+} MockObject;
+
+typedef struct {
+  int fd;
+  // Counts up from 1 for each client that connects, for logging.
+  uint32_t number;
+  uint8_t receive_buffer[RECEIVE_BUFFER_SIZE];
+  uint32_t received;
+  // FDs received but not yet consumed by a message, in the order they
+  // arrived.
+  int fds[MAX_RECEIVED_FDS];
+  uint32_t fd_count;
+  uint8_t send_buffer[SEND_BUFFER_SIZE];
+  uint32_t send_size;
+  // FDs to send along with the queued events. They're closed once sent.
+  int send_fds[MAX_SENT_FDS];
+  uint32_t send_fd_count;
+  // Indexed by object ID.
+  MockObject *objects;
+  uint32_t object_capacity;
+  uint32_t next_serial;
+  // Set once the client should be disconnected, after flushing any events.
+  int closing;
+  // Statistics printed when the client disconnects.
+  double connect_time;
+  // When the client committed its first buffer, if it has.
+  double first_frame_time;
+  uint64_t bytes_received;
+  uint64_t messages_received;
+  uint64_t bytes_sent;
+  uint64_t events_sent;
+  uint64_t fds_received;
+  uint64_t fds_sent;
+  uint64_t commits;
+  uint64_t frames;
+  uint64_t checksummed_bytes;
+  double checksum_seconds;
+  uint32_t last_checksum;
+} MockClient;
+
+typedef struct {
+  int listen_fd;
+  struct sockaddr_un address;
+  MockClient *clients[MAX_CLIENTS];
+  uint32_t clients_connected;
+  uint32_t clients_disconnected;
+  // The command-line options.
+  uint64_t frame_limit;
+  uint32_t client_limit;
+  double refresh_interval;
+  uint32_t configure_width;
+  uint32_t configure_height;
+  int verbose;
+  // When to send the next batch of frame callbacks, if refresh_interval is
+  // nonzero.
+  double next_refresh;
+} MockCompositor;
+
+// A request being decoded.
+typedef struct {
+  uint32_t object_id;
+  uint16_t opcode;
+  uint8_t *args;
+  uint32_t args_size;
+  uint32_t offset;
+} MockMessage;
+
+static uint32_t crc32_tables[8][256];
+
+static double CurrentSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec) + ((double) ts.tv_nsec) * 1e-9;
+}
+
+// Returns the current time in milliseconds, as sent in wl_callback.done.
+static uint32_t CurrentMilliseconds(void) {
+  return (uint32_t) ((uint64_t) (CurrentSeconds() * 1000.0));
+}
+
+// Fills in the tables used by CRC32. Each table after the first advances the
+// CRC of a byte by one more byte position, so CRC32 can do 8 bytes at a time.
+static void InitCRC32Tables(void) {
+  uint32_t i, j, crc;
+  for (i = 0; i < 256; i++) {
+    crc = i;
+    for (j = 0; j < 8; j++) crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+    crc32_tables[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++) {
+    for (j = 1; j < 8; j++) {
+      crc = crc32_tables[j - 1][i];
+      crc32_tables[j][i] = (crc >> 8) ^ crc32_tables[0][crc & 0xff];
+    }
+  }
+}
+
+// Returns the same CRC-32 as zlib's crc32(0, data, size).
+static uint32_t CRC32(const uint8_t *data, size_t size) {
+  uint32_t crc = 0xffffffff;
+  uint32_t a, b;
+  while (size >= 8) {
+    memcpy(&a, data, 4);
+    memcpy(&b, data + 4, 4);
+    a ^= crc;
+    crc = crc32_tables[7][a & 0xff] ^ crc32_tables[6][(a >> 8) & 0xff] ^
+      crc32_tables[5][(a >> 16) & 0xff] ^ crc32_tables[4][a >> 24] ^
+      crc32_tables[3][b & 0xff] ^ crc32_tables[2][(b >> 8) & 0xff] ^
+      crc32_tables[1][(b >> 16) & 0xff] ^ crc32_tables[0][b >> 24];
+    data += 8;
+    size -= 8;
+  }
+  while (size > 0) {
+    crc = (crc >> 8) ^ crc32_tables[0][(crc ^ *data) & 0xff];
+    data++;
+    size--;
+  }
+  return ~crc;
+}
+
+static void SignalHandler(int signal_number) {
+  should_exit = 1;
+}
+
+static void ReleasePool(MockPool *p) {
+  if (!p) return;
+  p->references--;
+  if (p->references != 0) return;
+  if (p->data) munmap(p->data, p->size);
+  close(p->fd);
+  free(p);
+}
+
+// Closes the FDs queued to be sent, after they've been sent or if they never
+// will be.
+static void CloseSentFDs(MockClient *c) {
+  uint32_t i;
+  for (i = 0; i < c->send_fd_count; i++) close(c->send_fds[i]);
+  c->send_fd_count = 0;
+}
+
+// Writes any queued events to the client, along with any queued FDs. Returns
+// 0 on error.
+static int FlushClient(MockClient *c) {
+  char control[CMSG_SPACE(MAX_SENT_FDS * sizeof(int))];
+  struct cmsghdr *control_info = NULL;
+  struct msghdr header;
+  struct iovec io;
+  uint32_t sent = 0;
+  ssize_t result;
+  while (sent < c->send_size) {
+    memset(&header, 0, sizeof(header));
+    io.iov_base = c->send_buffer + sent;
+    io.iov_len = c->send_size - sent;
+    header.msg_iov = &io;
+    header.msg_iovlen = 1;
+    // The FDs go along with the first bytes sent.
+    if (c->send_fd_count != 0) {
+      memset(control, 0, sizeof(control));
+      header.msg_control = control;
+      header.msg_controllen = CMSG_SPACE(c->send_fd_count * sizeof(int));
+      control_info = CMSG_FIRSTHDR(&header);
+      control_info->cmsg_level = SOL_SOCKET;
+      control_info->cmsg_type = SCM_RIGHTS;
+      control_info->cmsg_len = CMSG_LEN(c->send_fd_count * sizeof(int));
+      memcpy(CMSG_DATA(control_info), c->send_fds,
+        c->send_fd_count * sizeof(int));
+    }
+    result = sendmsg(c->fd, &header, MSG_NOSIGNAL);
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      printf("Client %u: error sending events: %s\n", (unsigned) c->number,
+        strerror(errno));
+      return 0;
+    }
+    c->fds_sent += c->send_fd_count;
+    CloseSentFDs(c);
+    sent += result;
+  }
+  c->bytes_sent += c->send_size;
+  c->send_size = 0;
+  return 1;
+}
+
+// Returns a pointer to size bytes at the end of the client's send buffer,
+// flushing it first if needed. Returns NULL on error.
+static uint8_t* ReserveEvent(MockClient *c, uint32_t size) {
+  uint8_t *to_return = NULL;
+  if ((c->send_size + size) > SEND_BUFFER_SIZE) {
+    if (!FlushClient(c)) return NULL;
+  }
+  if (size > SEND_BUFFER_SIZE) return NULL;
+  to_return = c->send_buffer + c->send_size;
+  c->send_size += size;
+  c->events_sent++;
+  return to_return;
+}
+
+// Queues fd to be sent along with the next flush, which takes ownership of it.
+// Must be called before reserving the event the FD goes with, so that the FD
+// can't be flushed after the event. Returns 0 on error.
+static int QueueFD(MockClient *c, int fd) {
+  if ((c->send_fd_count >= MAX_SENT_FDS) && !FlushClient(c)) {
+    close(fd);
+    return 0;
+  }
+  c->send_fds[c->send_fd_count] = fd;
+  c->send_fd_count++;
+  return 1;
+}
+
+// Sends wl_display.error and marks the client for disconnection. Always
+// returns 0, so handlers can return its result directly.
+static int ProtocolError(MockClient *c, uint32_t object_id, uint32_t code,
+  const char *format, ...) {
+  char message[256];
+  uint8_t *dst = NULL;
+  uint32_t size;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  printf("Client %u: protocol error on object %u: %s\n", (unsigned) c->number,
+    (unsigned) object_id, message);
+  c->closing = 1;
+  size = WAYLAND_HEADER_SIZE + 8 + ProtocolStringSize(message);
+  dst = ReserveEvent(c, size);
+  if (!dst) return 0;
+  dst = ProtocolWriteHeader(dst, WAYLAND_DISPLAY_OBJECT_ID,
+    WL_DISPLAY_ERROR_EVENT, size);
+  dst = ProtocolWriteUint32(dst, object_id);
+  dst = ProtocolWriteUint32(dst, code);
+  ProtocolWriteString(dst, message);
+  return 0;
+}
+
+// Queues an event whose arguments are all uint32s. Returns 0 on error.
+static int SendEvent(MockClient *c, uint32_t object_id, uint16_t opcode,
+  uint32_t arg_count, const uint32_t *args) {
+  uint32_t size = WAYLAND_HEADER_SIZE + arg_count * 4;
+  uint8_t *dst = ReserveEvent(c, size);
+  uint32_t i;
+  if (!dst) return 0;
+  dst = ProtocolWriteHeader(dst, object_id, opcode, size);
+  for (i = 0; i < arg_count; i++) dst = ProtocolWriteUint32(dst, args[i]);
+  return 1;
+}
+
+static int SendGlobal(MockClient *c, uint32_t registry_id, uint32_t name,
+  const char *interface, uint32_t version) {
+  uint32_t size = WAYLAND_HEADER_SIZE + 8 + ProtocolStringSize(interface);
+  uint8_t *dst = ReserveEvent(c, size);
+  if (!dst) return 0;
+  dst = ProtocolWriteHeader(dst, registry_id, WL_REGISTRY_GLOBAL_EVENT, size);
+  dst = ProtocolWriteUint32(dst, name);
+  dst = ProtocolWriteString(dst, interface);
+  ProtocolWriteUint32(dst, version);
+  return 1;
+}
+
+// Returns the object with the given ID, or NULL if it doesn't exist.
+static MockObject* LookupObject(MockClient *c, uint32_t id) {
+  if ((id >= c->object_capacity) || (c->objects[id].type == MOCK_OBJECT_NONE)) {
+    return NULL;
+  }
+  return c->objects + id;
+}
+
+// Sends xdg_toplevel.configure, with no states, followed by
+// xdg_surface.configure. Like current desktop compositors, it's preceded by
+// configure_bounds and wm_capabilities if the toplevel's version has them.
+static int SendConfigure(MockCompositor *m, MockClient *c,
+  uint32_t xdg_surface_id, uint32_t toplevel_id) {
+  MockObject *toplevel = LookupObject(c, toplevel_id);
+  uint32_t size = WAYLAND_HEADER_SIZE + ProtocolArraySize(0);
+  uint32_t bounds[2] = {m->configure_width, m->configure_height};
+  uint8_t *dst = NULL;
+  if (toplevel && (toplevel->version >=
+    XDG_TOPLEVEL_CONFIGURE_BOUNDS_EVENT_SINCE)) {
+    if (!SendEvent(c, toplevel_id, XDG_TOPLEVEL_CONFIGURE_BOUNDS_EVENT, 2,
+      bounds)) {
+      return 0;
+    }
+  }
+  if (toplevel && (toplevel->version >=
+    XDG_TOPLEVEL_WM_CAPABILITIES_EVENT_SINCE)) {
+    dst = ReserveEvent(c, size);
+    if (!dst) return 0;
+    dst = ProtocolWriteHeader(dst, toplevel_id,
+      XDG_TOPLEVEL_WM_CAPABILITIES_EVENT, size);
+    ProtocolWriteArray(dst, NULL, 0);
+  }
+  size = WAYLAND_HEADER_SIZE + 8 + ProtocolArraySize(0);
+  dst = ReserveEvent(c, size);
+  if (!dst) return 0;
+  dst = ProtocolWriteHeader(dst, toplevel_id, XDG_TOPLEVEL_CONFIGURE_EVENT,
+    size);
+  dst = ProtocolWriteUint32(dst, m->configure_width);
+  dst = ProtocolWriteUint32(dst, m->configure_height);
+  ProtocolWriteArray(dst, NULL, 0);
+  c->next_serial++;
+  return SendEvent(c, xdg_surface_id, XDG_SURFACE_CONFIGURE_EVENT, 1,
+    &(c->next_serial));
+}
+
+// Creates an object with an ID the client picked. Returns NULL and sends an
+// error if the ID is invalid or already in use.
+static MockObject* NewObject(MockClient *c, uint32_t id, MockObjectType type,
+  uint32_t version) {
+  uint32_t new_capacity;
+  MockObject *new_objects = NULL;
+  if ((id == 0) || (id >= MAX_CLIENT_OBJECT_ID)) {
+    ProtocolError(c, WAYLAND_DISPLAY_OBJECT_ID,
+      WL_DISPLAY_ERROR_INVALID_OBJECT, "invalid new ID %u", (unsigned) id);
+    return NULL;
+  }
+  if (id >= c->object_capacity) {
+    new_capacity = c->object_capacity ? c->object_capacity : 64;
+    while (new_capacity <= id) new_capacity *= 2;
+    new_objects = (MockObject *) realloc(c->objects, new_capacity *
+      sizeof(MockObject));
+    if (!new_objects) {
+      ProtocolError(c, WAYLAND_DISPLAY_OBJECT_ID, WL_DISPLAY_ERROR_NO_MEMORY,
+        "out of memory");
+      return NULL;
+    }
+    memset(new_objects + c->object_capacity, 0, (new_capacity -
+      c->object_capacity) * sizeof(MockObject));
+    c->objects = new_objects;
+    c->object_capacity = new_capacity;
+  }
+  if (c->objects[id].type != MOCK_OBJECT_NONE) {
+    ProtocolError(c, WAYLAND_DISPLAY_OBJECT_ID,
+      WL_DISPLAY_ERROR_INVALID_OBJECT, "ID %u is already in use",
+      (unsigned) id);
+    return NULL;
+  }
+  c->objects[id].type = type;
+  c->objects[id].version = version;
+  return c->objects + id;
+}
+
+// Destroys the object and tells the client its ID can be reused.
+static int DeleteObject(MockClient *c, uint32_t id) {
+  MockObject *o = c->objects + id;
+  ReleasePool(o->pool);
+  memset(o, 0, sizeof(*o));
+  return SendEvent(c, WAYLAND_DISPLAY_OBJECT_ID, WL_DISPLAY_DELETE_ID_EVENT, 1,
+    &id);
+}
+
+// Removes the next FD the client sent from the queue and returns it, or
+// returns -1 if it hasn't sent one.
+static int TakeFD(MockClient *c) {
+  int to_return;
+  if (c->fd_count == 0) return -1;
+  to_return = c->fds[0];
+  c->fd_count--;
+  memmove(c->fds, c->fds + 1, c->fd_count * sizeof(int));
+  return to_return;
+}
+
+// Reads the next uint32 or int argument. Returns 0 if the message is too
+// short.
+static int MessageUint32(MockMessage *msg, uint32_t *v) {
+  if ((msg->offset + 4) > msg->args_size) return 0;
+  memcpy(v, msg->args + msg->offset, 4);
+  msg->offset += 4;
+  return 1;
+}
+
+// Reads the next string argument. Sets *s to NULL for a null string. Returns
+// 0 if the string doesn't fit in the message or isn't terminated.
+static int MessageString(MockMessage *msg, const char **s) {
+  uint32_t length, padded_length;
+  if (!MessageUint32(msg, &length)) return 0;
+  if (length == 0) {
+    *s = NULL;
+    return 1;
+  }
+  padded_length = (length + 3) & ~((uint32_t) 3);
+  if ((padded_length < length) ||
+    (padded_length > (msg->args_size - msg->offset))) {
+    return 0;
+  }
+  if (msg->args[msg->offset + length - 1] != 0) return 0;
+  *s = (const char *) (msg->args + msg->offset);
+  msg->offset += padded_length;
+  return 1;
+}
+
+static int BadMessage(MockClient *c, MockMessage *msg) {
+  return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+    "malformed request %u", (unsigned) msg->opcode);
+}
+
+// Sends wl_callback.done for every callback due at this refresh.
+static int SendFrameCallbacks(MockClient *c) {
+  uint32_t i, time = CurrentMilliseconds();
+  for (i = 0; i < c->object_capacity; i++) {
+    if ((c->objects[i].type != MOCK_OBJECT_CALLBACK) || !c->objects[i].due) {
+      continue;
+    }
+    if (!SendEvent(c, i, WL_CALLBACK_DONE_EVENT, 1, &time)) return 0;
+    if (!DeleteObject(c, i)) return 0;
+  }
+  return 1;
+}
+
+static int HandleDisplayRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  uint32_t id, zero = 0, unplugged = UNPLUGGED_OUTPUT_GLOBAL_NAME;
+  if (!MessageUint32(msg, &id)) return BadMessage(c, msg);
+  switch (msg->opcode) {
+  case WL_DISPLAY_SYNC_OPCODE:
+    // Everything before this was handled already, so the callback is done.
+    if (!NewObject(c, id, MOCK_OBJECT_CALLBACK, 1)) return 0;
+    if (!SendEvent(c, id, WL_CALLBACK_DONE_EVENT, 1, &zero)) return 0;
+    return DeleteObject(c, id);
+  case WL_DISPLAY_GET_REGISTRY_OPCODE:
+    if (!NewObject(c, id, MOCK_OBJECT_REGISTRY, 1)) return 0;
+    if (!SendGlobal(c, id, COMPOSITOR_GLOBAL_NAME, WL_COMPOSITOR_INTERFACE,
+      WL_COMPOSITOR_VERSION)) {
+      return 0;
+    }
+    if (!SendGlobal(c, id, SHM_GLOBAL_NAME, WL_SHM_INTERFACE,
+      WL_SHM_VERSION)) {
+      return 0;
+    }
+    if (!SendGlobal(c, id, XDG_WM_BASE_GLOBAL_NAME, XDG_WM_BASE_INTERFACE,
+      XDG_WM_BASE_VERSION)) {
+      return 0;
+    }
+    if (!SendGlobal(c, id, SEAT_GLOBAL_NAME, WL_SEAT_INTERFACE,
+      WL_SEAT_VERSION)) {
+      return 0;
+    }
+    if (!SendGlobal(c, id, UNPLUGGED_OUTPUT_GLOBAL_NAME, "wl_output", 4)) {
+      return 0;
+    }
+    return SendEvent(c, id, WL_REGISTRY_GLOBAL_REMOVE_EVENT, 1, &unplugged);
+  }
+  return BadMessage(c, msg);
+}
+
+static int HandleRegistryRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  uint32_t name, version, id, format;
+  const char *interface = NULL;
+  MockObjectType type;
+  uint32_t max_version;
+  if ((msg->opcode != WL_REGISTRY_BIND_OPCODE) ||
+    !MessageUint32(msg, &name) || !MessageString(msg, &interface) ||
+    !MessageUint32(msg, &version) || !MessageUint32(msg, &id)) {
+    return BadMessage(c, msg);
+  }
+  switch (name) {
+  case COMPOSITOR_GLOBAL_NAME:
+    type = MOCK_OBJECT_COMPOSITOR;
+    max_version = WL_COMPOSITOR_VERSION;
+    break;
+  case SHM_GLOBAL_NAME:
+    type = MOCK_OBJECT_SHM;
+    max_version = WL_SHM_VERSION;
+    break;
+  case XDG_WM_BASE_GLOBAL_NAME:
+    type = MOCK_OBJECT_XDG_WM_BASE;
+    max_version = XDG_WM_BASE_VERSION;
+    break;
+  case SEAT_GLOBAL_NAME:
+    type = MOCK_OBJECT_SEAT;
+    max_version = WL_SEAT_VERSION;
+    break;
+  default:
+    return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_OBJECT,
+      "no global named %u", (unsigned) name);
+  }
+  if ((version == 0) || (version > max_version)) {
+    return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_OBJECT,
+      "invalid version %u for %s", (unsigned) version,
+      interface ? interface : "(null)");
+  }
+  if (!NewObject(c, id, type, version)) return 0;
+  if (type == MOCK_OBJECT_SEAT) {
+    format = WL_SEAT_CAPABILITY_KEYBOARD;
+    return SendEvent(c, id, WL_SEAT_CAPABILITIES_EVENT, 1, &format);
+  }
+  if (type != MOCK_OBJECT_SHM) return 1;
+  format = WL_SHM_FORMAT_ARGB8888;
+  if (!SendEvent(c, id, WL_SHM_FORMAT_EVENT, 1, &format)) return 0;
+  format = WL_SHM_FORMAT_XRGB8888;
+  return SendEvent(c, id, WL_SHM_FORMAT_EVENT, 1, &format);
+}
+
+static int HandleCompositorRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  MockObject *o = LookupObject(c, msg->object_id);
+  uint32_t id;
+  if (!MessageUint32(msg, &id)) return BadMessage(c, msg);
+  switch (msg->opcode) {
+  case WL_COMPOSITOR_CREATE_SURFACE_OPCODE:
+    return NewObject(c, id, MOCK_OBJECT_SURFACE, o->version) != NULL;
+  case WL_COMPOSITOR_CREATE_REGION_OPCODE:
+    return NewObject(c, id, MOCK_OBJECT_REGION, 1) != NULL;
+  }
+  return BadMessage(c, msg);
+}
+
+static int HandleShmRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  MockObject *o = NULL;
+  MockPool *p = NULL;
+  uint32_t id, size;
+  int fd;
+  if ((msg->opcode != WL_SHM_CREATE_POOL_OPCODE) || !MessageUint32(msg, &id) ||
+    !MessageUint32(msg, &size)) {
+    return BadMessage(c, msg);
+  }
+  fd = TakeFD(c);
+  if (fd < 0) {
+    return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+      "create_pool without an FD");
+  }
+  if (((int32_t) size) <= 0) {
+    close(fd);
+    return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+      "invalid pool size %d", (int) size);
+  }
+  p = (MockPool *) calloc(1, sizeof(*p));
+  if (!p) {
+    close(fd);
+    return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_NO_MEMORY,
+      "out of memory");
+  }
+  p->fd = fd;
+  p->size = size;
+  p->references = 1;
+  p->data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (p->data == MAP_FAILED) {
+    p->data = NULL;
+    ReleasePool(p);
+    return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+      "failed mapping the pool: %s", strerror(errno));
+  }
+  o = NewObject(c, id, MOCK_OBJECT_SHM_POOL, 1);
+  if (!o) {
+    ReleasePool(p);
+    return 0;
+  }
+  o->pool = p;
+  return 1;
+}
+
+static int HandlePoolRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  MockObject *o = LookupObject(c, msg->object_id);
+  MockObject *b = NULL;
+  MockPool *p = o->pool;
+  uint32_t id, offset, width, height, stride, format, new_size;
+  uint8_t *new_data = NULL;
+  switch (msg->opcode) {
+  case WL_SHM_POOL_CREATE_BUFFER_OPCODE:
+    if (!MessageUint32(msg, &id) || !MessageUint32(msg, &offset) ||
+      !MessageUint32(msg, &width) || !MessageUint32(msg, &height) ||
+      !MessageUint32(msg, &stride) || !MessageUint32(msg, &format)) {
+      return BadMessage(c, msg);
+    }
+    if ((format != WL_SHM_FORMAT_ARGB8888) &&
+      (format != WL_SHM_FORMAT_XRGB8888)) {
+      return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+        "unsupported format %u", (unsigned) format);
+    }
+    if ((((int32_t) width) <= 0) || (((int32_t) height) <= 0) ||
+      (stride < (((uint64_t) width) * 4)) ||
+      ((((uint64_t) stride) * height + offset) > p->size)) {
+      return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+        "invalid %ux%u buffer with stride %u at offset %u",
+        (unsigned) width, (unsigned) height, (unsigned) stride,
+        (unsigned) offset);
+    }
+    b = NewObject(c, id, MOCK_OBJECT_BUFFER, 1);
+    if (!b) return 0;
+    b->pool = p;
+    p->references++;
+    b->offset = offset;
+    b->width = width;
+    b->height = height;
+    b->stride = stride;
+    return 1;
+  case WL_SHM_POOL_DESTROY_OPCODE:
+    return DeleteObject(c, msg->object_id);
+  case WL_SHM_POOL_RESIZE_OPCODE:
+    if (!MessageUint32(msg, &new_size)) return BadMessage(c, msg);
+    if (((int32_t) new_size) < ((int32_t) p->size)) {
+      return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+        "pools can't shrink");
+    }
+    new_data = mremap(p->data, p->size, new_size, MREMAP_MAYMOVE);
+    if (new_data == MAP_FAILED) {
+      return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+        "failed remapping the pool: %s", strerror(errno));
+    }
+    p->data = new_data;
+    p->size = new_size;
+    return 1;
+  }
+  return BadMessage(c, msg);
+}
+
+// Checksums the buffer attached to the surface, as if it were being
+// composited, and releases the buffer it replaces.
+static int CommitBuffer(MockCompositor *m, MockClient *c, MockObject *surface) {
+  MockObject *b = LookupObject(c, surface->pending_buffer);
+  uint32_t previous = surface->current_buffer;
+  double start;
+  uint64_t size;
+  surface->buffer_attached = 0;
+  surface->current_buffer = surface->pending_buffer;
+  if (previous && (previous != surface->current_buffer) &&
+    LookupObject(c, previous)) {
+    if (!SendEvent(c, previous, WL_BUFFER_RELEASE_EVENT, 0, NULL)) return 0;
+  }
+  if (!b) return 1;
+  size = ((uint64_t) b->stride) * b->height;
+  start = CurrentSeconds();
+  if (c->frames == 0) c->first_frame_time = start;
+  c->last_checksum = CRC32(b->pool->data + b->offset, size);
+  c->checksum_seconds += CurrentSeconds() - start;
+  c->checksummed_bytes += size;
+  c->frames++;
+  if (m->verbose) {
+    printf("Client %u: frame %llu, buffer %u, %ux%u, CRC-32 %08x\n",
+      (unsigned) c->number, (unsigned long long) c->frames,
+      (unsigned) surface->current_buffer, (unsigned) b->width,
+      (unsigned) b->height, (unsigned) c->last_checksum);
+  }
+  if (m->frame_limit && (c->frames >= m->frame_limit)) c->closing = 1;
+  return 1;
+}
+
+static int CommitSurface(MockCompositor *m, MockClient *c, uint32_t id) {
+  MockObject *surface = c->objects + id;
+  MockObject *xdg_surface = LookupObject(c, surface->link);
+  uint32_t i;
+  c->commits++;
+  // Callbacks requested since the last commit are now due.
+  for (i = 0; i < c->object_capacity; i++) {
+    if ((c->objects[i].type == MOCK_OBJECT_CALLBACK) &&
+      (c->objects[i].link == id)) {
+      c->objects[i].due = 1;
+    }
+  }
+  if (surface->buffer_attached && !CommitBuffer(m, c, surface)) return 0;
+  // The initial commit of an xdg_surface with a role gets it configured.
+  if (xdg_surface && !xdg_surface->configured &&
+    LookupObject(c, xdg_surface->role)) {
+    xdg_surface->configured = 1;
+    if (!SendConfigure(m, c, surface->link, xdg_surface->role)) return 0;
+  }
+  if (m->refresh_interval == 0) return SendFrameCallbacks(c);
+  return 1;
+}
+
+static int HandleSurfaceRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  MockObject *o = LookupObject(c, msg->object_id);
+  MockObject *callback = NULL;
+  uint32_t id;
+  switch (msg->opcode) {
+  case WL_SURFACE_DESTROY_OPCODE:
+    if (LookupObject(c, o->link)) {
+      return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+        "destroyed before its xdg_surface");
+    }
+    return DeleteObject(c, msg->object_id);
+  case WL_SURFACE_ATTACH_OPCODE:
+    if (!MessageUint32(msg, &id)) return BadMessage(c, msg);
+    if (id && (!LookupObject(c, id) ||
+      (c->objects[id].type != MOCK_OBJECT_BUFFER))) {
+      return ProtocolError(c, msg->object_id,
+        WL_DISPLAY_ERROR_INVALID_OBJECT, "attached a non-buffer");
+    }
+    o->pending_buffer = id;
+    o->buffer_attached = 1;
+    return 1;
+  case WL_SURFACE_FRAME_OPCODE:
+    if (!MessageUint32(msg, &id)) return BadMessage(c, msg);
+    callback = NewObject(c, id, MOCK_OBJECT_CALLBACK, 1);
+    if (!callback) return 0;
+    callback->link = msg->object_id;
+    return 1;
+  case WL_SURFACE_COMMIT_OPCODE:
+    return CommitSurface(m, c, msg->object_id);
+  case WL_SURFACE_DAMAGE_OPCODE:
+  case WL_SURFACE_SET_OPAQUE_REGION_OPCODE:
+  case WL_SURFACE_SET_INPUT_REGION_OPCODE:
+  case WL_SURFACE_SET_BUFFER_TRANSFORM_OPCODE:
+  case WL_SURFACE_SET_BUFFER_SCALE_OPCODE:
+  case WL_SURFACE_DAMAGE_BUFFER_OPCODE:
+  case WL_SURFACE_OFFSET_OPCODE:
+    // We always look at the whole buffer, so there's nothing to do.
+    return 1;
+  }
+  return BadMessage(c, msg);
+}
+
+static int HandleXDGWmBaseRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  MockObject *o = LookupObject(c, msg->object_id);
+  MockObject *xdg_surface = NULL;
+  MockObject *surface = NULL;
+  uint32_t id, surface_id;
+  switch (msg->opcode) {
+  case XDG_WM_BASE_DESTROY_OPCODE:
+    return DeleteObject(c, msg->object_id);
+  case XDG_WM_BASE_CREATE_POSITIONER_OPCODE:
+    if (!MessageUint32(msg, &id)) return BadMessage(c, msg);
+    return NewObject(c, id, MOCK_OBJECT_XDG_POSITIONER, o->version) != NULL;
+  case XDG_WM_BASE_GET_XDG_SURFACE_OPCODE:
+    if (!MessageUint32(msg, &id) || !MessageUint32(msg, &surface_id)) {
+      return BadMessage(c, msg);
+    }
+    surface = LookupObject(c, surface_id);
+    if (!surface || (surface->type != MOCK_OBJECT_SURFACE) || surface->link) {
+      return ProtocolError(c, msg->object_id,
+        WL_DISPLAY_ERROR_INVALID_OBJECT, "invalid surface %u",
+        (unsigned) surface_id);
+    }
+    xdg_surface = NewObject(c, id, MOCK_OBJECT_XDG_SURFACE, o->version);
+    if (!xdg_surface) return 0;
+    // NewObject may have moved the object table.
+    c->objects[surface_id].link = id;
+    xdg_surface->link = surface_id;
+    return 1;
+  case XDG_WM_BASE_PONG_OPCODE:
+    return 1;
+  }
+  return BadMessage(c, msg);
+}
+
+static int HandleXDGSurfaceRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  MockObject *o = LookupObject(c, msg->object_id);
+  MockObject *toplevel = NULL;
+  uint32_t id;
+  switch (msg->opcode) {
+  case XDG_SURFACE_DESTROY_OPCODE:
+    if (LookupObject(c, o->link)) c->objects[o->link].link = 0;
+    return DeleteObject(c, msg->object_id);
+  case XDG_SURFACE_GET_TOPLEVEL_OPCODE:
+    if (!MessageUint32(msg, &id)) return BadMessage(c, msg);
+    toplevel = NewObject(c, id, MOCK_OBJECT_XDG_TOPLEVEL, o->version);
+    if (!toplevel) return 0;
+    toplevel->link = msg->object_id;
+    // NewObject may have moved the object table.
+    c->objects[msg->object_id].role = id;
+    return 1;
+  case XDG_SURFACE_ACK_CONFIGURE_OPCODE:
+  case XDG_SURFACE_SET_WINDOW_GEOMETRY_OPCODE:
+    return 1;
+  }
+  return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_IMPLEMENTATION,
+    "request %u isn't supported", (unsigned) msg->opcode);
+}
+
+// Creates a memfd holding mock_keymap and sends it in wl_keyboard.keymap.
+// Returns 0 on error.
+static int SendKeymap(MockClient *c, uint32_t keyboard_id) {
+  uint32_t args[2] = {WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, sizeof(mock_keymap)};
+  int fd = memfd_create("mock_keymap", MFD_CLOEXEC);
+  if (fd < 0) {
+    printf("Error creating the keymap memfd: %s\n", strerror(errno));
+    return 0;
+  }
+  if (write(fd, mock_keymap, sizeof(mock_keymap)) != sizeof(mock_keymap)) {
+    printf("Error writing the keymap: %s\n", strerror(errno));
+    close(fd);
+    return 0;
+  }
+  // The FD isn't part of the event's arguments.
+  if (!QueueFD(c, fd)) return 0;
+  return SendEvent(c, keyboard_id, WL_KEYBOARD_KEYMAP_EVENT, 2, args);
+}
+
+static int HandleSeatRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  MockObject *o = LookupObject(c, msg->object_id);
+  uint32_t id;
+  if (msg->opcode == WL_SEAT_RELEASE_OPCODE) {
+    return DeleteObject(c, msg->object_id);
+  }
+  if (!MessageUint32(msg, &id)) return BadMessage(c, msg);
+  switch (msg->opcode) {
+  case WL_SEAT_GET_KEYBOARD_OPCODE:
+    if (!NewObject(c, id, MOCK_OBJECT_KEYBOARD, o->version)) return 0;
+    return SendKeymap(c, id);
+  case WL_SEAT_GET_POINTER_OPCODE:
+  case WL_SEAT_GET_TOUCH_OPCODE:
+    return ProtocolError(c, msg->object_id, WL_SEAT_ERROR_MISSING_CAPABILITY,
+      "the seat only has a keyboard");
+  }
+  return BadMessage(c, msg);
+}
+
+// Handles requests to objects that have nothing to do but be destroyed: only
+// opcode 0 does anything, and every such interface uses it for destroy.
+static int HandleInertRequest(MockCompositor *m, MockClient *c,
+  MockMessage *msg) {
+  if (msg->opcode == 0) return DeleteObject(c, msg->object_id);
+  return 1;
+}
+
+// Decodes and handles one request. Returns 0 on error.
+static int HandleRequest(MockCompositor *m, MockClient *c, MockMessage *msg) {
+  MockObject *o = LookupObject(c, msg->object_id);
+  if (!o) {
+    return ProtocolError(c, WAYLAND_DISPLAY_OBJECT_ID,
+      WL_DISPLAY_ERROR_INVALID_OBJECT, "no object %u",
+      (unsigned) msg->object_id);
+  }
+  switch (o->type) {
+  case MOCK_OBJECT_DISPLAY:
+    return HandleDisplayRequest(m, c, msg);
+  case MOCK_OBJECT_REGISTRY:
+    return HandleRegistryRequest(m, c, msg);
+  case MOCK_OBJECT_COMPOSITOR:
+    return HandleCompositorRequest(m, c, msg);
+  case MOCK_OBJECT_SHM:
+    return HandleShmRequest(m, c, msg);
+  case MOCK_OBJECT_SHM_POOL:
+    return HandlePoolRequest(m, c, msg);
+  case MOCK_OBJECT_SURFACE:
+    return HandleSurfaceRequest(m, c, msg);
+  case MOCK_OBJECT_XDG_WM_BASE:
+    return HandleXDGWmBaseRequest(m, c, msg);
+  case MOCK_OBJECT_XDG_SURFACE:
+    return HandleXDGSurfaceRequest(m, c, msg);
+  case MOCK_OBJECT_SEAT:
+    return HandleSeatRequest(m, c, msg);
+  case MOCK_OBJECT_BUFFER:
+  case MOCK_OBJECT_REGION:
+  case MOCK_OBJECT_XDG_POSITIONER:
+  case MOCK_OBJECT_XDG_TOPLEVEL:
+  case MOCK_OBJECT_KEYBOARD:
+    return HandleInertRequest(m, c, msg);
+  default:
+    break;
+  }
+  return ProtocolError(c, msg->object_id, WL_DISPLAY_ERROR_INVALID_METHOD,
+    "object %u has no requests", (unsigned) msg->object_id);
+}
+
+// Adds any FDs in the control message to the client's queue. Returns 0 if
+// there are too many.
+static int ReceiveFDs(MockClient *c, struct msghdr *header) {
+  struct cmsghdr *control = NULL;
+  uint32_t i, count;
+  int *fds = NULL;
+  int ok = 1;
+  for (control = CMSG_FIRSTHDR(header); control;
+    control = CMSG_NXTHDR(header, control)) {
+    if ((control->cmsg_level != SOL_SOCKET) ||
+      (control->cmsg_type != SCM_RIGHTS)) {
+      continue;
+    }
+    fds = (int *) CMSG_DATA(control);
+    count = (control->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (i = 0; i < count; i++) {
+      if (c->fd_count >= MAX_RECEIVED_FDS) {
+        close(fds[i]);
+        ok = 0;
+        continue;
+      }
+      c->fds[c->fd_count] = fds[i];
+      c->fd_count++;
+      c->fds_received++;
+    }
+  }
+  if (!ok || (header->msg_flags & MSG_CTRUNC)) {
+    printf("Client %u sent too many FDs.\n", (unsigned) c->number);
+    return 0;
+  }
+  return 1;
+}
+
+// Reads whatever the client has sent and handles every complete request.
+// Returns 0 if the client disconnected or should be disconnected.
+static int ReceiveFromClient(MockCompositor *m, MockClient *c) {
+  char control[CMSG_SPACE(MAX_RECEIVED_FDS * sizeof(int))];
+  struct msghdr header;
+  struct iovec io;
+  MockMessage msg;
+  uint32_t offset = 0, word, size;
+  ssize_t result;
+  memset(&header, 0, sizeof(header));
+  io.iov_base = c->receive_buffer + c->received;
+  io.iov_len = RECEIVE_BUFFER_SIZE - c->received;
+  header.msg_iov = &io;
+  header.msg_iovlen = 1;
+  header.msg_control = control;
+  header.msg_controllen = sizeof(control);
+  result = recvmsg(c->fd, &header, MSG_CMSG_CLOEXEC);
+  if (result < 0) {
+    if (errno == EINTR) return 1;
+    printf("Client %u: error receiving: %s\n", (unsigned) c->number,
+      strerror(errno));
+    return 0;
+  }
+  if (result == 0) return 0;
+  if (!ReceiveFDs(c, &header)) return 0;
+  c->received += result;
+  c->bytes_received += result;
+  while ((c->received - offset) >= WAYLAND_HEADER_SIZE) {
+    memcpy(&(msg.object_id), c->receive_buffer + offset, 4);
+    memcpy(&word, c->receive_buffer + offset + 4, 4);
+    size = word >> 16;
+    if ((size < WAYLAND_HEADER_SIZE) || ((size & 3) != 0)) {
+      ProtocolError(c, WAYLAND_DISPLAY_OBJECT_ID,
+        WL_DISPLAY_ERROR_INVALID_METHOD, "invalid message size %u",
+        (unsigned) size);
+      return 0;
+    }
+    if ((c->received - offset) < size) break;
+    msg.opcode = word & 0xffff;
+    msg.args = c->receive_buffer + offset + WAYLAND_HEADER_SIZE;
+    msg.args_size = size - WAYLAND_HEADER_SIZE;
+    msg.offset = 0;
+    offset += size;
+    c->messages_received++;
+    if (!HandleRequest(m, c, &msg)) return 0;
+    if (c->closing) return 0;
+  }
+  c->received -= offset;
+  memmove(c->receive_buffer, c->receive_buffer + offset, c->received);
+  return FlushClient(c);
+}
+
+static MockClient* CreateClient(MockCompositor *m, int fd) {
+  MockClient *c = (MockClient *) calloc(1, sizeof(*c));
+  if (!c) {
+    printf("Failed allocating a client.\n");
+    return NULL;
+  }
+  c->fd = fd;
+  m->clients_connected++;
+  c->number = m->clients_connected;
+  c->connect_time = CurrentSeconds();
+  if (!NewObject(c, WAYLAND_DISPLAY_OBJECT_ID, MOCK_OBJECT_DISPLAY, 1)) {
+    free(c);
+    return NULL;
+  }
+  printf("Client %u connected.\n", (unsigned) c->number);
+  return c;
+}
+
+// Prints the client's statistics, flushes any remaining events (e.g. an
+// error), and frees it.
+static void DestroyClient(MockCompositor *m, MockClient *c) {
+  double elapsed = CurrentSeconds() - c->connect_time;
+  uint32_t i;
+  FlushClient(c);
+  printf("Client %u disconnected after %.3f s. Received %llu bytes in %llu "
+    "requests and %llu FDs; sent %llu bytes in %llu events and %llu FDs.\n",
+    (unsigned) c->number, elapsed, (unsigned long long) c->bytes_received,
+    (unsigned long long) c->messages_received,
+    (unsigned long long) c->fds_received,
+    (unsigned long long) c->bytes_sent, (unsigned long long) c->events_sent,
+    (unsigned long long) c->fds_sent);
+  printf("Client %u: %llu commits, %llu frames, %.2f frames/s, %.2f MB/s of "
+    "pixels, last CRC-32 %08x.\n", (unsigned) c->number,
+    (unsigned long long) c->commits, (unsigned long long) c->frames,
+    c->frames / elapsed, c->checksummed_bytes / elapsed / 1e6,
+    (unsigned) c->last_checksum);
+  if (c->frames != 0) {
+    printf("Client %u: first buffer committed %.3f ms after connecting.\n",
+      (unsigned) c->number, (c->first_frame_time - c->connect_time) * 1e3);
+  }
+  if (c->checksum_seconds > 0) {
+    printf("Client %u: checksummed %llu bytes at %.2f GB/s.\n",
+      (unsigned) c->number, (unsigned long long) c->checksummed_bytes,
+      c->checksummed_bytes / c->checksum_seconds / 1e9);
+  }
+  for (i = 0; i < c->object_capacity; i++) ReleasePool(c->objects[i].pool);
+  for (i = 0; i < c->fd_count; i++) close(c->fds[i]);
+  CloseSentFDs(c);
+  close(c->fd);
+  free(c->objects);
+  free(c);
+  m->clients_disconnected++;
+}
+
+// Creates the listening socket. Refuses to replace the socket of a server
+// that's still running. Returns 0 on error.
+static int ListenForClients(MockCompositor *m) {
+  char *xdg_dir = getenv("XDG_RUNTIME_DIR");
+  char *display_name = getenv("WAYLAND_DISPLAY");
+  int fd;
+  if (!xdg_dir) {
+    printf("The XDG_RUNTIME_DIR environment variable was not set.\n");
+    return 0;
+  }
+  if (!display_name) display_name = "wayland-0";
+  memset(&(m->address), 0, sizeof(m->address));
+  m->address.sun_family = AF_UNIX;
+  snprintf(m->address.sun_path, sizeof(m->address.sun_path) - 1, "%s/%s",
+    xdg_dir, display_name);
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    printf("Error creating socket: %s\n", strerror(errno));
+    return 0;
+  }
+  if (connect(fd, (struct sockaddr *) &(m->address), sizeof(m->address)) ==
+    0) {
+    printf("A server is already listening on %s.\n", m->address.sun_path);
+    close(fd);
+    return 0;
+  }
+  close(fd);
+  // Whatever is there is stale.
+  unlink(m->address.sun_path);
+  m->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (m->listen_fd < 0) {
+    printf("Error creating socket: %s\n", strerror(errno));
+    return 0;
+  }
+  if (bind(m->listen_fd, (struct sockaddr *) &(m->address),
+    sizeof(m->address)) != 0) {
+    printf("Error binding to %s: %s\n", m->address.sun_path, strerror(errno));
+    return 0;
+  }
+  if (listen(m->listen_fd, MAX_CLIENTS) != 0) {
+    printf("Error listening on %s: %s\n", m->address.sun_path,
+      strerror(errno));
+    return 0;
+  }
+  printf("Listening on %s.\n", m->address.sun_path);
+  return 1;
+}
+
+static void AcceptClient(MockCompositor *m) {
+  int fd = accept4(m->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  uint32_t i;
+  if (fd < 0) {
+    printf("Error accepting a client: %s\n", strerror(errno));
+    return;
+  }
+  for (i = 0; i < MAX_CLIENTS; i++) {
+    if (m->clients[i]) continue;
+    m->clients[i] = CreateClient(m, fd);
+    if (!m->clients[i]) close(fd);
+    return;
+  }
+  printf("Too many clients; refusing a new one.\n");
+  close(fd);
+}
+
+// Returns the poll timeout until the next refresh, in milliseconds, or -1 if
+// no frame callbacks are waiting for one.
+static int RefreshTimeout(MockCompositor *m) {
+  double remaining;
+  uint32_t i, j;
+  MockClient *c = NULL;
+  int waiting = 0;
+  if (m->refresh_interval == 0) return -1;
+  for (i = 0; (i < MAX_CLIENTS) && !waiting; i++) {
+    c = m->clients[i];
+    if (!c) continue;
+    for (j = 0; j < c->object_capacity; j++) {
+      if ((c->objects[j].type == MOCK_OBJECT_CALLBACK) && c->objects[j].due) {
+        waiting = 1;
+        break;
+      }
+    }
+  }
+  if (!waiting) return -1;
+  remaining = m->next_refresh - CurrentSeconds();
+  if (remaining <= 0) return 0;
+  return (int) (remaining * 1000.0) + 1;
+}
+
+// Sends the frame callbacks due at this refresh, if it's time for one.
+static void Refresh(MockCompositor *m) {
+  double now = CurrentSeconds();
+  MockClient *c = NULL;
+  uint32_t i;
+  if ((m->refresh_interval == 0) || (now < m->next_refresh)) return;
+  m->next_refresh += m->refresh_interval;
+  // Don't try to catch up on refreshes that happened while idle.
+  if (m->next_refresh < now) m->next_refresh = now + m->refresh_interval;
+  for (i = 0; i < MAX_CLIENTS; i++) {
+    c = m->clients[i];
+    if (!c) continue;
+    if (!SendFrameCallbacks(c) || !FlushClient(c)) {
+      DestroyClient(m, c);
+      m->clients[i] = NULL;
+    }
+  }
+}
+
+static int RunMockCompositor(MockCompositor *m) {
+  struct pollfd fds[MAX_CLIENTS + 1];
+  MockClient *polled[MAX_CLIENTS + 1];
+  uint32_t i, count;
+  int result;
+  while (!should_exit) {
+    if (m->client_limit && (m->clients_disconnected >= m->client_limit)) {
+      break;
+    }
+    fds[0].fd = m->listen_fd;
+    fds[0].events = POLLIN;
+    count = 1;
+    for (i = 0; i < MAX_CLIENTS; i++) {
+      if (!m->clients[i]) continue;
+      fds[count].fd = m->clients[i]->fd;
+      fds[count].events = POLLIN;
+      polled[count] = m->clients[i];
+      count++;
+    }
+    result = poll(fds, count, RefreshTimeout(m));
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      printf("Error polling: %s\n", strerror(errno));
+      return 0;
+    }
+    for (i = 1; i < count; i++) {
+      if (!fds[i].revents) continue;
+      if (ReceiveFromClient(m, polled[i])) continue;
+      // Clients are only ever removed here, so polled[i] is still in the
+      // client list.
+      for (result = 0; result < MAX_CLIENTS; result++) {
+        if (m->clients[result] == polled[i]) m->clients[result] = NULL;
+      }
+      DestroyClient(m, polled[i]);
+    }
+    if (fds[0].revents & POLLIN) AcceptClient(m);
+    Refresh(m);
+  }
+  return 1;
+}
+
+// Parses the arguments into m. Returns 0 if they're invalid.
+static int ParseArguments(MockCompositor *m, int argc, char **argv) {
+  double hz;
+  int i;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      m->verbose = 1;
+      continue;
+    }
+    if ((i + 1) >= argc) return 0;
+    if (strcmp(argv[i], "-f") == 0) {
+      m->frame_limit = strtoull(argv[i + 1], NULL, 10);
+    } else if (strcmp(argv[i], "-n") == 0) {
+      m->client_limit = strtoul(argv[i + 1], NULL, 10);
+    } else if (strcmp(argv[i], "-r") == 0) {
+      hz = strtod(argv[i + 1], NULL);
+      if (hz < 0) return 0;
+      m->refresh_interval = (hz == 0) ? 0 : 1.0 / hz;
+    } else if (strcmp(argv[i], "-s") == 0) {
+      if (sscanf(argv[i + 1], "%ux%u", &(m->configure_width),
+        &(m->configure_height)) != 2) {
+        return 0;
+      }
+    } else {
+      return 0;
+    }
+    i++;
+  }
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  MockCompositor m;
+  struct sigaction signal_action;
+  uint32_t i;
+  int result;
+  memset(&m, 0, sizeof(m));
+  m.listen_fd = -1;
+  if (!ParseArguments(&m, argc, argv)) {
+    printf("Usage: %s [-f frames] [-n clients] [-r hz] [-s WxH] [-v]\n",
+      argv[0]);
+    return 1;
+  }
+  InitCRC32Tables();
+  memset(&signal_action, 0, sizeof(signal_action));
+  signal_action.sa_handler = SignalHandler;
+  if ((sigaction(SIGINT, &signal_action, NULL) != 0) ||
+    (sigaction(SIGTERM, &signal_action, NULL) != 0)) {
+    printf("Error setting signal handlers: %s\n", strerror(errno));
+    return 1;
+  }
+  if (!ListenForClients(&m)) {
+    if (m.listen_fd >= 0) close(m.listen_fd);
+    return 1;
+  }
+  m.next_refresh = CurrentSeconds();
+  result = RunMockCompositor(&m);
+  for (i = 0; i < MAX_CLIENTS; i++) {
+    if (m.clients[i]) DestroyClient(&m, m.clients[i]);
+  }
+  close(m.listen_fd);
+  unlink(m.address.sun_path);
+  return result ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+#ifndef PIXEL_FILL_H
+#define PIXEL_FILL_H
+// This is a header-only library of kernels for filling 32-bit pixels with a
+// solid color. On x86 there are SSE2, AVX2 and AVX-512 versions in addition to
+// the scalar fallback; the best one the CPU supports is chosen once by calling
+// InitPixelFill at startup.
+//
+// FillPattern32(dst, count, value) fills count pixels starting at dst.
+// FillSpan32(row, x_start, x_end, value) fills pixels [x_start, x_end) of a
+//   row.
+// FillRect32(buffer, stride, x, y, w, h, value) fills a rectangle in an image
+//   with the given stride, in bytes.
+// FillRect32NonTemporal is the same as FillRect32, but always bypasses the
+//   cache. Use it when the rectangle is part of a bigger fill, e.g. one tile of
+//   a large frame.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_FILL_X86 (1)
+#include <immintrin.h>
+#endif
+
+// Fills larger than this many bytes use non-temporal stores on the SIMD paths,
+// so that filling a big frame doesn't evict everything else from the cache.
+// The compositor reads the buffer from a different process anyway. Streaming
+// only pays off for long runs of contiguous memory; short strided rows are
+// faster with ordinary stores.
+#define PIXEL_FILL_STREAMING_THRESHOLD (1024 * 1024)
+// FillRect32 only streams if the rectangle's rows are at least this long.
+#define PIXEL_FILL_MIN_STREAMING_ROW (4096)
+
+// The kernels use non-temporal stores if non_temporal is nonzero and they
+// support them.
+typedef void (*FillPattern32Function)(uint32_t *dst, size_t count,
+  uint32_t value, int non_temporal);
+
+static void FillPattern32Scalar(uint32_t *dst, size_t count, uint32_t value,
+  int non_temporal) {
+  size_t i;
+  for (i = 0; i < count; i++) dst[i] = value;
+}
+
+#ifdef PIXEL_FILL_X86
+
+// Fills pixels one at a time until dst is aligned to the given number of
+// bytes, or count runs out. Returns the number of pixels filled.
+static size_t FillUntilAligned(uint32_t *dst, size_t count, uint32_t value,
+  uintptr_t alignment) {
+  size_t i = 0;
+  while ((i < count) && (((uintptr_t) (dst + i)) & (alignment - 1))) {
+    dst[i] = value;
+    i++;
+  }
+  return i;
+}
+
+__attribute__((target("sse2")))
+static void FillPattern32SSE2(uint32_t *dst, size_t count, uint32_t value,
+  int non_temporal) {
+  __m128i v = _mm_set1_epi32((int) value);
+  size_t i = FillUntilAligned(dst, count, value, 16);
+  if (non_temporal) {
+    for (; (i + 16) <= count; i += 16) {
+      _mm_stream_si128((__m128i *) (dst + i), v);
+      _mm_stream_si128((__m128i *) (dst + i + 4), v);
+      _mm_stream_si128((__m128i *) (dst + i + 8), v);
+      _mm_stream_si128((__m128i *) (dst + i + 12), v);
+    }
+    _mm_sfence();
+  }
+  for (; (i + 4) <= count; i += 4) {
+    _mm_store_si128((__m128i *) (dst + i), v);
+  }
+  for (; i < count; i++) dst[i] = value;
+}
+
+__attribute__((target("avx2")))
+static void FillPattern32AVX2(uint32_t *dst, size_t count, uint32_t value,
+  int non_temporal) {
+  __m256i v = _mm256_set1_epi32((int) value);
+  size_t i = FillUntilAligned(dst, count, value, 32);
+  if (non_temporal) {
+    for (; (i + 32) <= count; i += 32) {
+      _mm256_stream_si256((__m256i *) (dst + i), v);
+      _mm256_stream_si256((__m256i *) (dst + i + 8), v);
+      _mm256_stream_si256((__m256i *) (dst + i + 16), v);
+      _mm256_stream_si256((__m256i *) (dst + i + 24), v);
+    }
+    _mm_sfence();
+  }
+  for (; (i + 8) <= count; i += 8) {
+    _mm256_store_si256((__m256i *) (dst + i), v);
+  }
+  for (; i < count; i++) dst[i] = value;
+}
+
+__attribute__((target("avx512f")))
+static void FillPattern32AVX512(uint32_t *dst, size_t count, uint32_t value,
+  int non_temporal) {
+  __m512i v = _mm512_set1_epi32((int) value);
+  size_t i = FillUntilAligned(dst, count, value, 64);
+  if (non_temporal) {
+    for (; (i + 64) <= count; i += 64) {
+      _mm512_stream_si512((__m512i *) (dst + i), v);
+      _mm512_stream_si512((__m512i *) (dst + i + 16), v);
+      _mm512_stream_si512((__m512i *) (dst + i + 32), v);
+      _mm512_stream_si512((__m512i *) (dst + i + 48), v);
+    }
+    _mm_sfence();
+  }
+  for (; (i + 16) <= count; i += 16) {
+    _mm512_store_si512((__m512i *) (dst + i), v);
+  }
+  // Finish off the row with a masked store rather than a scalar loop.
+  if (i < count) {
+    _mm512_mask_storeu_epi32(dst + i, (__mmask16) ((1u << (count - i)) - 1),
+      v);
+  }
+}
+
+#endif  // PIXEL_FILL_X86
+
+// The kernels, in increasing order of preference.
+typedef enum {
+  PIXEL_FILL_SCALAR = 0,
+  PIXEL_FILL_SSE2 = 1,
+  PIXEL_FILL_AVX2 = 2,
+  PIXEL_FILL_AVX512 = 3,
+  PIXEL_FILL_KERNEL_COUNT = 4,
+} PixelFillKernel;
+
+static const char *pixel_fill_kernel_names[PIXEL_FILL_KERNEL_COUNT] = {
+  "scalar", "sse2", "avx2", "avx512",
+};
+
+// The kernel chosen by InitPixelFill. Defaults to the scalar one so the
+// functions below work even if InitPixelFill is never called.
+static FillPattern32Function pixel_fill_function = FillPattern32Scalar;
+static PixelFillKernel pixel_fill_kernel = PIXEL_FILL_SCALAR;
+
+// Returns nonzero if the CPU supports the given kernel.
+static int PixelFillKernelSupported(PixelFillKernel kernel) {
+  switch (kernel) {
+  case PIXEL_FILL_SCALAR:
+    return 1;
+#ifdef PIXEL_FILL_X86
+  case PIXEL_FILL_SSE2:
+    return __builtin_cpu_supports("sse2");
+  case PIXEL_FILL_AVX2:
+    return __builtin_cpu_supports("avx2");
+  case PIXEL_FILL_AVX512:
+    return __builtin_cpu_supports("avx512f");
+#endif
+  default:
+    break;
+  }
+  return 0;
+}
+
+// Makes the fill functions use the given kernel. Returns 0 if the CPU doesn't
+// support it, in which case the current kernel is kept.
+static int SelectPixelFillKernel(PixelFillKernel kernel) {
+  FillPattern32Function f = FillPattern32Scalar;
+  if (!PixelFillKernelSupported(kernel)) return 0;
+  switch (kernel) {
+#ifdef PIXEL_FILL_X86
+  case PIXEL_FILL_SSE2:
+    f = FillPattern32SSE2;
+    break;
+  case PIXEL_FILL_AVX2:
+    f = FillPattern32AVX2;
+    break;
+  case PIXEL_FILL_AVX512:
+    f = FillPattern32AVX512;
+    break;
+#endif
+  default:
+    break;
+  }
+  pixel_fill_function = f;
+  pixel_fill_kernel = kernel;
+  return 1;
+}
+
+// Picks the best kernel the CPU supports. Returns the kernel's name.
+static const char* InitPixelFill(void) {
+  int kernel;
+#ifdef PIXEL_FILL_X86
+  __builtin_cpu_init();
+#endif
+  for (kernel = PIXEL_FILL_KERNEL_COUNT - 1; kernel > 0; kernel--) {
+    if (SelectPixelFillKernel((PixelFillKernel) kernel)) break;
+  }
+  if (kernel == 0) SelectPixelFillKernel(PIXEL_FILL_SCALAR);
+  return pixel_fill_kernel_names[pixel_fill_kernel];
+}
+
+static inline void FillPattern32(uint32_t *dst, size_t count, uint32_t value) {
+  pixel_fill_function(dst, count, value,
+    (count * 4) >= PIXEL_FILL_STREAMING_THRESHOLD);
+}
+
+static inline void FillSpan32(uint32_t *row, uint32_t x_start, uint32_t x_end,
+  uint32_t value) {
+  if (x_end <= x_start) return;
+  FillPattern32(row + x_start, x_end - x_start, value);
+}
+
+static void FillRect32Internal(uint8_t *buffer, uint32_t stride, uint32_t x,
+  uint32_t y, uint32_t w, uint32_t h, uint32_t value, int non_temporal) {
+  uint8_t *row = buffer + ((size_t) y) * stride;
+  uint32_t i;
+  // If the rows are contiguous, fill the whole thing with one call.
+  if ((x == 0) && (((size_t) w) * 4 == stride)) {
+    pixel_fill_function((uint32_t *) row, ((size_t) w) * h, value,
+      non_temporal);
+    return;
+  }
+  for (i = 0; i < h; i++) {
+    pixel_fill_function(((uint32_t *) row) + x, w, value, non_temporal);
+    row += stride;
+  }
+}
+
+static inline void FillRect32(uint8_t *buffer, uint32_t stride, uint32_t x,
+  uint32_t y, uint32_t w, uint32_t h, uint32_t value) {
+  int non_temporal = ((((size_t) w) * h * 4) >=
+    PIXEL_FILL_STREAMING_THRESHOLD) &&
+    ((w * 4) >= PIXEL_FILL_MIN_STREAMING_ROW);
+  FillRect32Internal(buffer, stride, x, y, w, h, value, non_temporal);
+}
+
+static inline void FillRect32NonTemporal(uint8_t *buffer, uint32_t stride,
+  uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t value) {
+  FillRect32Internal(buffer, stride, x, y, w, h, value, 1);
+}
+
+#endif  // PIXEL_FILL_H
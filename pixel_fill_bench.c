@@ -0,0 +1,135 @@
+// This program measures the throughput of the kernels in pixel_fill.h at a few
+// common frame sizes. For reference it also measures the old way RenderFrame
+// filled the buffer: a memset followed by writing each pixel a byte at a time.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pixel_fill.h"
+
+// Each measurement repeats the fill until at least this much time has passed.
+#define MIN_BENCHMARK_SECONDS (0.25)
+#define FILL_COLOR (0xff5510aa)
+
+typedef struct {
+  const char *name;
+  uint32_t width;
+  uint32_t height;
+} FrameSize;
+
+static const FrameSize frame_sizes[] = {
+  {"256x256", 256, 256},
+  {"1920x1080", 1920, 1080},
+  {"3840x2160", 3840, 2160},
+};
+
+static double CurrentSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec) + ((double) ts.tv_nsec) * 1e-9;
+}
+
+// The loop RenderFrame used before it was switched to FillRect32.
+static void FillByteLoop(uint8_t *buffer, uint32_t stride, uint32_t w,
+  uint32_t h) {
+  uint32_t x, y, row_offset = 0, pixel_offset;
+  memset(buffer, 0, ((size_t) stride) * h);
+  for (y = 0; y < h; y++) {
+    for (x = 0; x < w; x++) {
+      pixel_offset = row_offset + (x * 4);
+      buffer[pixel_offset] = 0xaa;
+      buffer[pixel_offset + 1] = 0x10;
+      buffer[pixel_offset + 2] = 0x55;
+      buffer[pixel_offset + 3] = 0xff;
+    }
+    row_offset += stride;
+  }
+}
+
+// Fills the buffer using either the byte loop (if kernel is negative) or the
+// currently selected kernel.
+static void FillOnce(int kernel, uint8_t *buffer, uint32_t w, uint32_t h) {
+  if (kernel < 0) {
+    FillByteLoop(buffer, w * 4, w, h);
+    return;
+  }
+  FillRect32(buffer, w * 4, 0, 0, w, h, FILL_COLOR);
+}
+
+// Returns 0 if any pixel in the buffer doesn't contain the fill color.
+static int CheckBuffer(uint8_t *buffer, size_t pixel_count) {
+  uint32_t *pixels = (uint32_t *) buffer;
+  size_t i;
+  for (i = 0; i < pixel_count; i++) {
+    if (pixels[i] != FILL_COLOR) {
+      printf("Pixel %lu is 0x%08x, expected 0x%08x.\n", (unsigned long) i,
+        pixels[i], FILL_COLOR);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Prints the throughput of one kernel at one frame size. Returns 0 on error.
+static int RunBenchmark(int kernel, const FrameSize *size, uint8_t *buffer) {
+  size_t bytes = ((size_t) size->width) * size->height * 4;
+  double start, elapsed;
+  uint64_t iterations = 0;
+  const char *name = "byte loop";
+  if (kernel >= 0) name = pixel_fill_kernel_names[kernel];
+
+  // Do one untimed fill to fault in the pages and check the result.
+  memset(buffer, 0, bytes);
+  FillOnce(kernel, buffer, size->width, size->height);
+  if (!CheckBuffer(buffer, bytes / 4)) {
+    printf("The %s kernel produced the wrong output at %s.\n", name,
+      size->name);
+    return 0;
+  }
+
+  start = CurrentSeconds();
+  do {
+    FillOnce(kernel, buffer, size->width, size->height);
+    iterations++;
+    elapsed = CurrentSeconds() - start;
+  } while (elapsed < MIN_BENCHMARK_SECONDS);
+  printf("%-10s %-10s %8.2f GB/s %10.1f us/frame\n", name, size->name,
+    (((double) bytes) * iterations) / elapsed / 1e9,
+    elapsed / iterations * 1e6);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  const FrameSize *largest = frame_sizes + (sizeof(frame_sizes) /
+    sizeof(frame_sizes[0])) - 1;
+  size_t buffer_size = ((size_t) largest->width) * largest->height * 4;
+  uint8_t *buffer = NULL;
+  int kernel, i, result = 0;
+
+  printf("Best supported kernel: %s\n", InitPixelFill());
+  buffer = (uint8_t *) aligned_alloc(64, buffer_size);
+  if (!buffer) {
+    printf("Failed allocating a %lu-byte buffer.\n",
+      (unsigned long) buffer_size);
+    return 1;
+  }
+  for (kernel = -1; kernel < PIXEL_FILL_KERNEL_COUNT; kernel++) {
+    if (kernel >= 0) {
+      if (!SelectPixelFillKernel((PixelFillKernel) kernel)) {
+        printf("%-10s not supported by this CPU\n",
+          pixel_fill_kernel_names[kernel]);
+        continue;
+      }
+    }
+    for (i = 0; i < (sizeof(frame_sizes) / sizeof(frame_sizes[0])); i++) {
+      if (!RunBenchmark(kernel, frame_sizes + i, buffer)) {
+        result = 1;
+        goto done;
+      }
+    }
+  }
+done:
+  free(buffer);
+  return result;
+}
@@ -0,0 +1,801 @@
+// This is a small build-time code generator, similar in spirit to
+// wayland-scanner. It reads one or more wayland protocol XML files and writes
+// a header to stdout containing opcode constants, message sizes and inline
+// functions that serialize each request directly into a caller-provided
+// buffer.
+//
+// Usage: protocol_scanner [-i interface1,interface2,...] file.xml [...]
+//
+// If -i is given, only the listed interfaces are emitted. The XML parser only
+// understands as much of XML as the protocol files use: tags, attributes,
+// comments, processing instructions and CDATA sections.
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_NAME_LENGTH (64)
+#define MAX_ARGS (20)
+#define MAX_MESSAGES (48)
+#define MAX_INTERFACES (256)
+
+typedef struct {
+  char name[MAX_NAME_LENGTH];
+  char type[MAX_NAME_LENGTH];
+  // Empty if the arg doesn't specify an interface.
+  char interface[MAX_NAME_LENGTH];
+  int allow_null;
+} ProtocolArg;
+
+typedef struct {
+  char name[MAX_NAME_LENGTH];
+  int since;
+  int is_destructor;
+  int arg_count;
+  ProtocolArg args[MAX_ARGS];
+} ProtocolMessage;
+
+typedef struct {
+  char name[MAX_NAME_LENGTH];
+  int version;
+  int request_count;
+  int event_count;
+  ProtocolMessage requests[MAX_MESSAGES];
+  ProtocolMessage events[MAX_MESSAGES];
+} ProtocolInterface;
+
+// Holds a single parsed tag. Only the attributes we care about are kept.
+typedef struct {
+  char name[MAX_NAME_LENGTH];
+  int is_closing;
+  int is_self_closing;
+  char attr_name[MAX_NAME_LENGTH];
+  char attr_type[MAX_NAME_LENGTH];
+  char attr_interface[MAX_NAME_LENGTH];
+  char attr_version[MAX_NAME_LENGTH];
+  char attr_since[MAX_NAME_LENGTH];
+  char attr_allow_null[MAX_NAME_LENGTH];
+} XMLTag;
+
+// Each interface is allocated as it is encountered.
+static ProtocolInterface *interfaces[MAX_INTERFACES];
+static int interface_count = 0;
+
+// Reads the entire file into a null-terminated buffer. Returns NULL on error.
+static char* ReadFile(const char *path) {
+  FILE *f = fopen(path, "rb");
+  char *to_return = NULL;
+  long size;
+  if (!f) {
+    fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  if ((fseek(f, 0, SEEK_END) != 0) || ((size = ftell(f)) < 0) ||
+    (fseek(f, 0, SEEK_SET) != 0)) {
+    fprintf(stderr, "Error getting the size of %s: %s\n", path,
+      strerror(errno));
+    fclose(f);
+    return NULL;
+  }
+  to_return = (char *) malloc(size + 1);
+  if (!to_return) {
+    fprintf(stderr, "Failed allocating %ld bytes for %s.\n", size, path);
+    fclose(f);
+    return NULL;
+  }
+  if (fread(to_return, 1, size, f) != (size_t) size) {
+    fprintf(stderr, "Error reading %s.\n", path);
+    free(to_return);
+    fclose(f);
+    return NULL;
+  }
+  to_return[size] = 0;
+  fclose(f);
+  return to_return;
+}
+
+static int IsSpace(char c) {
+  return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+// Copies at most MAX_NAME_LENGTH - 1 chars from src to dst.
+static void CopyName(char *dst, const char *src, size_t length) {
+  if (length >= MAX_NAME_LENGTH) length = MAX_NAME_LENGTH - 1;
+  memcpy(dst, src, length);
+  dst[length] = 0;
+}
+
+// Parses the tag starting at *cursor, which must point at the '<'. Updates
+// *cursor to point past the end of the tag. Returns 0 on error.
+static int ParseTag(const char **cursor, XMLTag *tag) {
+  const char *p = *cursor + 1;
+  const char *start, *value_start;
+  char quote, *dst;
+  size_t name_length;
+  memset(tag, 0, sizeof(*tag));
+  if (*p == '/') {
+    tag->is_closing = 1;
+    p++;
+  }
+  start = p;
+  while (*p && !IsSpace(*p) && (*p != '>') && (*p != '/')) p++;
+  CopyName(tag->name, start, p - start);
+  while (1) {
+    while (IsSpace(*p)) p++;
+    if (*p == 0) return 0;
+    if (*p == '>') break;
+    if ((p[0] == '/') && (p[1] == '>')) {
+      tag->is_self_closing = 1;
+      p++;
+      break;
+    }
+    // Parse an attribute of the form name="value" or name='value'.
+    start = p;
+    while (*p && !IsSpace(*p) && (*p != '=') && (*p != '>')) p++;
+    name_length = p - start;
+    while (IsSpace(*p)) p++;
+    if (*p != '=') return 0;
+    p++;
+    while (IsSpace(*p)) p++;
+    if ((*p != '"') && (*p != '\'')) return 0;
+    quote = *p;
+    p++;
+    value_start = p;
+    while (*p && (*p != quote)) p++;
+    if (*p == 0) return 0;
+    dst = NULL;
+    if ((name_length == 4) && (memcmp(start, "name", 4) == 0)) {
+      dst = tag->attr_name;
+    } else if ((name_length == 4) && (memcmp(start, "type", 4) == 0)) {
+      dst = tag->attr_type;
+    } else if ((name_length == 9) && (memcmp(start, "interface", 9) == 0)) {
+      dst = tag->attr_interface;
+    } else if ((name_length == 7) && (memcmp(start, "version", 7) == 0)) {
+      dst = tag->attr_version;
+    } else if ((name_length == 5) && (memcmp(start, "since", 5) == 0)) {
+      dst = tag->attr_since;
+    } else if ((name_length == 10) && (memcmp(start, "allow-null", 10) == 0)) {
+      dst = tag->attr_allow_null;
+    }
+    if (dst) CopyName(dst, value_start, p - value_start);
+    p++;
+  }
+  *cursor = p + 1;
+  return 1;
+}
+
+// Skips past the given terminator, starting at *cursor. Returns 0 if the
+// terminator wasn't found.
+static int SkipPast(const char **cursor, const char *terminator) {
+  const char *end = strstr(*cursor, terminator);
+  if (!end) return 0;
+  *cursor = end + strlen(terminator);
+  return 1;
+}
+
+// Parses the protocol XML in the given buffer, appending to the global list of
+// interfaces. Returns 0 on error.
+static int ParseProtocol(const char *path, const char *xml) {
+  const char *cursor = xml;
+  ProtocolInterface *current_interface = NULL;
+  ProtocolMessage *current_message = NULL;
+  ProtocolArg *arg = NULL;
+  XMLTag tag;
+  while ((cursor = strchr(cursor, '<')) != NULL) {
+    if (strncmp(cursor, "<!--", 4) == 0) {
+      if (!SkipPast(&cursor, "-->")) break;
+      continue;
+    }
+    if (strncmp(cursor, "<![CDATA[", 9) == 0) {
+      if (!SkipPast(&cursor, "]]>")) break;
+      continue;
+    }
+    if ((strncmp(cursor, "<?", 2) == 0) || (strncmp(cursor, "<!", 2) == 0)) {
+      if (!SkipPast(&cursor, ">")) break;
+      continue;
+    }
+    if (!ParseTag(&cursor, &tag)) {
+      fprintf(stderr, "%s: malformed tag near offset %d.\n", path,
+        (int) (cursor - xml));
+      return 0;
+    }
+
+    if (strcmp(tag.name, "interface") == 0) {
+      if (tag.is_closing) {
+        current_interface = NULL;
+        continue;
+      }
+      if (interface_count >= MAX_INTERFACES) {
+        fprintf(stderr, "%s: too many interfaces.\n", path);
+        return 0;
+      }
+      current_interface = (ProtocolInterface *) calloc(1,
+        sizeof(ProtocolInterface));
+      if (!current_interface) {
+        fprintf(stderr, "Failed allocating an interface.\n");
+        return 0;
+      }
+      interfaces[interface_count] = current_interface;
+      interface_count++;
+      strcpy(current_interface->name, tag.attr_name);
+      current_interface->version = atoi(tag.attr_version);
+      if (current_interface->version <= 0) current_interface->version = 1;
+      continue;
+    }
+
+    if ((strcmp(tag.name, "request") == 0) ||
+      (strcmp(tag.name, "event") == 0)) {
+      if (tag.is_closing) {
+        current_message = NULL;
+        continue;
+      }
+      if (!current_interface) {
+        fprintf(stderr, "%s: %s %s is outside of an interface.\n", path,
+          tag.name, tag.attr_name);
+        return 0;
+      }
+      if (tag.name[0] == 'r') {
+        if (current_interface->request_count >= MAX_MESSAGES) {
+          fprintf(stderr, "%s: too many requests in %s.\n", path,
+            current_interface->name);
+          return 0;
+        }
+        current_message = current_interface->requests +
+          current_interface->request_count;
+        current_interface->request_count++;
+      } else {
+        if (current_interface->event_count >= MAX_MESSAGES) {
+          fprintf(stderr, "%s: too many events in %s.\n", path,
+            current_interface->name);
+          return 0;
+        }
+        current_message = current_interface->events +
+          current_interface->event_count;
+        current_interface->event_count++;
+      }
+      memset(current_message, 0, sizeof(*current_message));
+      strcpy(current_message->name, tag.attr_name);
+      current_message->since = atoi(tag.attr_since);
+      if (current_message->since <= 0) current_message->since = 1;
+      current_message->is_destructor = strcmp(tag.attr_type, "destructor") ==
+        0;
+      if (tag.is_self_closing) current_message = NULL;
+      continue;
+    }
+
+    if ((strcmp(tag.name, "arg") == 0) && !tag.is_closing) {
+      if (!current_message) {
+        fprintf(stderr, "%s: arg %s is outside of a message.\n", path,
+          tag.attr_name);
+        return 0;
+      }
+      if (current_message->arg_count >= MAX_ARGS) {
+        fprintf(stderr, "%s: too many args in %s.\n", path,
+          current_message->name);
+        return 0;
+      }
+      arg = current_message->args + current_message->arg_count;
+      current_message->arg_count++;
+      strcpy(arg->name, tag.attr_name);
+      strcpy(arg->type, tag.attr_type);
+      strcpy(arg->interface, tag.attr_interface);
+      arg->allow_null = strcmp(tag.attr_allow_null, "true") == 0;
+    }
+  }
+  return 1;
+}
+
+// Returns nonzero if name is in the comma-separated list. A NULL list contains
+// every name.
+static int InList(const char *list, const char *name) {
+  size_t length = strlen(name);
+  const char *p = list;
+  if (!list) return 1;
+  while (*p) {
+    if ((strncmp(p, name, length) == 0) &&
+      ((p[length] == ',') || (p[length] == 0))) {
+      return 1;
+    }
+    p = strchr(p, ',');
+    if (!p) break;
+    p++;
+  }
+  return 0;
+}
+
+// Returns 0 if any interface in the comma-separated list wasn't found in the
+// protocol files.
+static int CheckInterfacesFound(const char *list) {
+  char name[MAX_NAME_LENGTH];
+  const char *p = list, *end;
+  int i, found, to_return = 1;
+  while (*p) {
+    end = strchr(p, ',');
+    if (!end) end = p + strlen(p);
+    CopyName(name, p, end - p);
+    found = 0;
+    for (i = 0; i < interface_count; i++) {
+      if (strcmp(interfaces[i]->name, name) == 0) {
+        found = 1;
+        break;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "Interface %s wasn't found in the protocol files.\n",
+        name);
+      to_return = 0;
+    }
+    if (*end == 0) break;
+    p = end + 1;
+  }
+  return to_return;
+}
+
+// Generated code is built up one statement at a time in one of these, so it
+// can be wrapped to 80 columns before being printed.
+typedef struct {
+  char text[4096];
+  size_t length;
+} StringBuilder;
+
+static void Append(StringBuilder *b, const char *format, ...) {
+  va_list args;
+  int result;
+  va_start(args, format);
+  result = vsnprintf(b->text + b->length, sizeof(b->text) - b->length, format,
+    args);
+  va_end(args);
+  if (result < 0) return;
+  b->length += result;
+  if (b->length >= sizeof(b->text)) b->length = sizeof(b->text) - 1;
+}
+
+// Appends the interface and message names in upper case, joined by '_'. The
+// message name may be NULL.
+static void AppendUpper(StringBuilder *b, const char *a, const char *c) {
+  char name[MAX_NAME_LENGTH * 2 + 1];
+  size_t i;
+  snprintf(name, sizeof(name), "%s%s%s", a, c ? "_" : "", c ? c : "");
+  for (i = 0; name[i]; i++) {
+    if ((name[i] >= 'a') && (name[i] <= 'z')) name[i] = name[i] - 'a' + 'A';
+  }
+  Append(b, "%s", name);
+}
+
+// Appends a snake_case name in CamelCase, e.g. "wl_surface" -> "WlSurface".
+static void AppendCamel(StringBuilder *b, const char *name) {
+  int capitalize = 1;
+  const char *p;
+  for (p = name; *p; p++) {
+    if (*p == '_') {
+      capitalize = 1;
+      continue;
+    }
+    if (capitalize && (*p >= 'a') && (*p <= 'z')) {
+      Append(b, "%c", *p - 'a' + 'A');
+    } else {
+      Append(b, "%c", *p);
+    }
+    capitalize = 0;
+  }
+}
+
+// Prints the statement in b, breaking it after commas so that no line exceeds
+// 80 columns. Continuation lines are indented by two more spaces than the
+// first line. Clears b afterwards.
+static void PrintCode(StringBuilder *b, int indent) {
+  const char *p = b->text;
+  const char *break_at, *q;
+  int width = 80 - indent;
+  printf("%*s", indent, "");
+  while ((int) strlen(p) > width) {
+    break_at = NULL;
+    for (q = p; (q - p) < width; q++) {
+      if ((q[0] == ',') && (q[1] == ' ')) break_at = q;
+    }
+    if (!break_at) break;
+    printf("%.*s\n", (int) (break_at - p + 1), p);
+    p = break_at + 2;
+    if (width == (80 - indent)) {
+      indent += 2;
+      width -= 2;
+    }
+    printf("%*s", indent, "");
+  }
+  printf("%s\n", p);
+  b->length = 0;
+  b->text[0] = 0;
+}
+
+// Prints the text in b as a // comment, wrapped at 80 columns. Clears b.
+static void PrintComment(StringBuilder *b) {
+  const char *p = b->text;
+  const char *break_at, *q;
+  while ((int) strlen(p) > 77) {
+    break_at = NULL;
+    for (q = p; (q - p) <= 77; q++) {
+      if (*q == ' ') break_at = q;
+    }
+    if (!break_at) break;
+    printf("// %.*s\n", (int) (break_at - p), p);
+    p = break_at + 1;
+  }
+  printf("// %s\n", p);
+  b->length = 0;
+  b->text[0] = 0;
+}
+
+// Prints "#define <INTERFACE>_<MESSAGE><suffix> (<value>)". The message name
+// may be NULL.
+static void PrintDefine(const char *interface, const char *message,
+  const char *suffix, int value) {
+  StringBuilder b;
+  b.length = 0;
+  Append(&b, "#define ");
+  AppendUpper(&b, interface, message);
+  Append(&b, "%s (%d)", suffix, value);
+  PrintCode(&b, 0);
+}
+
+// Returns nonzero if the arg is a new_id without a specified interface, which
+// is sent as an (interface, version, id) triple.
+static int IsGenericNewID(ProtocolArg *arg) {
+  return (strcmp(arg->type, "new_id") == 0) && (arg->interface[0] == 0);
+}
+
+// Returns the number of bytes the message occupies on the wire, or 0 if its
+// size depends on its arguments.
+static uint32_t FixedMessageSize(ProtocolMessage *m) {
+  uint32_t size = 8;
+  ProtocolArg *arg = NULL;
+  int i;
+  for (i = 0; i < m->arg_count; i++) {
+    arg = m->args + i;
+    if ((strcmp(arg->type, "string") == 0) ||
+      (strcmp(arg->type, "array") == 0) || IsGenericNewID(arg)) {
+      return 0;
+    }
+    if (strcmp(arg->type, "fd") == 0) continue;
+    size += 4;
+  }
+  return size;
+}
+
+static int CountFDs(ProtocolMessage *m) {
+  int i, to_return = 0;
+  for (i = 0; i < m->arg_count; i++) {
+    if (strcmp(m->args[i].type, "fd") == 0) to_return++;
+  }
+  return to_return;
+}
+
+// Appends an arg name, renamed if it would collide with the generated code's
+// own parameter names.
+static void AppendArgName(StringBuilder *b, ProtocolArg *arg) {
+  if ((strcmp(arg->name, "dst") == 0) || (strcmp(arg->name, "object_id") ==
+    0) || (strcmp(arg->name, "size") == 0)) {
+    Append(b, "%s_arg", arg->name);
+    return;
+  }
+  Append(b, "%s", arg->name);
+}
+
+// Appends the C parameter list for the arguments that are written to the
+// message payload. If sizes_only is set, only the arguments that affect the
+// message's size are appended. Returns the total number of parameters in the
+// list, including the printed count passed in.
+static int AppendParameters(StringBuilder *b, ProtocolMessage *m,
+  int sizes_only, int printed) {
+  ProtocolArg *arg = NULL;
+  int i;
+  for (i = 0; i < m->arg_count; i++) {
+    arg = m->args + i;
+    if (strcmp(arg->type, "fd") == 0) continue;
+    if (strcmp(arg->type, "string") == 0) {
+      Append(b, "%sconst char *", printed ? ", " : "");
+      AppendArgName(b, arg);
+      printed++;
+      continue;
+    }
+    if (strcmp(arg->type, "array") == 0) {
+      if (sizes_only) {
+        Append(b, "%suint32_t ", printed ? ", " : "");
+      } else {
+        Append(b, "%sconst void *", printed ? ", " : "");
+        AppendArgName(b, arg);
+        Append(b, ", uint32_t ");
+      }
+      AppendArgName(b, arg);
+      Append(b, "_size");
+      printed++;
+      continue;
+    }
+    if (IsGenericNewID(arg)) {
+      Append(b, "%sconst char *interface", printed ? ", " : "");
+      printed++;
+      if (sizes_only) continue;
+      Append(b, ", uint32_t version, uint32_t ");
+      AppendArgName(b, arg);
+      continue;
+    }
+    if (sizes_only) continue;
+    if ((strcmp(arg->type, "int") == 0) || (strcmp(arg->type, "fixed") == 0)) {
+      Append(b, "%sint32_t ", printed ? ", " : "");
+    } else {
+      Append(b, "%suint32_t ", printed ? ", " : "");
+    }
+    AppendArgName(b, arg);
+    printed++;
+  }
+  return printed;
+}
+
+// Appends the expression for the size of a message whose size isn't fixed.
+static void AppendSizeExpression(StringBuilder *b, ProtocolMessage *m) {
+  ProtocolArg *arg = NULL;
+  uint32_t fixed = 8;
+  int i;
+  for (i = 0; i < m->arg_count; i++) {
+    arg = m->args + i;
+    if (strcmp(arg->type, "fd") == 0) continue;
+    if (strcmp(arg->type, "string") == 0) {
+      Append(b, "ProtocolStringSize(");
+      AppendArgName(b, arg);
+      Append(b, ") + ");
+      continue;
+    }
+    if (strcmp(arg->type, "array") == 0) {
+      Append(b, "ProtocolArraySize(");
+      AppendArgName(b, arg);
+      Append(b, "_size) + ");
+      continue;
+    }
+    if (IsGenericNewID(arg)) {
+      Append(b, "ProtocolStringSize(interface) + ");
+      fixed += 8;
+      continue;
+    }
+    fixed += 4;
+  }
+  Append(b, "%u", (unsigned) fixed);
+}
+
+// Prints the defines for every event in the interface.
+static void PrintEvents(ProtocolInterface *iface) {
+  ProtocolMessage *m = NULL;
+  uint32_t size;
+  int i, fd_count;
+  for (i = 0; i < iface->event_count; i++) {
+    m = iface->events + i;
+    PrintDefine(iface->name, m->name, "_EVENT", i);
+    size = FixedMessageSize(m);
+    if (size != 0) PrintDefine(iface->name, m->name, "_EVENT_SIZE", size);
+    fd_count = CountFDs(m);
+    if (fd_count != 0) {
+      PrintDefine(iface->name, m->name, "_EVENT_FDS", fd_count);
+    }
+    if (m->since > 1) {
+      PrintDefine(iface->name, m->name, "_EVENT_SINCE", m->since);
+    }
+  }
+}
+
+// Prints the defines and the serialization function for a single request.
+static void PrintRequest(ProtocolInterface *iface, int opcode) {
+  ProtocolMessage *m = iface->requests + opcode;
+  ProtocolArg *arg = NULL;
+  uint32_t size = FixedMessageSize(m);
+  int i, fd_count = CountFDs(m);
+  StringBuilder b;
+  b.length = 0;
+
+  printf("\n");
+  PrintDefine(iface->name, m->name, "_OPCODE", opcode);
+  if (size != 0) PrintDefine(iface->name, m->name, "_SIZE", size);
+  if (fd_count != 0) PrintDefine(iface->name, m->name, "_FDS", fd_count);
+  if (m->since > 1) PrintDefine(iface->name, m->name, "_SINCE", m->since);
+
+  // Variable-sized messages get a function to compute their size, so callers
+  // can reserve space before writing them.
+  if (size == 0) {
+    printf("\n");
+    Append(&b, "static inline uint32_t ");
+    AppendCamel(&b, iface->name);
+    AppendCamel(&b, m->name);
+    Append(&b, "Size(");
+    AppendParameters(&b, m, 1, 0);
+    Append(&b, ") {");
+    PrintCode(&b, 0);
+    Append(&b, "return ");
+    AppendSizeExpression(&b, m);
+    Append(&b, ";");
+    PrintCode(&b, 2);
+    printf("}\n");
+  }
+
+  printf("\n");
+  Append(&b, "Writes a %s.%s request%s to dst, which must have room for ",
+    iface->name, m->name, m->is_destructor ? " (a destructor)" : "");
+  if (size != 0) {
+    AppendUpper(&b, iface->name, m->name);
+    Append(&b, "_SIZE bytes.");
+  } else {
+    AppendCamel(&b, iface->name);
+    AppendCamel(&b, m->name);
+    Append(&b, "Size() bytes.");
+  }
+  Append(&b, " Returns the number of bytes written.");
+  if (fd_count != 0) {
+    Append(&b, " The fd argument isn't part of the payload; it must be passed "
+      "to the server as ancillary data.");
+  }
+  PrintComment(&b);
+  Append(&b, "static inline uint32_t Write");
+  AppendCamel(&b, iface->name);
+  AppendCamel(&b, m->name);
+  Append(&b, "(uint8_t *dst, uint32_t object_id");
+  AppendParameters(&b, m, 0, 1);
+  Append(&b, ") {");
+  PrintCode(&b, 0);
+  Append(&b, "const uint32_t size = ");
+  if (size != 0) {
+    AppendUpper(&b, iface->name, m->name);
+    Append(&b, "_SIZE;");
+  } else {
+    AppendSizeExpression(&b, m);
+    Append(&b, ";");
+  }
+  PrintCode(&b, 2);
+  Append(&b, "dst = ProtocolWriteHeader(dst, object_id, ");
+  AppendUpper(&b, iface->name, m->name);
+  Append(&b, "_OPCODE, size);");
+  PrintCode(&b, 2);
+  for (i = 0; i < m->arg_count; i++) {
+    arg = m->args + i;
+    if (strcmp(arg->type, "fd") == 0) continue;
+    if (strcmp(arg->type, "string") == 0) {
+      Append(&b, "dst = ProtocolWriteString(dst, ");
+      AppendArgName(&b, arg);
+      Append(&b, ");");
+    } else if (strcmp(arg->type, "array") == 0) {
+      Append(&b, "dst = ProtocolWriteArray(dst, ");
+      AppendArgName(&b, arg);
+      Append(&b, ", ");
+      AppendArgName(&b, arg);
+      Append(&b, "_size);");
+    } else if (IsGenericNewID(arg)) {
+      Append(&b, "dst = ProtocolWriteString(dst, interface);");
+      PrintCode(&b, 2);
+      Append(&b, "dst = ProtocolWriteUint32(dst, version);");
+      PrintCode(&b, 2);
+      Append(&b, "dst = ProtocolWriteUint32(dst, ");
+      AppendArgName(&b, arg);
+      Append(&b, ");");
+    } else {
+      Append(&b, "dst = ProtocolWriteUint32(dst, (uint32_t) ");
+      AppendArgName(&b, arg);
+      Append(&b, ");");
+    }
+    PrintCode(&b, 2);
+  }
+  printf("  (void) dst;\n  return size;\n}\n");
+}
+
+static void PrintInterface(ProtocolInterface *iface) {
+  int i;
+  StringBuilder b;
+  b.length = 0;
+  printf("\n// %s, version %d\n", iface->name, iface->version);
+  Append(&b, "#define ");
+  AppendUpper(&b, iface->name, NULL);
+  Append(&b, "_INTERFACE \"%s\"", iface->name);
+  PrintCode(&b, 0);
+  PrintDefine(iface->name, NULL, "_VERSION", iface->version);
+  PrintDefine(iface->name, NULL, "_REQUEST_COUNT", iface->request_count);
+  PrintDefine(iface->name, NULL, "_EVENT_COUNT", iface->event_count);
+  PrintEvents(iface);
+  for (i = 0; i < iface->request_count; i++) {
+    PrintRequest(iface, i);
+  }
+}
+
+// Prints the helpers used by every generated serialization function.
+static void PrintPreamble(int argc, char **argv, int first_file) {
+  int i;
+  printf("// This file was generated by protocol_scanner from:\n");
+  for (i = first_file; i < argc; i++) {
+    const char *base = strrchr(argv[i], '/');
+    printf("//   %s\n", base ? base + 1 : argv[i]);
+  }
+  printf("// Don't edit it by hand; run \"make protocol\" to regenerate it.\n"
+    "#ifndef WAYLAND_PROTOCOL_H\n"
+    "#define WAYLAND_PROTOCOL_H\n"
+    "\n"
+    "#include <stdint.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "// The size of the object ID and opcode/size header on every message.\n"
+    "#define WAYLAND_HEADER_SIZE (8)\n"
+    "\n"
+    "static inline uint8_t* ProtocolWriteUint32(uint8_t *dst, uint32_t v) {\n"
+    "  memcpy(dst, &v, sizeof(v));\n"
+    "  return dst + sizeof(v);\n"
+    "}\n"
+    "\n"
+    "static inline uint8_t* ProtocolWriteHeader(uint8_t *dst, uint32_t "
+    "object_id,\n"
+    "  uint16_t opcode, uint32_t size) {\n"
+    "  dst = ProtocolWriteUint32(dst, object_id);\n"
+    "  return ProtocolWriteUint32(dst, (size << 16) | opcode);\n"
+    "}\n"
+    "\n"
+    "// Returns the size of a string on the wire, including its length, null\n"
+    "// terminator and padding. A NULL string is sent as a 0 length.\n"
+    "static inline uint32_t ProtocolStringSize(const char *s) {\n"
+    "  if (!s) return 4;\n"
+    "  return 4 + ((strlen(s) + 4) & ~((uint32_t) 3));\n"
+    "}\n"
+    "\n"
+    "static inline uint32_t ProtocolArraySize(uint32_t size) {\n"
+    "  return 4 + ((size + 3) & ~((uint32_t) 3));\n"
+    "}\n"
+    "\n"
+    "static inline uint8_t* ProtocolWriteString(uint8_t *dst, const char *s) "
+    "{\n"
+    "  uint32_t length, padded_length;\n"
+    "  if (!s) return ProtocolWriteUint32(dst, 0);\n"
+    "  length = strlen(s) + 1;\n"
+    "  padded_length = (length + 3) & ~((uint32_t) 3);\n"
+    "  dst = ProtocolWriteUint32(dst, length);\n"
+    "  memcpy(dst, s, length);\n"
+    "  memset(dst + length, 0, padded_length - length);\n"
+    "  return dst + padded_length;\n"
+    "}\n"
+    "\n"
+    "static inline uint8_t* ProtocolWriteArray(uint8_t *dst, const void "
+    "*data,\n"
+    "  uint32_t size) {\n"
+    "  uint32_t padded_size = (size + 3) & ~((uint32_t) 3);\n"
+    "  dst = ProtocolWriteUint32(dst, size);\n"
+    "  memcpy(dst, data, size);\n"
+    "  memset(dst + size, 0, padded_size - size);\n"
+    "  return dst + padded_size;\n"
+    "}\n");
+}
+
+int main(int argc, char **argv) {
+  const char *interface_list = NULL;
+  int i, first_file = 1;
+  char *xml = NULL;
+  if ((argc >= 3) && (strcmp(argv[1], "-i") == 0)) {
+    interface_list = argv[2];
+    first_file = 3;
+  }
+  if (first_file >= argc) {
+    fprintf(stderr, "Usage: %s [-i interface1,interface2,...] file.xml "
+      "[...]\n", argv[0]);
+    return 1;
+  }
+  for (i = first_file; i < argc; i++) {
+    xml = ReadFile(argv[i]);
+    if (!xml) return 1;
+    if (!ParseProtocol(argv[i], xml)) {
+      free(xml);
+      return 1;
+    }
+    free(xml);
+  }
+
+  if (interface_list && !CheckInterfacesFound(interface_list)) return 1;
+
+  PrintPreamble(argc, argv, first_file);
+  for (i = 0; i < interface_count; i++) {
+    if (!InList(interface_list, interfaces[i]->name)) continue;
+    PrintInterface(interfaces[i]);
+  }
+  printf("\n#endif  // WAYLAND_PROTOCOL_H\n");
+  return 0;
+}
@@ -0,0 +1,304 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+// This is a header-only implementation of an epoll-based event loop, with
+// support for timers (using timerfd) and signals (using signalfd) alongside
+// ordinary FDs.
+//
+// Each source has a callback, which ReactorWait calls from the thread that
+// called it when the source is ready. The callback gets a value depending on
+// the kind of source:
+//  - For FDs added with ReactorAddFd, the epoll events that are ready.
+//  - For timers, the number of times the timer expired since the last call.
+//  - For signals, the number of the signal that was received.
+// A callback returning 0 makes ReactorWait return 0 as well.
+//
+// Signals handled by the reactor must be blocked in every thread, or they'll
+// still be delivered the normal way. Call ReactorBlockSignals before creating
+// any threads, since new threads inherit the mask of the thread creating them.
+//
+// Requires _GNU_SOURCE to be defined before any system headers are included.
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// The most events handled per epoll_wait call.
+#define REACTOR_MAX_EVENTS (16)
+
+typedef int (*ReactorCallback)(void *context, uint64_t value);
+
+typedef enum {
+  REACTOR_SOURCE_FD,
+  REACTOR_SOURCE_TIMER,
+  REACTOR_SOURCE_SIGNAL,
+} ReactorSourceType;
+
+typedef struct {
+  int fd;
+  ReactorSourceType type;
+  ReactorCallback callback;
+  void *context;
+  // Set by ReactorRemove. The source is freed once it can no longer be in a
+  // batch of events being dispatched.
+  int removed;
+} ReactorSource;
+
+typedef struct {
+  int epoll_fd;
+  // Every source that hasn't been freed, including removed ones.
+  ReactorSource **sources;
+  uint32_t source_count;
+  uint32_t source_capacity;
+  // The number of epoll_wait calls that returned at least one event.
+  uint64_t wakeups;
+} Reactor;
+
+// Sets up r so that ReactorDestroy is safe to call on it.
+static void ReactorInit(Reactor *r) {
+  memset(r, 0, sizeof(*r));
+  r->epoll_fd = -1;
+}
+
+// Creates the epoll instance. Returns 0 on error.
+static int ReactorCreate(Reactor *r) {
+  ReactorInit(r);
+  r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (r->epoll_fd < 0) {
+    printf("Error creating epoll instance: %s\n", strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+// Closes the epoll instance and every timer and signal FD. FDs added with
+// ReactorAddFd belong to the caller and are left open.
+static void ReactorDestroy(Reactor *r) {
+  ReactorSource *source = NULL;
+  uint32_t i;
+  for (i = 0; i < r->source_count; i++) {
+    source = r->sources[i];
+    if (!source->removed && (source->type != REACTOR_SOURCE_FD)) {
+      close(source->fd);
+    }
+    free(source);
+  }
+  free(r->sources);
+  if (r->epoll_fd >= 0) close(r->epoll_fd);
+  ReactorInit(r);
+}
+
+// Registers fd with epoll, calling callback when any of the given events are
+// ready. Returns NULL on error.
+static ReactorSource* ReactorAddSource(Reactor *r, int fd,
+  ReactorSourceType type, uint32_t events, ReactorCallback callback,
+  void *context) {
+  ReactorSource *source = NULL, **new_sources = NULL;
+  struct epoll_event event;
+  uint32_t new_capacity;
+  if (r->source_count >= r->source_capacity) {
+    new_capacity = r->source_capacity ? r->source_capacity * 2 : 8;
+    new_sources = (ReactorSource **) realloc(r->sources, new_capacity *
+      sizeof(ReactorSource *));
+    if (!new_sources) {
+      printf("Failed growing the reactor's source list.\n");
+      return NULL;
+    }
+    r->sources = new_sources;
+    r->source_capacity = new_capacity;
+  }
+  source = (ReactorSource *) calloc(1, sizeof(*source));
+  if (!source) {
+    printf("Failed allocating a reactor source.\n");
+    return NULL;
+  }
+  source->fd = fd;
+  source->type = type;
+  source->callback = callback;
+  source->context = context;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.ptr = source;
+  if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+    printf("Error adding FD %d to epoll: %s\n", fd, strerror(errno));
+    free(source);
+    return NULL;
+  }
+  r->sources[r->source_count] = source;
+  r->source_count++;
+  return source;
+}
+
+// Calls callback with the ready events whenever any of the given epoll events
+// (e.g. EPOLLIN) are ready on fd. Returns NULL on error.
+static ReactorSource* ReactorAddFd(Reactor *r, int fd, uint32_t events,
+  ReactorCallback callback, void *context) {
+  return ReactorAddSource(r, fd, REACTOR_SOURCE_FD, events, callback,
+    context);
+}
+
+// Changes the epoll events the source's callback is called for. Only for
+// sources added with ReactorAddFd. Returns 0 on error.
+static int ReactorModifyFd(Reactor *r, ReactorSource *source,
+  uint32_t events) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.ptr = source;
+  if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, source->fd, &event) != 0) {
+    printf("Error changing the events for FD %d: %s\n", source->fd,
+      strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+// Creates a timer that first expires after initial_ns nanoseconds, and then
+// every interval_ns nanoseconds, or only once if interval_ns is 0. The timer
+// is based on CLOCK_MONOTONIC, so changes to the system time don't affect it.
+// Returns NULL on error.
+static ReactorSource* ReactorAddTimer(Reactor *r, uint64_t initial_ns,
+  uint64_t interval_ns, ReactorCallback callback, void *context) {
+  ReactorSource *source = NULL;
+  struct itimerspec spec;
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    printf("Error creating timerfd: %s\n", strerror(errno));
+    return NULL;
+  }
+  // An all-zero it_value would disarm the timer instead.
+  if (initial_ns == 0) initial_ns = 1;
+  spec.it_value.tv_sec = initial_ns / 1000000000ull;
+  spec.it_value.tv_nsec = initial_ns % 1000000000ull;
+  spec.it_interval.tv_sec = interval_ns / 1000000000ull;
+  spec.it_interval.tv_nsec = interval_ns % 1000000000ull;
+  if (timerfd_settime(fd, 0, &spec, NULL) != 0) {
+    printf("Error arming timerfd: %s\n", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  source = ReactorAddSource(r, fd, REACTOR_SOURCE_TIMER, EPOLLIN, callback,
+    context);
+  if (!source) close(fd);
+  return source;
+}
+
+// Blocks the given signals in the calling thread, and in any threads it
+// creates afterwards. Returns 0 on error.
+static int ReactorBlockSignals(const sigset_t *signals) {
+  int result = pthread_sigmask(SIG_BLOCK, signals, NULL);
+  if (result != 0) {
+    printf("Error blocking signals: %s\n", strerror(result));
+    return 0;
+  }
+  return 1;
+}
+
+// Calls callback with the signal number whenever one of the given signals is
+// received. The signals must already be blocked; see ReactorBlockSignals.
+// Returns NULL on error.
+static ReactorSource* ReactorAddSignals(Reactor *r, const sigset_t *signals,
+  ReactorCallback callback, void *context) {
+  ReactorSource *source = NULL;
+  int fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    printf("Error creating signalfd: %s\n", strerror(errno));
+    return NULL;
+  }
+  source = ReactorAddSource(r, fd, REACTOR_SOURCE_SIGNAL, EPOLLIN, callback,
+    context);
+  if (!source) close(fd);
+  return source;
+}
+
+// Stops calling the source's callback, and closes its FD if it's a timer or
+// signal source. Safe to call from within a callback.
+static inline void ReactorRemove(Reactor *r, ReactorSource *source) {
+  if (source->removed) return;
+  epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+  if (source->type != REACTOR_SOURCE_FD) close(source->fd);
+  source->removed = 1;
+}
+
+// Frees the sources that were removed.
+static void ReactorFreeRemoved(Reactor *r) {
+  uint32_t i = 0;
+  while (i < r->source_count) {
+    if (!r->sources[i]->removed) {
+      i++;
+      continue;
+    }
+    free(r->sources[i]);
+    r->source_count--;
+    r->sources[i] = r->sources[r->source_count];
+  }
+}
+
+// Reads whatever made a timer or signal source ready, and calls its callback.
+// Returns the callback's result, or 0 on error.
+static int ReactorDispatch(ReactorSource *source, uint32_t events) {
+  struct signalfd_siginfo info;
+  uint64_t expirations;
+  ssize_t result;
+  switch (source->type) {
+  case REACTOR_SOURCE_FD:
+    return source->callback(source->context, events);
+  case REACTOR_SOURCE_TIMER:
+    result = read(source->fd, &expirations, sizeof(expirations));
+    // The timer may have been rearmed since epoll_wait returned.
+    if ((result < 0) && (errno == EAGAIN)) return 1;
+    if (result != sizeof(expirations)) {
+      printf("Error reading timerfd: %s\n", strerror(errno));
+      return 0;
+    }
+    return source->callback(source->context, expirations);
+  case REACTOR_SOURCE_SIGNAL:
+    while (1) {
+      result = read(source->fd, &info, sizeof(info));
+      if ((result < 0) && (errno == EAGAIN)) return 1;
+      if (result != sizeof(info)) {
+        printf("Error reading signalfd: %s\n", strerror(errno));
+        return 0;
+      }
+      if (!source->callback(source->context, info.ssi_signo)) return 0;
+      if (source->removed) return 1;
+    }
+  }
+  return 0;
+}
+
+// Waits up to timeout_ms milliseconds (forever if negative) for any source to
+// be ready, and calls the callbacks of every source that is. Returns 0 on
+// error or if a callback returned 0.
+static int ReactorWait(Reactor *r, int timeout_ms) {
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+  ReactorSource *source = NULL;
+  int count, i, result = 1;
+  count = epoll_wait(r->epoll_fd, events, REACTOR_MAX_EVENTS, timeout_ms);
+  if (count < 0) {
+    if (errno == EINTR) return 1;
+    printf("Error waiting for events: %s\n", strerror(errno));
+    return 0;
+  }
+  if (count > 0) r->wakeups++;
+  for (i = 0; i < count; i++) {
+    source = (ReactorSource *) events[i].data.ptr;
+    // An earlier callback may have removed this source.
+    if (source->removed) continue;
+    if (!ReactorDispatch(source, events[i].events)) {
+      result = 0;
+      break;
+    }
+  }
+  ReactorFreeRemoved(r);
+  return result;
+}
+
+#endif  // REACTOR_H
@@ -0,0 +1,133 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+// This is a header-only implementation of a growable byte ring buffer. It's
+// used to hold data read from the wayland socket, so that messages split
+// between two reads can be kept until the rest of them arrives.
+//
+// The read and write positions are free-running counters that are masked by
+// the capacity (always a power of two) when indexing into the data, so the
+// number of used bytes is simply write_count - read_count.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+typedef struct {
+  uint8_t *data;
+  // The size of data, in bytes. Always a power of two.
+  uint32_t capacity;
+  // The total number of bytes ever consumed from, and written to, the buffer.
+  uint32_t read_count;
+  uint32_t write_count;
+} RingBuffer;
+
+// Returns the smallest power of two that's at least v.
+static uint32_t RingBufferRoundUpPow2(uint32_t v) {
+  uint32_t to_return = 1;
+  while (to_return < v) to_return <<= 1;
+  return to_return;
+}
+
+// Allocates the buffer with at least min_capacity bytes. Returns 0 on error.
+static int RingBufferInit(RingBuffer *r, uint32_t min_capacity) {
+  memset(r, 0, sizeof(*r));
+  r->capacity = RingBufferRoundUpPow2(min_capacity);
+  r->data = (uint8_t *) malloc(r->capacity);
+  if (!r->data) {
+    r->capacity = 0;
+    return 0;
+  }
+  return 1;
+}
+
+static void RingBufferDestroy(RingBuffer *r) {
+  free(r->data);
+  memset(r, 0, sizeof(*r));
+}
+
+// Returns the number of bytes that have been written but not yet consumed.
+static uint32_t RingBufferUsed(RingBuffer *r) {
+  return r->write_count - r->read_count;
+}
+
+static uint32_t RingBufferFree(RingBuffer *r) {
+  return r->capacity - RingBufferUsed(r);
+}
+
+// Makes sure at least min_free bytes can be written without overwriting any
+// unconsumed data, doubling the capacity as many times as necessary. Returns 0
+// if the allocation fails, in which case the buffer is left unchanged.
+static int RingBufferReserve(RingBuffer *r, uint32_t min_free) {
+  uint32_t used = RingBufferUsed(r);
+  uint32_t new_capacity = r->capacity;
+  uint32_t start, first_part;
+  uint8_t *new_data = NULL;
+  if (RingBufferFree(r) >= min_free) return 1;
+  while ((new_capacity - used) < min_free) new_capacity <<= 1;
+  new_data = (uint8_t *) malloc(new_capacity);
+  if (!new_data) return 0;
+  // Copy the unconsumed data to the start of the new buffer, unwrapping it if
+  // necessary.
+  start = r->read_count & (r->capacity - 1);
+  first_part = r->capacity - start;
+  if (first_part > used) first_part = used;
+  memcpy(new_data, r->data + start, first_part);
+  memcpy(new_data + first_part, r->data, used - first_part);
+  free(r->data);
+  r->data = new_data;
+  r->capacity = new_capacity;
+  r->read_count = 0;
+  r->write_count = used;
+  return 1;
+}
+
+// Fills in up to two iovecs describing the free space in the buffer, in the
+// order it must be written. Returns the number of iovecs that were filled in,
+// which will be 0 if the buffer is full.
+static int RingBufferWriteRegions(RingBuffer *r, struct iovec *regions) {
+  uint32_t free_bytes = RingBufferFree(r);
+  uint32_t start = r->write_count & (r->capacity - 1);
+  uint32_t first_part = r->capacity - start;
+  if (free_bytes == 0) return 0;
+  if (first_part >= free_bytes) {
+    regions[0].iov_base = r->data + start;
+    regions[0].iov_len = free_bytes;
+    return 1;
+  }
+  regions[0].iov_base = r->data + start;
+  regions[0].iov_len = first_part;
+  regions[1].iov_base = r->data;
+  regions[1].iov_len = free_bytes - first_part;
+  return 2;
+}
+
+// Marks size bytes of the regions returned by RingBufferWriteRegions as used.
+static void RingBufferCommitWrite(RingBuffer *r, uint32_t size) {
+  r->write_count += size;
+}
+
+// Copies size bytes, starting offset bytes past the current read position,
+// into dst. The caller must make sure that many bytes are available.
+static void RingBufferPeek(RingBuffer *r, uint32_t offset, void *dst,
+  uint32_t size) {
+  uint32_t start = (r->read_count + offset) & (r->capacity - 1);
+  uint32_t first_part = r->capacity - start;
+  if (first_part > size) first_part = size;
+  memcpy(dst, r->data + start, first_part);
+  memcpy(((uint8_t *) dst) + first_part, r->data, size - first_part);
+}
+
+// Returns a pointer to the next size unconsumed bytes if they're contiguous in
+// the buffer, or NULL if they wrap around its end.
+static uint8_t* RingBufferContiguous(RingBuffer *r, uint32_t size) {
+  uint32_t start = r->read_count & (r->capacity - 1);
+  if ((r->capacity - start) < size) return NULL;
+  return r->data + start;
+}
+
+static void RingBufferConsume(RingBuffer *r, uint32_t size) {
+  r->read_count += size;
+}
+
+#endif  // RING_BUFFER_H
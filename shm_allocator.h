@@ -0,0 +1,256 @@
+#ifndef SHM_ALLOCATOR_H
+#define SHM_ALLOCATOR_H
+// This is a header-only implementation of an allocator that carves slices out
+// of a single shm pool, so that any number of wl_buffers of different sizes
+// can share one memfd, one mapping and one wl_shm_pool.
+//
+// The allocator only deals in offsets; it never touches the memory itself.
+// Slices are placed in the free range they fit in most snugly, and otherwise
+// at the end of the used part of the pool, which the caller must then grow
+// the pool to cover (see ShmAllocatorEnd). Freed slices are merged with any
+// free neighbors, and the used part of the pool shrinks again if the slice at
+// the end is freed.
+//
+// Sizes are rounded up to a size class, so a slice freed by one buffer fits
+// exactly when another buffer of the same size is created, e.g. when a
+// swapchain is recreated. Classes smaller than a page are powers of two, and
+// are aligned to a cache line. Larger classes are four steps per power of two,
+// so no more than a quarter of a slice is wasted, and are aligned to a page.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+
+#define SHM_CACHE_LINE_SIZE (64)
+#define SHM_PAGE_SIZE (4096)
+// Rows of pixels are aligned to this many bytes.
+#define SHM_ROW_ALIGNMENT (SHM_CACHE_LINE_SIZE)
+
+// A slice of the pool, suitable for wl_shm_pool.create_buffer.
+typedef struct {
+  uint32_t offset;
+  // The size of the slice, rounded up to its size class.
+  uint32_t size;
+  // The number of bytes between the starts of rows of pixels, for slices
+  // allocated with ShmAllocatorAllocImage. Otherwise 0.
+  uint32_t stride;
+} ShmSlice;
+
+// A range of the pool that isn't in use.
+typedef struct {
+  uint64_t offset;
+  uint64_t size;
+} ShmFreeRange;
+
+typedef struct {
+  // The end of the highest slice in use. The pool must be at least this big.
+  uint64_t end;
+  // The offset no slice may extend past.
+  uint64_t limit;
+  // The free ranges below end, sorted by offset. Adjacent ranges are always
+  // merged, so no two of these touch.
+  ShmFreeRange *free_ranges;
+  uint32_t free_count;
+  uint32_t free_capacity;
+  // The number of slices in use, the total number ever allocated, and how
+  // many of those were placed in a free range rather than at the end.
+  uint32_t slices_in_use;
+  uint64_t allocations;
+  uint64_t reused;
+} ShmAllocator;
+
+// Sets up an empty allocator whose slices must all lie below limit.
+static void ShmAllocatorInit(ShmAllocator *a, uint64_t limit) {
+  memset(a, 0, sizeof(*a));
+  a->limit = limit;
+}
+
+static void ShmAllocatorDestroy(ShmAllocator *a) {
+  free(a->free_ranges);
+  ShmAllocatorInit(a, a->limit);
+}
+
+// Returns the size class the given size belongs to, or 0 if it's too big to
+// have one.
+static uint64_t ShmAllocatorClassSize(uint64_t size) {
+  uint64_t power = SHM_CACHE_LINE_SIZE;
+  uint64_t step;
+  if (size > (1ull << 62)) return 0;
+  if (size <= SHM_PAGE_SIZE) {
+    while (power < size) power *= 2;
+    return power;
+  }
+  // Find the biggest power of two below size, and round up to a quarter of
+  // it, but never to less than a page.
+  power = SHM_PAGE_SIZE;
+  while ((power * 2) < size) power *= 2;
+  step = power / 4;
+  if (step < SHM_PAGE_SIZE) step = SHM_PAGE_SIZE;
+  return (size + step - 1) & ~(step - 1);
+}
+
+// Returns the alignment of slices in the given size class.
+static uint64_t ShmAllocatorClassAlignment(uint64_t class_size) {
+  if (class_size < SHM_PAGE_SIZE) return SHM_CACHE_LINE_SIZE;
+  return SHM_PAGE_SIZE;
+}
+
+static uint64_t ShmAlignUp(uint64_t v, uint64_t alignment) {
+  return (v + alignment - 1) & ~(alignment - 1);
+}
+
+// Removes the free range at the given index.
+static void ShmAllocatorRemoveRange(ShmAllocator *a, uint32_t index) {
+  a->free_count--;
+  memmove(a->free_ranges + index, a->free_ranges + index + 1,
+    (a->free_count - index) * sizeof(ShmFreeRange));
+}
+
+// Inserts a free range at the given index, without merging it with anything.
+// Returns 0 on error.
+static int ShmAllocatorInsertRange(ShmAllocator *a, uint32_t index,
+  uint64_t offset, uint64_t size) {
+  uint32_t new_capacity;
+  ShmFreeRange *new_ranges = NULL;
+  if (a->free_count >= a->free_capacity) {
+    new_capacity = a->free_capacity ? a->free_capacity * 2 : 8;
+    new_ranges = (ShmFreeRange *) realloc(a->free_ranges, new_capacity *
+      sizeof(ShmFreeRange));
+    if (!new_ranges) {
+      LOG_ERROR("Failed growing the shm allocator's free list.\n");
+      return 0;
+    }
+    a->free_ranges = new_ranges;
+    a->free_capacity = new_capacity;
+  }
+  memmove(a->free_ranges + index + 1, a->free_ranges + index,
+    (a->free_count - index) * sizeof(ShmFreeRange));
+  a->free_ranges[index].offset = offset;
+  a->free_ranges[index].size = size;
+  a->free_count++;
+  return 1;
+}
+
+// Marks the given range as free, merging it with its neighbors. Returns 0 on
+// error.
+static int ShmAllocatorAddFreeRange(ShmAllocator *a, uint64_t offset,
+  uint64_t size) {
+  ShmFreeRange *prev = NULL, *next = NULL;
+  uint32_t i = 0;
+  if (size == 0) return 1;
+  while ((i < a->free_count) && (a->free_ranges[i].offset < offset)) i++;
+  if (i > 0) prev = a->free_ranges + i - 1;
+  if (i < a->free_count) next = a->free_ranges + i;
+  if (prev && ((prev->offset + prev->size) == offset)) {
+    prev->size += size;
+    if (next && ((prev->offset + prev->size) == next->offset)) {
+      prev->size += next->size;
+      ShmAllocatorRemoveRange(a, i);
+    }
+    return 1;
+  }
+  if (next && ((offset + size) == next->offset)) {
+    next->offset = offset;
+    next->size += size;
+    return 1;
+  }
+  return ShmAllocatorInsertRange(a, i, offset, size);
+}
+
+// Allocates a slice of at least size bytes, and sets *offset and *slice_size
+// to where it is and its actual size. Returns 0 if the slice doesn't fit
+// below the limit, or on error.
+static int ShmAllocatorAllocRaw(ShmAllocator *a, uint64_t size,
+  uint64_t *offset, uint64_t *slice_size) {
+  uint64_t class_size = ShmAllocatorClassSize(size);
+  uint64_t alignment = ShmAllocatorClassAlignment(class_size);
+  uint64_t start, padding, best_waste = UINT64_MAX, waste;
+  ShmFreeRange *r = NULL;
+  uint32_t i, best = 0;
+  if ((size == 0) || (class_size == 0)) return 0;
+  // Use the free range the slice fits in most snugly, so a range that exactly
+  // fits a slice of the same class is always picked over splitting a bigger
+  // one.
+  for (i = 0; i < a->free_count; i++) {
+    r = a->free_ranges + i;
+    start = ShmAlignUp(r->offset, alignment);
+    padding = start - r->offset;
+    if ((padding > r->size) || ((r->size - padding) < class_size)) continue;
+    waste = r->size - class_size;
+    if (waste >= best_waste) continue;
+    best_waste = waste;
+    best = i;
+  }
+  if (best_waste != UINT64_MAX) {
+    r = a->free_ranges + best;
+    start = ShmAlignUp(r->offset, alignment);
+    padding = start - r->offset;
+    // Give back whatever's left on either side of the slice.
+    r->offset = start + class_size;
+    r->size -= padding + class_size;
+    if (r->size == 0) ShmAllocatorRemoveRange(a, best);
+    if (!ShmAllocatorAddFreeRange(a, start - padding, padding)) return 0;
+    a->reused++;
+  } else {
+    start = ShmAlignUp(a->end, alignment);
+    if ((start + class_size) > a->limit) return 0;
+    if (!ShmAllocatorAddFreeRange(a, a->end, start - a->end)) return 0;
+    a->end = start + class_size;
+  }
+  *offset = start;
+  *slice_size = class_size;
+  a->slices_in_use++;
+  a->allocations++;
+  return 1;
+}
+
+// Allocates a slice of at least size bytes. Returns 0 if the slice doesn't
+// fit below the limit, or on error.
+static int ShmAllocatorAlloc(ShmAllocator *a, uint64_t size, ShmSlice *s) {
+  uint64_t offset, slice_size;
+  if (!ShmAllocatorAllocRaw(a, size, &offset, &slice_size)) return 0;
+  s->offset = offset;
+  s->size = slice_size;
+  s->stride = 0;
+  return 1;
+}
+
+// Returns the stride to use for an image with the given width and number of
+// bytes per pixel.
+static uint64_t ShmImageStride(uint32_t width, uint32_t bytes_per_pixel) {
+  return ShmAlignUp(((uint64_t) width) * bytes_per_pixel, SHM_ROW_ALIGNMENT);
+}
+
+// Allocates a slice for a width x height image, with each row aligned to
+// SHM_ROW_ALIGNMENT. Returns 0 if it doesn't fit below the limit, or on error.
+static int ShmAllocatorAllocImage(ShmAllocator *a, uint32_t width,
+  uint32_t height, uint32_t bytes_per_pixel, ShmSlice *s) {
+  uint64_t stride = ShmImageStride(width, bytes_per_pixel);
+  if (stride > UINT32_MAX) return 0;
+  if (!ShmAllocatorAlloc(a, stride * height, s)) return 0;
+  s->stride = stride;
+  return 1;
+}
+
+// Returns the slice to the allocator. Returns 0 on error.
+static int ShmAllocatorFree(ShmAllocator *a, const ShmSlice *s) {
+  ShmFreeRange *last = NULL;
+  if (!ShmAllocatorAddFreeRange(a, s->offset, s->size)) return 0;
+  a->slices_in_use--;
+  // Give the end of the pool back, so the next big slice can go there.
+  if (a->free_count == 0) return 1;
+  last = a->free_ranges + a->free_count - 1;
+  if ((last->offset + last->size) == a->end) {
+    a->end = last->offset;
+    a->free_count--;
+  }
+  return 1;
+}
+
+// Returns the size the pool needs to be to hold every slice in use.
+static uint64_t ShmAllocatorEnd(ShmAllocator *a) {
+  return a->end;
+}
+
+#endif  // SHM_ALLOCATOR_H
@@ -0,0 +1,172 @@
+#ifndef SHM_BACKING_H
+#define SHM_BACKING_H
+// This is a header-only implementation of the memory backing a wl_shm pool.
+//
+// The memory is an anonymous memfd, so there's no name to collide with other
+// clients and nothing to unlink. It's sealed against shrinking, which
+// guarantees the compositor that its mapping of the pool can't be truncated
+// out from under it. Optionally, the memory can use huge pages, and can be
+// prefaulted so that drawing the first frame doesn't take a page fault on
+// every 4 KiB.
+//
+// Requires _GNU_SOURCE to be defined before any system headers are included.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "log.h"
+
+// Try to back the memory with huge pages. Uses MFD_HUGETLB if the system has
+// huge pages reserved, and otherwise asks for transparent huge pages with
+// madvise, which only applies to mappings of at least SHM_HUGE_PAGE_SIZE.
+#define SHM_BACKING_HUGE_PAGES (1)
+// Fault in every page when the memory is mapped or grown.
+#define SHM_BACKING_PREFAULT (2)
+
+#define SHM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct {
+  int fd;
+  uint8_t *data;
+  uint64_t size;
+  // The SHM_BACKING_* options passed to ShmBackingCreate.
+  int options;
+  // Will be nonzero if the memfd was created with MFD_HUGETLB. Its size must
+  // then always be a multiple of SHM_HUGE_PAGE_SIZE.
+  int hugetlb;
+  // The minor page faults taken while creating and growing the memory.
+  uint64_t prefault_minor_faults;
+} ShmBacking;
+
+// Returns the number of minor page faults this process has taken so far.
+static uint64_t CurrentMinorFaults(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return usage.ru_minflt;
+}
+
+// Sets up b so that ShmBackingDestroy is safe to call on it.
+static void ShmBackingInit(ShmBacking *b) {
+  memset(b, 0, sizeof(*b));
+  b->fd = -1;
+}
+
+static void ShmBackingDestroy(ShmBacking *b) {
+  if (b->data) munmap(b->data, b->size);
+  if (b->fd >= 0) close(b->fd);
+  ShmBackingInit(b);
+}
+
+// Returns the size to actually allocate for the requested size.
+static uint64_t ShmBackingRoundSize(ShmBacking *b, uint64_t size) {
+  if (!b->hugetlb) return size;
+  return (size + SHM_HUGE_PAGE_SIZE - 1) & ~((uint64_t) SHM_HUGE_PAGE_SIZE - 1);
+}
+
+// Applies the huge page option to the given range of the mapping, which must
+// be page-aligned, and prefaults it if prefault is nonzero.
+static void ShmBackingAdvise(ShmBacking *b, uint64_t offset, uint64_t size,
+  int prefault) {
+  volatile uint8_t *p = NULL;
+  uint64_t i;
+  if ((b->options & SHM_BACKING_HUGE_PAGES) && !b->hugetlb &&
+    (b->size >= SHM_HUGE_PAGE_SIZE)) {
+    // This is only a hint, so ignore any errors; e.g. the kernel may not
+    // support transparent huge pages for shared memory.
+    madvise(b->data + offset, size, MADV_HUGEPAGE);
+  }
+  if (!prefault) return;
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(b->data + offset, size, MADV_POPULATE_WRITE) == 0) return;
+#endif
+  // Older kernels don't have MADV_POPULATE_WRITE, so touch each page instead.
+  // The memory is freshly allocated, so it's all zero already.
+  p = b->data + offset;
+  for (i = 0; i < size; i += 4096) p[i] = 0;
+}
+
+// Creates, seals and maps a memfd of the given size. Returns 0 on error
+// without printing anything, so the caller can retry without huge pages.
+static int ShmBackingOpen(ShmBacking *b, const char *name, uint64_t size,
+  int hugetlb) {
+  int flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+  int map_flags = MAP_SHARED;
+  if (hugetlb) flags |= MFD_HUGETLB;
+  b->hugetlb = hugetlb;
+  b->size = ShmBackingRoundSize(b, size);
+  b->fd = memfd_create(name, flags);
+  if (b->fd < 0) return 0;
+  if (ftruncate(b->fd, b->size) != 0) return 0;
+  // The pool only ever grows, so promise the compositor it'll never shrink.
+  if (fcntl(b->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) != 0) return 0;
+  if (b->options & SHM_BACKING_PREFAULT) map_flags |= MAP_POPULATE;
+  // Huge pages are reserved here, so this is where using them fails if there
+  // aren't enough.
+  b->data = mmap(NULL, b->size, PROT_READ | PROT_WRITE, map_flags, b->fd, 0);
+  if (b->data == MAP_FAILED) {
+    b->data = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+// Creates and maps at least size bytes of shared memory. The name is only
+// used for debugging. Returns 0 on error.
+static int ShmBackingCreate(ShmBacking *b, const char *name, uint64_t size,
+  int options) {
+  uint64_t faults_before = CurrentMinorFaults();
+  ShmBackingInit(b);
+  b->options = options;
+  if (options & SHM_BACKING_HUGE_PAGES) {
+    if (!ShmBackingOpen(b, name, size, 1)) {
+      // There probably aren't enough huge pages reserved. Fall back to normal
+      // pages, and transparent huge pages if possible.
+      ShmBackingDestroy(b);
+      b->options = options;
+    }
+  }
+  if ((b->fd < 0) && !ShmBackingOpen(b, name, size, 0)) {
+    LOG_ERROR("Error creating %llu bytes of shared memory: %s\n",
+      (unsigned long long) size, strerror(errno));
+    ShmBackingDestroy(b);
+    return 0;
+  }
+  // MAP_POPULATE already faulted everything in, so this only applies the huge
+  // page hint.
+  ShmBackingAdvise(b, 0, b->size, 0);
+  b->prefault_minor_faults = CurrentMinorFaults() - faults_before;
+  return 1;
+}
+
+// Grows the memory to at least new_size bytes. The mapping may move. Returns
+// 0 on error, in which case the memory is left unchanged.
+static int ShmBackingGrow(ShmBacking *b, uint64_t new_size) {
+  uint64_t old_size = b->size;
+  uint64_t faults_before;
+  uint8_t *new_data = NULL;
+  new_size = ShmBackingRoundSize(b, new_size);
+  if (new_size <= old_size) return 1;
+  if (ftruncate(b->fd, new_size) != 0) {
+    LOG_ERROR("Error growing memfd to %llu bytes: %s\n",
+      (unsigned long long) new_size, strerror(errno));
+    return 0;
+  }
+  new_data = mremap(b->data, old_size, new_size, MREMAP_MAYMOVE);
+  if (new_data == MAP_FAILED) {
+    LOG_ERROR("Error remapping memfd: %s\n", strerror(errno));
+    return 0;
+  }
+  b->data = new_data;
+  b->size = new_size;
+  faults_before = CurrentMinorFaults();
+  ShmBackingAdvise(b, old_size, new_size - old_size,
+    b->options & SHM_BACKING_PREFAULT);
+  b->prefault_minor_faults += CurrentMinorFaults() - faults_before;
+  return 1;
+}
+
+#endif  // SHM_BACKING_H
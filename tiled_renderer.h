@@ -0,0 +1,196 @@
+#ifndef TILED_RENDERER_H
+#define TILED_RENDERER_H
+// This is a header-only implementation of a renderer that splits an image into
+// tiles and draws them on a pool of worker threads.
+//
+// Each tile is a band of whole rows of the area being drawn, about tile_size
+// bytes of 32-bit pixels long. When drawing the whole image, that keeps every
+// tile a single contiguous range of memory, which is much faster than narrow
+// 2D tiles for big frames, where each row of a tile would land on a different
+// page.
+//
+// TiledRendererRun hands the tiles out to the workers through a shared atomic
+// counter, draws tiles on the calling thread too, and returns once every tile
+// is done. So, the caller can use the image immediately afterwards, e.g. to
+// attach it to a surface. TiledRendererRunRect does the same for part of the
+// image. A renderer with a thread count of 1 has no workers and draws
+// everything on the calling thread, as does any job that fits in one tile.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+
+// The default tile size, in bytes. Fits in the L2 cache of pretty much
+// anything.
+#define DEFAULT_TILE_SIZE (256 * 1024)
+
+// Draws the w x h rectangle at (x, y) of the image. Called concurrently from
+// several threads, for different tiles.
+typedef void (*TileRenderFunction)(void *context, uint8_t *image,
+  uint32_t stride, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+typedef struct {
+  pthread_t *threads;
+  // The total number of threads drawing tiles, including the calling thread.
+  uint32_t thread_count;
+  // The approximate size of each tile, in bytes.
+  uint32_t tile_size;
+  pthread_mutex_t lock;
+  // Signaled when a new job is available, or when the workers need to exit.
+  pthread_cond_t job_ready;
+  // Signaled when the last worker finishes its part of the job.
+  pthread_cond_t job_done;
+  // Incremented each time a job starts, so workers can tell a new job apart
+  // from a spurious wakeup.
+  uint64_t job_number;
+  // The number of workers that haven't finished the current job yet.
+  uint32_t busy_workers;
+  int exiting;
+  // The current job. Only changed while no workers are busy.
+  TileRenderFunction render;
+  void *context;
+  uint8_t *image;
+  uint32_t stride;
+  // The part of the image being drawn.
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+  uint32_t tile_height;
+  uint32_t tile_count;
+  // The index of the next tile to be drawn. Accessed atomically.
+  uint32_t next_tile;
+} TiledRenderer;
+
+// Draws tiles from the current job until there are none left.
+static void TiledRendererDrawTiles(TiledRenderer *r) {
+  uint32_t tile, y, h;
+  while (1) {
+    tile = __atomic_fetch_add(&r->next_tile, 1, __ATOMIC_RELAXED);
+    if (tile >= r->tile_count) break;
+    y = tile * r->tile_height;
+    h = r->height - y;
+    if (h > r->tile_height) h = r->tile_height;
+    r->render(r->context, r->image, r->stride, r->x, r->y + y, r->width, h);
+  }
+}
+
+static void* TiledRendererWorker(void *arg) {
+  TiledRenderer *r = (TiledRenderer *) arg;
+  uint64_t last_job = 0;
+  pthread_mutex_lock(&r->lock);
+  while (1) {
+    while (!r->exiting && (r->job_number == last_job)) {
+      pthread_cond_wait(&r->job_ready, &r->lock);
+    }
+    if (r->exiting) break;
+    last_job = r->job_number;
+    pthread_mutex_unlock(&r->lock);
+    TiledRendererDrawTiles(r);
+    pthread_mutex_lock(&r->lock);
+    r->busy_workers--;
+    if (r->busy_workers == 0) pthread_cond_signal(&r->job_done);
+  }
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+// Stops and joins the worker threads. Safe to call on a renderer that was
+// zeroed or only partially initialized.
+static void TiledRendererDestroy(TiledRenderer *r) {
+  uint32_t i;
+  if (!r->threads) return;
+  pthread_mutex_lock(&r->lock);
+  r->exiting = 1;
+  pthread_cond_broadcast(&r->job_ready);
+  pthread_mutex_unlock(&r->lock);
+  for (i = 0; i < (r->thread_count - 1); i++) {
+    pthread_join(r->threads[i], NULL);
+  }
+  free(r->threads);
+  pthread_cond_destroy(&r->job_done);
+  pthread_cond_destroy(&r->job_ready);
+  pthread_mutex_destroy(&r->lock);
+  memset(r, 0, sizeof(*r));
+}
+
+// Starts thread_count - 1 worker threads. A thread count of 0 is treated as 1.
+// Returns 0 on error.
+static int TiledRendererInit(TiledRenderer *r, uint32_t thread_count,
+  uint32_t tile_size) {
+  uint32_t i;
+  int result;
+  memset(r, 0, sizeof(*r));
+  if (thread_count == 0) thread_count = 1;
+  r->thread_count = 1;
+  r->tile_size = tile_size;
+  if (thread_count == 1) return 1;
+  r->threads = (pthread_t *) calloc(thread_count - 1, sizeof(pthread_t));
+  if (!r->threads) {
+    LOG_ERROR("Failed allocating renderer threads.\n");
+    return 0;
+  }
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->job_ready, NULL);
+  pthread_cond_init(&r->job_done, NULL);
+  for (i = 0; i < (thread_count - 1); i++) {
+    result = pthread_create(r->threads + i, NULL, TiledRendererWorker, r);
+    if (result != 0) {
+      LOG_ERROR("Failed starting renderer thread: %s\n", strerror(result));
+      TiledRendererDestroy(r);
+      return 0;
+    }
+    // Only count threads that actually started, so Destroy joins the right
+    // number of them.
+    r->thread_count++;
+  }
+  return 1;
+}
+
+// Draws the w x h rectangle at (x, y) of the image by calling render on every
+// tile in it, and waits for all of them to finish.
+static void TiledRendererRunRect(TiledRenderer *r, TileRenderFunction render,
+  void *context, uint8_t *image, uint32_t stride, uint32_t x, uint32_t y,
+  uint32_t w, uint32_t h) {
+  if ((w == 0) || (h == 0)) return;
+  r->render = render;
+  r->context = context;
+  r->image = image;
+  r->stride = stride;
+  r->x = x;
+  r->y = y;
+  r->width = w;
+  r->height = h;
+  r->tile_height = r->tile_size / (w * 4);
+  if (r->tile_height == 0) r->tile_height = 1;
+  r->tile_count = (h + r->tile_height - 1) / r->tile_height;
+  r->next_tile = 0;
+  // Waking the workers costs more than drawing a single tile.
+  if ((r->thread_count == 1) || (r->tile_count == 1)) {
+    TiledRendererDrawTiles(r);
+    return;
+  }
+  pthread_mutex_lock(&r->lock);
+  r->busy_workers = r->thread_count - 1;
+  r->job_number++;
+  pthread_cond_broadcast(&r->job_ready);
+  pthread_mutex_unlock(&r->lock);
+
+  TiledRendererDrawTiles(r);
+
+  pthread_mutex_lock(&r->lock);
+  while (r->busy_workers != 0) pthread_cond_wait(&r->job_done, &r->lock);
+  pthread_mutex_unlock(&r->lock);
+}
+
+// Draws the whole width x height image. See TiledRendererRunRect.
+static inline void TiledRendererRun(TiledRenderer *r,
+  TileRenderFunction render, void *context, uint8_t *image, uint32_t stride,
+  uint32_t width, uint32_t height) {
+  TiledRendererRunRect(r, render, context, image, stride, 0, 0, width,
+    height);
+}
+
+#endif  // TILED_RENDERER_H
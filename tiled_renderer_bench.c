@@ -0,0 +1,125 @@
+// This program measures how the tiled renderer scales with the number of
+// threads, by filling 1080p and 4K frames using 1 through N threads. N defaults
+// to the number of online CPUs, but can be passed as the first argument.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pixel_fill.h"
+#include "tiled_renderer.h"
+
+// Each measurement repeats the frame until at least this much time has passed.
+#define MIN_BENCHMARK_SECONDS (0.25)
+#define FILL_COLOR (0xff5510aa)
+
+typedef struct {
+  const char *name;
+  uint32_t width;
+  uint32_t height;
+} FrameSize;
+
+static const FrameSize frame_sizes[] = {
+  {"1920x1080", 1920, 1080},
+  {"3840x2160", 3840, 2160},
+};
+
+static double CurrentSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec) + ((double) ts.tv_nsec) * 1e-9;
+}
+
+static void FillTile(void *context, uint8_t *image, uint32_t stride,
+  uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+  FillRect32NonTemporal(image, stride, x, y, w, h, *((uint32_t *) context));
+}
+
+// Returns 0 if any pixel in the buffer doesn't contain the fill color.
+static int CheckBuffer(uint8_t *buffer, size_t pixel_count) {
+  uint32_t *pixels = (uint32_t *) buffer;
+  size_t i;
+  for (i = 0; i < pixel_count; i++) {
+    if (pixels[i] != FILL_COLOR) {
+      printf("Pixel %lu is 0x%08x, expected 0x%08x.\n", (unsigned long) i,
+        pixels[i], FILL_COLOR);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Returns the average time to render one frame, in seconds, or a negative
+// number on error.
+static double TimeFrames(TiledRenderer *r, const FrameSize *size,
+  uint8_t *buffer) {
+  uint32_t color = FILL_COLOR;
+  uint32_t stride = size->width * 4;
+  uint64_t iterations = 0;
+  double start, elapsed;
+
+  memset(buffer, 0, ((size_t) stride) * size->height);
+  TiledRendererRun(r, FillTile, &color, buffer, stride, size->width,
+    size->height);
+  if (!CheckBuffer(buffer, ((size_t) size->width) * size->height)) {
+    return -1.0;
+  }
+  start = CurrentSeconds();
+  do {
+    TiledRendererRun(r, FillTile, &color, buffer, stride, size->width,
+      size->height);
+    iterations++;
+    elapsed = CurrentSeconds() - start;
+  } while (elapsed < MIN_BENCHMARK_SECONDS);
+  return elapsed / iterations;
+}
+
+int main(int argc, char **argv) {
+  const FrameSize *size;
+  TiledRenderer renderer;
+  size_t buffer_size = 3840 * 2160 * 4;
+  uint8_t *buffer = NULL;
+  double single_thread_time[2], t;
+  long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int i, threads, result = 0;
+
+  if (argc > 1) max_threads = strtol(argv[1], NULL, 10);
+  if (max_threads < 1) {
+    printf("Usage: %s [max threads]\n", argv[0]);
+    return 1;
+  }
+  printf("Using the %s pixel fill kernel, %u-byte tiles.\n", InitPixelFill(),
+    DEFAULT_TILE_SIZE);
+  buffer = (uint8_t *) aligned_alloc(64, buffer_size);
+  if (!buffer) {
+    printf("Failed allocating a %lu-byte buffer.\n",
+      (unsigned long) buffer_size);
+    return 1;
+  }
+  for (threads = 1; threads <= max_threads; threads++) {
+    if (!TiledRendererInit(&renderer, threads, DEFAULT_TILE_SIZE)) {
+      result = 1;
+      break;
+    }
+    for (i = 0; i < (sizeof(frame_sizes) / sizeof(frame_sizes[0])); i++) {
+      size = frame_sizes + i;
+      t = TimeFrames(&renderer, size, buffer);
+      if (t < 0) {
+        printf("Rendering %s on %d threads produced the wrong output.\n",
+          size->name, threads);
+        result = 1;
+        break;
+      }
+      if (threads == 1) single_thread_time[i] = t;
+      printf("%2d threads %-10s %8.3f ms/frame %8.2f GB/s %6.2fx\n", threads,
+        size->name, t * 1e3,
+        ((double) size->width) * size->height * 4 / t / 1e9,
+        single_thread_time[i] / t);
+    }
+    TiledRendererDestroy(&renderer);
+    if (result != 0) break;
+  }
+  free(buffer);
+  return result;
+}
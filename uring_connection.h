@@ -0,0 +1,527 @@
+#ifndef URING_CONNECTION_H
+#define URING_CONNECTION_H
+// This is a header-only implementation of socket I/O through io_uring, using
+// the raw syscalls rather than liburing.
+//
+// Receiving uses a single multishot recvmsg, which keeps completing into
+// buffers taken from a ring of provided buffers without being resubmitted.
+// Each buffer holds the ancillary data, e.g. FDs, as well as the bytes. Sending
+// copies the caller's bytes into a buffer owned by the connection and submits
+// one sendmsg for all of them, resubmitting whatever's left after a partial
+// send. Only one send is in flight at a time, so bytes go out in order. An
+// extra FD, such as an epoll instance, can be polled as well, so everything
+// the caller waits for completes on the same ring.
+//
+// UringConnectionEnter submits everything prepared since the last call and
+// waits for completions, using a single io_uring_enter. UringConnectionNext
+// then returns the completions one at a time. A send submitted by the same
+// call doesn't end the wait by completing, so a request and its reply take
+// one io_uring_enter.
+//
+// The socket should be in blocking mode. io_uring waits for it to be ready
+// by itself, but fails with EAGAIN instead if it's non-blocking.
+//
+// The connection holds pointers to itself while a send is in flight, so it
+// must not be moved after UringConnectionCreate.
+//
+// Requires _GNU_SOURCE to be defined before any system headers are included.
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "log.h"
+
+// The size of the submission queue. At most one recv, one send and one poll
+// are prepared between calls to io_uring_enter.
+#define URING_ENTRIES (8)
+// The number and size of the buffers the multishot recvmsg completes into.
+// The count must be a power of two. Each buffer starts with the ancillary
+// data, so holds a bit less than this of received bytes.
+#define URING_RECV_BUFFER_COUNT (16)
+#define URING_RECV_BUFFER_SIZE (16 * 1024)
+#define URING_BUFFER_GROUP (0)
+// The most FDs that can be passed with one send or received with one recvmsg.
+#define URING_MAX_FDS (28)
+// How long UringConnectionEnter waits for a completion other than a send it
+// submitted, in case the send can't complete until the peer reads, before
+// returning with just the send's completion.
+#define URING_SEND_WAIT_MS (100)
+
+typedef enum {
+  URING_RECV = 1,
+  URING_SEND = 2,
+  URING_POLL = 3,
+} UringOperation;
+
+typedef struct {
+  UringOperation operation;
+  // For URING_RECV and URING_SEND, the number of bytes received or sent, or a
+  // negative errno value. A URING_RECV result of 0 means the peer closed the
+  // connection. For URING_POLL, the poll events that are ready.
+  int32_t result;
+  // For URING_RECV, the bytes received. For URING_SEND, the bytes sent, and
+  // the FDs that went along with them. Only valid until the next call to
+  // UringConnectionNext or UringConnectionEnter.
+  const uint8_t *data;
+  const int *fds;
+  uint32_t fd_count;
+  // For URING_RECV, the ancillary data that came with the bytes, and the
+  // flags recvmsg would have set, e.g. MSG_CTRUNC. The control data can be
+  // walked with CMSG_FIRSTHDR by pointing a msghdr's msg_control at it. Any
+  // FDs in it belong to the caller.
+  void *control;
+  uint32_t control_size;
+  int msg_flags;
+} UringCompletion;
+
+typedef struct {
+  int ring_fd;
+  int socket_fd;
+  // The FD that's polled for POLLIN, or -1.
+  int poll_fd;
+  // The submission and completion rings, which share one mapping, and the
+  // submission queue entries.
+  uint8_t *rings;
+  size_t rings_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  uint32_t *sq_head;
+  uint32_t *sq_tail;
+  uint32_t *sq_array;
+  uint32_t sq_mask;
+  uint32_t sq_entries;
+  uint32_t *cq_head;
+  uint32_t *cq_tail;
+  uint32_t cq_mask;
+  struct io_uring_cqe *cqes;
+  // The tail including entries that were prepared but not yet submitted, and
+  // the number of those entries.
+  uint32_t sq_local_tail;
+  uint32_t to_submit;
+  // The ring the kernel takes receive buffers from, and the buffers.
+  struct io_uring_buf_ring *buffer_ring;
+  size_t buffer_ring_size;
+  uint8_t *buffers;
+  uint16_t buffer_tail;
+  // The buffer holding the data of the last URING_RECV completion, or -1.
+  // It's given back to the kernel by the next call to UringConnectionNext or
+  // UringConnectionEnter.
+  int held_buffer;
+  // Nonzero while the multishot recvmsg and poll are active.
+  int recv_armed;
+  int poll_armed;
+  // Tells the multishot recvmsg how much room to leave for ancillary data.
+  struct msghdr recv_message;
+  // The bytes being sent, and how many of them have been sent so far.
+  uint8_t *send_data;
+  size_t send_capacity;
+  size_t send_size;
+  size_t send_done;
+  int send_fds[URING_MAX_FDS];
+  uint32_t send_fd_count;
+  int send_in_flight;
+  // Nonzero if a send was prepared since the last io_uring_enter.
+  int send_prepared;
+  // Nonzero if the kernel supports a timeout for io_uring_enter.
+  int enter_timeout;
+  // Referred to by the sendmsg in flight, so they must outlive it.
+  struct msghdr send_message;
+  struct iovec send_io;
+  uint8_t send_control[CMSG_SPACE(sizeof(int) * URING_MAX_FDS)];
+  // The number of io_uring_enter calls and of completions handled.
+  uint64_t enters;
+  uint64_t completions;
+} UringConnection;
+
+// Sets up c so that UringConnectionDestroy is safe to call on it.
+static void UringConnectionInit(UringConnection *c) {
+  memset(c, 0, sizeof(*c));
+  c->ring_fd = -1;
+  c->socket_fd = -1;
+  c->poll_fd = -1;
+  c->held_buffer = -1;
+}
+
+// Closes the ring, which cancels anything still in flight, and frees the
+// buffers. The socket and poll FDs belong to the caller and are left open.
+static void UringConnectionDestroy(UringConnection *c) {
+  if (c->ring_fd >= 0) close(c->ring_fd);
+  if (c->rings) munmap(c->rings, c->rings_size);
+  if (c->sqes) munmap(c->sqes, c->sqes_size);
+  if (c->buffer_ring) munmap(c->buffer_ring, c->buffer_ring_size);
+  free(c->buffers);
+  free(c->send_data);
+  UringConnectionInit(c);
+}
+
+// Maps size bytes of the ring at the given offset. Returns NULL on error.
+static void* UringMap(UringConnection *c, size_t size, uint64_t offset) {
+  void *result = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED |
+    MAP_POPULATE, c->ring_fd, offset);
+  if (result == MAP_FAILED) {
+    LOG_WARNING("Error mapping the io_uring rings: %s\n", strerror(errno));
+    return NULL;
+  }
+  return result;
+}
+
+// Gives the buffer from the last URING_RECV completion back to the kernel.
+static void UringReleaseBuffer(UringConnection *c) {
+  struct io_uring_buf *buffer = NULL;
+  if (c->held_buffer < 0) return;
+  // Only the address, length and ID are written, since the ring's tail
+  // overlaps the first entry's reserved field.
+  buffer = &(c->buffer_ring->bufs[c->buffer_tail &
+    (URING_RECV_BUFFER_COUNT - 1)]);
+  buffer->addr = (uint64_t) (uintptr_t) (c->buffers + ((size_t)
+    c->held_buffer) * URING_RECV_BUFFER_SIZE);
+  buffer->len = URING_RECV_BUFFER_SIZE;
+  buffer->bid = c->held_buffer;
+  c->buffer_tail++;
+  __atomic_store_n(&(c->buffer_ring->tail), c->buffer_tail,
+    __ATOMIC_RELEASE);
+  c->held_buffer = -1;
+}
+
+// Creates the ring and registers the receive buffers. Completions for the
+// socket and for poll_fd, unless it's -1, start arriving after the first
+// call to UringConnectionEnter. Returns 0 on error, including if the kernel
+// doesn't support everything needed.
+static int UringConnectionCreate(UringConnection *c, int socket_fd,
+  int poll_fd) {
+  struct io_uring_params params;
+  struct io_uring_buf_reg buffer_reg;
+  size_t cq_size;
+  int i;
+  UringConnectionInit(c);
+  c->socket_fd = socket_fd;
+  c->poll_fd = poll_fd;
+  // Only this thread uses the ring, which lets completions be handled when
+  // we next enter rather than interrupting us as they happen.
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  c->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if ((c->ring_fd < 0) && (errno == EINVAL)) {
+    // Kernels before 6.1 don't support those flags.
+    memset(&params, 0, sizeof(params));
+    c->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  }
+  if (c->ring_fd < 0) {
+    LOG_WARNING("Error setting up io_uring: %s\n", strerror(errno));
+    return 0;
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    LOG_WARNING("The kernel's io_uring is too old.\n");
+    return 0;
+  }
+  c->enter_timeout = (params.features & IORING_FEAT_EXT_ARG) != 0;
+  c->rings_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cq_size = params.cq_off.cqes + params.cq_entries *
+    sizeof(struct io_uring_cqe);
+  if (cq_size > c->rings_size) c->rings_size = cq_size;
+  c->rings = (uint8_t *) UringMap(c, c->rings_size, IORING_OFF_SQ_RING);
+  if (!c->rings) return 0;
+  c->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  c->sqes = (struct io_uring_sqe *) UringMap(c, c->sqes_size,
+    IORING_OFF_SQES);
+  if (!c->sqes) return 0;
+  c->sq_head = (uint32_t *) (c->rings + params.sq_off.head);
+  c->sq_tail = (uint32_t *) (c->rings + params.sq_off.tail);
+  c->sq_array = (uint32_t *) (c->rings + params.sq_off.array);
+  c->sq_mask = *((uint32_t *) (c->rings + params.sq_off.ring_mask));
+  c->sq_entries = params.sq_entries;
+  c->sq_local_tail = *(c->sq_tail);
+  c->cq_head = (uint32_t *) (c->rings + params.cq_off.head);
+  c->cq_tail = (uint32_t *) (c->rings + params.cq_off.tail);
+  c->cq_mask = *((uint32_t *) (c->rings + params.cq_off.ring_mask));
+  c->cqes = (struct io_uring_cqe *) (c->rings + params.cq_off.cqes);
+
+  c->buffer_ring_size = URING_RECV_BUFFER_COUNT * sizeof(struct io_uring_buf);
+  c->buffer_ring = (struct io_uring_buf_ring *) mmap(NULL,
+    c->buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+    -1, 0);
+  if (c->buffer_ring == MAP_FAILED) {
+    c->buffer_ring = NULL;
+    LOG_WARNING("Error allocating the io_uring buffer ring: %s\n",
+      strerror(errno));
+    return 0;
+  }
+  c->buffers = (uint8_t *) malloc(URING_RECV_BUFFER_COUNT *
+    URING_RECV_BUFFER_SIZE);
+  if (!c->buffers) {
+    LOG_WARNING("Failed allocating the io_uring receive buffers.\n");
+    return 0;
+  }
+  memset(&buffer_reg, 0, sizeof(buffer_reg));
+  buffer_reg.ring_addr = (uint64_t) (uintptr_t) c->buffer_ring;
+  buffer_reg.ring_entries = URING_RECV_BUFFER_COUNT;
+  buffer_reg.bgid = URING_BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, c->ring_fd, IORING_REGISTER_PBUF_RING,
+    &buffer_reg, 1) != 0) {
+    LOG_WARNING("Error registering the io_uring receive buffers: %s\n",
+      strerror(errno));
+    return 0;
+  }
+  for (i = 0; i < URING_RECV_BUFFER_COUNT; i++) {
+    c->held_buffer = i;
+    UringReleaseBuffer(c);
+  }
+  return 1;
+}
+
+// Returns a zeroed submission queue entry to fill in, which is submitted by
+// the next io_uring_enter. Returns NULL if the queue is full.
+static struct io_uring_sqe* UringGetEntry(UringConnection *c) {
+  uint32_t head = __atomic_load_n(c->sq_head, __ATOMIC_ACQUIRE);
+  uint32_t index = c->sq_local_tail & c->sq_mask;
+  struct io_uring_sqe *sqe = c->sqes + index;
+  if ((c->sq_local_tail - head) >= c->sq_entries) {
+    LOG_ERROR("The io_uring submission queue is full.\n");
+    return NULL;
+  }
+  memset(sqe, 0, sizeof(*sqe));
+  c->sq_array[index] = index;
+  c->sq_local_tail++;
+  c->to_submit++;
+  return sqe;
+}
+
+// Prepares the multishot recvmsg. Returns 0 on error.
+static int UringArmRecv(UringConnection *c) {
+  struct io_uring_sqe *sqe = UringGetEntry(c);
+  if (!sqe) return 0;
+  memset(&(c->recv_message), 0, sizeof(c->recv_message));
+  c->recv_message.msg_controllen = CMSG_SPACE(sizeof(int) * URING_MAX_FDS);
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = c->socket_fd;
+  sqe->addr = (uint64_t) (uintptr_t) &(c->recv_message);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_CMSG_CLOEXEC;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  sqe->user_data = URING_RECV;
+  c->recv_armed = 1;
+  return 1;
+}
+
+// Prepares the multishot poll of poll_fd. Returns 0 on error.
+static int UringArmPoll(UringConnection *c) {
+  struct io_uring_sqe *sqe = UringGetEntry(c);
+  if (!sqe) return 0;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = c->poll_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = URING_POLL;
+  c->poll_armed = 1;
+  return 1;
+}
+
+// Prepares a sendmsg for the rest of the send buffer, and the FDs if nothing
+// has been sent yet. Returns 0 on error.
+static int UringPrepareSend(UringConnection *c) {
+  struct io_uring_sqe *sqe = UringGetEntry(c);
+  struct cmsghdr *control_info = NULL;
+  if (!sqe) return 0;
+  memset(&(c->send_message), 0, sizeof(c->send_message));
+  c->send_io.iov_base = c->send_data + c->send_done;
+  c->send_io.iov_len = c->send_size - c->send_done;
+  c->send_message.msg_iov = &(c->send_io);
+  c->send_message.msg_iovlen = 1;
+  if ((c->send_fd_count != 0) && (c->send_done == 0)) {
+    memset(c->send_control, 0, sizeof(c->send_control));
+    c->send_message.msg_control = c->send_control;
+    c->send_message.msg_controllen = CMSG_SPACE(sizeof(int) *
+      c->send_fd_count);
+    control_info = CMSG_FIRSTHDR(&(c->send_message));
+    control_info->cmsg_level = SOL_SOCKET;
+    control_info->cmsg_type = SCM_RIGHTS;
+    control_info->cmsg_len = CMSG_LEN(sizeof(int) * c->send_fd_count);
+    memcpy(CMSG_DATA(control_info), c->send_fds, sizeof(int) *
+      c->send_fd_count);
+  }
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = c->socket_fd;
+  sqe->addr = (uint64_t) (uintptr_t) &(c->send_message);
+  sqe->len = 1;
+  // Report an error rather than dying of SIGPIPE if the peer goes away. With
+  // MSG_WAITALL, io_uring keeps sending until everything is sent rather than
+  // completing after a partial send.
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  sqe->user_data = URING_SEND;
+  c->send_in_flight = 1;
+  c->send_prepared = 1;
+  return 1;
+}
+
+// Returns nonzero if UringConnectionSend can be called, i.e. the previous
+// send has completed.
+static inline int UringConnectionCanSend(UringConnection *c) {
+  return !c->send_in_flight;
+}
+
+// Returns the number of bytes passed to UringConnectionSend that haven't
+// been sent yet.
+static inline size_t UringConnectionUnsent(UringConnection *c) {
+  return c->send_size - c->send_done;
+}
+
+// Copies size bytes into the send buffer and prepares a sendmsg for them,
+// passing the given FDs along with them. The FDs must stay open until the
+// send completes. Must only be called if UringConnectionCanSend returns
+// nonzero. Returns 0 on error.
+static int UringConnectionSend(UringConnection *c, const uint8_t *data,
+  size_t size, const int *fds, uint32_t fd_count) {
+  size_t new_capacity = c->send_capacity ? c->send_capacity : 4096;
+  uint8_t *new_data = NULL;
+  if (fd_count > URING_MAX_FDS) {
+    LOG_ERROR("Too many FDs for one io_uring send.\n");
+    return 0;
+  }
+  if (size > c->send_capacity) {
+    while (new_capacity < size) new_capacity *= 2;
+    new_data = (uint8_t *) realloc(c->send_data, new_capacity);
+    if (!new_data) {
+      LOG_ERROR("Failed growing the io_uring send buffer.\n");
+      return 0;
+    }
+    c->send_data = new_data;
+    c->send_capacity = new_capacity;
+  }
+  memcpy(c->send_data, data, size);
+  memcpy(c->send_fds, fds, sizeof(int) * fd_count);
+  c->send_fd_count = fd_count;
+  c->send_size = size;
+  c->send_done = 0;
+  return UringPrepareSend(c);
+}
+
+// Re-arms the multishot operations if needed, submits everything prepared,
+// and, if wait is nonzero, waits until at least one completion is ready, all
+// in one io_uring_enter call. Returns 0 on error.
+static int UringConnectionEnter(UringConnection *c, int wait) {
+  struct io_uring_getevents_arg extra;
+  struct __kernel_timespec timeout;
+  // With IORING_SETUP_DEFER_TASKRUN, completions are only posted when
+  // entering with IORING_ENTER_GETEVENTS, so always pass it.
+  uint32_t flags = IORING_ENTER_GETEVENTS, wait_count = wait ? 1 : 0;
+  long result;
+  UringReleaseBuffer(c);
+  if (!c->recv_armed && !UringArmRecv(c)) return 0;
+  if ((c->poll_fd >= 0) && !c->poll_armed && !UringArmPoll(c)) return 0;
+  __atomic_store_n(c->sq_tail, c->sq_local_tail, __ATOMIC_RELEASE);
+  // A send nearly always completes as it's submitted, which would end the
+  // wait before anything the caller is waiting for, so wait for one more
+  // completion. That's bounded by a timeout in case the socket is full.
+  if (wait && c->send_prepared && c->enter_timeout) {
+    wait_count++;
+    memset(&extra, 0, sizeof(extra));
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = URING_SEND_WAIT_MS * 1000000ll;
+    extra.ts = (uint64_t) (uintptr_t) &timeout;
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+  c->send_prepared = 0;
+  result = syscall(__NR_io_uring_enter, c->ring_fd, c->to_submit,
+    wait_count, flags, (flags & IORING_ENTER_EXT_ARG) ? &extra : NULL,
+    (flags & IORING_ENTER_EXT_ARG) ? sizeof(extra) : 0);
+  c->enters++;
+  if ((result < 0) && (errno != EINTR) && (errno != ETIME)) {
+    LOG_ERROR("Error entering io_uring: %s\n", strerror(errno));
+    return 0;
+  }
+  // Anything the kernel didn't consume is submitted next time.
+  c->to_submit = c->sq_local_tail - __atomic_load_n(c->sq_head,
+    __ATOMIC_ACQUIRE);
+  return 1;
+}
+
+// Fills in a URING_RECV completion from the buffer the multishot recvmsg
+// completed into, which starts with a struct io_uring_recvmsg_out, followed
+// by room for the address, which is unused, the ancillary data and the bytes.
+static void UringParseRecvmsg(UringConnection *c,
+  UringCompletion *completion) {
+  uint8_t *buffer = c->buffers + ((size_t) c->held_buffer) *
+    URING_RECV_BUFFER_SIZE;
+  struct io_uring_recvmsg_out *header = (struct io_uring_recvmsg_out *)
+    buffer;
+  completion->control = buffer + sizeof(*header) +
+    c->recv_message.msg_namelen;
+  completion->control_size = header->controllen;
+  completion->msg_flags = header->flags;
+  completion->data = ((uint8_t *) completion->control) +
+    c->recv_message.msg_controllen;
+  completion->result = header->payloadlen;
+}
+
+// Sets *completion to the next completion that's ready. Completions that only
+// matter to the connection itself, such as a recv running out of buffers,
+// are handled here and skipped. Returns 0 if there are no more.
+static int UringConnectionNext(UringConnection *c,
+  UringCompletion *completion) {
+  struct io_uring_cqe *cqe = NULL;
+  uint32_t head, flags;
+  uint64_t operation;
+  int32_t result;
+  UringReleaseBuffer(c);
+  while (1) {
+    head = *(c->cq_head);
+    if (head == __atomic_load_n(c->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    cqe = c->cqes + (head & c->cq_mask);
+    operation = cqe->user_data;
+    result = cqe->res;
+    flags = cqe->flags;
+    __atomic_store_n(c->cq_head, head + 1, __ATOMIC_RELEASE);
+    c->completions++;
+    memset(completion, 0, sizeof(*completion));
+    completion->operation = (UringOperation) operation;
+    completion->result = result;
+    switch (operation) {
+    case URING_RECV:
+      if (!(flags & IORING_CQE_F_MORE)) c->recv_armed = 0;
+      // Every buffer was full. They're given back as the completions before
+      // this one are handled, and the recv is re-armed on the next enter.
+      if (result == -ENOBUFS) continue;
+      if (flags & IORING_CQE_F_BUFFER) {
+        c->held_buffer = flags >> IORING_CQE_BUFFER_SHIFT;
+      }
+      if ((result > 0) && (c->held_buffer >= 0)) {
+        UringParseRecvmsg(c, completion);
+      }
+      return 1;
+    case URING_SEND:
+      c->send_in_flight = 0;
+      if ((result == -EAGAIN) || (result == -EINTR)) result = 0;
+      completion->result = result;
+      if (result < 0) return 1;
+      completion->data = c->send_data + c->send_done;
+      if ((c->send_done == 0) && (result > 0)) {
+        completion->fds = c->send_fds;
+        completion->fd_count = c->send_fd_count;
+      }
+      c->send_done += result;
+      if (c->send_done < c->send_size) {
+        if (!UringPrepareSend(c)) completion->result = -EBUSY;
+        return 1;
+      }
+      c->send_size = 0;
+      c->send_done = 0;
+      return 1;
+    case URING_POLL:
+      if (!(flags & IORING_CQE_F_MORE)) c->poll_armed = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+#endif  // URING_CONNECTION_H
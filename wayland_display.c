@@ -1,3 +1,5 @@
+// Needed for mremap.
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -6,24 +8,83 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
+#include "damage.h"
 #include "hex_dump.h"
+#include "id_allocator.h"
+#include "latency_histogram.h"
+#include "log.h"
+#include "pixel_fill.h"
+#include "reactor.h"
+#include "ring_buffer.h"
+#include "shm_allocator.h"
+#include "shm_backing.h"
+#include "tiled_renderer.h"
+#include "wayland_protocol.h"
+#include "wayland_wire.h"
+#include "wire_capture.h"
+
+// Set to 1 to do the socket I/O through io_uring, when the kernel supports
+// it. See the Makefile's IO_URING option.
+#ifndef USE_IO_URING
+#define USE_IO_URING (0)
+#endif
+#if USE_IO_URING
+#include "uring_connection.h"
+#endif
 
 #define WAYLAND_DISPLAY_OBJECT_ID (1)
-#define WAYLAND_DISPLAY_GET_REGISTRY_OPCODE (1)
-#define WAYLAND_REGISTRY_BIND_OPCODE (0)
-#define WAYLAND_REGISTRY_GLOBAL_EVENT (0)
-#define WAYLAND_DISPLAY_ERROR_EVENT (0)
-#define WAYLAND_SHM_FORMAT_EVENT (0)
-#define XDG_WM_PING_EVENT (0)
-#define XDG_SURFACE_CONFIGURE_EVENT (0)
-#define XDG_TOPLEVEL_CONFIGURE_EVENT (0)
+// IDs at or above this are allocated by the server.
+#define WAYLAND_SERVER_ID_START (0xff000000)
+// The initial number of entries in each half of the object table.
+#define INITIAL_OBJECT_TABLE_SIZE (64)
 #define IMAGE_WIDTH (256)
 #define IMAGE_HEIGHT (256)
 #define COLOR_CHANNELS (4)
+// The number of buffers in the swapchain. With three, there's always a free
+// buffer to draw into while the compositor holds one for scanout and another
+// is queued.
+#define SWAPCHAIN_LENGTH (3)
+// wl_shm_pool sizes are sent as signed 32-bit values.
+#define MAX_SHM_POOL_SIZE (0x7fffffff)
+// The number of frame callback timestamps we keep.
+#define FRAME_TIME_HISTORY (128)
+// The size, in pixels, of the square that moves across the window.
+#define ANIMATED_BOX_SIZE (32)
+// How long the square takes to move one pixel, in milliseconds.
+#define ANIMATION_MS_PER_PIXEL (4)
+// From the xdg_toplevel.state enum in xdg-shell.xml. Sent in the states array
+// of xdg_toplevel.configure when the surface isn't visible at all.
+#define XDG_TOPLEVEL_STATE_SUSPENDED (9)
+// From the wl_seat.capability enum in wayland.xml.
+#define WL_SEAT_CAPABILITY_KEYBOARD (2)
+// From the wl_keyboard.keymap_format enum in wayland.xml.
+#define WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1 (1)
+// An upper bound on the size of a message, including the header and padding.
+// The size is sent as a 16-bit value.
+#define WAYLAND_MAX_MESSAGE_SIZE (0x10000)
+// Used to size reads if we can't get the socket's receive buffer size.
+#define DEFAULT_RECEIVE_SIZE (0x10000)
+// The number of bytes of requests we'll buffer before flushing them.
+#define OUTBOUND_QUEUE_SIZE (4096)
+// Once this many bytes of requests are waiting for the socket to become
+// writable, new frames are held back until no more than the low watermark
+// are left.
+#define OUTBOUND_HIGH_WATERMARK (64 * 1024)
+#define OUTBOUND_LOW_WATERMARK (16 * 1024)
+// The most FDs we'll send in a single sendmsg call. Matches libwayland.
+#define OUTBOUND_MAX_FDS (28)
+// The most FDs a single recvmsg call can receive. The server sends no more
+// than OUTBOUND_MAX_FDS at once, if it's libwayland.
+#define RECEIVE_MAX_FDS (28)
+// The most received FDs that can wait for the events they go with to be
+// handled. Must be a power of two.
+#define RECEIVED_FD_QUEUE_SIZE (128)
 
 // Will be set to nonzero if the application should exit.
 static int should_exit = 0;
@@ -34,30 +95,244 @@ typedef enum {
   SURFACE_ATTACHED = 2,
 } SurfaceState;
 
+// Holds data received on the wayland socket that hasn't been handled yet.
+typedef struct {
+  // Holds the received bytes, including any partial message at the end.
+  RingBuffer ring;
+  // The number of bytes we try to read at once. Set to the size of the
+  // socket's receive buffer, so a single read can drain it.
+  uint32_t read_size;
+  // Messages that wrap around the end of the ring are copied here before
+  // being handled. Holds WAYLAND_MAX_MESSAGE_SIZE bytes.
+  uint8_t *scratch;
+  // The number of bytes read and complete messages handled during the most
+  // recent wakeup.
+  uint32_t last_bytes;
+  uint32_t last_messages;
+  // Totals over the lifetime of the connection.
+  uint64_t total_bytes;
+  uint64_t total_messages;
+  uint64_t wakeups;
+  uint32_t max_bytes;
+  // When the most recent data was received, from MonotonicNanoseconds.
+  uint64_t last_receive_time;
+  // FDs received as ancillary data, in the order they arrived, used as a
+  // ring. They arrive no later than the bytes of the events they go with, and
+  // each event's handler takes them in argument order with TakeReceivedFd.
+  int fds[RECEIVED_FD_QUEUE_SIZE];
+  uint32_t fd_head;
+  uint32_t fd_count;
+  // The number of FDs the event being handled carries that its handler
+  // hasn't taken yet. Any it doesn't take are closed once it returns.
+  uint32_t event_fds_left;
+  uint64_t total_fds;
+  uint64_t unused_fds;
+} WaylandReceiver;
+
+// Holds requests that have been written but not yet sent to the server. The
+// queue is flushed with a single sendmsg call once per event loop iteration,
+// or earlier if OUTBOUND_QUEUE_SIZE bytes are waiting. The socket is
+// non-blocking, so if the server isn't reading fast enough the unsent bytes
+// stay queued, and the queue grows as needed, until the socket is writable
+// again.
+typedef struct {
+  uint8_t *data;
+  size_t capacity;
+  // The end of the queued requests, and how many bytes from the start have
+  // already been sent by a partial write.
+  size_t size;
+  size_t sent;
+  // FDs to pass alongside the queued requests. They're sent as ancillary data
+  // with the first sendmsg call that sends any bytes, which the server handles
+  // the same as receiving them with the requests that refer to them. They
+  // must stay open until then.
+  int fds[OUTBOUND_MAX_FDS];
+  uint32_t fd_count;
+  // Nonzero while waiting for EPOLLOUT to send the rest of the queue.
+  int waiting_for_writable;
+  // Nonzero from when the unsent bytes reach OUTBOUND_HIGH_WATERMARK until
+  // they drop to OUTBOUND_LOW_WATERMARK. New frames aren't drawn meanwhile.
+  int congested;
+  // The number of sendmsg calls (or sendmsg operations submitted to io_uring)
+  // made so far, and the number at the time the last frame was presented.
+  uint64_t send_syscalls;
+  uint64_t last_frame_syscalls;
+  uint64_t bytes_sent;
+  // The number of sends that couldn't send everything queued, the number of
+  // times the queue became congested, and the most bytes ever waiting.
+  uint64_t partial_sends;
+  uint64_t congestion_events;
+  size_t max_unsent;
+} OutboundQueue;
+
+// One of the wl_buffers the frames are drawn into.
+typedef struct {
+  // The wl_buffer's ID, or 0 if it hasn't been created yet.
+  uint32_t id;
+  // Where the buffer is in the shm pool.
+  ShmSlice slice;
+  // Points to the buffer's pixels in our mapping of the pool.
+  uint8_t *data;
+  // Will be nonzero from the time the buffer is committed to a surface until
+  // the compositor sends wl_buffer.release. Must not be drawn into while busy.
+  int busy;
+  // The parts of the buffer that are out of date, because they changed in
+  // frames drawn into other buffers since this one was last drawn.
+  DamageRegion damage;
+} SwapchainBuffer;
+
+// A set of buffers carved out of one shm pool. Each frame is drawn into a
+// buffer the compositor isn't using, so we never draw over pixels it may
+// still be reading.
+//
+// When the window is resized, buffers with the old size are destroyed, except
+// for ones the compositor is still using. Those are moved to the retired list
+// and destroyed once they're released. A buffer's slice of the pool goes back
+// to the pool's allocator when the buffer is destroyed.
+typedef struct {
+  SwapchainBuffer buffers[SWAPCHAIN_LENGTH];
+  SwapchainBuffer *retired;
+  uint32_t retired_count;
+  uint32_t retired_capacity;
+  // The number of times we wanted to draw a frame but every buffer was busy.
+  uint64_t stalls;
+  // The number of times the shm pool was grown.
+  uint64_t pool_resizes;
+} Swapchain;
+
+// Paces rendering using wl_surface.frame callbacks. A callback is requested
+// with each commit, and the next frame is only drawn once it's done. The
+// compositor doesn't send the callback while the surface is hidden, so we
+// don't draw anything then either. If a callback finds nothing to draw, we
+// stop asking for callbacks until the animation next moves.
+typedef struct {
+  // The ID of the wl_callback we're waiting on, or 0 if there isn't one.
+  uint32_t callback_id;
+  // Will be nonzero if the last callback fired and we haven't drawn since.
+  int frame_due;
+  // Will be nonzero if the last callback found nothing to draw, so we aren't
+  // waiting on one. idle_timer fires when the animation next moves, or is
+  // NULL if it never will.
+  int idle;
+  ReactorSource *idle_timer;
+  // Will be nonzero if the toplevel's most recent configure event included
+  // the suspended state.
+  int suspended;
+  // The size from the toplevel's most recent configure event. Applied when
+  // the following xdg_surface.configure is acked. 0 means we pick the size.
+  uint32_t pending_width;
+  uint32_t pending_height;
+  // The timestamps of the most recent callbacks, in milliseconds. The newest
+  // is at (callback_count - 1) % FRAME_TIME_HISTORY.
+  uint32_t times[FRAME_TIME_HISTORY];
+  uint64_t callback_count;
+  // The time of the first callback, which the animation is relative to.
+  uint32_t first_time;
+  // Statistics about the intervals between callbacks, in milliseconds.
+  uint32_t min_interval;
+  uint32_t max_interval;
+  uint64_t interval_sum;
+} FrameScheduler;
+
+// The stages of responding to a configure and of presenting each frame. The
+// configure stages are only recorded for the first frame after a configure.
+typedef enum {
+  // From receiving xdg_surface.configure to queueing ack_configure.
+  LATENCY_CONFIGURE_TO_ACK = 0,
+  // From the ack to starting to draw the frame.
+  LATENCY_ACK_TO_RENDER,
+  // Drawing a frame, for every frame.
+  LATENCY_RENDER,
+  // From finishing drawing to queueing the commit, for every frame.
+  LATENCY_RENDER_TO_COMMIT,
+  // From receiving xdg_surface.configure to queueing the commit of the frame
+  // drawn in response.
+  LATENCY_CONFIGURE_TO_COMMIT,
+  LATENCY_STAGE_COUNT,
+} LatencyStage;
+
+static const char *latency_stage_names[LATENCY_STAGE_COUNT] = {
+  "configure -> ack",
+  "ack -> render",
+  "render",
+  "render -> commit",
+  "configure -> commit",
+};
+
+typedef struct {
+  LatencyHistogram stages[LATENCY_STAGE_COUNT];
+  // When the most recent xdg_surface.configure was received and acked. Will
+  // be 0 once a frame has been committed in response.
+  uint64_t configure_time;
+  uint64_t ack_time;
+  // When the most recently drawn frame started and finished drawing.
+  uint64_t render_start;
+  uint64_t render_end;
+  // The number of configures answered with a frame drawn before they
+  // arrived. Each counts as 0 in ack -> render.
+  uint64_t prerendered;
+} LatencyStats;
+
+// When startup reached each milestone, from MonotonicNanoseconds. Each is 0
+// until it's reached.
+typedef struct {
+  uint64_t start;
+  uint64_t connected;
+  uint64_t globals_bound;
+  uint64_t configured;
+  // When the request committing the first frame was about to be sent.
+  uint64_t first_commit;
+} StartupTimes;
+
+struct WaylandInterface;
+
+// An entry in the object table. Unused entries have a NULL interface.
+typedef struct {
+  const struct WaylandInterface *interface;
+} WaylandObject;
+
+// Maps object IDs to objects. Client-allocated IDs index directly into
+// client_objects. Server-allocated IDs index into server_objects after
+// subtracting WAYLAND_SERVER_ID_START. Both arrays grow as needed.
+typedef struct {
+  WaylandObject *client_objects;
+  uint32_t client_capacity;
+  WaylandObject *server_objects;
+  uint32_t server_capacity;
+} ObjectTable;
+
 // Holds various IDs and such we use for the window.
 typedef struct {
   // The FD for the connection to Wayland.
   int socket_fd;
-  // The FD for the shared memory object containing the image buffer.
-  int shm_fd;
   // The ID of the display registry used by wayland.
   uint32_t registry_id;
   // The ID bound to the global wl_shm object.
   uint32_t shm_id;
+  // The numeric names of the globals bound to shm_id, compositor_id,
+  // xdg_wm_base_id and seat_id, for recognizing wl_registry.global_remove
+  // events about them.
+  uint32_t shm_name;
+  uint32_t compositor_name;
+  uint32_t xdg_wm_base_name;
+  uint32_t seat_name;
   // The ID of the shm_pool object.
   uint32_t shm_pool_id;
-  // The ID of the frame buffer within the shm pool.
-  uint32_t frame_buffer_id;
-  // The ID bound to the global wl_compositor object.
+  // The ID bound to the global wl_compositor object, and its version. Our
+  // wl_surface has the same version.
   uint32_t compositor_id;
+  uint32_t compositor_version;
   // The ID bound to the global xdg_wm_base object.
   uint32_t xdg_wm_base_id;
+  // The ID bound to the first wl_seat global, and its version, which our
+  // wl_keyboard shares. keyboard_id is 0 unless the seat has a keyboard.
+  uint32_t seat_id;
+  uint32_t seat_version;
+  uint32_t keyboard_id;
   // The IDs of the wayland surface object and the associated xdg objects.
   uint32_t surface_id;
   uint32_t xdg_surface_id;
   uint32_t xdg_toplevel_id;
-  // Will be nonzero if we're done binding to the global objects we need.
-  int binding_done;
   // Will be 0 if we ack'd the initial xdg_surface.configure event.
   SurfaceState surface_state;
   // Properties of the image we'll display.
@@ -65,145 +340,266 @@ typedef struct {
   uint32_t height;
   uint32_t color_channels;
   uint32_t stride;
-  // The actual buffer containing the image.
+  // The size of one frame, in bytes.
   uint32_t image_buffer_size;
-  uint8_t *image_buffer;
+  // The memory shared with the compositor as the shm pool. Holds at least
+  // SWAPCHAIN_LENGTH frames, plus any retired buffers. Grows as needed, but
+  // never shrinks.
+  ShmBacking pool_memory;
+  // Hands out the slices of the pool that each wl_buffer uses.
+  ShmAllocator pool_allocator;
+  // The SHM_BACKING_* options to use for the pool.
+  int pool_options;
+  // The buffers in the pool.
+  Swapchain swapchain;
+  // Decides when to draw the next frame.
+  FrameScheduler scheduler;
+  // How long each stage of drawing and presenting a frame takes.
+  LatencyStats latency;
+  // How long it took to get the first frame on screen.
+  StartupTimes startup;
+  // The parts of the image that changed since the last frame we committed.
+  DamageRegion damage;
+  // Where the animated box was drawn in the most recent frame. box_drawn will
+  // be 0 before the first frame.
+  uint32_t box_x;
+  uint32_t box_y;
+  uint32_t box_size;
+  int box_drawn;
+  // Nonzero if the first frame was drawn into the first buffer while waiting
+  // for the first configure, and hasn't been committed yet.
+  int prerendered;
+  // The number of pixels we've drawn, and how many we'd have drawn if every
+  // frame were redrawn in full.
+  uint64_t pixels_drawn;
+  uint64_t full_frame_pixels;
+  // Buffers data received from the server.
+  WaylandReceiver receiver;
+  // Holds requests waiting to be sent to the server.
+  OutboundQueue outbound;
+  // Will be nonzero if a frame was committed since the last flush.
+  int frame_queued;
+  uint32_t frames_presented;
+  // Used to look up the interface of the object each event is sent to.
+  ObjectTable objects;
+  // Hands out IDs for the objects we create.
+  IDAllocator ids;
+  // Draws the image on all available cores.
+  TiledRenderer renderer;
+  // Waits for the socket, signals and timers.
+  Reactor reactor;
+  ReactorSource *socket_source;
+  // If nonzero, the latency histograms are printed this often.
+  uint32_t stats_interval_ms;
+  // Records everything sent and received, if --capture was given.
+  const char *capture_path;
+  WireCapture capture;
+  // If --replay was given, events are read from this capture instead of a
+  // connection, and requests are discarded rather than sent. With --paced,
+  // each read waits until the time it was recorded at, relative to the start
+  // of the replay.
+  const char *replay_path;
+  WireReplay replay;
+  int replay_paced;
+  uint64_t replay_start_time;
+  // Will be nonzero if the socket's I/O goes through io_uring rather than
+  // the reactor. The reactor's epoll FD is polled through the ring, so the
+  // event loop only waits in io_uring_enter. Only possible in builds with
+  // USE_IO_URING, and disabled by --no-io-uring.
+  int use_uring;
+  int disable_uring;
+#if USE_IO_URING
+  UringConnection uring;
+#endif
 } ApplicationState;
 
-// Holds data received from the server.
-typedef struct {
-  uint32_t object_id;
-  uint16_t opcode;
-  // Holds the size of the payload, in bytes. Does not include padding or the
-  // size of the header.
-  uint16_t payload_size;
-  // Will be NULL if payload_size is 0.
-  uint8_t *payload;
-} ParsedWaylandEvent;
+// Handles a single event on an object. Returns 0 on error.
+typedef int (*WaylandEventHandler)(ApplicationState *s, ParsedWaylandEvent *e);
+
+// Describes an interface we use. Events are dispatched by indexing handlers
+// with the event's opcode. A NULL handler means the event isn't supported.
+// event_fds, also indexed by opcode, holds how many FDs each event carries,
+// and may be NULL if none carry any.
+typedef struct WaylandInterface {
+  const char *name;
+  uint32_t event_count;
+  const WaylandEventHandler *handlers;
+  const uint8_t *event_fds;
+} WaylandInterface;
+
+// These are defined after the event handlers they refer to.
+static const WaylandInterface wl_display_interface;
+static const WaylandInterface wl_registry_interface;
+static const WaylandInterface wl_callback_interface;
+static const WaylandInterface wl_compositor_interface;
+static const WaylandInterface wl_shm_interface;
+static const WaylandInterface wl_shm_pool_interface;
+static const WaylandInterface wl_buffer_interface;
+static const WaylandInterface wl_surface_interface;
+static const WaylandInterface wl_seat_interface;
+static const WaylandInterface wl_keyboard_interface;
+static const WaylandInterface xdg_wm_base_interface;
+static const WaylandInterface xdg_surface_interface;
+static const WaylandInterface xdg_toplevel_interface;
+
+// Closes every received FD that hasn't been taken by an event handler.
+static void CloseReceivedFds(WaylandReceiver *r) {
+  while (r->fd_count > 0) {
+    close(r->fds[r->fd_head]);
+    r->fd_head = (r->fd_head + 1) & (RECEIVED_FD_QUEUE_SIZE - 1);
+    r->fd_count--;
+  }
+}
+
+// Adds fd to the end of the received FD queue, or closes it and returns 0 if
+// the queue is full.
+static int PushReceivedFd(WaylandReceiver *r, int fd) {
+  if (r->fd_count >= RECEIVED_FD_QUEUE_SIZE) {
+    close(fd);
+    return 0;
+  }
+  r->fds[(r->fd_head + r->fd_count) & (RECEIVED_FD_QUEUE_SIZE - 1)] = fd;
+  r->fd_count++;
+  r->total_fds++;
+  return 1;
+}
+
+// Removes the next received FD from the queue, for the handler of the event
+// being handled, which then owns it. Returns -1 if the event doesn't carry
+// any more FDs.
+static int TakeReceivedFd(WaylandReceiver *r) {
+  int fd;
+  if (r->event_fds_left == 0) {
+    LOG_ERROR("Took more FDs than the event carries.\n");
+    return -1;
+  }
+  fd = r->fds[r->fd_head];
+  r->fd_head = (r->fd_head + 1) & (RECEIVED_FD_QUEUE_SIZE - 1);
+  r->fd_count--;
+  r->event_fds_left--;
+  return fd;
+}
 
 // Frees and destroys any state held in s, including unlinking the shared
 // memory objects and closing sockets.
 static void CleanupState(ApplicationState *s) {
+#if USE_IO_URING
+  // Closing the ring cancels anything still using the socket.
+  UringConnectionDestroy(&(s->uring));
+#endif
   if (s->socket_fd >= 0) {
     close(s->socket_fd);
   }
-  if (s->shm_fd >= 0) {
-    munmap(s->image_buffer, s->image_buffer_size);
-    close(s->shm_fd);
-  }
+  ShmBackingDestroy(&(s->pool_memory));
+  RingBufferDestroy(&(s->receiver.ring));
+  free(s->receiver.scratch);
+  CloseReceivedFds(&(s->receiver));
+  free(s->objects.client_objects);
+  free(s->objects.server_objects);
+  free(s->swapchain.retired);
+  free(s->outbound.data);
+  ShmAllocatorDestroy(&(s->pool_allocator));
+  IDAllocatorDestroy(&(s->ids));
+  TiledRendererDestroy(&(s->renderer));
+  WireCaptureClose(&(s->capture));
+  WireReplayClose(&(s->replay));
+  ReactorDestroy(&(s->reactor));
+  LogShutdown();
 
   memset(s, 0, sizeof(*s));
   s->socket_fd = -1;
-  s->shm_fd = -1;
-}
-
-// Rounds v up to the next multiple of 4.
-static uint32_t RoundUp4(uint32_t v) {
-  while (v & 3) v++;
-  return v;
+  ShmBackingInit(&(s->pool_memory));
+  WireCaptureInit(&(s->capture));
+  ReactorInit(&(s->reactor));
+#if USE_IO_URING
+  UringConnectionInit(&(s->uring));
+#endif
 }
 
-static void AppendUint32(uint8_t *buffer, size_t *current_offset, uint32_t v) {
-  *((uint32_t *) (buffer + *current_offset)) = v;
-  *current_offset += 4;
+// Grows the table so that index is valid, zeroing the new entries. Returns 0
+// on error.
+static int GrowObjectArray(WaylandObject **objects, uint32_t *capacity,
+  uint32_t index) {
+  uint32_t new_capacity = *capacity;
+  WaylandObject *new_objects = NULL;
+  if (index < *capacity) return 1;
+  if (new_capacity == 0) new_capacity = INITIAL_OBJECT_TABLE_SIZE;
+  while (new_capacity <= index) new_capacity *= 2;
+  new_objects = (WaylandObject *) realloc(*objects,
+    new_capacity * sizeof(WaylandObject));
+  if (!new_objects) {
+    LOG_ERROR("Failed growing the object table to %u entries.\n",
+      (unsigned) new_capacity);
+    return 0;
+  }
+  memset(new_objects + *capacity, 0,
+    (new_capacity - *capacity) * sizeof(WaylandObject));
+  *objects = new_objects;
+  *capacity = new_capacity;
+  return 1;
 }
 
-// Appends the given string, preceded by its length, to the buffer. Prints a
-// message and returns 0 if appending the string would exceed the buffer's
-// capacity.
-static int AppendWaylandString(uint8_t *buffer, size_t *current_offset,
-  size_t buffer_capacity, char *str) {
-  size_t length = strlen(str);
-  size_t padded_length = RoundUp4(length + 1);
-  size_t padding_length = padded_length - length;
-  size_t remaining = buffer_capacity - *current_offset;
-  if ((padded_length + 4) > remaining) {
-    printf("Appending a string exceeds the %u bytes remaining in a buffer.\n",
-      (unsigned) remaining);
+// Records that the object with the given ID implements the interface. Returns
+// 0 on error.
+static int RegisterObject(ApplicationState *s, uint32_t id,
+  const WaylandInterface *interface) {
+  ObjectTable *t = &(s->objects);
+  if (id >= WAYLAND_SERVER_ID_START) {
+    id -= WAYLAND_SERVER_ID_START;
+    if (!GrowObjectArray(&(t->server_objects), &(t->server_capacity), id)) {
+      return 0;
+    }
+    t->server_objects[id].interface = interface;
+    return 1;
+  }
+  if (!GrowObjectArray(&(t->client_objects), &(t->client_capacity), id)) {
     return 0;
   }
-  // 1. Append the string length + 1 for null terminator.
-  // 2. Append the string content
-  // 3. Add the null terminator.
-  AppendUint32(buffer, current_offset, length + 1);
-  memcpy(buffer + *current_offset, str, length);
-  *current_offset += length;
-  memset(buffer + *current_offset, 0, padding_length);
-  *current_offset += padding_length;
+  t->client_objects[id].interface = interface;
   return 1;
 }
 
-static uint32_t ReadUint32(uint8_t *buffer, size_t *current_offset) {
-  uint32_t to_return = *((uint32_t *) (buffer + *current_offset));
-  *current_offset += 4;
-  return to_return;
+// Removes the object with the given ID from the table.
+static void UnregisterObject(ApplicationState *s, uint32_t id) {
+  ObjectTable *t = &(s->objects);
+  if (id >= WAYLAND_SERVER_ID_START) {
+    id -= WAYLAND_SERVER_ID_START;
+    if (id < t->server_capacity) t->server_objects[id].interface = NULL;
+    return;
+  }
+  if (id < t->client_capacity) t->client_objects[id].interface = NULL;
 }
 
-// Assumes the current offset into the buffer is at the start of a wayland
-// event. Fills dst with the event data, incrementing the current_offset to
-// point past the event in the buffer.
-static void ReadWaylandEvent(uint8_t *buffer, size_t *current_offset,
-  ParsedWaylandEvent *dst) {
-  uint32_t opcode_and_size, size_with_header;
-  dst->object_id  = ReadUint32(buffer, current_offset);
-  opcode_and_size = ReadUint32(buffer, current_offset);
-  dst->opcode = opcode_and_size & 0xffff;
-  size_with_header = opcode_and_size >> 16;
-  if (size_with_header < 8) {
-    printf("Got invalid wayland message size: %d\n", (int) size_with_header);
-    exit(1);
-  }
-  dst->payload_size = size_with_header - 8;
-  if (dst->payload_size == 0) {
-    dst->payload = NULL;
+// Returns the table entry for the given ID, or NULL if the ID is unknown.
+static WaylandObject* LookupObject(ApplicationState *s, uint32_t id) {
+  ObjectTable *t = &(s->objects);
+  WaylandObject *to_return = NULL;
+  if (id >= WAYLAND_SERVER_ID_START) {
+    id -= WAYLAND_SERVER_ID_START;
+    if (id >= t->server_capacity) return NULL;
+    to_return = t->server_objects + id;
   } else {
-    dst->payload = buffer + *current_offset;
-  }
-  *current_offset += RoundUp4(dst->payload_size);
-}
-
-// Serializes the src event into the buffer at the given offset, including
-// copying the message's payload. Updates *current_offset to point past the end
-// of the serialized message.
-static void WriteWaylandMessage(uint8_t *buffer, size_t *current_offset,
-    ParsedWaylandEvent *src) {
-  uint32_t opcode_and_size = 0;
-  AppendUint32(buffer, current_offset, src->object_id);
-  opcode_and_size = (src->payload_size + 8) << 16;
-  opcode_and_size |= src->opcode;
-  AppendUint32(buffer, current_offset, opcode_and_size);
-  if (src->payload_size > 0) {
-    memcpy(buffer + *current_offset, src->payload, src->payload_size);
-    *current_offset += RoundUp4(src->payload_size);
-  }
-}
-
-// Reads a wayland string from a buffer. A wayland string is prefixed by a
-// 4-byte size, includes the null terminator, and is padded to 4 bytes. Updates
-// the buffer offset to be past the end of the string and padding. Returns an
-// empty null terminated string ("") if the string's length is 0.
-static char* ReadWaylandString(uint8_t *buffer, size_t *current_offset) {
-  char *to_return = NULL;
-  uint32_t string_length = ReadUint32(buffer, current_offset);
-  if (string_length == 0) return "";
-  to_return = (char *) (buffer + *current_offset);
-  *current_offset += RoundUp4(string_length);
+    if (id >= t->client_capacity) return NULL;
+    to_return = t->client_objects + id;
+  }
+  if (!to_return->interface) return NULL;
   return to_return;
 }
 
-// Generates and returns a unique ID to identify messages sent and received.
-// Will never return 0, and will wrap around if IDs exceed the max client ID.
-static uint32_t NextWaylandID(void) {
-  // IDs must be densely packed according to the spec, and ID 1 already belongs
-  // to the display object, so the first ID we'll return will be 2.
-  static uint32_t next_id = 1;
-  next_id++;
-  // IDs above 0xfeffffff are reserved for the server.
-  if (next_id > 0xfeffffff) {
-    printf("Error: Allocated too many client-side wayland IDs.\n");
-    exit(1);
+// Allocates a new ID for an object implementing the given interface, and adds
+// it to the object table. Returns 0 on error.
+static uint32_t NewWaylandObject(ApplicationState *s,
+  const WaylandInterface *interface) {
+  uint32_t id = IDAllocatorAllocate(&(s->ids));
+  if (!id) {
+    LOG_ERROR("Error: Allocated too many client-side wayland IDs.\n");
+    return 0;
   }
-  return next_id;
+  if (!RegisterObject(s, id, interface)) {
+    IDAllocatorRelease(&(s->ids), id);
+    return 0;
+  }
+  return id;
 }
 
 // Returns the FD for the wayland Unix socket. Prints a message and returns -1
@@ -214,7 +610,7 @@ static int GetWaylandConnection(void) {
   char *display_name = NULL;
   int fd, result;
   if (!xdg_dir) {
-    printf("The XDG_RUNTIME_DIR environment variable was not set.\n");
+    LOG_ERROR("The XDG_RUNTIME_DIR environment variable was not set.\n");
     return -1;
   }
   memset(&address, 0, sizeof(address));
@@ -227,118 +623,297 @@ static int GetWaylandConnection(void) {
   }
   snprintf(address.sun_path, sizeof(address.sun_path) - 1, "%s/%s", xdg_dir,
     display_name);
-  printf("Connecting to display path: %s\n", address.sun_path);
+  LOG_INFO("Connecting to display path: %s\n", address.sun_path);
   fd = socket(AF_UNIX, SOCK_STREAM, 0);
   if (fd < 0) {
-    printf("Error creating socket: %s\n", strerror(errno));
+    LOG_ERROR("Error creating socket: %s\n", strerror(errno));
     return -1;
   }
   result = connect(fd, (struct sockaddr *) &address, sizeof(address));
   if (result != 0) {
-    printf("Error connecting to %s: %s\n", address.sun_path, strerror(errno));
+    LOG_ERROR("Error connecting to %s: %s\n", address.sun_path,
+      strerror(errno));
+    close(fd);
+    return -1;
+  }
+  // Neither reads nor writes may block the event loop.
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+    LOG_ERROR("Error making the socket non-blocking: %s\n", strerror(errno));
     close(fd);
     return -1;
   }
   return fd;
 }
 
+// Returns the number of bytes of requests that haven't been sent yet,
+// including any that io_uring is still sending.
+static size_t UnsentBytes(ApplicationState *s) {
+  size_t unsent = s->outbound.size - s->outbound.sent;
+#if USE_IO_URING
+  if (s->use_uring) unsent += UringConnectionUnsent(&(s->uring));
+#endif
+  return unsent;
+}
+
+// Updates the congested state and whether the reactor waits for the socket
+// to become writable, after the number of unsent bytes changed. Returns 0 on
+// error.
+static int UpdateOutboundState(ApplicationState *s) {
+  OutboundQueue *q = &(s->outbound);
+  size_t unsent = UnsentBytes(s);
+  int want_writable = unsent != 0;
+  if (unsent > q->max_unsent) q->max_unsent = unsent;
+  if (!q->congested && (unsent >= OUTBOUND_HIGH_WATERMARK)) {
+    q->congested = 1;
+    q->congestion_events++;
+    LOG_DEBUG("%u bytes of requests are waiting to be sent; holding back "
+      "frames.\n", (unsigned) unsent);
+  } else if (q->congested && (unsent <= OUTBOUND_LOW_WATERMARK)) {
+    q->congested = 0;
+  }
+  if (!s->socket_source || (want_writable == q->waiting_for_writable)) {
+    return 1;
+  }
+  if (!ReactorModifyFd(&(s->reactor), s->socket_source, EPOLLIN |
+    (want_writable ? EPOLLOUT : 0))) {
+    return 0;
+  }
+  q->waiting_for_writable = want_writable;
+  return 1;
+}
+
+#if USE_IO_URING
+// Hands the queued requests and FDs to io_uring, to be sent by the next
+// io_uring_enter. If the previous send hasn't completed yet, they stay queued
+// until it does. Returns 0 on error.
+static int SubmitOutboundQueue(ApplicationState *s) {
+  OutboundQueue *q = &(s->outbound);
+  if ((q->size != q->sent) && UringConnectionCanSend(&(s->uring))) {
+    if (!UringConnectionSend(&(s->uring), q->data + q->sent, q->size -
+      q->sent, q->fds, q->fd_count)) {
+      return 0;
+    }
+    q->send_syscalls++;
+    q->fd_count = 0;
+    q->sent = 0;
+    q->size = 0;
+  }
+  return UpdateOutboundState(s);
+}
+#endif
+
+// Sends as many queued requests as the socket will take, along with any
+// queued FDs, using one sendmsg call. Anything that isn't sent stays queued
+// until the socket is writable. Returns 0 on error.
+static int FlushOutboundQueue(ApplicationState *s) {
+  OutboundQueue *q = &(s->outbound);
+  uint8_t control_buffer[CMSG_SPACE(sizeof(int) * OUTBOUND_MAX_FDS)];
+  struct iovec io;
+  struct msghdr message_info;
+  struct cmsghdr *control_info = NULL;
+  ssize_t result;
+  uint32_t i;
+#if USE_IO_URING
+  // This also updates the outbound state after a send completes, so it's
+  // called even if nothing new is queued.
+  if (s->use_uring) return SubmitOutboundQueue(s);
+#endif
+  if (q->size == q->sent) return 1;
+  memset(&message_info, 0, sizeof(message_info));
+  memset(control_buffer, 0, sizeof(control_buffer));
+  io.iov_base = q->data + q->sent;
+  io.iov_len = q->size - q->sent;
+  message_info.msg_iov = &io;
+  message_info.msg_iovlen = 1;
+
+  // Set up the control data to send the FDs, if there are any.
+  if (q->fd_count != 0) {
+    message_info.msg_control = control_buffer;
+    message_info.msg_controllen = CMSG_SPACE(sizeof(int) * q->fd_count);
+    control_info = CMSG_FIRSTHDR(&message_info);
+    control_info->cmsg_level = SOL_SOCKET;
+    control_info->cmsg_type = SCM_RIGHTS;
+    control_info->cmsg_len = CMSG_LEN(sizeof(int) * q->fd_count);
+    memcpy(CMSG_DATA(control_info), q->fds, sizeof(int) * q->fd_count);
+  }
+
+  // If the server goes away, report an error rather than dying of SIGPIPE.
+  if (s->replay_path) {
+    result = io.iov_len;
+  } else {
+    result = sendmsg(s->socket_fd, &message_info, MSG_NOSIGNAL);
+  }
+  q->send_syscalls++;
+  if (result < 0) {
+    if ((errno == EPIPE) || (errno == ECONNRESET)) {
+      LOG_ERROR("The wayland server closed the connection.\n");
+      return 0;
+    }
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+      LOG_ERROR("Error sending queued requests: %s\n", strerror(errno));
+      return 0;
+    }
+    result = 0;
+  }
+  if ((result > 0) && WireCaptureActive(&(s->capture))) {
+    if (!WireCaptureData(&(s->capture), WIRE_CAPTURE_SENT, q->data + q->sent,
+      result)) {
+      return 0;
+    }
+    for (i = 0; i < q->fd_count; i++) {
+      if (!WireCaptureFd(&(s->capture), q->fds[i])) return 0;
+    }
+  }
+  if (result > 0) q->fd_count = 0;
+  q->bytes_sent += result;
+  q->sent += result;
+  if (q->sent == q->size) {
+    q->sent = 0;
+    q->size = 0;
+  } else {
+    q->partial_sends++;
+  }
+  return UpdateOutboundState(s);
+}
+
+// Makes room for size more bytes at the end of the outbound queue, by moving
+// the unsent bytes to the start and growing it if needed. Returns 0 on error.
+static int GrowOutboundQueue(OutboundQueue *q, size_t size) {
+  size_t new_capacity = q->capacity ? q->capacity : OUTBOUND_QUEUE_SIZE;
+  uint8_t *new_data = NULL;
+  if ((q->size + size) <= q->capacity) return 1;
+  if (q->sent != 0) {
+    memmove(q->data, q->data + q->sent, q->size - q->sent);
+    q->size -= q->sent;
+    q->sent = 0;
+    if ((q->size + size) <= q->capacity) return 1;
+  }
+  while (new_capacity < (q->size + size)) new_capacity *= 2;
+  new_data = (uint8_t *) realloc(q->data, new_capacity);
+  if (!new_data) {
+    LOG_ERROR("Failed growing the outbound queue to %u bytes.\n",
+      (unsigned) new_capacity);
+    return 0;
+  }
+  q->data = new_data;
+  q->capacity = new_capacity;
+  return 1;
+}
+
+// Reserves size bytes at the end of the outbound queue for a request to be
+// written into, flushing the queue first if OUTBOUND_QUEUE_SIZE bytes would be
+// waiting. If fd is nonnegative, it will be sent along with the request.
+// Returns NULL on error.
+static uint8_t* ReserveRequest(ApplicationState *s, uint32_t size, int fd) {
+  OutboundQueue *q = &(s->outbound);
+  uint8_t *to_return = NULL;
+  if (size > OUTBOUND_QUEUE_SIZE) {
+    LOG_ERROR("A %d-byte request is too big for the outbound queue.\n",
+      (int) size);
+    return NULL;
+  }
+  if (((q->size - q->sent + size) > OUTBOUND_QUEUE_SIZE) ||
+    ((fd >= 0) && (q->fd_count >= OUTBOUND_MAX_FDS))) {
+    if (!FlushOutboundQueue(s)) return NULL;
+  }
+  if ((fd >= 0) && (q->fd_count >= OUTBOUND_MAX_FDS)) {
+    LOG_ERROR("Too many FDs are waiting to be sent.\n");
+    return NULL;
+  }
+  if (!GrowOutboundQueue(q, size)) return NULL;
+  to_return = q->data + q->size;
+  q->size += size;
+  if (fd >= 0) {
+    q->fds[q->fd_count] = fd;
+    q->fd_count++;
+  }
+  return to_return;
+}
+
 // Gets the wayland display object registry ID. Returns 0 on error.
 static uint32_t GetWaylandDisplayRegistry(ApplicationState *s) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[128];
-  size_t buffer_offset = 0;
-  uint32_t wayland_id = NextWaylandID();
-  size_t result;
-  msg.object_id = WAYLAND_DISPLAY_OBJECT_ID;
-  msg.opcode = WAYLAND_DISPLAY_GET_REGISTRY_OPCODE;
-  msg.payload_size = sizeof(wayland_id);
-  msg.payload = (uint8_t *) (&wayland_id);
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, MSG_DONTWAIT);
-  if (result != buffer_offset) {
-    printf("Error sending message: %s\n", strerror(errno));
+  uint32_t wayland_id = 0;
+  uint8_t *dst = ReserveRequest(s, WL_DISPLAY_GET_REGISTRY_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing get_registry message.\n");
+    return 0;
+  }
+  // The display object always exists, so register it along with the registry.
+  if (!RegisterObject(s, WAYLAND_DISPLAY_OBJECT_ID, &wl_display_interface)) {
     return 0;
   }
+  wayland_id = NewWaylandObject(s, &wl_registry_interface);
+  if (!wayland_id) return 0;
+  WriteWlDisplayGetRegistry(dst, WAYLAND_DISPLAY_OBJECT_ID, wayland_id);
   s->registry_id = wayland_id;
   return 1;
 }
 
 // Binds the global object with the given numeric "name" to a new ID and
-// returns the ID.
+// returns the ID. Returns 0 on error.
 static uint32_t WaylandRegistryBind(ApplicationState *s, uint32_t name,
-  char *interface, uint32_t version) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[256];
-  uint8_t payload[248];
-  size_t buffer_offset = 0;
-  size_t payload_offset = 0;
-  uint32_t new_id = 0;
-  size_t result;
-  new_id = NextWaylandID();
-
-  // The args:
-  //  1. Numeric name
-  //  2. Interface string (length + content)
-  //  3. Version
-  //  4. The ID to bind the object to
-  // WHY IS THIS NOT WHAT IT SAYS IN WAYLAND.XML???? WHY IS THE "DOCUMENTATION"
-  // APPARENTLY SOME RANDOM BLOG POSTS?
-  AppendUint32(payload, &payload_offset, name);
-  if (!AppendWaylandString(payload, &payload_offset, sizeof(payload),
-    interface)) {
-    printf("Error copying wayland interface name string.\n");
-    return 0;
-  }
-  AppendUint32(payload, &payload_offset, version);
-  AppendUint32(payload, &payload_offset, new_id);
-
-  msg.object_id = s->registry_id;
-  msg.opcode = WAYLAND_REGISTRY_BIND_OPCODE;
-  msg.payload_size = payload_offset;
-  msg.payload = payload;
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, 0);
-  if (result != buffer_offset) {
-    printf("Error sending registry bind message: %s\n", strerror(errno));
+  const WaylandInterface *interface, uint32_t version) {
+  uint32_t new_id = NewWaylandObject(s, interface);
+  uint8_t *dst = NULL;
+  if (!new_id) return 0;
+  // wayland.xml only lists the name and a new_id, but a new_id without a
+  // specified interface goes on the wire as the interface name, version and
+  // ID. The generated code takes care of this.
+  dst = ReserveRequest(s, WlRegistryBindSize(interface->name), -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing registry bind message.\n");
     return 0;
   }
+  WriteWlRegistryBind(dst, s->registry_id, name, interface->name, version,
+    new_id);
   return new_id;
 }
 
-// Generates a random path for the shared memory object, opens it, and maps it
-// into the image buffer. Returns 0 on error.
+// Creates the shared memory for the shm pool, big enough to hold every buffer
+// in the swapchain. Returns 0 on error.
 static int OpenSharedMemoryObject(ApplicationState *s) {
-  char shm_path[256];
-  memset(shm_path, 0, sizeof(shm_path));
-  int t = (time(NULL) % 0xffffff);
-  snprintf(shm_path, sizeof(shm_path) - 1, "wl_shm_%d", t);
-  s->shm_fd = shm_open(shm_path, O_RDWR | O_EXCL | O_CREAT, 0600);
-  if (s->shm_fd <= -1) {
-    printf("Error creating %s: %s\n", shm_path, strerror(errno));
-    return 0;
-  }
-  // We can unlink this now since we'll only need the FD.
-  if (shm_unlink(shm_path) != 0) {
-    printf("Error unlinking %s: %s\n", shm_path, strerror(errno));
-    return 0;
-  }
-  if (ftruncate(s->shm_fd, s->image_buffer_size) != 0) {
-    printf("Error setting size of %s to %d: %s\n", shm_path,
-      (int) s->image_buffer_size, strerror(errno));
-    return 0;
-  }
-  s->image_buffer = mmap(NULL, s->image_buffer_size,
-    PROT_READ | PROT_WRITE, MAP_SHARED, s->shm_fd, 0);
-  if (s->image_buffer == MAP_FAILED) {
-    printf("Error mapping shared image buffer: %s\n", strerror(errno));
+  ShmBacking *b = &(s->pool_memory);
+  if (!ShmBackingCreate(b, "wayland_display", ShmAllocatorClassSize(
+    s->image_buffer_size) * SWAPCHAIN_LENGTH, s->pool_options)) {
     return 0;
   }
+  LOG_INFO("Created a %llu-byte shm pool%s%s, taking %llu page faults.\n",
+    (unsigned long long) b->size, b->hugetlb ? " using huge pages" : "",
+    (s->pool_options & SHM_BACKING_PREFAULT) ? ", prefaulted" : "",
+    (unsigned long long) b->prefault_minor_faults);
   return 1;
 }
 
-static void SignalHandler(int signal_number) {
-  printf("Received signal %d. Exiting.\n", signal_number);
-  should_exit = 1;
+// Prints how long after starting each startup milestone was reached.
+static void PrintStartupTimes(StartupTimes *t) {
+  printf("Startup: connected at %.3f ms, globals bound at %.3f ms, "
+    "configured at %.3f ms, first commit at %.3f ms.\n",
+    (t->connected - t->start) / 1e6, (t->globals_bound - t->start) / 1e6,
+    (t->configured - t->start) / 1e6, (t->first_commit - t->start) / 1e6);
+}
+
+// Prints the median, 99th and 99.9th percentile and maximum time taken by
+// each stage of presenting a frame.
+static void PrintLatencyStats(ApplicationState *s) {
+  const LatencyHistogram *h = NULL;
+  int i;
+  // Keep the table from being interleaved with logged messages.
+  LogFlush();
+  printf("%-20s %8s %10s %10s %10s %10s\n", "Latency (us)", "count", "p50",
+    "p99", "p999", "max");
+  for (i = 0; i < LATENCY_STAGE_COUNT; i++) {
+    h = s->latency.stages + i;
+    printf("%-20s %8llu %10.1f %10.1f %10.1f %10.1f\n",
+      latency_stage_names[i], (unsigned long long) h->total,
+      LatencyHistogramPercentile(h, 0.5) / 1e3,
+      LatencyHistogramPercentile(h, 0.99) / 1e3,
+      LatencyHistogramPercentile(h, 0.999) / 1e3, h->max / 1e3);
+  }
+  if (s->latency.prerendered) {
+    printf("%llu frame(s) were drawn before their configure arrived, and "
+      "count as 0 in ack -> render.\n",
+      (unsigned long long) s->latency.prerendered);
+  }
 }
 
 // Called if e is a Wayland error event. Prints the error message.
@@ -347,90 +922,57 @@ static void PrintErrorEventInfo(ParsedWaylandEvent *e) {
   char *msg = NULL;
   size_t current_offset = 0;
   if (e->payload_size <= 12) {
-    printf("Got an error event, but it was only %d bytes long.\n",
+    LOG_ERROR("Got an error event, but it was only %d bytes long.\n",
       (int) e->payload_size);
     return;
   }
   object_id = ReadUint32(e->payload, &current_offset);
   error_code = ReadUint32(e->payload, &current_offset);
   msg = ReadWaylandString(e->payload, &current_offset);
-  printf("Error detected on object ID %u, code %u: %s\n", (unsigned) object_id,
-    (unsigned) error_code, msg);
-}
-
-// Returns 0 if we're still looking for global objects to bind to, otherwise
-// returns 1.
-static int BindingDone(ApplicationState *s) {
-  if (s->binding_done) return 1;
-  if (s->shm_id && s->compositor_id && s->xdg_wm_base_id) {
-    s->binding_done = 1;
-    return 1;
-  }
-  return 0;
+  LOG_ERROR("Error detected on object ID %u, code %u: %s\n",
+    (unsigned) object_id, (unsigned) error_code, msg);
 }
 
 // Creates and sets s->surface_id.
 static int CreateWLSurface(ApplicationState *s) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[64];
-  size_t result, buffer_offset = 0;
-  s->surface_id = NextWaylandID();
-  msg.payload = (uint8_t *) &(s->surface_id);
-  msg.payload_size = sizeof(uint32_t);
-  msg.object_id = s->compositor_id;
-  msg.opcode = 0;
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, 0);
-  if (result != buffer_offset) {
-    printf("Error sending create-surface message: %s\n", strerror(errno));
+  uint8_t *dst = ReserveRequest(s, WL_COMPOSITOR_CREATE_SURFACE_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing create-surface message.\n");
     return 0;
   }
-  printf("s->surface_id = %d\n", (int) s->surface_id);
+  s->surface_id = NewWaylandObject(s, &wl_surface_interface);
+  if (!s->surface_id) return 0;
+  WriteWlCompositorCreateSurface(dst, s->compositor_id, s->surface_id);
+  LOG_DEBUG("s->surface_id = %d\n", (int) s->surface_id);
   return 1;
 }
 
 // Creates and sets s->xdg_surface_id. Must be called after CreateWLSurface.
 static int CreateXDGSurface(ApplicationState *s) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[64];
-  size_t result, buffer_offset = 0;
-  uint32_t args[2];
-  s->xdg_surface_id = NextWaylandID();
-  args[0] = s->xdg_surface_id;
-  args[1] = s->surface_id;
-  msg.payload = (uint8_t *) args;
-  msg.payload_size = sizeof(args);
-  msg.object_id = s->xdg_wm_base_id;
-  // xdg_wm_base.2 = get_xdg_surface
-  msg.opcode = 2;
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, 0);
-  if (result != buffer_offset) {
-    printf("Error getting xdg surface: %s\n", strerror(errno));
+  uint8_t *dst = ReserveRequest(s, XDG_WM_BASE_GET_XDG_SURFACE_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing request for xdg surface.\n");
     return 0;
   }
-  printf("s->xdg_surface_id = %d\n", (int) s->xdg_surface_id);
+  s->xdg_surface_id = NewWaylandObject(s, &xdg_surface_interface);
+  if (!s->xdg_surface_id) return 0;
+  WriteXdgWmBaseGetXdgSurface(dst, s->xdg_wm_base_id, s->xdg_surface_id,
+    s->surface_id);
+  LOG_DEBUG("s->xdg_surface_id = %d\n", (int) s->xdg_surface_id);
   return 1;
 }
 
 // Creates and sets s->xdg_toplevel_id. Must be called after CreateXDGSurface.
 static int GetXDGTopLevel(ApplicationState *s) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[64];
-  size_t result, buffer_offset = 0;
-  s->xdg_toplevel_id = NextWaylandID();
-  msg.payload = (uint8_t *) &(s->xdg_toplevel_id);
-  msg.payload_size = sizeof(uint32_t);
-  msg.object_id = s->xdg_surface_id;
-  // xdg_surface.1 = get_toplevel
-  msg.opcode = 1;
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, 0);
-  if (result != buffer_offset) {
-    printf("Error getting xdg toplevel: %s\n", strerror(errno));
+  uint8_t *dst = ReserveRequest(s, XDG_SURFACE_GET_TOPLEVEL_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing request for xdg toplevel.\n");
     return 0;
   }
-  printf("s->xdg_toplevel_id = %d\n", (int) s->xdg_toplevel_id);
+  s->xdg_toplevel_id = NewWaylandObject(s, &xdg_toplevel_interface);
+  if (!s->xdg_toplevel_id) return 0;
+  WriteXdgSurfaceGetToplevel(dst, s->xdg_surface_id, s->xdg_toplevel_id);
+  LOG_DEBUG("s->xdg_toplevel_id = %d\n", (int) s->xdg_toplevel_id);
   return 1;
 }
 
@@ -441,458 +983,1969 @@ static int CreateSurface(ApplicationState *s) {
   return 1;
 }
 
-// Wraps the sendmsg call to include the shm_fd descriptor as ancillary data.
-static int SendMsgWithShmDescriptor(ApplicationState *s, uint8_t *msg_buffer,
-  size_t msg_size) {
-  uint8_t control_buffer[CMSG_SPACE(sizeof(int))];
-  struct iovec io;
-  struct msghdr message_info;
-  struct cmsghdr *control_info = NULL;
-  ssize_t result;
-  memset(&message_info, 0, sizeof(message_info));
-  memset(control_buffer, 0, sizeof(control_buffer));
-  memset(&io, 0, sizeof(io));
-
-  // Set up the entry to send the "normal" message content.
-  io.iov_base = msg_buffer;
-  io.iov_len = msg_size;
-  message_info.msg_iov = &io;
-  message_info.msg_iovlen = 1;
+// Sends the message to create the shm_pool object. The memfd is queued along
+// with the message, and passed to the server as ancillary data when flushed.
+static int CreateShmPool(ApplicationState *s) {
+  uint32_t shm_pool_id = NewWaylandObject(s, &wl_shm_pool_interface);
+  uint8_t *dst = NULL;
+  if (!shm_pool_id) return 0;
+  dst = ReserveRequest(s, WL_SHM_CREATE_POOL_SIZE, s->pool_memory.fd);
+  if (!dst) {
+    LOG_ERROR("Error queueing shm_pool.create message.\n");
+    return 0;
+  }
+  // wayland.xml includes the FD in the args, but it's only sent as ancillary
+  // data, so the generated code leaves it out of the payload.
+  WriteWlShmCreatePool(dst, s->shm_id, shm_pool_id, s->pool_memory.size);
+  if (LOG_ENABLED(LOG_LEVEL_DEBUG)) {
+    // The hex dump is written directly, so write out earlier messages first.
+    LOG_DEBUG("Message queued when creating shm pool:\n");
+    LogFlush();
+    PrintHexDump(dst, WL_SHM_CREATE_POOL_SIZE, 0);
+  }
+  s->shm_pool_id = shm_pool_id;
+  return 1;
+}
 
-  // Set up the control data to send the FD.
-  message_info.msg_control = control_buffer;
-  message_info.msg_controllen = sizeof(control_buffer);
-  control_info = CMSG_FIRSTHDR(&message_info);
-  control_info->cmsg_level = SOL_SOCKET;
-  control_info->cmsg_type = SCM_RIGHTS;
-  control_info->cmsg_len = CMSG_LEN(sizeof(int));
-  *((int *) CMSG_DATA(control_info)) = s->shm_fd;
+// Grows the shm pool to at least min_size bytes. The size is at least doubled
+// each time, so a stream of configure events while the user drags a window
+// edge only grows it a few times. Returns 0 on error.
+static int GrowShmPool(ApplicationState *s, uint64_t min_size) {
+  Swapchain *c = &(s->swapchain);
+  ShmBacking *b = &(s->pool_memory);
+  uint64_t new_size = b->size;
+  uint8_t *dst = NULL;
+  uint32_t i;
+  if (min_size <= b->size) return 1;
+  if (min_size > MAX_SHM_POOL_SIZE) {
+    LOG_ERROR("Can't grow the shm pool to %llu bytes.\n",
+      (unsigned long long) min_size);
+    return 0;
+  }
+  while (new_size < min_size) new_size *= 2;
+  if (new_size > MAX_SHM_POOL_SIZE) new_size = MAX_SHM_POOL_SIZE;
+  if (!ShmBackingGrow(b, new_size)) return 0;
+  // The mapping may have moved, so update the buffers' pointers into it.
+  for (i = 0; i < SWAPCHAIN_LENGTH; i++) {
+    c->buffers[i].data = b->data + c->buffers[i].slice.offset;
+  }
+  for (i = 0; i < c->retired_count; i++) {
+    c->retired[i].data = b->data + c->retired[i].slice.offset;
+  }
+  c->pool_resizes++;
+  // If the pool object doesn't exist yet, it'll be created with the new size.
+  if (!s->shm_pool_id) return 1;
+  dst = ReserveRequest(s, WL_SHM_POOL_RESIZE_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing wl_shm_pool.resize message.\n");
+    return 0;
+  }
+  WriteWlShmPoolResize(dst, s->shm_pool_id, b->size);
+  return 1;
+}
 
-  printf("Message sent when creating shm pool:\n");
-  PrintHexDump((uint8_t *) io.iov_base, io.iov_len, 0);
+// Calls the create_buffer method to carve each of the swapchain's buffers out
+// of the shared memory pool, growing the pool if needed.
+static int CreateFrameBuffers(ApplicationState *s) {
+  SwapchainBuffer *b = NULL;
+  uint8_t *dst = NULL;
+  int i;
+  for (i = 0; i < SWAPCHAIN_LENGTH; i++) {
+    b = s->swapchain.buffers + i;
+    if (!ShmAllocatorAllocImage(&(s->pool_allocator), s->width, s->height,
+      COLOR_CHANNELS, &(b->slice))) {
+      LOG_ERROR("Failed allocating a %ux%u buffer in the shm pool.\n",
+        (unsigned) s->width, (unsigned) s->height);
+      return 0;
+    }
+    if (!GrowShmPool(s, ShmAllocatorEnd(&(s->pool_allocator)))) return 0;
+    b->id = NewWaylandObject(s, &wl_buffer_interface);
+    if (!b->id) return 0;
+    dst = ReserveRequest(s, WL_SHM_POOL_CREATE_BUFFER_SIZE, -1);
+    if (!dst) {
+      LOG_ERROR("Error queueing create-buffer message.\n");
+      return 0;
+    }
+    b->data = s->pool_memory.data + b->slice.offset;
+    b->busy = 0;
+    // Nothing has been drawn into the buffer yet.
+    DamageRegionClear(&(b->damage));
+    DamageRegionAdd(&(b->damage), 0, 0, s->width, s->height, s->width,
+      s->height);
+    // Format 0 is argb8888.
+    WriteWlShmPoolCreateBuffer(dst, s->shm_pool_id, b->id, b->slice.offset,
+      s->width, s->height, b->slice.stride, 0);
+  }
+  return 1;
+}
 
-  // Actually send the FD and message data.
-  result = sendmsg(s->socket_fd, &message_info, 0);
-  if (result < 0) {
-    printf("Error sending message with FD: %s\n", strerror(errno));
+// Sends the request to destroy the buffer and frees its slice of the pool. The
+// ID is released once the server acknowledges it with delete_id.
+static int DestroyBuffer(ApplicationState *s, SwapchainBuffer *b) {
+  uint8_t *dst = ReserveRequest(s, WL_BUFFER_DESTROY_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing wl_buffer.destroy message.\n");
     return 0;
   }
+  WriteWlBufferDestroy(dst, b->id);
+  if (!ShmAllocatorFree(&(s->pool_allocator), &(b->slice))) return 0;
+  memset(b, 0, sizeof(*b));
   return 1;
 }
 
-// Sends the message to create the shm_pool object. Requires a bunch of socket
-// boilderplate to send the shm_fd, so this gets a separate function.
-static int CreateShmPool(ApplicationState *s) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[256];
-  size_t buffer_offset = 0;
-  uint32_t args[2];
-  uint32_t shm_pool_id = NextWaylandID();
-  // wayland.xml includes the FD in the args, but the blog post code does not.
-  // This version seems to work on my systems.
-  args[0] = shm_pool_id;
-  args[1] = s->image_buffer_size;
-  // wl_shm.create_pool = opcode 0
-  msg.object_id = s->shm_id;
-  msg.opcode = 0;
-  msg.payload = (uint8_t *) args;
-  msg.payload_size = sizeof(args);
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  if (!SendMsgWithShmDescriptor(s, buffer, buffer_offset)) {
-    printf("Error sending shm_pool.create message.\n");
+// Adds the buffer to the list of retired buffers. Returns 0 on error.
+static int RetireBuffer(ApplicationState *s, SwapchainBuffer *b) {
+  Swapchain *c = &(s->swapchain);
+  uint32_t new_capacity;
+  SwapchainBuffer *new_retired = NULL;
+  if (c->retired_count >= c->retired_capacity) {
+    new_capacity = c->retired_capacity ? c->retired_capacity * 2 :
+      SWAPCHAIN_LENGTH;
+    new_retired = (SwapchainBuffer *) realloc(c->retired, new_capacity *
+      sizeof(SwapchainBuffer));
+    if (!new_retired) {
+      LOG_ERROR("Failed growing the retired buffer list.\n");
+      return 0;
+    }
+    c->retired = new_retired;
+    c->retired_capacity = new_capacity;
+  }
+  c->retired[c->retired_count] = *b;
+  c->retired_count++;
+  memset(b, 0, sizeof(*b));
+  return 1;
+}
+
+// Changes the size of the image. Buffers the compositor isn't using are
+// destroyed right away, and the rest are retired. New buffers with the new
+// size are created when the next frame is drawn. Returns 0 on error.
+static int ResizeImage(ApplicationState *s, uint32_t width, uint32_t height) {
+  SwapchainBuffer *b = NULL;
+  uint64_t stride = ShmImageStride(width, COLOR_CHANNELS);
+  uint64_t frame_size = stride * height;
+  int i;
+  if ((frame_size * SWAPCHAIN_LENGTH) > MAX_SHM_POOL_SIZE) {
+    LOG_ERROR("Can't resize to %ux%u: too big.\n", (unsigned) width,
+      (unsigned) height);
     return 0;
   }
-  s->shm_pool_id = shm_pool_id;
+  for (i = 0; i < SWAPCHAIN_LENGTH; i++) {
+    b = s->swapchain.buffers + i;
+    if (!b->id) continue;
+    if (b->busy) {
+      if (!RetireBuffer(s, b)) return 0;
+    } else {
+      if (!DestroyBuffer(s, b)) return 0;
+    }
+  }
+  LOG_DEBUG("Resizing from %ux%u to %ux%u.\n", (unsigned) s->width,
+    (unsigned) s->height, (unsigned) width, (unsigned) height);
+  s->width = width;
+  s->height = height;
+  s->stride = stride;
+  s->image_buffer_size = frame_size;
+  // Everything is redrawn after a configure anyway, and the old rectangles
+  // may be out of bounds now.
+  DamageRegionClear(&(s->damage));
+  s->box_drawn = 0;
+  s->prerendered = 0;
   return 1;
 }
 
-// Calls the create_buffer method to set up the shared memory pool as a frame
-// buffer.
-static int CreateFrameBuffer(ApplicationState *s) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[256];
-  size_t buffer_offset = 0;
-  size_t result;
-  uint32_t args[6];
-  uint32_t buffer_id = NextWaylandID();
+// Returns a buffer the compositor isn't using, or NULL if they're all busy.
+static SwapchainBuffer* GetFreeBuffer(ApplicationState *s) {
+  int i;
+  for (i = 0; i < SWAPCHAIN_LENGTH; i++) {
+    if (!s->swapchain.buffers[i].busy) return s->swapchain.buffers + i;
+  }
+  return NULL;
+}
 
-  // See wayland.xml for the args order.
-  args[0] = buffer_id;
-  args[1] = 0;  // offset in shm buffer
-  args[2] = s->width;
-  args[3] = s->height;
-  args[4] = s->stride;
-  args[5] = 0;  // argb8888
+// Attaches the buffer to the wl_surface. The buffer is busy from now until the
+// compositor releases it.
+static int AttachBuffer(ApplicationState *s, SwapchainBuffer *b) {
+  uint8_t *dst = ReserveRequest(s, WL_SURFACE_ATTACH_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing surface attach message.\n");
+    return 0;
+  }
+  WriteWlSurfaceAttach(dst, s->surface_id, b->id, 0, 0);
+  b->busy = 1;
+  return 1;
+}
 
-  // shm_pool.create_buffer = opcode 0
-  msg.object_id = s->shm_pool_id;
-  msg.opcode = 0;
-  msg.payload = (uint8_t *) args;
-  msg.payload_size = sizeof(args);
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, 0);
-  if (result != buffer_offset) {
-    printf("Error sending create-buffer message: %s\n", strerror(errno));
+// Signals that the surface is ready to display.
+static int CommitSurface(ApplicationState *s) {
+  uint8_t *dst = ReserveRequest(s, WL_SURFACE_COMMIT_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing surface commit message.\n");
     return 0;
   }
-  s->frame_buffer_id = buffer_id;
+  WriteWlSurfaceCommit(dst, s->surface_id);
   return 1;
 }
 
-// To be used after creating the frame buffer. Attaches the frame buffer to the
-// wl_surface.
-static int AttachBuffer(ApplicationState *s) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[128];
-  size_t buffer_offset = 0;
-  size_t result;
-  uint32_t args[3];
+// Returns the number of milliseconds between the first frame callback and the
+// most recent one. Used to animate the frames.
+static uint32_t AnimationTime(ApplicationState *s) {
+  FrameScheduler *f = &(s->scheduler);
+  if (f->callback_count == 0) return 0;
+  return f->times[(f->callback_count - 1) % FRAME_TIME_HISTORY] -
+    f->first_time;
+}
+
+// Computes where the animated box should be drawn. It moves back and forth
+// across the middle of the window at 250 pixels per second.
+static void GetAnimatedBox(ApplicationState *s, uint32_t *x, uint32_t *y,
+  uint32_t *size) {
+  uint32_t range, position;
+  *size = ANIMATED_BOX_SIZE;
+  if ((*size > s->width) || (*size > s->height)) *size = 0;
+  *y = (s->height - *size) / 2;
+  range = s->width - *size;
+  if (range == 0) {
+    *x = 0;
+    return;
+  }
+  position = (AnimationTime(s) / ANIMATION_MS_PER_PIXEL) % (range * 2);
+  if (position >= range) position = range * 2 - position;
+  *x = position;
+}
+
+// A TileRenderFunction that fills the tile with a solid color, then draws the
+// part of the animated box that falls within it. The context is the
+// ApplicationState.
+static void FillTile(void *context, uint8_t *image, uint32_t stride,
+  uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+  ApplicationState *s = (ApplicationState *) context;
+  // In xrgb8888 each pixel is a little-endian 32-bit value, so this is
+  // B = 0xaa, G = 0x10, R = 0x55.
+  uint32_t color = 0xff5510aa;
+  uint32_t box_color = 0xffe0e0e0;
+  uint32_t left, right, top, bottom;
+  // When redrawing whole rows of a big frame, decide whether to bypass the
+  // cache based on the size of the whole frame, not just this tile.
+  if ((w == s->width) &&
+    (s->image_buffer_size >= PIXEL_FILL_STREAMING_THRESHOLD)) {
+    FillRect32NonTemporal(image, stride, x, y, w, h, color);
+  } else {
+    FillRect32(image, stride, x, y, w, h, color);
+  }
+  left = s->box_x > x ? s->box_x : x;
+  right = (s->box_x + s->box_size) < (x + w) ? (s->box_x + s->box_size) :
+    (x + w);
+  top = s->box_y > y ? s->box_y : y;
+  bottom = (s->box_y + s->box_size) < (y + h) ? (s->box_y + s->box_size) :
+    (y + h);
+  if ((left >= right) || (top >= bottom)) return;
+  FillRect32(image, stride, left, top, right - left, bottom - top, box_color);
+}
+
+// Marks the w x h rectangle at (x, y) as needing to be redrawn in the next
+// frame.
+static void MarkDirty(ApplicationState *s, uint32_t x, uint32_t y, uint32_t w,
+  uint32_t h) {
+  DamageRegionAdd(&(s->damage), x, y, w, h, s->width, s->height);
+}
 
-  // Frame buffer, x, y
-  args[0] = s->frame_buffer_id;
-  args[1] = 0;
-  args[2] = 0;
+// Moves the animated box to where it should be at the current animation time,
+// marking its old and new positions dirty if it moved.
+static void UpdateAnimation(ApplicationState *s) {
+  uint32_t x, y, size;
+  GetAnimatedBox(s, &x, &y, &size);
+  if (s->box_drawn && (x == s->box_x) && (y == s->box_y) &&
+    (size == s->box_size)) {
+    return;
+  }
+  if (s->box_drawn) MarkDirty(s, s->box_x, s->box_y, s->box_size,
+    s->box_size);
+  MarkDirty(s, x, y, size, size);
+  s->box_x = x;
+  s->box_y = y;
+  s->box_size = size;
+  s->box_drawn = 1;
+}
 
-  // surface.attach = opcode 1
-  msg.object_id = s->surface_id;
-  msg.opcode = 1;
-  msg.payload = (uint8_t *) args;
-  msg.payload_size = sizeof(args);
+// Tells the compositor which parts of the attached buffer changed, using
+// wl_surface.damage_buffer if the surface supports it. Otherwise falls back
+// to wl_surface.damage, which takes surface coordinates; they're the same as
+// buffer coordinates since we never set a buffer scale or transform.
+static int SendDamage(ApplicationState *s) {
+  DamageRect *r = NULL;
+  uint8_t *dst = NULL;
+  uint32_t i;
+  for (i = 0; i < s->damage.count; i++) {
+    r = s->damage.rects + i;
+    if (s->compositor_version >= WL_SURFACE_DAMAGE_BUFFER_SINCE) {
+      dst = ReserveRequest(s, WL_SURFACE_DAMAGE_BUFFER_SIZE, -1);
+      if (dst) {
+        WriteWlSurfaceDamageBuffer(dst, s->surface_id, r->x, r->y, r->w,
+          r->h);
+      }
+    } else {
+      dst = ReserveRequest(s, WL_SURFACE_DAMAGE_SIZE, -1);
+      if (dst) WriteWlSurfaceDamage(dst, s->surface_id, r->x, r->y, r->w, r->h);
+    }
+    if (!dst) {
+      LOG_ERROR("Error queueing surface damage message.\n");
+      return 0;
+    }
+  }
+  DamageRegionClear(&(s->damage));
+  return 1;
+}
 
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, 0);
-  if (result != buffer_offset) {
-    printf("Error sending surface attach message: %s\n", strerror(errno));
+// Asks the compositor to tell us when it's a good time to draw the next
+// frame. Must be called before committing the frame. Does nothing if we're
+// still waiting on an earlier callback, which happens when a configure event
+// makes us draw a frame early.
+static int RequestFrameCallback(ApplicationState *s) {
+  uint8_t *dst = NULL;
+  uint32_t callback_id;
+  if (s->scheduler.callback_id) return 1;
+  callback_id = NewWaylandObject(s, &wl_callback_interface);
+  if (!callback_id) return 0;
+  dst = ReserveRequest(s, WL_SURFACE_FRAME_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing wl_surface.frame message.\n");
     return 0;
   }
+  WriteWlSurfaceFrame(dst, s->surface_id, callback_id);
+  s->scheduler.callback_id = callback_id;
   return 1;
 }
 
-// Signals that the surface is ready to display.
-static int CommitSurface(ApplicationState *s) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[64];
-  size_t buffer_offset = 0;
-  size_t result;
-  msg.object_id = s->surface_id;
-  msg.opcode = 6;
-  msg.payload_size = 0;
-  msg.payload = NULL;
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, 0);
-  if (result != buffer_offset) {
-    printf("Error sending surface commit message: %s\n", strerror(errno));
+// Adds this frame's damage to every buffer, then redraws the parts of b that
+// are out of date.
+static void DrawBuffer(ApplicationState *s, SwapchainBuffer *b) {
+  DamageRect *r = NULL;
+  LatencyStats *l = &(s->latency);
+  uint64_t faults_before = 0;
+  int i;
+  // Each buffer needs to catch up on everything that changed since it was
+  // last drawn, including this frame's changes.
+  for (i = 0; i < SWAPCHAIN_LENGTH; i++) {
+    DamageRegionAddRegion(&(s->swapchain.buffers[i].damage), &(s->damage),
+      s->width, s->height);
+  }
+  if (s->full_frame_pixels == 0) faults_before = CurrentMinorFaults();
+  l->render_start = MonotonicNanoseconds();
+  for (i = 0; i < b->damage.count; i++) {
+    r = b->damage.rects + i;
+    TiledRendererRunRect(&(s->renderer), FillTile, s, b->data, s->stride,
+      r->x, r->y, r->w, r->h);
+  }
+  l->render_end = MonotonicNanoseconds();
+  LatencyHistogramRecord(l->stages + LATENCY_RENDER, l->render_end -
+    l->render_start);
+  if (s->full_frame_pixels == 0) {
+    LOG_INFO("Drew the first frame in %.1f us, taking %llu page faults.\n",
+      (l->render_end - l->render_start) / 1e3,
+      (unsigned long long) (CurrentMinorFaults() - faults_before));
+  }
+  s->pixels_drawn += DamageRegionArea(&(b->damage));
+  s->full_frame_pixels += ((uint64_t) s->width) * s->height;
+  DamageRegionClear(&(b->damage));
+}
+
+// Draws the first frame into the first buffer while waiting for the first
+// configure. Unless the configure changes the size, the frame is committed as
+// soon as the configure is acked.
+static void PrerenderFrame(ApplicationState *s) {
+  MarkDirty(s, 0, 0, s->width, s->height);
+  UpdateAnimation(s);
+  DrawBuffer(s, s->swapchain.buffers);
+  s->prerendered = 1;
+}
+
+// Returns nonzero if the surface and buffers exist but no frame has been
+// drawn, and the first configure hasn't arrived yet.
+static int ShouldPrerenderFrame(ApplicationState *s) {
+  return s->surface_id && s->swapchain.buffers[0].id &&
+    (s->surface_state == NONE) && (s->full_frame_pixels == 0);
+}
+
+// Returns the number of milliseconds from the most recent frame callback until
+// the animated box moves again, or 0 if it never will at the current size.
+static uint32_t NextAnimationChange(ApplicationState *s) {
+  if ((ANIMATED_BOX_SIZE >= s->width) || (ANIMATED_BOX_SIZE > s->height)) {
+    return 0;
+  }
+  return ANIMATION_MS_PER_PIXEL - (AnimationTime(s) % ANIMATION_MS_PER_PIXEL);
+}
+
+// Leaves the idle state, without asking for a callback.
+static void StopIdling(ApplicationState *s) {
+  FrameScheduler *f = &(s->scheduler);
+  if (f->idle_timer) ReactorRemove(&(s->reactor), f->idle_timer);
+  f->idle_timer = NULL;
+  f->idle = 0;
+}
+
+// If idle, asks for a frame callback again, committing so the compositor acts
+// on the request. Returns 0 on error.
+static int ResumeFrameCallbacks(ApplicationState *s) {
+  if (!s->scheduler.idle) return 1;
+  StopIdling(s);
+  if (!RequestFrameCallback(s) || !CommitSurface(s)) {
+    LOG_ERROR("Error requesting a frame callback after idling.\n");
     return 0;
   }
   return 1;
 }
 
+// Called by the reactor when the animation moves after idling.
+static int HandleIdleTimer(void *context, uint64_t expirations) {
+  return ResumeFrameCallbacks((ApplicationState *) context);
+}
+
+// Stops asking for frame callbacks after one found nothing to draw, rather
+// than committing an unchanged frame just to get the next callback, which
+// would wake both us and the compositor up every frame for nothing. Sets a
+// timer for when the animation next moves. When replaying there's no
+// compositor to wait on, and the captured client asked again at some point,
+// so it asks again straight away. Returns 0 on error.
+static int StartIdling(ApplicationState *s) {
+  FrameScheduler *f = &(s->scheduler);
+  uint32_t delay_ms = NextAnimationChange(s);
+  f->frame_due = 0;
+  f->idle = 1;
+  if (s->replay_path) return ResumeFrameCallbacks(s);
+  if (delay_ms == 0) return 1;
+  f->idle_timer = ReactorAddTimer(&(s->reactor),
+    ((uint64_t) delay_ms) * 1000000, 0, HandleIdleTimer, s);
+  return f->idle_timer != NULL;
+}
+
 // To be called after a configure is ACKED in order to render a frame. Sets up
-// the shm buffers if they aren't already set up.
+// the shm buffers if they aren't already set up. Only the parts of the buffer
+// that are out of date are redrawn, and only the parts that changed since the
+// last frame are reported to the compositor as damaged. If every buffer is
+// still in use by the compositor, this returns without drawing anything and
+// leaves the surface state alone, so the frame is drawn once a buffer is
+// released.
 static int RenderFrame(ApplicationState *s) {
-  uint32_t x, y, row_offset, pixel_offset;
+  SwapchainBuffer *b = NULL;
+  LatencyStats *l = &(s->latency);
+  uint64_t commit_time;
+  int prerendered = s->prerendered;
   if (s->shm_pool_id == 0) {
     if (!CreateShmPool(s)) {
-      printf("Error creating shm_pool.\n");
+      LOG_ERROR("Error creating shm_pool.\n");
       return 0;
     }
   }
-  if (s->frame_buffer_id == 0) {
-    if (!CreateFrameBuffer(s)) {
-      printf("Error creating frame buffer.\n");
+  if (s->swapchain.buffers[0].id == 0) {
+    if (!CreateFrameBuffers(s)) {
+      LOG_ERROR("Error creating frame buffers.\n");
       return 0;
     }
   }
-
-  // Fill the image buffer with opaque red.
-  memset(s->image_buffer, 0, s->image_buffer_size);
-  row_offset = 0;
-  for (y = 0; y < s->height; y++) {
-    for (x = 0; x < s->width; x++) {
-      pixel_offset = row_offset + (x * 4);
-      // Blue
-      s->image_buffer[pixel_offset] = 0xaa;
-      // Green
-      s->image_buffer[pixel_offset + 1] = 0x10;
-      // Red
-      s->image_buffer[pixel_offset + 2] = 0x55;
-      // Alpha
-      s->image_buffer[pixel_offset + 3] = 0xff;
+  if (prerendered) {
+    // The first frame is already drawn, and s->damage still covers all of
+    // it. l->render_end is still from when it was drawn.
+    b = s->swapchain.buffers;
+    s->prerendered = 0;
+  } else {
+    // A configure may change anything, so always redraw everything in
+    // response to one.
+    if (s->surface_state == ACKED_CONFIGURE) {
+      MarkDirty(s, 0, 0, s->width, s->height);
+    }
+    UpdateAnimation(s);
+    // Nothing changed, so there's nothing to commit.
+    if (s->damage.count == 0) return StartIdling(s);
+    b = GetFreeBuffer(s);
+    if (!b) {
+      s->swapchain.stalls++;
+      return 1;
+    }
+    DrawBuffer(s, b);
+  }
+  if (l->configure_time) {
+    // This is the frame drawn in response to the configure. A prerendered
+    // frame was ready before the ack, so it took no time after it.
+    if (prerendered) {
+      LatencyHistogramRecord(l->stages + LATENCY_ACK_TO_RENDER, 0);
+      l->prerendered++;
+    } else {
+      LatencyHistogramRecord(l->stages + LATENCY_ACK_TO_RENDER,
+        l->render_start - l->ack_time);
     }
-    row_offset += s->stride;
   }
 
-  if (!AttachBuffer(s)) {
-    printf("Error attaching buffer to surface.\n");
+  if (!AttachBuffer(s, b)) {
+    LOG_ERROR("Error attaching buffer to surface.\n");
+    return 0;
+  }
+  if (!SendDamage(s)) return 0;
+  if (!RequestFrameCallback(s)) {
+    LOG_ERROR("Error requesting frame callback.\n");
     return 0;
   }
   if (!CommitSurface(s)) {
-    printf("Error committing surface.\n");
+    LOG_ERROR("Error committing surface.\n");
     return 0;
   }
+  // A configure may have made us draw while idle.
+  StopIdling(s);
+  commit_time = MonotonicNanoseconds();
+  LatencyHistogramRecord(l->stages + LATENCY_RENDER_TO_COMMIT, commit_time -
+    l->render_end);
+  if (l->configure_time) {
+    LatencyHistogramRecord(l->stages + LATENCY_CONFIGURE_TO_COMMIT,
+      commit_time - l->configure_time);
+    l->configure_time = 0;
+  }
   s->surface_state = SURFACE_ATTACHED;
+  s->scheduler.frame_due = 0;
+  s->frame_queued = 1;
   return 1;
 }
 
+// Returns nonzero if a frame should be drawn during this loop iteration.
+static int ShouldRenderFrame(ApplicationState *s) {
+  // A new configure always needs a new frame committed in response.
+  if (s->surface_state == ACKED_CONFIGURE) return 1;
+  if (s->surface_state != SURFACE_ATTACHED) return 0;
+  // If the server isn't keeping up with our requests, wait until it catches
+  // up. The damage from any frames skipped meanwhile is merged into the next
+  // one.
+  if (s->outbound.congested) return 0;
+  return s->scheduler.frame_due && !s->scheduler.suspended;
+}
+
 // Responds to an xdg "ping" to check that the application is alive.
 static int SendXDGPong(ApplicationState *s, uint32_t ping_serial) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[128];
-  size_t buffer_offset = 0;
-  size_t result;
-  uint32_t arg = ping_serial;
-  msg.object_id = s->xdg_wm_base_id;
-  msg.payload_size = sizeof(uint32_t);
-  msg.payload = (uint8_t *) &arg;
-  // xdg_wm_base.3 = pong
-  msg.opcode = 3;
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, 0);
-  if (result != buffer_offset) {
-    printf("Error sending XDG WM pong: %s\n", strerror(errno));
+  uint8_t *dst = ReserveRequest(s, XDG_WM_BASE_PONG_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing XDG WM pong.\n");
     return 0;
   }
+  WriteXdgWmBasePong(dst, s->xdg_wm_base_id, ping_serial);
   return 1;
 }
 
 // Responds to xdg_surface "configure" events. Similar to SendXDGPong.
 static int AckXDGSurfaceConfigure(ApplicationState *s, uint32_t serial) {
-  ParsedWaylandEvent msg;
-  uint8_t buffer[64];
-  size_t result, buffer_offset = 0;
-  uint32_t arg = serial;
-  msg.object_id = s->xdg_surface_id;
-  msg.payload_size = sizeof(uint32_t);
-  msg.payload = (uint8_t *) &arg;
-  // xdg_surface.4 = ack_configure
-  msg.opcode = 4;
-  WriteWaylandMessage(buffer, &buffer_offset, &msg);
-  result = send(s->socket_fd, buffer, buffer_offset, 0);
-  if (result != buffer_offset) {
-    printf("Error sending xdg_surface.ack_configure: %s\n", strerror(errno));
+  uint8_t *dst = ReserveRequest(s, XDG_SURFACE_ACK_CONFIGURE_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing xdg_surface.ack_configure.\n");
     return 0;
   }
+  WriteXdgSurfaceAckConfigure(dst, s->xdg_surface_id, serial);
   return 1;
 }
 
-// Handles a single event received on the wayland socket. Receives the object's
-// ID, opcode, the (non-padded) size of the message payload and the payload
-// itself, which must be ignored if payload_size is 0.
-static int HandleWaylandEvent(ApplicationState *s, ParsedWaylandEvent *e) {
-  size_t payload_offset = 0;
-  uint32_t name, interface_version = 0;
-  int result;
-  char *interface_name = NULL;
-
-  // The global registry can produce two events: announcing an object is
-  // available, and announcing a global object is removed.
-  if ((e->object_id == s->registry_id) &&
-    (e->opcode == WAYLAND_REGISTRY_GLOBAL_EVENT)) {
-    name = ReadUint32(e->payload, &payload_offset);
-    interface_name = ReadWaylandString(e->payload, &payload_offset);
-    interface_version = ReadUint32(e->payload, &payload_offset);
-    printf("Found interface %s: name %u, version %u\n", interface_name,
-      (unsigned) name, (unsigned) interface_version);
-    if (strcmp("wl_shm", interface_name) == 0) {
-      s->shm_id = WaylandRegistryBind(s, name, interface_name,
-        interface_version);
-      if (!s->shm_id) {
-        printf("Error binding wl_shm object.\n");
-        return 0;
-      } else {
-        printf("  -> Bound to ID %u\n", (unsigned) s->shm_id);
-      }
-    }
-    if (strcmp("xdg_wm_base", interface_name) == 0) {
-      s->xdg_wm_base_id = WaylandRegistryBind(s, name, interface_name,
-        interface_version);
-      if (!s->xdg_wm_base_id) {
-        printf("Error binding xdg_wm_base object.\n");
-        return 0;
-      } else {
-        printf("  -> Bound to ID %u\n", (unsigned) s->xdg_wm_base_id);
-      }
-    }
-    if (strcmp("wl_compositor", interface_name) == 0) {
-      s->compositor_id = WaylandRegistryBind(s, name, interface_name,
-        interface_version);
-      if (!s->compositor_id) {
-        printf("Error binding wl_compositor object.\n");
-        return 0;
-      } else {
-        printf("  -> Bound to ID %u\n", (unsigned) s->compositor_id);
-      }
-    }
-    return 1;
-  }
-
-  if ((e->object_id == WAYLAND_DISPLAY_OBJECT_ID) &&
-    (e->opcode == WAYLAND_DISPLAY_ERROR_EVENT)) {
-    PrintErrorEventInfo(e);
+// Creates a wl_keyboard for the seat's keyboard. Returns 0 on error.
+static int GetSeatKeyboard(ApplicationState *s) {
+  uint8_t *dst = ReserveRequest(s, WL_SEAT_GET_KEYBOARD_SIZE, -1);
+  if (!dst) {
+    LOG_ERROR("Error queueing wl_seat.get_keyboard message.\n");
     return 0;
   }
+  s->keyboard_id = NewWaylandObject(s, &wl_keyboard_interface);
+  if (!s->keyboard_id) return 0;
+  WriteWlSeatGetKeyboard(dst, s->seat_id, s->keyboard_id);
+  return 1;
+}
 
-  // "ping" event from the xdg_wm_base
-  if ((e->object_id == s->xdg_wm_base_id) &&
-    (e->opcode == XDG_WM_PING_EVENT)) {
-    if (e->payload_size != sizeof(uint32_t)) {
-      printf("Incorrect xdg ping payload size: %d\n", (int) e->payload_size);
+// Destroys our wl_keyboard, after the seat lost its keyboard. Before version
+// 3 there's no way to, so the object just stays around unused. Returns 0 on
+// error.
+static int ReleaseSeatKeyboard(ApplicationState *s) {
+  uint8_t *dst = NULL;
+  if (s->seat_version >= WL_KEYBOARD_RELEASE_SINCE) {
+    dst = ReserveRequest(s, WL_KEYBOARD_RELEASE_SIZE, -1);
+    if (!dst) {
+      LOG_ERROR("Error queueing wl_keyboard.release message.\n");
       return 0;
     }
-    return SendXDGPong(s, *((uint32_t *) e->payload));
+    WriteWlKeyboardRelease(dst, s->keyboard_id);
   }
+  s->keyboard_id = 0;
+  return 1;
+}
 
-  // The surface configure message from xdg_surface must be ack'd
-  if ((e->object_id == s->xdg_surface_id) &&
-    (e->opcode == XDG_SURFACE_CONFIGURE_EVENT)) {
-    if (e->payload_size != sizeof(uint32_t)) {
-      printf("Incorrect xdg_surface configure payload size: %d\n",
-        (int) e->payload_size);
+// Destroys our wl_seat and its keyboard, after the seat was removed. Before
+// version 5 there's no way to destroy the seat, so it just stays around
+// unused. Either way, a seat announced later can be bound in its place.
+// Returns 0 on error.
+static int ReleaseSeat(ApplicationState *s) {
+  uint8_t *dst = NULL;
+  if (s->keyboard_id && !ReleaseSeatKeyboard(s)) return 0;
+  if (s->seat_version >= WL_SEAT_RELEASE_SINCE) {
+    dst = ReserveRequest(s, WL_SEAT_RELEASE_SIZE, -1);
+    if (!dst) {
+      LOG_ERROR("Error queueing wl_seat.release message.\n");
       return 0;
     }
-    result = AckXDGSurfaceConfigure(s, *((uint32_t *) e->payload));
-    if (result == 0) return 0;
-    s->surface_state = ACKED_CONFIGURE;
-    return 1;
+    WriteWlSeatRelease(dst, s->seat_id);
   }
+  s->seat_id = 0;
+  s->seat_name = 0;
+  s->seat_version = 0;
+  return 1;
+}
 
-  // The configure message from xdg_toplevel must also be handled. The current
-  // version in xdg-shell.xml says that this requires an ack, but the blog post
-  // version never sends an ack...
-  if ((e->object_id == s->xdg_toplevel_id) &&
-    (e->opcode == XDG_TOPLEVEL_CONFIGURE_EVENT)) {
-    if (e->payload_size < 8) {
-      printf("Invalid payload size for xdg_toplevel configure: %d\n",
-        (int) e->payload_size);
-    }
-    printf("Got xdg toplevel configure event. W=%d, H=%d\n",
-      *((int *) e->payload), *((int *) (e->payload + 4)));
-    return 1;
+// Binds the global with the given numeric "name" at the given version, and
+// returns the new ID. Returns 0 on error.
+static uint32_t BindGlobal(ApplicationState *s, uint32_t name,
+  const WaylandInterface *interface, uint32_t version) {
+  uint32_t id = WaylandRegistryBind(s, name, interface, version);
+  if (!id) {
+    LOG_ERROR("Error binding %s object.\n", interface->name);
+    return 0;
   }
+  LOG_DEBUG("  -> Bound to ID %u at version %u\n", (unsigned) id,
+    (unsigned) version);
+  return id;
+}
 
-  // These are informational messages about supported pixel formats.
-  if ((e->object_id == s->shm_id) &&
-    (e->opcode == WAYLAND_SHM_FORMAT_EVENT)) {
-    if (e->payload_size != sizeof(uint32_t)) {
-      printf("Incorrect wl_shm.format payload size: %d\n",
-        (int) e->payload_size);
-      return 0;
-    }
-    printf("Supported pixel format: 0x%08x\n", *((uint32_t *) e->payload));
+// Creates the surface and commits it without a buffer, which gets the first
+// configure sent, as soon as both the globals it needs are bound. Returns 0 on
+// error.
+static int CreateSurfaceIfReady(ApplicationState *s) {
+  if (!s->compositor_id || !s->xdg_wm_base_id || s->surface_id) return 1;
+  if (!CreateSurface(s)) {
+    LOG_ERROR("Error creating surface.\n");
+    return 0;
+  }
+  if (!CommitSurface(s)) {
+    LOG_ERROR("Error initially committing surface.\n");
+    return 0;
+  }
+  LOG_INFO("Created surface.\n");
+  return 1;
+}
+
+// These bind the first global of their interface to be announced, and ignore
+// any others. Our wl_surface has the same version as the compositor. The
+// requests that depend on each global are queued right behind its bind, in
+// the same flush, rather than after the rest of the globals are handled.
+static int BindShm(ApplicationState *s, uint32_t name, uint32_t version) {
+  if (s->shm_id) return 1;
+  s->shm_id = BindGlobal(s, name, &wl_shm_interface, version);
+  if (!s->shm_id) return 0;
+  s->shm_name = name;
+  // The pool's memory was allocated while waiting for the globals.
+  if (!CreateShmPool(s)) {
+    LOG_ERROR("Error creating shm_pool.\n");
+    return 0;
+  }
+  if (!CreateFrameBuffers(s)) {
+    LOG_ERROR("Error creating frame buffers.\n");
+    return 0;
+  }
+  return 1;
+}
+
+static int BindCompositor(ApplicationState *s, uint32_t name,
+  uint32_t version) {
+  if (s->compositor_id) return 1;
+  s->compositor_id = BindGlobal(s, name, &wl_compositor_interface, version);
+  if (!s->compositor_id) return 0;
+  s->compositor_name = name;
+  s->compositor_version = version;
+  return CreateSurfaceIfReady(s);
+}
+
+static int BindXDGWmBase(ApplicationState *s, uint32_t name,
+  uint32_t version) {
+  if (s->xdg_wm_base_id) return 1;
+  s->xdg_wm_base_id = BindGlobal(s, name, &xdg_wm_base_interface, version);
+  if (!s->xdg_wm_base_id) return 0;
+  s->xdg_wm_base_name = name;
+  return CreateSurfaceIfReady(s);
+}
+
+static int BindSeat(ApplicationState *s, uint32_t name, uint32_t version) {
+  if (s->seat_id) return 1;
+  s->seat_id = BindGlobal(s, name, &wl_seat_interface, version);
+  if (!s->seat_id) return 0;
+  s->seat_name = name;
+  s->seat_version = version;
+  return 1;
+}
+
+// The highest version of each global, and of the objects created through it,
+// that we handle every event of. A compositor may send any event up to the
+// version we bind, and an event without a handler is a fatal error, so these
+// must only be raised along with adding handlers for the new events. They
+// can't be above the versions wayland_protocol.h was generated for.
+//  - wl_shm 1: format.
+//  - wl_compositor 5: wl_surface.enter and leave are only sent for outputs
+//    we've bound, which is none. Version 6 adds preferred_buffer_scale and
+//    preferred_buffer_transform.
+//  - xdg_wm_base 6: every xdg_surface and xdg_toplevel event, up to
+//    xdg_toplevel.wm_capabilities in version 5.
+//  - wl_seat 8: every wl_seat and wl_keyboard event.
+#define SUPPORTED_WL_SHM_VERSION (1)
+#define SUPPORTED_WL_COMPOSITOR_VERSION (5)
+#define SUPPORTED_XDG_WM_BASE_VERSION (6)
+#define SUPPORTED_WL_SEAT_VERSION (8)
+
+// Describes a global we bind. It's bound at the lower of version, the most
+// recent version of it we support, and the version the server announces.
+typedef struct {
+  const WaylandInterface *interface;
+  uint32_t version;
+  // Called with the global's numeric name and the version to bind. Returns 0
+  // on error.
+  int (*bind)(ApplicationState *s, uint32_t name, uint32_t version);
+} GlobalDescriptor;
+
+static const GlobalDescriptor wl_shm_global = {
+  &wl_shm_interface, SUPPORTED_WL_SHM_VERSION, BindShm,
+};
+static const GlobalDescriptor wl_seat_global = {
+  &wl_seat_interface, SUPPORTED_WL_SEAT_VERSION, BindSeat,
+};
+static const GlobalDescriptor xdg_wm_base_global = {
+  &xdg_wm_base_interface, SUPPORTED_XDG_WM_BASE_VERSION,
+  BindXDGWmBase,
+};
+static const GlobalDescriptor wl_compositor_global = {
+  &wl_compositor_interface, SUPPORTED_WL_COMPOSITOR_VERSION,
+  BindCompositor,
+};
+
+// Returns the descriptor for the interface with the given name, which is
+// length bytes long, or NULL if we don't bind it. The interfaces we bind all
+// have names of different lengths, so the length picks the only candidate and
+// a single memcmp confirms it. Two names of the same length would be a
+// duplicate case label, which doesn't compile; the case would then need to
+// switch on a byte that differs between them as well.
+static const GlobalDescriptor* LookupGlobal(const char *interface_name,
+  uint32_t length) {
+  const GlobalDescriptor *d = NULL;
+  switch (length) {
+  case sizeof(WL_SHM_INTERFACE) - 1:
+    d = &wl_shm_global;
+    break;
+  case sizeof(WL_SEAT_INTERFACE) - 1:
+    d = &wl_seat_global;
+    break;
+  case sizeof(XDG_WM_BASE_INTERFACE) - 1:
+    d = &xdg_wm_base_global;
+    break;
+  case sizeof(WL_COMPOSITOR_INTERFACE) - 1:
+    d = &wl_compositor_global;
+    break;
+  default:
+    return NULL;
+  }
+  if (memcmp(interface_name, d->interface->name, length) != 0) return NULL;
+  return d;
+}
+
+// Handles wl_registry.global, announcing that a global object is available.
+static int HandleRegistryGlobal(ApplicationState *s, ParsedWaylandEvent *e) {
+  const GlobalDescriptor *d = NULL;
+  size_t payload_offset = 0;
+  uint32_t name, string_size = 0, interface_version, version;
+  char *interface_name = NULL;
+  // The name and version surround the interface name, whose size includes
+  // the null terminator.
+  if (e->payload_size >= 12) {
+    memcpy(&string_size, e->payload + 4, sizeof(string_size));
+  }
+  if ((e->payload_size < 12) || (string_size == 0) ||
+    (string_size > (e->payload_size - 12u)) ||
+    (RoundUp4(string_size) != (e->payload_size - 12u)) ||
+    (e->payload[8 + string_size - 1] != 0)) {
+    LOG_ERROR("Invalid wl_registry.global payload.\n");
+    return 0;
+  }
+  name = ReadUint32(e->payload, &payload_offset);
+  interface_name = ReadWaylandString(e->payload, &payload_offset);
+  interface_version = ReadUint32(e->payload, &payload_offset);
+  LOG_DEBUG("Found interface %s: name %u, version %u\n", interface_name,
+    (unsigned) name, (unsigned) interface_version);
+  d = LookupGlobal(interface_name, string_size - 1);
+  if (!d) return 1;
+  version = interface_version;
+  if (version > d->version) version = d->version;
+  if (!d->bind(s, name, version)) return 0;
+  if (!s->startup.globals_bound && s->shm_id && s->compositor_id &&
+    s->xdg_wm_base_id) {
+    s->startup.globals_bound = MonotonicNanoseconds();
+  }
+  return 1;
+}
+
+// Handles wl_registry.global_remove, announcing that a global object is gone,
+// e.g. because a seat or output was unplugged. Globals we didn't bind don't
+// concern us. Our objects for a removed global become inert, so the seat is
+// released and can be replaced by one announced later, but the others are
+// needed for the window to exist at all.
+static int HandleRegistryGlobalRemove(ApplicationState *s,
+  ParsedWaylandEvent *e) {
+  uint32_t name;
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) !=
+    WL_REGISTRY_GLOBAL_REMOVE_EVENT_SIZE) {
+    LOG_ERROR("Incorrect wl_registry.global_remove payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  name = *((uint32_t *) e->payload);
+  LOG_DEBUG("Global %u was removed.\n", (unsigned) name);
+  if (s->seat_id && (name == s->seat_name)) {
+    LOG_INFO("The seat was removed.\n");
+    return ReleaseSeat(s);
+  }
+  if ((s->shm_id && (name == s->shm_name)) ||
+    (s->compositor_id && (name == s->compositor_name)) ||
+    (s->xdg_wm_base_id && (name == s->xdg_wm_base_name))) {
+    LOG_ERROR("A global needed for the window was removed.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Sent when the seat is bound, and whenever it gains or loses a keyboard,
+// pointer or touchscreen. We only use the keyboard.
+static int HandleSeatCapabilities(ApplicationState *s, ParsedWaylandEvent *e) {
+  uint32_t capabilities;
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) !=
+    WL_SEAT_CAPABILITIES_EVENT_SIZE) {
+    LOG_ERROR("Incorrect wl_seat.capabilities payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  capabilities = *((uint32_t *) e->payload);
+  LOG_DEBUG("Seat capabilities: 0x%x\n", (unsigned) capabilities);
+  // A released seat's events may still be on the way.
+  if (e->object_id != s->seat_id) return 1;
+  if ((capabilities & WL_SEAT_CAPABILITY_KEYBOARD) && !s->keyboard_id) {
+    return GetSeatKeyboard(s);
+  }
+  if (!(capabilities & WL_SEAT_CAPABILITY_KEYBOARD) && s->keyboard_id) {
+    return ReleaseSeatKeyboard(s);
+  }
+  return 1;
+}
+
+// The seat's name is only useful for telling multiple seats apart.
+static int HandleSeatName(ApplicationState *s, ParsedWaylandEvent *e) {
+  return 1;
+}
+
+// Sent with an FD holding the keyboard's keymap. We don't handle key events
+// yet, so the keymap is only mapped to check that it's readable.
+static int HandleKeyboardKeymap(ApplicationState *s, ParsedWaylandEvent *e) {
+  size_t payload_offset = 0;
+  uint32_t format, size;
+  void *keymap = NULL;
+  int fd;
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) !=
+    WL_KEYBOARD_KEYMAP_EVENT_SIZE) {
+    LOG_ERROR("Incorrect wl_keyboard.keymap payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  // The FD isn't part of the payload.
+  format = ReadUint32(e->payload, &payload_offset);
+  size = ReadUint32(e->payload, &payload_offset);
+  fd = TakeReceivedFd(&(s->receiver));
+  if (fd < 0) return 0;
+  if ((format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) || (size == 0)) {
+    LOG_DEBUG("Ignoring keymap with format %u.\n", (unsigned) format);
+    close(fd);
     return 1;
   }
+  // Must be mapped privately from version 7 on.
+  keymap = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (keymap == MAP_FAILED) {
+    LOG_ERROR("Error mapping the %u-byte keymap: %s\n", (unsigned) size,
+      strerror(errno));
+    return 0;
+  }
+  LOG_INFO("Got a %u-byte keymap.\n", (unsigned) size);
+  munmap(keymap, size);
+  return 1;
+}
 
-  printf("Handling opcode %d on object %u is not supported!\n",
-    (int) e->opcode, (unsigned) e->object_id);
+// Handles the keyboard events we don't care about: enter, leave, key,
+// modifiers and repeat_info.
+static int HandleKeyboardInput(ApplicationState *s, ParsedWaylandEvent *e) {
+  return 1;
+}
+
+static int HandleDisplayError(ApplicationState *s, ParsedWaylandEvent *e) {
+  PrintErrorEventInfo(e);
   return 0;
 }
 
-// Reads events from the buffer until buffer_size bytes have been processed.
-static int ProcessWaylandEvents(ApplicationState *s, uint8_t *buffer,
-    uint32_t buffer_size) {
-  size_t buffer_offset = 0;
+// The server sends wl_display.delete_id once it's done with an object we
+// destroyed, after which the object's ID can be reused.
+static int HandleDisplayDeleteID(ApplicationState *s, ParsedWaylandEvent *e) {
+  uint32_t id;
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) !=
+    WL_DISPLAY_DELETE_ID_EVENT_SIZE) {
+    LOG_ERROR("Incorrect wl_display.delete_id payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  id = *((uint32_t *) e->payload);
+  if ((id >= WAYLAND_SERVER_ID_START) || (id == WAYLAND_DISPLAY_OBJECT_ID) ||
+    !LookupObject(s, id)) {
+    LOG_ERROR("Got wl_display.delete_id for invalid object %u.\n",
+      (unsigned) id);
+    return 0;
+  }
+  UnregisterObject(s, id);
+  if (!IDAllocatorRelease(&(s->ids), id)) {
+    LOG_ERROR("Failed adding ID %u to the free list.\n", (unsigned) id);
+    return 0;
+  }
+  return 1;
+}
+
+// Handles the "ping" event from the xdg_wm_base.
+static int HandleXDGPing(ApplicationState *s, ParsedWaylandEvent *e) {
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) != XDG_WM_BASE_PING_EVENT_SIZE) {
+    LOG_ERROR("Incorrect xdg ping payload size: %d\n", (int) e->payload_size);
+    return 0;
+  }
+  return SendXDGPong(s, *((uint32_t *) e->payload));
+}
+
+// The surface configure message from xdg_surface must be ack'd
+static int HandleXDGSurfaceConfigure(ApplicationState *s,
+  ParsedWaylandEvent *e) {
+  uint32_t w, h;
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) !=
+    XDG_SURFACE_CONFIGURE_EVENT_SIZE) {
+    LOG_ERROR("Incorrect xdg_surface configure payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  if (!AckXDGSurfaceConfigure(s, *((uint32_t *) e->payload))) return 0;
+  s->latency.configure_time = s->receiver.last_receive_time;
+  s->latency.ack_time = MonotonicNanoseconds();
+  LatencyHistogramRecord(s->latency.stages + LATENCY_CONFIGURE_TO_ACK,
+    s->latency.ack_time - s->latency.configure_time);
+  s->surface_state = ACKED_CONFIGURE;
+  if (!s->startup.configured) {
+    s->startup.configured = s->latency.configure_time;
+  }
+  // The toplevel configure event that came before this one holds the new
+  // size, which takes effect now that it's been acked.
+  w = s->scheduler.pending_width;
+  h = s->scheduler.pending_height;
+  if ((w != 0) && (h != 0) && ((w != s->width) || (h != s->height))) {
+    if (!ResizeImage(s, w, h)) return 0;
+  }
+  return 1;
+}
+
+// The configure message from xdg_toplevel must also be handled. The current
+// version in xdg-shell.xml says that this requires an ack, but the blog post
+// version never sends an ack...
+static int HandleXDGTopLevelConfigure(ApplicationState *s,
+  ParsedWaylandEvent *e) {
+  size_t offset = 8;
+  int32_t width, height;
+  uint32_t states_size, i;
+  uint32_t *states = NULL;
+  if (e->payload_size < 12) {
+    LOG_ERROR("Invalid payload size for xdg_toplevel configure: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  width = *((int32_t *) e->payload);
+  height = *((int32_t *) (e->payload + 4));
+  LOG_DEBUG("Got xdg toplevel configure event. W=%d, H=%d\n", (int) width,
+    (int) height);
+  // A size of 0 means we can choose, in which case we keep the current size.
+  if ((width < 0) || (height < 0)) {
+    LOG_ERROR("Invalid xdg_toplevel configure size.\n");
+    return 0;
+  }
+  s->scheduler.pending_width = width;
+  s->scheduler.pending_height = height;
+  states_size = ReadUint32(e->payload, &offset);
+  if ((states_size & 3) || ((offset + states_size) > e->payload_size)) {
+    LOG_ERROR("Invalid xdg_toplevel configure states size: %u\n",
+      (unsigned) states_size);
+    return 0;
+  }
+  states = (uint32_t *) (e->payload + offset);
+  s->scheduler.suspended = 0;
+  for (i = 0; i < (states_size / 4); i++) {
+    if (states[i] == XDG_TOPLEVEL_STATE_SUSPENDED) s->scheduler.suspended = 1;
+  }
+  return 1;
+}
+
+// Sent when the user asks to close the window, e.g. with its close button.
+static int HandleXDGTopLevelClose(ApplicationState *s, ParsedWaylandEvent *e) {
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) !=
+    XDG_TOPLEVEL_CLOSE_EVENT_SIZE) {
+    LOG_ERROR("Incorrect xdg_toplevel.close payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  LOG_INFO("The window was closed. Exiting.\n");
+  should_exit = 1;
+  return 1;
+}
+
+// Sent before a configure with the largest size the window could usefully be.
+// We pick our own size anyway, so it's ignored.
+static int HandleXDGTopLevelConfigureBounds(ApplicationState *s,
+  ParsedWaylandEvent *e) {
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) !=
+    XDG_TOPLEVEL_CONFIGURE_BOUNDS_EVENT_SIZE) {
+    LOG_ERROR("Incorrect xdg_toplevel.configure_bounds payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  return 1;
+}
+
+// Sent before a configure with an array of the window management features,
+// such as minimizing, that the compositor supports. We don't request any of
+// them, so it's ignored.
+static int HandleXDGTopLevelWmCapabilities(ApplicationState *s,
+  ParsedWaylandEvent *e) {
+  uint32_t array_size;
+  if (e->payload_size < 4) {
+    LOG_ERROR("Invalid xdg_toplevel.wm_capabilities payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  array_size = *((uint32_t *) e->payload);
+  if ((array_size & 3) || (array_size != (e->payload_size - 4))) {
+    LOG_ERROR("Invalid xdg_toplevel.wm_capabilities array size: %u\n",
+      (unsigned) array_size);
+    return 0;
+  }
+  return 1;
+}
+
+// Sent when it's time to draw the next frame. The payload is a timestamp in
+// milliseconds.
+static int HandleCallbackDone(ApplicationState *s, ParsedWaylandEvent *e) {
+  FrameScheduler *f = &(s->scheduler);
+  uint32_t t, interval;
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) != WL_CALLBACK_DONE_EVENT_SIZE) {
+    LOG_ERROR("Incorrect wl_callback.done payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  if (e->object_id != f->callback_id) {
+    LOG_ERROR("Got wl_callback.done for unexpected callback %u.\n",
+      (unsigned) e->object_id);
+    return 0;
+  }
+  t = *((uint32_t *) e->payload);
+  if (f->callback_count == 0) {
+    f->first_time = t;
+  } else {
+    // The timestamps wrap around every 49 days, which unsigned subtraction
+    // handles.
+    interval = t - f->times[(f->callback_count - 1) % FRAME_TIME_HISTORY];
+    if ((f->callback_count == 1) || (interval < f->min_interval)) {
+      f->min_interval = interval;
+    }
+    if (interval > f->max_interval) f->max_interval = interval;
+    f->interval_sum += interval;
+  }
+  f->times[f->callback_count % FRAME_TIME_HISTORY] = t;
+  f->callback_count++;
+  // The server destroys the callback object after this, and will send
+  // delete_id for it.
+  f->callback_id = 0;
+  f->frame_due = 1;
+  return 1;
+}
+
+// These are informational messages about supported pixel formats.
+static int HandleShmFormat(ApplicationState *s, ParsedWaylandEvent *e) {
+  if ((e->payload_size + WAYLAND_HEADER_SIZE) != WL_SHM_FORMAT_EVENT_SIZE) {
+    LOG_ERROR("Incorrect wl_shm.format payload size: %d\n",
+      (int) e->payload_size);
+    return 0;
+  }
+  LOG_DEBUG("Supported pixel format: 0x%08x\n", *((uint32_t *) e->payload));
+  return 1;
+}
+
+// Sent when the compositor is done reading a buffer, so we can draw into it
+// again.
+static int HandleBufferRelease(ApplicationState *s, ParsedWaylandEvent *e) {
+  Swapchain *c = &(s->swapchain);
+  uint32_t i;
+  for (i = 0; i < SWAPCHAIN_LENGTH; i++) {
+    if (c->buffers[i].id == e->object_id) {
+      c->buffers[i].busy = 0;
+      return 1;
+    }
+  }
+  // Retired buffers are destroyed as soon as the compositor is done with
+  // them, freeing their space in the pool.
+  for (i = 0; i < c->retired_count; i++) {
+    if (c->retired[i].id != e->object_id) continue;
+    if (!DestroyBuffer(s, c->retired + i)) return 0;
+    c->retired_count--;
+    c->retired[i] = c->retired[c->retired_count];
+    return 1;
+  }
+  LOG_ERROR("Got wl_buffer.release for unknown buffer %u.\n",
+    (unsigned) e->object_id);
+  return 0;
+}
+
+static const WaylandEventHandler
+  wl_display_handlers[WL_DISPLAY_EVENT_COUNT] = {
+  [WL_DISPLAY_ERROR_EVENT] = HandleDisplayError,
+  [WL_DISPLAY_DELETE_ID_EVENT] = HandleDisplayDeleteID,
+};
+static const WaylandInterface wl_display_interface = {
+  WL_DISPLAY_INTERFACE, WL_DISPLAY_EVENT_COUNT, wl_display_handlers,
+};
+
+static const WaylandEventHandler
+  wl_registry_handlers[WL_REGISTRY_EVENT_COUNT] = {
+  [WL_REGISTRY_GLOBAL_EVENT] = HandleRegistryGlobal,
+  [WL_REGISTRY_GLOBAL_REMOVE_EVENT] = HandleRegistryGlobalRemove,
+};
+static const WaylandInterface wl_registry_interface = {
+  WL_REGISTRY_INTERFACE, WL_REGISTRY_EVENT_COUNT, wl_registry_handlers,
+};
+
+static const WaylandEventHandler
+  wl_callback_handlers[WL_CALLBACK_EVENT_COUNT] = {
+  [WL_CALLBACK_DONE_EVENT] = HandleCallbackDone,
+};
+static const WaylandInterface wl_callback_interface = {
+  WL_CALLBACK_INTERFACE, WL_CALLBACK_EVENT_COUNT, wl_callback_handlers,
+};
+
+static const WaylandInterface wl_compositor_interface = {
+  WL_COMPOSITOR_INTERFACE, 0, NULL,
+};
+
+static const WaylandEventHandler
+  wl_shm_handlers[WL_SHM_EVENT_COUNT] = {
+  [WL_SHM_FORMAT_EVENT] = HandleShmFormat,
+};
+static const WaylandInterface wl_shm_interface = {
+  WL_SHM_INTERFACE, WL_SHM_EVENT_COUNT, wl_shm_handlers,
+};
+
+static const WaylandInterface wl_shm_pool_interface = {
+  WL_SHM_POOL_INTERFACE, 0, NULL,
+};
+
+static const WaylandEventHandler
+  wl_buffer_handlers[WL_BUFFER_EVENT_COUNT] = {
+  [WL_BUFFER_RELEASE_EVENT] = HandleBufferRelease,
+};
+static const WaylandInterface wl_buffer_interface = {
+  WL_BUFFER_INTERFACE, WL_BUFFER_EVENT_COUNT, wl_buffer_handlers,
+};
+
+static const WaylandInterface wl_surface_interface = {
+  WL_SURFACE_INTERFACE, 0, NULL,
+};
+
+static const WaylandEventHandler
+  wl_seat_handlers[WL_SEAT_EVENT_COUNT] = {
+  [WL_SEAT_CAPABILITIES_EVENT] = HandleSeatCapabilities,
+  [WL_SEAT_NAME_EVENT] = HandleSeatName,
+};
+static const WaylandInterface wl_seat_interface = {
+  WL_SEAT_INTERFACE, WL_SEAT_EVENT_COUNT, wl_seat_handlers,
+};
+
+static const WaylandEventHandler
+  wl_keyboard_handlers[WL_KEYBOARD_EVENT_COUNT] = {
+  [WL_KEYBOARD_KEYMAP_EVENT] = HandleKeyboardKeymap,
+  [WL_KEYBOARD_ENTER_EVENT] = HandleKeyboardInput,
+  [WL_KEYBOARD_LEAVE_EVENT] = HandleKeyboardInput,
+  [WL_KEYBOARD_KEY_EVENT] = HandleKeyboardInput,
+  [WL_KEYBOARD_MODIFIERS_EVENT] = HandleKeyboardInput,
+  [WL_KEYBOARD_REPEAT_INFO_EVENT] = HandleKeyboardInput,
+};
+static const uint8_t wl_keyboard_event_fds[WL_KEYBOARD_EVENT_COUNT] = {
+  [WL_KEYBOARD_KEYMAP_EVENT] = WL_KEYBOARD_KEYMAP_EVENT_FDS,
+};
+static const WaylandInterface wl_keyboard_interface = {
+  WL_KEYBOARD_INTERFACE, WL_KEYBOARD_EVENT_COUNT, wl_keyboard_handlers,
+  wl_keyboard_event_fds,
+};
+
+static const WaylandEventHandler
+  xdg_wm_base_handlers[XDG_WM_BASE_EVENT_COUNT] = {
+  [XDG_WM_BASE_PING_EVENT] = HandleXDGPing,
+};
+static const WaylandInterface xdg_wm_base_interface = {
+  XDG_WM_BASE_INTERFACE, XDG_WM_BASE_EVENT_COUNT, xdg_wm_base_handlers,
+};
+
+static const WaylandEventHandler
+  xdg_surface_handlers[XDG_SURFACE_EVENT_COUNT] = {
+  [XDG_SURFACE_CONFIGURE_EVENT] = HandleXDGSurfaceConfigure,
+};
+static const WaylandInterface xdg_surface_interface = {
+  XDG_SURFACE_INTERFACE, XDG_SURFACE_EVENT_COUNT, xdg_surface_handlers,
+};
+
+static const WaylandEventHandler
+  xdg_toplevel_handlers[XDG_TOPLEVEL_EVENT_COUNT] = {
+  [XDG_TOPLEVEL_CONFIGURE_EVENT] = HandleXDGTopLevelConfigure,
+  [XDG_TOPLEVEL_CLOSE_EVENT] = HandleXDGTopLevelClose,
+  [XDG_TOPLEVEL_CONFIGURE_BOUNDS_EVENT] = HandleXDGTopLevelConfigureBounds,
+  [XDG_TOPLEVEL_WM_CAPABILITIES_EVENT] = HandleXDGTopLevelWmCapabilities,
+};
+static const WaylandInterface xdg_toplevel_interface = {
+  XDG_TOPLEVEL_INTERFACE, XDG_TOPLEVEL_EVENT_COUNT, xdg_toplevel_handlers,
+};
+
+// Handles a single event received on the wayland socket by looking up the
+// object it was sent to and calling the handler for the event's opcode. Any
+// FDs the event carries that the handler doesn't take are closed.
+static int HandleWaylandEvent(ApplicationState *s, ParsedWaylandEvent *e) {
+  WaylandReceiver *r = &(s->receiver);
+  WaylandObject *object = LookupObject(s, e->object_id);
+  WaylandEventHandler handler = NULL;
+  uint32_t fd_count = 0;
+  int result;
+  if (!object) {
+    LOG_ERROR("Got opcode %d for unknown object %u.\n", (int) e->opcode,
+      (unsigned) e->object_id);
+    return 0;
+  }
+  if (e->opcode < object->interface->event_count) {
+    handler = object->interface->handlers[e->opcode];
+  }
+  if (!handler) {
+    LOG_ERROR("Handling opcode %d on %s object %u is not supported!\n",
+      (int) e->opcode, object->interface->name, (unsigned) e->object_id);
+    return 0;
+  }
+  if (object->interface->event_fds) {
+    fd_count = object->interface->event_fds[e->opcode];
+  }
+  if (fd_count > r->fd_count) {
+    LOG_ERROR("Opcode %d on %s object %u carries %u FDs, but only %u were "
+      "received.\n", (int) e->opcode, object->interface->name,
+      (unsigned) e->object_id, (unsigned) fd_count, (unsigned) r->fd_count);
+    return 0;
+  }
+  r->event_fds_left = fd_count;
+  result = handler(s, e);
+  // The next event's FDs come right after these.
+  while (r->event_fds_left > 0) {
+    close(TakeReceivedFd(r));
+    r->unused_fds++;
+  }
+  return result;
+}
+
+// Allocates the receive buffer, sized so that one read can drain the socket's
+// entire receive buffer. Returns 0 on error.
+static int InitWaylandReceiver(ApplicationState *s) {
+  WaylandReceiver *r = &(s->receiver);
+  int receive_size = 0;
+  socklen_t option_size = sizeof(receive_size);
+  if (s->replay_path) {
+    receive_size = DEFAULT_RECEIVE_SIZE;
+  } else if ((getsockopt(s->socket_fd, SOL_SOCKET, SO_RCVBUF, &receive_size,
+    &option_size) != 0) || (receive_size <= 0)) {
+    LOG_WARNING("Couldn't get the socket receive buffer size, using %d "
+      "bytes.\n", DEFAULT_RECEIVE_SIZE);
+    receive_size = DEFAULT_RECEIVE_SIZE;
+  }
+  r->read_size = receive_size;
+  // Leave room for a partial message in addition to a full read.
+  if (!RingBufferInit(&(r->ring), r->read_size + WAYLAND_MAX_MESSAGE_SIZE)) {
+    LOG_ERROR("Failed allocating the receive buffer.\n");
+    return 0;
+  }
+  r->scratch = (uint8_t *) malloc(WAYLAND_MAX_MESSAGE_SIZE);
+  if (!r->scratch) {
+    LOG_ERROR("Failed allocating the receive scratch buffer.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Adds size bytes, just written to the receive buffer, to the buffer and to
+// the receive statistics.
+static void CommitReceivedData(WaylandReceiver *r, uint32_t size) {
+  RingBufferCommitWrite(&(r->ring), size);
+  r->last_receive_time = MonotonicNanoseconds();
+  r->last_bytes = size;
+  r->total_bytes += size;
+  r->wakeups++;
+  if (r->last_bytes > r->max_bytes) r->max_bytes = r->last_bytes;
+}
+
+// Copies size bytes that were received some other way than by reading
+// directly into the receive buffer, e.g. from a capture, into the buffer.
+// Returns 0 on error.
+static int CopyReceivedData(WaylandReceiver *r, const uint8_t *data,
+  uint32_t size) {
+  struct iovec regions[2];
+  uint32_t first_size;
+  if (!RingBufferReserve(&(r->ring), size)) {
+    LOG_ERROR("Failed growing the receive buffer to %u bytes.\n",
+      (unsigned) (RingBufferUsed(&(r->ring)) + size));
+    return 0;
+  }
+  RingBufferWriteRegions(&(r->ring), regions);
+  first_size = size;
+  if (first_size > regions[0].iov_len) first_size = regions[0].iov_len;
+  memcpy(regions[0].iov_base, data, first_size);
+  if (first_size < size) {
+    memcpy(regions[1].iov_base, data + first_size, size - first_size);
+  }
+  CommitReceivedData(r, size);
+  return 1;
+}
+
+// Stands in for ReceiveWaylandData when replaying a capture, by copying the
+// next received record into the receive buffer. The FDs that came with it
+// are replaced by empty memfds of the same size. Sets should_exit at the end
+// of the capture. Returns 0 on error.
+static int ReplayWaylandData(ApplicationState *s) {
+  WaylandReceiver *r = &(s->receiver);
+  WireCaptureRecord record;
+  const uint8_t *payload = NULL;
+  struct timespec delay;
+  uint64_t now, fd_size;
+  int fd;
+  r->last_bytes = 0;
+  do {
+    if (!WireReplayNext(&(s->replay), &record, &payload)) {
+      should_exit = 1;
+      return 1;
+    }
+  } while ((record.type != WIRE_CAPTURE_RECEIVED) || (record.size == 0));
+  if (s->replay_paced) {
+    now = MonotonicNanoseconds() - s->replay_start_time;
+    if (record.time > now) {
+      delay.tv_sec = (record.time - now) / 1000000000ull;
+      delay.tv_nsec = (record.time - now) % 1000000000ull;
+      nanosleep(&delay, NULL);
+    }
+  }
+  if (!CopyReceivedData(r, payload, record.size)) return 0;
+  while (WireReplayNextFd(&(s->replay), &fd_size)) {
+    fd = memfd_create("wayland_display_replay", MFD_CLOEXEC);
+    if (fd < 0) {
+      LOG_ERROR("Error creating a memfd for a replayed FD: %s\n",
+        strerror(errno));
+      return 0;
+    }
+    if (ftruncate(fd, fd_size) != 0) {
+      LOG_ERROR("Error resizing a replayed FD: %s\n", strerror(errno));
+      close(fd);
+      return 0;
+    }
+    if (!PushReceivedFd(r, fd)) {
+      LOG_ERROR("Replayed more FDs than can wait to be handled.\n");
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Adds the FDs passed as ancillary data to a recvmsg call to the end of the
+// received FD queue, capturing them if a capture is active. The data they
+// came with must already be captured. FDs that don't fit are closed. Returns
+// 0 on error, including if any FDs were lost.
+static int QueueReceivedFds(ApplicationState *s, struct msghdr *message) {
+  struct cmsghdr *control_info = NULL;
+  uint32_t count, i, dropped = 0;
+  int fd;
+  for (control_info = CMSG_FIRSTHDR(message); control_info;
+    control_info = CMSG_NXTHDR(message, control_info)) {
+    if ((control_info->cmsg_level != SOL_SOCKET) ||
+      (control_info->cmsg_type != SCM_RIGHTS)) {
+      continue;
+    }
+    count = (control_info->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (i = 0; i < count; i++) {
+      memcpy(&fd, CMSG_DATA(control_info) + i * sizeof(int), sizeof(int));
+      if (!PushReceivedFd(&(s->receiver), fd)) {
+        dropped++;
+        continue;
+      }
+      if (WireCaptureActive(&(s->capture)) && !WireCaptureFd(&(s->capture),
+        fd)) {
+        return 0;
+      }
+    }
+  }
+  if (dropped != 0) {
+    LOG_ERROR("Closed %u received FDs that didn't fit in the queue.\n",
+      (unsigned) dropped);
+    return 0;
+  }
+  if (message->msg_flags & MSG_CTRUNC) {
+    LOG_ERROR("Received more FDs than fit in the control buffer.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Does a single read from the socket into the receive buffer, growing the
+// buffer first if a full read wouldn't fit. Any FDs that come with the data
+// are added to the received FD queue. Returns 0 on error or if the server
+// closed the connection.
+static int ReceiveWaylandData(ApplicationState *s) {
+  WaylandReceiver *r = &(s->receiver);
+  uint8_t control_buffer[CMSG_SPACE(sizeof(int) * RECEIVE_MAX_FDS)];
+  struct iovec regions[2];
+  struct msghdr message_info;
+  ssize_t bytes_read;
+  if (s->replay_path) return ReplayWaylandData(s);
+  if (!RingBufferReserve(&(r->ring), r->read_size)) {
+    LOG_ERROR("Failed growing the receive buffer to %u bytes.\n",
+      (unsigned) (RingBufferUsed(&(r->ring)) + r->read_size));
+    return 0;
+  }
+  memset(&message_info, 0, sizeof(message_info));
+  message_info.msg_iov = regions;
+  message_info.msg_iovlen = RingBufferWriteRegions(&(r->ring), regions);
+  message_info.msg_control = control_buffer;
+  message_info.msg_controllen = sizeof(control_buffer);
+  bytes_read = recvmsg(s->socket_fd, &message_info, MSG_CMSG_CLOEXEC);
+  if (bytes_read < 0) {
+    // We'll simply return to the event loop if interrupted by a signal, or if
+    // there turned out to be nothing to read.
+    if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      r->last_bytes = 0;
+      return 1;
+    }
+    LOG_ERROR("Error receiving wayland message: %s\n", strerror(errno));
+    return 0;
+  }
+  if (bytes_read == 0) {
+    LOG_ERROR("The wayland server closed the connection.\n");
+    return 0;
+  }
+  if (WireCaptureActive(&(s->capture)) && !WireCaptureRegions(
+    &(s->capture), WIRE_CAPTURE_RECEIVED, regions, message_info.msg_iovlen,
+    bytes_read)) {
+    return 0;
+  }
+  CommitReceivedData(r, bytes_read);
+  return QueueReceivedFds(s, &message_info);
+}
+
+// Handles every complete message in the receive buffer. Any partial message at
+// the end of the buffer is left in place until the rest of it is received.
+static int ProcessWaylandEvents(ApplicationState *s) {
+  WaylandReceiver *r = &(s->receiver);
   ParsedWaylandEvent event;
-  while (buffer_offset < buffer_size) {
-    ReadWaylandEvent(buffer, &buffer_offset, &event);
-    if ((buffer_offset - 1) > buffer_size) {
-      printf("A message with a body of %d bytes overflowed the buffer "
-        "containing %d bytes.\n", (int) event.payload_size, (int) buffer_size);
+  uint32_t header[2];
+  uint32_t message_size;
+  size_t message_offset;
+  uint8_t *message = NULL;
+  r->last_messages = 0;
+  while (RingBufferUsed(&(r->ring)) >= sizeof(header)) {
+    RingBufferPeek(&(r->ring), 0, header, sizeof(header));
+    message_size = RoundUp4(header[1] >> 16);
+    if (message_size < sizeof(header)) {
+      LOG_ERROR("Got invalid wayland message size: %d\n", (int) message_size);
       return 0;
     }
+    if (RingBufferUsed(&(r->ring)) < message_size) break;
+    message = RingBufferContiguous(&(r->ring), message_size);
+    if (!message) {
+      RingBufferPeek(&(r->ring), 0, r->scratch, message_size);
+      message = r->scratch;
+    }
+    message_offset = 0;
+    if (!ReadWaylandEvent(message, &message_offset, &event)) return 0;
     if (!HandleWaylandEvent(s, &event)) {
-      printf("Error handling Wayland op %u on object %u.\n",
+      LOG_ERROR("Error handling Wayland op %u on object %u.\n",
         (unsigned) event.opcode, (unsigned) event.object_id);
       return 0;
     }
+    RingBufferConsume(&(r->ring), message_size);
+    r->last_messages++;
   }
+  r->total_messages += r->last_messages;
   return 1;
 }
 
-// Reads from the socket and handles events until signalled or an error occurs.
-// Returns 0 if an error caused an exit, and 1 otherwise.
-static int EventLoop(ApplicationState *s) {
-  // This really should probably be a ring buffer in case a message is split
-  // between two reads or the buffer overflows, but whatever. The article I
-  // followed ignores this issue for simplicity as well.
-  uint8_t recv_buffer[4096];
-  memset(recv_buffer, 0, sizeof(recv_buffer));
-  ssize_t bytes_read = 0;
-  while (!should_exit) {
-    bytes_read = recv(s->socket_fd, recv_buffer, sizeof(recv_buffer), 0);
-    if (bytes_read < 0) {
-      printf("Error receiving wayland message: %s\n", strerror(errno));
+// Handles every complete message received so far. Returns 0 on error.
+static int HandleReceivedData(ApplicationState *s) {
+  WaylandReceiver *r = &(s->receiver);
+  if (!ProcessWaylandEvents(s)) {
+    LOG_ERROR("Error handling wayland messages.\n");
+    return 0;
+  }
+  if (r->last_bytes != 0) {
+    LOG_DEBUG("Drained %u bytes containing %u messages (%u bytes "
+      "buffered).\n", (unsigned) r->last_bytes, (unsigned) r->last_messages,
+      (unsigned) RingBufferUsed(&(r->ring)));
+  }
+  return 1;
+}
+
+// Does a single read from the socket and handles every complete message
+// received. Returns 0 on error or if the server closed the connection.
+static int HandleWaylandData(ApplicationState *s) {
+  if (!ReceiveWaylandData(s)) return 0;
+  return HandleReceivedData(s);
+}
+
+// Called by the reactor when the socket is readable or was closed, or is
+// writable while requests are waiting to be sent.
+static int HandleSocketReady(void *context, uint64_t events) {
+  ApplicationState *s = (ApplicationState *) context;
+  if ((events & EPOLLOUT) && !FlushOutboundQueue(s)) return 0;
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) return HandleWaylandData(s);
+  return 1;
+}
+
+// Called by the reactor for SIGINT, SIGTERM and SIGUSR1. SIGUSR1 prints the
+// latency histograms without exiting.
+static int HandleSignal(void *context, uint64_t signal_number) {
+  if (signal_number == SIGUSR1) {
+    PrintLatencyStats((ApplicationState *) context);
+    return 1;
+  }
+  LOG_INFO("Received signal %d. Exiting.\n", (int) signal_number);
+  should_exit = 1;
+  return 1;
+}
+
+// Called by the reactor every stats_interval_ms.
+static int HandleStatsTimer(void *context, uint64_t expirations) {
+  PrintLatencyStats((ApplicationState *) context);
+  return 1;
+}
+
+#if USE_IO_URING
+// Switches the socket's I/O over to io_uring, polling the reactor's epoll FD
+// through the same ring. Falls back to plain syscalls if the kernel doesn't
+// support everything needed. Returns 0 on error.
+static int InitUring(ApplicationState *s) {
+  int flags;
+  if (s->disable_uring || (s->socket_fd < 0)) return 1;
+  if (!UringConnectionCreate(&(s->uring), s->socket_fd,
+    s->reactor.epoll_fd)) {
+    UringConnectionDestroy(&(s->uring));
+    LOG_WARNING("io_uring isn't available; using plain syscalls.\n");
+    return 1;
+  }
+  // io_uring waits for the socket to be ready itself, but fails with EAGAIN
+  // instead if the socket is non-blocking.
+  flags = fcntl(s->socket_fd, F_GETFL);
+  if ((flags < 0) || (fcntl(s->socket_fd, F_SETFL, flags & ~O_NONBLOCK) !=
+    0)) {
+    LOG_ERROR("Error making the socket blocking: %s\n", strerror(errno));
+    return 0;
+  }
+  s->use_uring = 1;
+  LOG_INFO("Using io_uring for the wayland connection.\n");
+  return 1;
+}
+
+// Copies the bytes from a completed multishot recvmsg into the receive buffer,
+// and adds any FDs that came with them to the received FD queue. Returns 0 on
+// error or if the server closed the connection.
+static int ReceiveUringData(ApplicationState *s,
+  const UringCompletion *completion) {
+  struct msghdr message_info;
+  if (completion->result == 0) {
+    LOG_ERROR("The wayland server closed the connection.\n");
+    return 0;
+  }
+  if (completion->result < 0) {
+    // The recv is re-armed by the next io_uring_enter.
+    if (completion->result == -EINTR) return 1;
+    LOG_ERROR("Error receiving wayland message: %s\n",
+      strerror(-completion->result));
+    return 0;
+  }
+  if (WireCaptureActive(&(s->capture)) && !WireCaptureData(&(s->capture),
+    WIRE_CAPTURE_RECEIVED, completion->data, completion->result)) {
+    return 0;
+  }
+  if (!CopyReceivedData(&(s->receiver), completion->data,
+    completion->result)) {
+    return 0;
+  }
+  memset(&message_info, 0, sizeof(message_info));
+  message_info.msg_control = completion->control;
+  message_info.msg_controllen = completion->control_size;
+  message_info.msg_flags = completion->msg_flags;
+  return QueueReceivedFds(s, &message_info);
+}
+
+// Accounts for a completed send, and hands over anything queued while it was
+// in flight. Returns 0 on error or if the server closed the connection.
+static int HandleUringSend(ApplicationState *s,
+  const UringCompletion *completion) {
+  OutboundQueue *q = &(s->outbound);
+  uint32_t i;
+  if (completion->result < 0) {
+    if ((completion->result == -EPIPE) ||
+      (completion->result == -ECONNRESET)) {
+      LOG_ERROR("The wayland server closed the connection.\n");
       return 0;
     }
-    if (!ProcessWaylandEvents(s, recv_buffer, bytes_read)) {
-      printf("Error handling wayland messages.\n");
+    LOG_ERROR("Error sending queued requests: %s\n",
+      strerror(-completion->result));
+    return 0;
+  }
+  if ((completion->result > 0) && WireCaptureActive(&(s->capture))) {
+    if (!WireCaptureData(&(s->capture), WIRE_CAPTURE_SENT, completion->data,
+      completion->result)) {
       return 0;
     }
-    if (BindingDone(s) && !s->surface_id) {
-      if (!CreateSurface(s)) {
-        printf("Error creating surface.\n");
-        return 0;
-      }
-      if (!CommitSurface(s)) {
-        printf("Error initially committing surface.\n");
-        return 0;
+    for (i = 0; i < completion->fd_count; i++) {
+      if (!WireCaptureFd(&(s->capture), completion->fds[i])) return 0;
+    }
+  }
+  q->bytes_sent += completion->result;
+  // The connection already resubmitted the rest.
+  if (!UringConnectionCanSend(&(s->uring))) {
+    q->partial_sends++;
+    q->send_syscalls++;
+  }
+  return FlushOutboundQueue(s);
+}
+
+// Submits everything prepared, sleeps until data is received or the poll of
+// the reactor completes, and handles every completion that's ready. A send
+// completing on its own gives the event loop nothing to do, so it keeps
+// waiting in that case, making a frame's round trip a single io_uring_enter.
+// The exception is if the send let frames be drawn again after congestion.
+// Returns 0 on error or if the server closed the connection.
+static int HandleUringCompletions(ApplicationState *s) {
+  UringConnection *c = &(s->uring);
+  UringCompletion completion;
+  int received = 0, woken = 0, congested;
+  s->receiver.last_bytes = 0;
+  while (!woken) {
+    congested = s->outbound.congested;
+    if (!UringConnectionEnter(c, 1)) return 0;
+    while (UringConnectionNext(c, &completion)) {
+      switch (completion.operation) {
+      case URING_RECV:
+        if (!ReceiveUringData(s, &completion)) return 0;
+        received = 1;
+        woken = 1;
+        break;
+      case URING_SEND:
+        if (!HandleUringSend(s, &completion)) return 0;
+        break;
+      case URING_POLL:
+        // A signal or timer is ready.
+        if (!ReactorWait(&(s->reactor), 0)) return 0;
+        woken = 1;
+        break;
       }
-      printf("Created surface.\n");
     }
-    if (s->surface_state == ACKED_CONFIGURE) {
+    if (congested && !s->outbound.congested) woken = 1;
+  }
+  if (!received) return 1;
+  return HandleReceivedData(s);
+}
+#endif
+
+// Adds the socket, signals and stats timer to s->reactor. The signals must
+// already be blocked. Returns 0 on error.
+static int InitReactor(ApplicationState *s, const sigset_t *signals) {
+  Reactor *r = &(s->reactor);
+  uint64_t interval = ((uint64_t) s->stats_interval_ms) * 1000000;
+  if (!ReactorCreate(r)) return 0;
+#if USE_IO_URING
+  if (!InitUring(s)) return 0;
+#endif
+  // There's no socket when replaying, and io_uring handles it if it's in use.
+  if ((s->socket_fd >= 0) && !s->use_uring) {
+    s->socket_source = ReactorAddFd(r, s->socket_fd, EPOLLIN,
+      HandleSocketReady, s);
+    if (!s->socket_source) return 0;
+  }
+  if (!ReactorAddSignals(r, signals, HandleSignal, s)) return 0;
+  if (s->stats_interval_ms && !ReactorAddTimer(r, interval, interval,
+    HandleStatsTimer, s)) {
+    return 0;
+  }
+  return 1;
+}
+
+// Waits for and handles events, signals and timers until told to exit or an
+// error occurs. Returns 0 if an error caused an exit, and 1 otherwise.
+static int EventLoop(ApplicationState *s) {
+  OutboundQueue *q = &(s->outbound);
+  // Send anything queued during startup before waiting for a response.
+  if (!FlushOutboundQueue(s)) return 0;
+  while (!should_exit) {
+    if (s->replay_path) {
+      // The next batch of events is always ready, but signals and timers
+      // still need to be checked.
+      if (!ReactorWait(&(s->reactor), 0)) return 0;
+      if (!should_exit && !HandleWaylandData(s)) return 0;
+#if USE_IO_URING
+    } else if (s->use_uring) {
+      // Submits the requests queued during the last iteration, and sleeps
+      // until something completes, in one io_uring_enter call.
+      if (!HandleUringCompletions(s)) return 0;
+#endif
+    } else {
+      // Sleeps until the socket is readable, a signal arrives or a timer
+      // expires.
+      if (!ReactorWait(&(s->reactor), -1)) return 0;
+    }
+    if (ShouldPrerenderFrame(s)) {
+      // Get the surface to the compositor first, so drawing overlaps with
+      // waiting for the configure.
+      if (!FlushOutboundQueue(s)) return 0;
+#if USE_IO_URING
+      // With io_uring, that only prepared the send.
+      if (s->use_uring && !UringConnectionEnter(&(s->uring), 0)) return 0;
+#endif
+      PrerenderFrame(s);
+    }
+    // Anything marked dirty while idle needs a callback to be drawn.
+    if (s->scheduler.idle && (s->damage.count > 0) &&
+      !ResumeFrameCallbacks(s)) {
+      return 0;
+    }
+    if (ShouldRenderFrame(s)) {
       if (!RenderFrame(s)) {
-        printf("Error rendering a frame.\n");
+        LOG_ERROR("Error rendering a frame.\n");
         return 0;
       }
     }
+    // Sending the first frame may wake the compositor up before the send
+    // returns, so don't count that time.
+    if (s->frame_queued && !s->startup.first_commit) {
+      s->startup.first_commit = MonotonicNanoseconds();
+    }
+    // Send every request generated during this iteration at once.
+    if (!FlushOutboundQueue(s)) return 0;
+    if (s->frame_queued) {
+      s->frame_queued = 0;
+      s->frames_presented++;
+      LOG_DEBUG("Presented frame %u using %u send syscalls.\n",
+        (unsigned) s->frames_presented,
+        (unsigned) (q->send_syscalls - q->last_frame_syscalls));
+      q->last_frame_syscalls = q->send_syscalls;
+    }
+  }
+  return 1;
+}
+
+// Sets options in s based on the command-line arguments. Returns 0 if they're
+// invalid.
+static int ParseArguments(ApplicationState *s, int argc, char **argv) {
+  int i;
+  s->pool_options = SHM_BACKING_PREFAULT;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--hugepages") == 0) {
+      s->pool_options |= SHM_BACKING_HUGE_PAGES;
+    } else if (strcmp(argv[i], "--no-prefault") == 0) {
+      s->pool_options &= ~SHM_BACKING_PREFAULT;
+    } else if ((strcmp(argv[i], "--capture") == 0) && ((i + 1) < argc)) {
+      i++;
+      s->capture_path = argv[i];
+    } else if ((strcmp(argv[i], "--replay") == 0) && ((i + 1) < argc)) {
+      i++;
+      s->replay_path = argv[i];
+    } else if (strcmp(argv[i], "--paced") == 0) {
+      s->replay_paced = 1;
+    } else if (strcmp(argv[i], "--no-io-uring") == 0) {
+      s->disable_uring = 1;
+    } else if ((strcmp(argv[i], "--stats-interval") == 0) &&
+      ((i + 1) < argc) && (atoi(argv[i + 1]) > 0)) {
+      i++;
+      s->stats_interval_ms = atoi(argv[i]);
+    } else {
+      printf("Usage: %s [--hugepages] [--no-prefault] [--capture <file>] "
+        "[--replay <file> [--paced]] [--stats-interval <ms>] "
+        "[--no-io-uring]\n", argv[0]);
+      return 0;
+    }
+  }
+  if (s->replay_paced && !s->replay_path) {
+    printf("--paced only applies to --replay.\n");
+    return 0;
   }
   return 1;
 }
 
 int main(int argc, char **argv) {
   ApplicationState state;
-  struct sigaction signal_action;
+  sigset_t signals;
+  struct rusage usage;
   int result;
   should_exit = 0;
   memset(&state, 0, sizeof(state));
-  memset(&signal_action, 0, sizeof(signal_action));
+  state.startup.start = MonotonicNanoseconds();
   state.socket_fd = -1;
-  state.shm_fd = -1;
-  state.socket_fd = GetWaylandConnection();
-  if (state.socket_fd <= 0) return 1;
-
+  ShmBackingInit(&state.pool_memory);
+  WireCaptureInit(&state.capture);
+  ReactorInit(&state.reactor);
+#if USE_IO_URING
+  UringConnectionInit(&state.uring);
+#endif
+  ShmAllocatorInit(&state.pool_allocator, MAX_SHM_POOL_SIZE);
+  if (!ParseArguments(&state, argc, argv)) return 1;
+  // These are handled by the event loop, so block them before starting any
+  // threads that could otherwise receive them.
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  if (!ReactorBlockSignals(&signals)) return 1;
+  if (!LogInit()) return 1;
+  // ID 1 always belongs to the display object.
+  IDAllocatorInit(&state.ids, WAYLAND_DISPLAY_OBJECT_ID + 1);
   // We'll use the xrgb8888 color format, which the specification guarantees
   // will be supported.
   state.width = IMAGE_WIDTH;
   state.height = IMAGE_HEIGHT;
-  state.stride = state.width * COLOR_CHANNELS;
+  state.stride = ShmImageStride(state.width, COLOR_CHANNELS);
   state.image_buffer_size = state.stride * state.height;
+  if (state.replay_path) {
+    if (!WireReplayOpen(&state.replay, state.replay_path)) {
+      CleanupState(&state);
+      return 1;
+    }
+    LOG_INFO("Replaying %s.\n", state.replay_path);
+    state.replay_start_time = MonotonicNanoseconds();
+  } else {
+    state.socket_fd = GetWaylandConnection();
+    if (state.socket_fd <= 0) {
+      CleanupState(&state);
+      return 1;
+    }
+  }
+  state.startup.connected = MonotonicNanoseconds();
+  if (state.capture_path) {
+    if (!WireCaptureOpen(&state.capture, state.capture_path)) {
+      CleanupState(&state);
+      return 1;
+    }
+    LOG_INFO("Capturing to %s.\n", state.capture_path);
+  }
 
-  // Map shared memory and get the display registry.
-  if (!OpenSharedMemoryObject(&state)) {
+  // Ask for the globals first, and set up everything else while the server
+  // enumerates them. The shm pool's memory in particular must exist by the
+  // time wl_shm is bound, since the pool is created right away.
+  if (!InitWaylandReceiver(&state)) {
+    CleanupState(&state);
+    return 1;
+  }
+  if (!GetWaylandDisplayRegistry(&state) || !FlushOutboundQueue(&state)) {
     CleanupState(&state);
     return 1;
   }
-  if (!GetWaylandDisplayRegistry(&state)) {
+  LOG_INFO("Using the %s pixel fill kernel.\n", InitPixelFill());
+  if (!TiledRendererInit(&state.renderer, sysconf(_SC_NPROCESSORS_ONLN),
+    DEFAULT_TILE_SIZE)) {
+    CleanupState(&state);
+    return 1;
+  }
+  LOG_INFO("Rendering on %u threads.\n", state.renderer.thread_count);
+  if (!OpenSharedMemoryObject(&state)) {
     CleanupState(&state);
     return 1;
   }
 
-  // Set the signal handler so we can break out of the loop with SIGINT.
-  signal_action.sa_handler = SignalHandler;
-  if (sigaction(SIGINT, &signal_action, NULL) != 0) {
-    printf("Error setting SIGINT handler: %s\n", strerror(errno));
+  if (!InitReactor(&state, &signals)) {
     CleanupState(&state);
     return 1;
   }
 
   // Run the event loop until exit.
-  printf("Running. Press Ctrl+C to exit.\n");
+  LOG_INFO("Running. Press Ctrl+C to exit.\n");
   result = EventLoop(&state);
+  LogShutdown();
   if (!result) {
     printf("The event loop exited with an error.\n");
   } else {
     printf("The event loop ended normally.\n");
   }
+  printf("Received %llu bytes containing %llu messages in %llu reads (at most "
+    "%u bytes in one read).\n", (unsigned long long) state.receiver.total_bytes,
+    (unsigned long long) state.receiver.total_messages,
+    (unsigned long long) state.receiver.wakeups,
+    (unsigned) state.receiver.max_bytes);
+  if (state.receiver.total_fds != 0) {
+    printf("Received %llu FDs, %llu of which went unused.\n",
+      (unsigned long long) state.receiver.total_fds,
+      (unsigned long long) state.receiver.unused_fds);
+  }
+  if (state.startup.first_commit) PrintStartupTimes(&state.startup);
+  printf("Sent %llu bytes in %llu syscalls over %u frames.\n",
+    (unsigned long long) state.outbound.bytes_sent,
+    (unsigned long long) state.outbound.send_syscalls,
+    (unsigned) state.frames_presented);
+  printf("Outbound queue: %llu partial sends, congested %llu times, at most "
+    "%u bytes waiting.\n", (unsigned long long) state.outbound.partial_sends,
+    (unsigned long long) state.outbound.congestion_events,
+    (unsigned) state.outbound.max_unsent);
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    double system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    printf("CPU time: %.3f s user, %.3f s system", user, system);
+    if (state.frames_presented != 0) {
+      printf(", %.1f us per presented frame",
+        (user + system) * 1e6 / state.frames_presented);
+    }
+    printf(".\n");
+  }
+#if USE_IO_URING
+  if (state.use_uring) {
+    printf("io_uring: %llu io_uring_enter calls, %llu completions.\n",
+      (unsigned long long) state.uring.enters,
+      (unsigned long long) state.uring.completions);
+  }
+#endif
+  printf("Object IDs: %u live, %u peak, %llu allocated, %llu reused.\n",
+    (unsigned) state.ids.live_count, (unsigned) state.ids.peak_live_count,
+    (unsigned long long) state.ids.allocated_count,
+    (unsigned long long) state.ids.reused_count);
+  printf("Swapchain: %d buffers, all busy %llu times. Pool grown %llu times "
+    "to %u bytes.\n", SWAPCHAIN_LENGTH,
+    (unsigned long long) state.swapchain.stalls,
+    (unsigned long long) state.swapchain.pool_resizes,
+    (unsigned) state.pool_memory.size);
+  printf("Shm pool: %llu buffers allocated, %llu in freed space, %u in use.\n",
+    (unsigned long long) state.pool_allocator.allocations,
+    (unsigned long long) state.pool_allocator.reused,
+    (unsigned) state.pool_allocator.slices_in_use);
+  if (state.full_frame_pixels != 0) {
+    printf("Drew %llu pixels, %.2f%% of redrawing every frame in full.\n",
+      (unsigned long long) state.pixels_drawn,
+      100.0 * state.pixels_drawn / state.full_frame_pixels);
+  }
+  if (state.scheduler.callback_count > 1) {
+    printf("Frame callbacks: %llu, interval min %u ms, average %.2f ms, max "
+      "%u ms.\n", (unsigned long long) state.scheduler.callback_count,
+      (unsigned) state.scheduler.min_interval,
+      ((double) state.scheduler.interval_sum) /
+      (state.scheduler.callback_count - 1),
+      (unsigned) state.scheduler.max_interval);
+  }
+  if (state.replay_path) {
+    printf("Replayed %llu records in %.1f ms.\n",
+      (unsigned long long) state.replay.records,
+      (MonotonicNanoseconds() - state.replay_start_time) / 1e6);
+  }
+  if (WireCaptureActive(&state.capture)) {
+    printf("Captured %llu records containing %llu bytes.\n",
+      (unsigned long long) state.capture.records,
+      (unsigned long long) state.capture.bytes);
+  }
+  PrintLatencyStats(&state);
 
   // Unmap state, close socket, etc, regardless of whether the exit was due to
   // an error.
@@ -0,0 +1,931 @@
+// This file was generated by protocol_scanner from:
+//   wayland.xml
+//   xdg-shell.xml
+// Don't edit it by hand; run "make protocol" to regenerate it.
+#ifndef WAYLAND_PROTOCOL_H
+#define WAYLAND_PROTOCOL_H
+
+#include <stdint.h>
+#include <string.h>
+
+// The size of the object ID and opcode/size header on every message.
+#define WAYLAND_HEADER_SIZE (8)
+
+static inline uint8_t* ProtocolWriteUint32(uint8_t *dst, uint32_t v) {
+  memcpy(dst, &v, sizeof(v));
+  return dst + sizeof(v);
+}
+
+static inline uint8_t* ProtocolWriteHeader(uint8_t *dst, uint32_t object_id,
+  uint16_t opcode, uint32_t size) {
+  dst = ProtocolWriteUint32(dst, object_id);
+  return ProtocolWriteUint32(dst, (size << 16) | opcode);
+}
+
+// Returns the size of a string on the wire, including its length, null
+// terminator and padding. A NULL string is sent as a 0 length.
+static inline uint32_t ProtocolStringSize(const char *s) {
+  if (!s) return 4;
+  return 4 + ((strlen(s) + 4) & ~((uint32_t) 3));
+}
+
+static inline uint32_t ProtocolArraySize(uint32_t size) {
+  return 4 + ((size + 3) & ~((uint32_t) 3));
+}
+
+static inline uint8_t* ProtocolWriteString(uint8_t *dst, const char *s) {
+  uint32_t length, padded_length;
+  if (!s) return ProtocolWriteUint32(dst, 0);
+  length = strlen(s) + 1;
+  padded_length = (length + 3) & ~((uint32_t) 3);
+  dst = ProtocolWriteUint32(dst, length);
+  memcpy(dst, s, length);
+  memset(dst + length, 0, padded_length - length);
+  return dst + padded_length;
+}
+
+static inline uint8_t* ProtocolWriteArray(uint8_t *dst, const void *data,
+  uint32_t size) {
+  uint32_t padded_size = (size + 3) & ~((uint32_t) 3);
+  dst = ProtocolWriteUint32(dst, size);
+  memcpy(dst, data, size);
+  memset(dst + size, 0, padded_size - size);
+  return dst + padded_size;
+}
+
+// wl_display, version 1
+#define WL_DISPLAY_INTERFACE "wl_display"
+#define WL_DISPLAY_VERSION (1)
+#define WL_DISPLAY_REQUEST_COUNT (2)
+#define WL_DISPLAY_EVENT_COUNT (2)
+#define WL_DISPLAY_ERROR_EVENT (0)
+#define WL_DISPLAY_DELETE_ID_EVENT (1)
+#define WL_DISPLAY_DELETE_ID_EVENT_SIZE (12)
+
+#define WL_DISPLAY_SYNC_OPCODE (0)
+#define WL_DISPLAY_SYNC_SIZE (12)
+
+// Writes a wl_display.sync request to dst, which must have room for
+// WL_DISPLAY_SYNC_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlDisplaySync(uint8_t *dst, uint32_t object_id,
+  uint32_t callback) {
+  const uint32_t size = WL_DISPLAY_SYNC_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_DISPLAY_SYNC_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) callback);
+  (void) dst;
+  return size;
+}
+
+#define WL_DISPLAY_GET_REGISTRY_OPCODE (1)
+#define WL_DISPLAY_GET_REGISTRY_SIZE (12)
+
+// Writes a wl_display.get_registry request to dst, which must have room for
+// WL_DISPLAY_GET_REGISTRY_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlDisplayGetRegistry(uint8_t *dst,
+  uint32_t object_id, uint32_t registry) {
+  const uint32_t size = WL_DISPLAY_GET_REGISTRY_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_DISPLAY_GET_REGISTRY_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) registry);
+  (void) dst;
+  return size;
+}
+
+// wl_registry, version 1
+#define WL_REGISTRY_INTERFACE "wl_registry"
+#define WL_REGISTRY_VERSION (1)
+#define WL_REGISTRY_REQUEST_COUNT (1)
+#define WL_REGISTRY_EVENT_COUNT (2)
+#define WL_REGISTRY_GLOBAL_EVENT (0)
+#define WL_REGISTRY_GLOBAL_REMOVE_EVENT (1)
+#define WL_REGISTRY_GLOBAL_REMOVE_EVENT_SIZE (12)
+
+#define WL_REGISTRY_BIND_OPCODE (0)
+
+static inline uint32_t WlRegistryBindSize(const char *interface) {
+  return ProtocolStringSize(interface) + 20;
+}
+
+// Writes a wl_registry.bind request to dst, which must have room for
+// WlRegistryBindSize() bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlRegistryBind(uint8_t *dst, uint32_t object_id,
+  uint32_t name, const char *interface, uint32_t version, uint32_t id) {
+  const uint32_t size = ProtocolStringSize(interface) + 20;
+  dst = ProtocolWriteHeader(dst, object_id, WL_REGISTRY_BIND_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) name);
+  dst = ProtocolWriteString(dst, interface);
+  dst = ProtocolWriteUint32(dst, version);
+  dst = ProtocolWriteUint32(dst, id);
+  (void) dst;
+  return size;
+}
+
+// wl_callback, version 1
+#define WL_CALLBACK_INTERFACE "wl_callback"
+#define WL_CALLBACK_VERSION (1)
+#define WL_CALLBACK_REQUEST_COUNT (0)
+#define WL_CALLBACK_EVENT_COUNT (1)
+#define WL_CALLBACK_DONE_EVENT (0)
+#define WL_CALLBACK_DONE_EVENT_SIZE (12)
+
+// wl_compositor, version 5
+#define WL_COMPOSITOR_INTERFACE "wl_compositor"
+#define WL_COMPOSITOR_VERSION (5)
+#define WL_COMPOSITOR_REQUEST_COUNT (2)
+#define WL_COMPOSITOR_EVENT_COUNT (0)
+
+#define WL_COMPOSITOR_CREATE_SURFACE_OPCODE (0)
+#define WL_COMPOSITOR_CREATE_SURFACE_SIZE (12)
+
+// Writes a wl_compositor.create_surface request to dst, which must have room
+// for WL_COMPOSITOR_CREATE_SURFACE_SIZE bytes. Returns the number of bytes
+// written.
+static inline uint32_t WriteWlCompositorCreateSurface(uint8_t *dst,
+  uint32_t object_id, uint32_t id) {
+  const uint32_t size = WL_COMPOSITOR_CREATE_SURFACE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_COMPOSITOR_CREATE_SURFACE_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  (void) dst;
+  return size;
+}
+
+#define WL_COMPOSITOR_CREATE_REGION_OPCODE (1)
+#define WL_COMPOSITOR_CREATE_REGION_SIZE (12)
+
+// Writes a wl_compositor.create_region request to dst, which must have room for
+// WL_COMPOSITOR_CREATE_REGION_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlCompositorCreateRegion(uint8_t *dst,
+  uint32_t object_id, uint32_t id) {
+  const uint32_t size = WL_COMPOSITOR_CREATE_REGION_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_COMPOSITOR_CREATE_REGION_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  (void) dst;
+  return size;
+}
+
+// wl_shm_pool, version 1
+#define WL_SHM_POOL_INTERFACE "wl_shm_pool"
+#define WL_SHM_POOL_VERSION (1)
+#define WL_SHM_POOL_REQUEST_COUNT (3)
+#define WL_SHM_POOL_EVENT_COUNT (0)
+
+#define WL_SHM_POOL_CREATE_BUFFER_OPCODE (0)
+#define WL_SHM_POOL_CREATE_BUFFER_SIZE (32)
+
+// Writes a wl_shm_pool.create_buffer request to dst, which must have room for
+// WL_SHM_POOL_CREATE_BUFFER_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlShmPoolCreateBuffer(uint8_t *dst,
+  uint32_t object_id, uint32_t id, int32_t offset, int32_t width,
+    int32_t height, int32_t stride, uint32_t format) {
+  const uint32_t size = WL_SHM_POOL_CREATE_BUFFER_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SHM_POOL_CREATE_BUFFER_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  dst = ProtocolWriteUint32(dst, (uint32_t) offset);
+  dst = ProtocolWriteUint32(dst, (uint32_t) width);
+  dst = ProtocolWriteUint32(dst, (uint32_t) height);
+  dst = ProtocolWriteUint32(dst, (uint32_t) stride);
+  dst = ProtocolWriteUint32(dst, (uint32_t) format);
+  (void) dst;
+  return size;
+}
+
+#define WL_SHM_POOL_DESTROY_OPCODE (1)
+#define WL_SHM_POOL_DESTROY_SIZE (8)
+
+// Writes a wl_shm_pool.destroy request (a destructor) to dst, which must have
+// room for WL_SHM_POOL_DESTROY_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlShmPoolDestroy(uint8_t *dst, uint32_t object_id) {
+  const uint32_t size = WL_SHM_POOL_DESTROY_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SHM_POOL_DESTROY_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+#define WL_SHM_POOL_RESIZE_OPCODE (2)
+#define WL_SHM_POOL_RESIZE_SIZE (12)
+
+// Writes a wl_shm_pool.resize request to dst, which must have room for
+// WL_SHM_POOL_RESIZE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlShmPoolResize(uint8_t *dst, uint32_t object_id,
+  int32_t size_arg) {
+  const uint32_t size = WL_SHM_POOL_RESIZE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SHM_POOL_RESIZE_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) size_arg);
+  (void) dst;
+  return size;
+}
+
+// wl_shm, version 1
+#define WL_SHM_INTERFACE "wl_shm"
+#define WL_SHM_VERSION (1)
+#define WL_SHM_REQUEST_COUNT (1)
+#define WL_SHM_EVENT_COUNT (1)
+#define WL_SHM_FORMAT_EVENT (0)
+#define WL_SHM_FORMAT_EVENT_SIZE (12)
+
+#define WL_SHM_CREATE_POOL_OPCODE (0)
+#define WL_SHM_CREATE_POOL_SIZE (16)
+#define WL_SHM_CREATE_POOL_FDS (1)
+
+// Writes a wl_shm.create_pool request to dst, which must have room for
+// WL_SHM_CREATE_POOL_SIZE bytes. Returns the number of bytes written. The fd
+// argument isn't part of the payload; it must be passed to the server as
+// ancillary data.
+static inline uint32_t WriteWlShmCreatePool(uint8_t *dst, uint32_t object_id,
+  uint32_t id, int32_t size_arg) {
+  const uint32_t size = WL_SHM_CREATE_POOL_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SHM_CREATE_POOL_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  dst = ProtocolWriteUint32(dst, (uint32_t) size_arg);
+  (void) dst;
+  return size;
+}
+
+// wl_buffer, version 1
+#define WL_BUFFER_INTERFACE "wl_buffer"
+#define WL_BUFFER_VERSION (1)
+#define WL_BUFFER_REQUEST_COUNT (1)
+#define WL_BUFFER_EVENT_COUNT (1)
+#define WL_BUFFER_RELEASE_EVENT (0)
+#define WL_BUFFER_RELEASE_EVENT_SIZE (8)
+
+#define WL_BUFFER_DESTROY_OPCODE (0)
+#define WL_BUFFER_DESTROY_SIZE (8)
+
+// Writes a wl_buffer.destroy request (a destructor) to dst, which must have
+// room for WL_BUFFER_DESTROY_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlBufferDestroy(uint8_t *dst, uint32_t object_id) {
+  const uint32_t size = WL_BUFFER_DESTROY_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_BUFFER_DESTROY_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+// wl_surface, version 5
+#define WL_SURFACE_INTERFACE "wl_surface"
+#define WL_SURFACE_VERSION (5)
+#define WL_SURFACE_REQUEST_COUNT (11)
+#define WL_SURFACE_EVENT_COUNT (2)
+#define WL_SURFACE_ENTER_EVENT (0)
+#define WL_SURFACE_ENTER_EVENT_SIZE (12)
+#define WL_SURFACE_LEAVE_EVENT (1)
+#define WL_SURFACE_LEAVE_EVENT_SIZE (12)
+
+#define WL_SURFACE_DESTROY_OPCODE (0)
+#define WL_SURFACE_DESTROY_SIZE (8)
+
+// Writes a wl_surface.destroy request (a destructor) to dst, which must have
+// room for WL_SURFACE_DESTROY_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSurfaceDestroy(uint8_t *dst, uint32_t object_id) {
+  const uint32_t size = WL_SURFACE_DESTROY_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_DESTROY_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_ATTACH_OPCODE (1)
+#define WL_SURFACE_ATTACH_SIZE (20)
+
+// Writes a wl_surface.attach request to dst, which must have room for
+// WL_SURFACE_ATTACH_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSurfaceAttach(uint8_t *dst, uint32_t object_id,
+  uint32_t buffer, int32_t x, int32_t y) {
+  const uint32_t size = WL_SURFACE_ATTACH_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_ATTACH_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) buffer);
+  dst = ProtocolWriteUint32(dst, (uint32_t) x);
+  dst = ProtocolWriteUint32(dst, (uint32_t) y);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_DAMAGE_OPCODE (2)
+#define WL_SURFACE_DAMAGE_SIZE (24)
+
+// Writes a wl_surface.damage request to dst, which must have room for
+// WL_SURFACE_DAMAGE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSurfaceDamage(uint8_t *dst, uint32_t object_id,
+  int32_t x, int32_t y, int32_t width, int32_t height) {
+  const uint32_t size = WL_SURFACE_DAMAGE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_DAMAGE_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) x);
+  dst = ProtocolWriteUint32(dst, (uint32_t) y);
+  dst = ProtocolWriteUint32(dst, (uint32_t) width);
+  dst = ProtocolWriteUint32(dst, (uint32_t) height);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_FRAME_OPCODE (3)
+#define WL_SURFACE_FRAME_SIZE (12)
+
+// Writes a wl_surface.frame request to dst, which must have room for
+// WL_SURFACE_FRAME_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSurfaceFrame(uint8_t *dst, uint32_t object_id,
+  uint32_t callback) {
+  const uint32_t size = WL_SURFACE_FRAME_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_FRAME_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) callback);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_SET_OPAQUE_REGION_OPCODE (4)
+#define WL_SURFACE_SET_OPAQUE_REGION_SIZE (12)
+
+// Writes a wl_surface.set_opaque_region request to dst, which must have room
+// for WL_SURFACE_SET_OPAQUE_REGION_SIZE bytes. Returns the number of bytes
+// written.
+static inline uint32_t WriteWlSurfaceSetOpaqueRegion(uint8_t *dst,
+  uint32_t object_id, uint32_t region) {
+  const uint32_t size = WL_SURFACE_SET_OPAQUE_REGION_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_SET_OPAQUE_REGION_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) region);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_SET_INPUT_REGION_OPCODE (5)
+#define WL_SURFACE_SET_INPUT_REGION_SIZE (12)
+
+// Writes a wl_surface.set_input_region request to dst, which must have room for
+// WL_SURFACE_SET_INPUT_REGION_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSurfaceSetInputRegion(uint8_t *dst,
+  uint32_t object_id, uint32_t region) {
+  const uint32_t size = WL_SURFACE_SET_INPUT_REGION_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_SET_INPUT_REGION_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) region);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_COMMIT_OPCODE (6)
+#define WL_SURFACE_COMMIT_SIZE (8)
+
+// Writes a wl_surface.commit request to dst, which must have room for
+// WL_SURFACE_COMMIT_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSurfaceCommit(uint8_t *dst, uint32_t object_id) {
+  const uint32_t size = WL_SURFACE_COMMIT_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_COMMIT_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_SET_BUFFER_TRANSFORM_OPCODE (7)
+#define WL_SURFACE_SET_BUFFER_TRANSFORM_SIZE (12)
+#define WL_SURFACE_SET_BUFFER_TRANSFORM_SINCE (2)
+
+// Writes a wl_surface.set_buffer_transform request to dst, which must have room
+// for WL_SURFACE_SET_BUFFER_TRANSFORM_SIZE bytes. Returns the number of bytes
+// written.
+static inline uint32_t WriteWlSurfaceSetBufferTransform(uint8_t *dst,
+  uint32_t object_id, int32_t transform) {
+  const uint32_t size = WL_SURFACE_SET_BUFFER_TRANSFORM_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id,
+    WL_SURFACE_SET_BUFFER_TRANSFORM_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) transform);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_SET_BUFFER_SCALE_OPCODE (8)
+#define WL_SURFACE_SET_BUFFER_SCALE_SIZE (12)
+#define WL_SURFACE_SET_BUFFER_SCALE_SINCE (3)
+
+// Writes a wl_surface.set_buffer_scale request to dst, which must have room for
+// WL_SURFACE_SET_BUFFER_SCALE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSurfaceSetBufferScale(uint8_t *dst,
+  uint32_t object_id, int32_t scale) {
+  const uint32_t size = WL_SURFACE_SET_BUFFER_SCALE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_SET_BUFFER_SCALE_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) scale);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_DAMAGE_BUFFER_OPCODE (9)
+#define WL_SURFACE_DAMAGE_BUFFER_SIZE (24)
+#define WL_SURFACE_DAMAGE_BUFFER_SINCE (4)
+
+// Writes a wl_surface.damage_buffer request to dst, which must have room for
+// WL_SURFACE_DAMAGE_BUFFER_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSurfaceDamageBuffer(uint8_t *dst,
+  uint32_t object_id, int32_t x, int32_t y, int32_t width, int32_t height) {
+  const uint32_t size = WL_SURFACE_DAMAGE_BUFFER_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_DAMAGE_BUFFER_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) x);
+  dst = ProtocolWriteUint32(dst, (uint32_t) y);
+  dst = ProtocolWriteUint32(dst, (uint32_t) width);
+  dst = ProtocolWriteUint32(dst, (uint32_t) height);
+  (void) dst;
+  return size;
+}
+
+#define WL_SURFACE_OFFSET_OPCODE (10)
+#define WL_SURFACE_OFFSET_SIZE (16)
+#define WL_SURFACE_OFFSET_SINCE (5)
+
+// Writes a wl_surface.offset request to dst, which must have room for
+// WL_SURFACE_OFFSET_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSurfaceOffset(uint8_t *dst, uint32_t object_id,
+  int32_t x, int32_t y) {
+  const uint32_t size = WL_SURFACE_OFFSET_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SURFACE_OFFSET_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) x);
+  dst = ProtocolWriteUint32(dst, (uint32_t) y);
+  (void) dst;
+  return size;
+}
+
+// wl_seat, version 8
+#define WL_SEAT_INTERFACE "wl_seat"
+#define WL_SEAT_VERSION (8)
+#define WL_SEAT_REQUEST_COUNT (4)
+#define WL_SEAT_EVENT_COUNT (2)
+#define WL_SEAT_CAPABILITIES_EVENT (0)
+#define WL_SEAT_CAPABILITIES_EVENT_SIZE (12)
+#define WL_SEAT_NAME_EVENT (1)
+#define WL_SEAT_NAME_EVENT_SINCE (2)
+
+#define WL_SEAT_GET_POINTER_OPCODE (0)
+#define WL_SEAT_GET_POINTER_SIZE (12)
+
+// Writes a wl_seat.get_pointer request to dst, which must have room for
+// WL_SEAT_GET_POINTER_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSeatGetPointer(uint8_t *dst, uint32_t object_id,
+  uint32_t id) {
+  const uint32_t size = WL_SEAT_GET_POINTER_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SEAT_GET_POINTER_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  (void) dst;
+  return size;
+}
+
+#define WL_SEAT_GET_KEYBOARD_OPCODE (1)
+#define WL_SEAT_GET_KEYBOARD_SIZE (12)
+
+// Writes a wl_seat.get_keyboard request to dst, which must have room for
+// WL_SEAT_GET_KEYBOARD_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSeatGetKeyboard(uint8_t *dst, uint32_t object_id,
+  uint32_t id) {
+  const uint32_t size = WL_SEAT_GET_KEYBOARD_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SEAT_GET_KEYBOARD_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  (void) dst;
+  return size;
+}
+
+#define WL_SEAT_GET_TOUCH_OPCODE (2)
+#define WL_SEAT_GET_TOUCH_SIZE (12)
+
+// Writes a wl_seat.get_touch request to dst, which must have room for
+// WL_SEAT_GET_TOUCH_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSeatGetTouch(uint8_t *dst, uint32_t object_id,
+  uint32_t id) {
+  const uint32_t size = WL_SEAT_GET_TOUCH_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SEAT_GET_TOUCH_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  (void) dst;
+  return size;
+}
+
+#define WL_SEAT_RELEASE_OPCODE (3)
+#define WL_SEAT_RELEASE_SIZE (8)
+#define WL_SEAT_RELEASE_SINCE (5)
+
+// Writes a wl_seat.release request (a destructor) to dst, which must have room
+// for WL_SEAT_RELEASE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlSeatRelease(uint8_t *dst, uint32_t object_id) {
+  const uint32_t size = WL_SEAT_RELEASE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_SEAT_RELEASE_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+// wl_keyboard, version 8
+#define WL_KEYBOARD_INTERFACE "wl_keyboard"
+#define WL_KEYBOARD_VERSION (8)
+#define WL_KEYBOARD_REQUEST_COUNT (1)
+#define WL_KEYBOARD_EVENT_COUNT (6)
+#define WL_KEYBOARD_KEYMAP_EVENT (0)
+#define WL_KEYBOARD_KEYMAP_EVENT_SIZE (16)
+#define WL_KEYBOARD_KEYMAP_EVENT_FDS (1)
+#define WL_KEYBOARD_ENTER_EVENT (1)
+#define WL_KEYBOARD_LEAVE_EVENT (2)
+#define WL_KEYBOARD_LEAVE_EVENT_SIZE (16)
+#define WL_KEYBOARD_KEY_EVENT (3)
+#define WL_KEYBOARD_KEY_EVENT_SIZE (24)
+#define WL_KEYBOARD_MODIFIERS_EVENT (4)
+#define WL_KEYBOARD_MODIFIERS_EVENT_SIZE (28)
+#define WL_KEYBOARD_REPEAT_INFO_EVENT (5)
+#define WL_KEYBOARD_REPEAT_INFO_EVENT_SIZE (16)
+#define WL_KEYBOARD_REPEAT_INFO_EVENT_SINCE (4)
+
+#define WL_KEYBOARD_RELEASE_OPCODE (0)
+#define WL_KEYBOARD_RELEASE_SIZE (8)
+#define WL_KEYBOARD_RELEASE_SINCE (3)
+
+// Writes a wl_keyboard.release request (a destructor) to dst, which must have
+// room for WL_KEYBOARD_RELEASE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteWlKeyboardRelease(uint8_t *dst,
+  uint32_t object_id) {
+  const uint32_t size = WL_KEYBOARD_RELEASE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, WL_KEYBOARD_RELEASE_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+// xdg_wm_base, version 6
+#define XDG_WM_BASE_INTERFACE "xdg_wm_base"
+#define XDG_WM_BASE_VERSION (6)
+#define XDG_WM_BASE_REQUEST_COUNT (4)
+#define XDG_WM_BASE_EVENT_COUNT (1)
+#define XDG_WM_BASE_PING_EVENT (0)
+#define XDG_WM_BASE_PING_EVENT_SIZE (12)
+
+#define XDG_WM_BASE_DESTROY_OPCODE (0)
+#define XDG_WM_BASE_DESTROY_SIZE (8)
+
+// Writes a xdg_wm_base.destroy request (a destructor) to dst, which must have
+// room for XDG_WM_BASE_DESTROY_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgWmBaseDestroy(uint8_t *dst, uint32_t object_id) {
+  const uint32_t size = XDG_WM_BASE_DESTROY_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_WM_BASE_DESTROY_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+#define XDG_WM_BASE_CREATE_POSITIONER_OPCODE (1)
+#define XDG_WM_BASE_CREATE_POSITIONER_SIZE (12)
+
+// Writes a xdg_wm_base.create_positioner request to dst, which must have room
+// for XDG_WM_BASE_CREATE_POSITIONER_SIZE bytes. Returns the number of bytes
+// written.
+static inline uint32_t WriteXdgWmBaseCreatePositioner(uint8_t *dst,
+  uint32_t object_id, uint32_t id) {
+  const uint32_t size = XDG_WM_BASE_CREATE_POSITIONER_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id,
+    XDG_WM_BASE_CREATE_POSITIONER_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  (void) dst;
+  return size;
+}
+
+#define XDG_WM_BASE_GET_XDG_SURFACE_OPCODE (2)
+#define XDG_WM_BASE_GET_XDG_SURFACE_SIZE (16)
+
+// Writes a xdg_wm_base.get_xdg_surface request to dst, which must have room for
+// XDG_WM_BASE_GET_XDG_SURFACE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgWmBaseGetXdgSurface(uint8_t *dst,
+  uint32_t object_id, uint32_t id, uint32_t surface) {
+  const uint32_t size = XDG_WM_BASE_GET_XDG_SURFACE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_WM_BASE_GET_XDG_SURFACE_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  dst = ProtocolWriteUint32(dst, (uint32_t) surface);
+  (void) dst;
+  return size;
+}
+
+#define XDG_WM_BASE_PONG_OPCODE (3)
+#define XDG_WM_BASE_PONG_SIZE (12)
+
+// Writes a xdg_wm_base.pong request to dst, which must have room for
+// XDG_WM_BASE_PONG_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgWmBasePong(uint8_t *dst, uint32_t object_id,
+  uint32_t serial) {
+  const uint32_t size = XDG_WM_BASE_PONG_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_WM_BASE_PONG_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) serial);
+  (void) dst;
+  return size;
+}
+
+// xdg_surface, version 6
+#define XDG_SURFACE_INTERFACE "xdg_surface"
+#define XDG_SURFACE_VERSION (6)
+#define XDG_SURFACE_REQUEST_COUNT (5)
+#define XDG_SURFACE_EVENT_COUNT (1)
+#define XDG_SURFACE_CONFIGURE_EVENT (0)
+#define XDG_SURFACE_CONFIGURE_EVENT_SIZE (12)
+
+#define XDG_SURFACE_DESTROY_OPCODE (0)
+#define XDG_SURFACE_DESTROY_SIZE (8)
+
+// Writes a xdg_surface.destroy request (a destructor) to dst, which must have
+// room for XDG_SURFACE_DESTROY_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgSurfaceDestroy(uint8_t *dst,
+  uint32_t object_id) {
+  const uint32_t size = XDG_SURFACE_DESTROY_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_SURFACE_DESTROY_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+#define XDG_SURFACE_GET_TOPLEVEL_OPCODE (1)
+#define XDG_SURFACE_GET_TOPLEVEL_SIZE (12)
+
+// Writes a xdg_surface.get_toplevel request to dst, which must have room for
+// XDG_SURFACE_GET_TOPLEVEL_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgSurfaceGetToplevel(uint8_t *dst,
+  uint32_t object_id, uint32_t id) {
+  const uint32_t size = XDG_SURFACE_GET_TOPLEVEL_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_SURFACE_GET_TOPLEVEL_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  (void) dst;
+  return size;
+}
+
+#define XDG_SURFACE_GET_POPUP_OPCODE (2)
+#define XDG_SURFACE_GET_POPUP_SIZE (20)
+
+// Writes a xdg_surface.get_popup request to dst, which must have room for
+// XDG_SURFACE_GET_POPUP_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgSurfaceGetPopup(uint8_t *dst, uint32_t object_id,
+  uint32_t id, uint32_t parent, uint32_t positioner) {
+  const uint32_t size = XDG_SURFACE_GET_POPUP_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_SURFACE_GET_POPUP_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) id);
+  dst = ProtocolWriteUint32(dst, (uint32_t) parent);
+  dst = ProtocolWriteUint32(dst, (uint32_t) positioner);
+  (void) dst;
+  return size;
+}
+
+#define XDG_SURFACE_SET_WINDOW_GEOMETRY_OPCODE (3)
+#define XDG_SURFACE_SET_WINDOW_GEOMETRY_SIZE (24)
+
+// Writes a xdg_surface.set_window_geometry request to dst, which must have room
+// for XDG_SURFACE_SET_WINDOW_GEOMETRY_SIZE bytes. Returns the number of bytes
+// written.
+static inline uint32_t WriteXdgSurfaceSetWindowGeometry(uint8_t *dst,
+  uint32_t object_id, int32_t x, int32_t y, int32_t width, int32_t height) {
+  const uint32_t size = XDG_SURFACE_SET_WINDOW_GEOMETRY_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id,
+    XDG_SURFACE_SET_WINDOW_GEOMETRY_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) x);
+  dst = ProtocolWriteUint32(dst, (uint32_t) y);
+  dst = ProtocolWriteUint32(dst, (uint32_t) width);
+  dst = ProtocolWriteUint32(dst, (uint32_t) height);
+  (void) dst;
+  return size;
+}
+
+#define XDG_SURFACE_ACK_CONFIGURE_OPCODE (4)
+#define XDG_SURFACE_ACK_CONFIGURE_SIZE (12)
+
+// Writes a xdg_surface.ack_configure request to dst, which must have room for
+// XDG_SURFACE_ACK_CONFIGURE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgSurfaceAckConfigure(uint8_t *dst,
+  uint32_t object_id, uint32_t serial) {
+  const uint32_t size = XDG_SURFACE_ACK_CONFIGURE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_SURFACE_ACK_CONFIGURE_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) serial);
+  (void) dst;
+  return size;
+}
+
+// xdg_toplevel, version 6
+#define XDG_TOPLEVEL_INTERFACE "xdg_toplevel"
+#define XDG_TOPLEVEL_VERSION (6)
+#define XDG_TOPLEVEL_REQUEST_COUNT (14)
+#define XDG_TOPLEVEL_EVENT_COUNT (4)
+#define XDG_TOPLEVEL_CONFIGURE_EVENT (0)
+#define XDG_TOPLEVEL_CLOSE_EVENT (1)
+#define XDG_TOPLEVEL_CLOSE_EVENT_SIZE (8)
+#define XDG_TOPLEVEL_CONFIGURE_BOUNDS_EVENT (2)
+#define XDG_TOPLEVEL_CONFIGURE_BOUNDS_EVENT_SIZE (16)
+#define XDG_TOPLEVEL_CONFIGURE_BOUNDS_EVENT_SINCE (4)
+#define XDG_TOPLEVEL_WM_CAPABILITIES_EVENT (3)
+#define XDG_TOPLEVEL_WM_CAPABILITIES_EVENT_SINCE (5)
+
+#define XDG_TOPLEVEL_DESTROY_OPCODE (0)
+#define XDG_TOPLEVEL_DESTROY_SIZE (8)
+
+// Writes a xdg_toplevel.destroy request (a destructor) to dst, which must have
+// room for XDG_TOPLEVEL_DESTROY_SIZE bytes. Returns the number of bytes
+// written.
+static inline uint32_t WriteXdgToplevelDestroy(uint8_t *dst,
+  uint32_t object_id) {
+  const uint32_t size = XDG_TOPLEVEL_DESTROY_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_DESTROY_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_SET_PARENT_OPCODE (1)
+#define XDG_TOPLEVEL_SET_PARENT_SIZE (12)
+
+// Writes a xdg_toplevel.set_parent request to dst, which must have room for
+// XDG_TOPLEVEL_SET_PARENT_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelSetParent(uint8_t *dst,
+  uint32_t object_id, uint32_t parent) {
+  const uint32_t size = XDG_TOPLEVEL_SET_PARENT_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_SET_PARENT_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) parent);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_SET_TITLE_OPCODE (2)
+
+static inline uint32_t XdgToplevelSetTitleSize(const char *title) {
+  return ProtocolStringSize(title) + 8;
+}
+
+// Writes a xdg_toplevel.set_title request to dst, which must have room for
+// XdgToplevelSetTitleSize() bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelSetTitle(uint8_t *dst,
+  uint32_t object_id, const char *title) {
+  const uint32_t size = ProtocolStringSize(title) + 8;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_SET_TITLE_OPCODE,
+    size);
+  dst = ProtocolWriteString(dst, title);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_SET_APP_ID_OPCODE (3)
+
+static inline uint32_t XdgToplevelSetAppIdSize(const char *app_id) {
+  return ProtocolStringSize(app_id) + 8;
+}
+
+// Writes a xdg_toplevel.set_app_id request to dst, which must have room for
+// XdgToplevelSetAppIdSize() bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelSetAppId(uint8_t *dst,
+  uint32_t object_id, const char *app_id) {
+  const uint32_t size = ProtocolStringSize(app_id) + 8;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_SET_APP_ID_OPCODE,
+    size);
+  dst = ProtocolWriteString(dst, app_id);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_SHOW_WINDOW_MENU_OPCODE (4)
+#define XDG_TOPLEVEL_SHOW_WINDOW_MENU_SIZE (24)
+
+// Writes a xdg_toplevel.show_window_menu request to dst, which must have room
+// for XDG_TOPLEVEL_SHOW_WINDOW_MENU_SIZE bytes. Returns the number of bytes
+// written.
+static inline uint32_t WriteXdgToplevelShowWindowMenu(uint8_t *dst,
+  uint32_t object_id, uint32_t seat, uint32_t serial, int32_t x, int32_t y) {
+  const uint32_t size = XDG_TOPLEVEL_SHOW_WINDOW_MENU_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id,
+    XDG_TOPLEVEL_SHOW_WINDOW_MENU_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) seat);
+  dst = ProtocolWriteUint32(dst, (uint32_t) serial);
+  dst = ProtocolWriteUint32(dst, (uint32_t) x);
+  dst = ProtocolWriteUint32(dst, (uint32_t) y);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_MOVE_OPCODE (5)
+#define XDG_TOPLEVEL_MOVE_SIZE (16)
+
+// Writes a xdg_toplevel.move request to dst, which must have room for
+// XDG_TOPLEVEL_MOVE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelMove(uint8_t *dst, uint32_t object_id,
+  uint32_t seat, uint32_t serial) {
+  const uint32_t size = XDG_TOPLEVEL_MOVE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_MOVE_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) seat);
+  dst = ProtocolWriteUint32(dst, (uint32_t) serial);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_RESIZE_OPCODE (6)
+#define XDG_TOPLEVEL_RESIZE_SIZE (20)
+
+// Writes a xdg_toplevel.resize request to dst, which must have room for
+// XDG_TOPLEVEL_RESIZE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelResize(uint8_t *dst, uint32_t object_id,
+  uint32_t seat, uint32_t serial, uint32_t edges) {
+  const uint32_t size = XDG_TOPLEVEL_RESIZE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_RESIZE_OPCODE, size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) seat);
+  dst = ProtocolWriteUint32(dst, (uint32_t) serial);
+  dst = ProtocolWriteUint32(dst, (uint32_t) edges);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_SET_MAX_SIZE_OPCODE (7)
+#define XDG_TOPLEVEL_SET_MAX_SIZE_SIZE (16)
+
+// Writes a xdg_toplevel.set_max_size request to dst, which must have room for
+// XDG_TOPLEVEL_SET_MAX_SIZE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelSetMaxSize(uint8_t *dst,
+  uint32_t object_id, int32_t width, int32_t height) {
+  const uint32_t size = XDG_TOPLEVEL_SET_MAX_SIZE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_SET_MAX_SIZE_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) width);
+  dst = ProtocolWriteUint32(dst, (uint32_t) height);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_SET_MIN_SIZE_OPCODE (8)
+#define XDG_TOPLEVEL_SET_MIN_SIZE_SIZE (16)
+
+// Writes a xdg_toplevel.set_min_size request to dst, which must have room for
+// XDG_TOPLEVEL_SET_MIN_SIZE_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelSetMinSize(uint8_t *dst,
+  uint32_t object_id, int32_t width, int32_t height) {
+  const uint32_t size = XDG_TOPLEVEL_SET_MIN_SIZE_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_SET_MIN_SIZE_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) width);
+  dst = ProtocolWriteUint32(dst, (uint32_t) height);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_SET_MAXIMIZED_OPCODE (9)
+#define XDG_TOPLEVEL_SET_MAXIMIZED_SIZE (8)
+
+// Writes a xdg_toplevel.set_maximized request to dst, which must have room for
+// XDG_TOPLEVEL_SET_MAXIMIZED_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelSetMaximized(uint8_t *dst,
+  uint32_t object_id) {
+  const uint32_t size = XDG_TOPLEVEL_SET_MAXIMIZED_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_SET_MAXIMIZED_OPCODE,
+    size);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_UNSET_MAXIMIZED_OPCODE (10)
+#define XDG_TOPLEVEL_UNSET_MAXIMIZED_SIZE (8)
+
+// Writes a xdg_toplevel.unset_maximized request to dst, which must have room
+// for XDG_TOPLEVEL_UNSET_MAXIMIZED_SIZE bytes. Returns the number of bytes
+// written.
+static inline uint32_t WriteXdgToplevelUnsetMaximized(uint8_t *dst,
+  uint32_t object_id) {
+  const uint32_t size = XDG_TOPLEVEL_UNSET_MAXIMIZED_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_UNSET_MAXIMIZED_OPCODE,
+    size);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_SET_FULLSCREEN_OPCODE (11)
+#define XDG_TOPLEVEL_SET_FULLSCREEN_SIZE (12)
+
+// Writes a xdg_toplevel.set_fullscreen request to dst, which must have room for
+// XDG_TOPLEVEL_SET_FULLSCREEN_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelSetFullscreen(uint8_t *dst,
+  uint32_t object_id, uint32_t output) {
+  const uint32_t size = XDG_TOPLEVEL_SET_FULLSCREEN_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_SET_FULLSCREEN_OPCODE,
+    size);
+  dst = ProtocolWriteUint32(dst, (uint32_t) output);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_UNSET_FULLSCREEN_OPCODE (12)
+#define XDG_TOPLEVEL_UNSET_FULLSCREEN_SIZE (8)
+
+// Writes a xdg_toplevel.unset_fullscreen request to dst, which must have room
+// for XDG_TOPLEVEL_UNSET_FULLSCREEN_SIZE bytes. Returns the number of bytes
+// written.
+static inline uint32_t WriteXdgToplevelUnsetFullscreen(uint8_t *dst,
+  uint32_t object_id) {
+  const uint32_t size = XDG_TOPLEVEL_UNSET_FULLSCREEN_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id,
+    XDG_TOPLEVEL_UNSET_FULLSCREEN_OPCODE, size);
+  (void) dst;
+  return size;
+}
+
+#define XDG_TOPLEVEL_SET_MINIMIZED_OPCODE (13)
+#define XDG_TOPLEVEL_SET_MINIMIZED_SIZE (8)
+
+// Writes a xdg_toplevel.set_minimized request to dst, which must have room for
+// XDG_TOPLEVEL_SET_MINIMIZED_SIZE bytes. Returns the number of bytes written.
+static inline uint32_t WriteXdgToplevelSetMinimized(uint8_t *dst,
+  uint32_t object_id) {
+  const uint32_t size = XDG_TOPLEVEL_SET_MINIMIZED_SIZE;
+  dst = ProtocolWriteHeader(dst, object_id, XDG_TOPLEVEL_SET_MINIMIZED_OPCODE,
+    size);
+  (void) dst;
+  return size;
+}
+
+#endif  // WAYLAND_PROTOCOL_H
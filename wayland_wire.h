@@ -0,0 +1,75 @@
+#ifndef WAYLAND_WIRE_H
+#define WAYLAND_WIRE_H
+// This is a header-only implementation of the functions used to decode
+// messages received from the wayland server. The functions that encode
+// requests are generated into wayland_protocol.h.
+//
+// None of these check that reads stay within the message; callers are
+// expected to check the payload size first.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "log.h"
+
+// An event received from the server.
+typedef struct {
+  uint32_t object_id;
+  uint16_t opcode;
+  // Holds the size of the payload, in bytes. Does not include padding or the
+  // size of the header.
+  uint16_t payload_size;
+  // Will be NULL if payload_size is 0.
+  uint8_t *payload;
+} ParsedWaylandEvent;
+
+// Rounds v up to the next multiple of 4.
+static uint32_t RoundUp4(uint32_t v) {
+  while (v & 3) v++;
+  return v;
+}
+
+static uint32_t ReadUint32(uint8_t *buffer, size_t *current_offset) {
+  uint32_t to_return = *((uint32_t *) (buffer + *current_offset));
+  *current_offset += 4;
+  return to_return;
+}
+
+// Assumes the current offset into the buffer is at the start of a wayland
+// event. Fills dst with the event data, incrementing the current_offset to
+// point past the event in the buffer. Prints a message and returns 0 if the
+// event's size is invalid.
+static int ReadWaylandEvent(uint8_t *buffer, size_t *current_offset,
+  ParsedWaylandEvent *dst) {
+  uint32_t opcode_and_size, size_with_header;
+  dst->object_id  = ReadUint32(buffer, current_offset);
+  opcode_and_size = ReadUint32(buffer, current_offset);
+  dst->opcode = opcode_and_size & 0xffff;
+  size_with_header = opcode_and_size >> 16;
+  if (size_with_header < 8) {
+    LOG_ERROR("Got invalid wayland message size: %d\n", (int) size_with_header);
+    return 0;
+  }
+  dst->payload_size = size_with_header - 8;
+  if (dst->payload_size == 0) {
+    dst->payload = NULL;
+  } else {
+    dst->payload = buffer + *current_offset;
+  }
+  *current_offset += RoundUp4(dst->payload_size);
+  return 1;
+}
+
+// Reads a wayland string from a buffer. A wayland string is prefixed by a
+// 4-byte size, includes the null terminator, and is padded to 4 bytes. Updates
+// the buffer offset to be past the end of the string and padding. Returns an
+// empty null terminated string ("") if the string's length is 0.
+static char* ReadWaylandString(uint8_t *buffer, size_t *current_offset) {
+  char *to_return = NULL;
+  uint32_t string_length = ReadUint32(buffer, current_offset);
+  if (string_length == 0) return "";
+  to_return = (char *) (buffer + *current_offset);
+  *current_offset += RoundUp4(string_length);
+  return to_return;
+}
+
+#endif  // WAYLAND_WIRE_H
@@ -0,0 +1,441 @@
+// This program measures the cost of encoding and decoding wayland messages,
+// using the generated request writers in wayland_protocol.h and the decoding
+// functions in wayland_wire.h. Each benchmark runs on a realistic mix of
+// messages: registry globals with strings, configure events with arrays, a
+// flood of pointer motion events, the events a client gets for each frame,
+// and the requests it sends to present one.
+//
+// Usage: wire_bench [-o results.json] [-c baseline.json] [-t percent]
+//   -o: Write the results to this file as JSON.
+//   -c: Compare the results against a file written by an earlier -o, and
+//       exit with status 2 if any benchmark got more than -t percent slower.
+//   -t: The slowdown, in percent, that counts as a regression. Defaults to 10.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "wayland_protocol.h"
+#include "wayland_wire.h"
+
+// Each measurement repeats the batch until at least this much time has
+// passed.
+#define MIN_BENCHMARK_SECONDS (0.25)
+// Messages are encoded and decoded in batches of about this many bytes, the
+// size of the client's receive buffer.
+#define BATCH_SIZE (0x10000)
+// Encoders stop adding to a batch once less than this much room is left.
+#define MAX_BENCH_MESSAGE_SIZE (256)
+#define MAX_RESULTS (32)
+#define MAX_NAME_LENGTH (64)
+#define DEFAULT_REGRESSION_PERCENT (10.0)
+
+// wl_pointer isn't in wayland_protocol.h, since the client doesn't use it.
+#define WL_POINTER_MOTION_EVENT (2)
+#define WL_POINTER_FRAME_EVENT (5)
+// xdg_toplevel states.
+#define XDG_TOPLEVEL_STATE_MAXIMIZED (1)
+#define XDG_TOPLEVEL_STATE_ACTIVATED (4)
+
+// Writes one batch of messages to dst, which has room for BATCH_SIZE bytes.
+// Returns the number of bytes written and sets *message_count.
+typedef uint32_t (*EncodeFunction)(uint8_t *dst, uint32_t *message_count);
+
+// Decodes a batch of messages, adding the values in them to *sink so the work
+// can't be optimized out. Returns the number of messages, or 0 on error.
+typedef uint32_t (*DecodeFunction)(uint8_t *src, uint32_t size,
+  uint64_t *sink);
+
+typedef struct {
+  const char *name;
+  EncodeFunction encode;
+  // NULL for the mixes of requests, which only the server decodes.
+  DecodeFunction decode;
+} MessageMix;
+
+typedef struct {
+  char name[MAX_NAME_LENGTH];
+  uint64_t messages;
+  uint64_t bytes;
+  double seconds;
+} BenchmarkResult;
+
+static const char *global_interfaces[] = {
+  "wl_compositor", "wl_subcompositor", "wl_shm", "wl_data_device_manager",
+  "zwp_linux_dmabuf_v1", "wp_viewporter", "xdg_wm_base", "wl_seat",
+  "wl_output", "zwp_pointer_constraints_v1",
+  "zwp_relative_pointer_manager_v1", "wp_fractional_scale_manager_v1",
+};
+
+#define GLOBAL_INTERFACE_COUNT \
+  (sizeof(global_interfaces) / sizeof(global_interfaces[0]))
+
+// Written at the end so the compiler can't discard the decoding work.
+static volatile uint64_t bench_sink;
+
+static double CurrentSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((double) ts.tv_sec) + ((double) ts.tv_nsec) * 1e-9;
+}
+
+// wl_registry.global events, as sent when a client gets the registry.
+static uint32_t EncodeRegistryGlobals(uint8_t *dst, uint32_t *message_count) {
+  uint32_t offset = 0, size, i = 0;
+  const char *interface = NULL;
+  uint8_t *p = NULL;
+  *message_count = 0;
+  while ((offset + MAX_BENCH_MESSAGE_SIZE) <= BATCH_SIZE) {
+    interface = global_interfaces[i % GLOBAL_INTERFACE_COUNT];
+    size = WAYLAND_HEADER_SIZE + 8 + ProtocolStringSize(interface);
+    p = ProtocolWriteHeader(dst + offset, 2, WL_REGISTRY_GLOBAL_EVENT, size);
+    p = ProtocolWriteUint32(p, i + 1);
+    p = ProtocolWriteString(p, interface);
+    ProtocolWriteUint32(p, 1 + (i % 5));
+    offset += size;
+    i++;
+  }
+  *message_count = i;
+  return offset;
+}
+
+static uint32_t DecodeRegistryGlobals(uint8_t *src, uint32_t size,
+  uint64_t *sink) {
+  ParsedWaylandEvent e;
+  size_t offset = 0, payload_offset;
+  uint32_t count = 0;
+  const char *interface = NULL;
+  while (offset < size) {
+    if (!ReadWaylandEvent(src, &offset, &e)) return 0;
+    payload_offset = 0;
+    *sink += ReadUint32(e.payload, &payload_offset);
+    interface = ReadWaylandString(e.payload, &payload_offset);
+    *sink += ReadUint32(e.payload, &payload_offset) + interface[0];
+    count++;
+  }
+  return count;
+}
+
+// Pairs of xdg_toplevel.configure, with a states array, and
+// xdg_surface.configure, as sent while a window is being resized.
+static uint32_t EncodeConfigures(uint8_t *dst, uint32_t *message_count) {
+  uint32_t states[] = {XDG_TOPLEVEL_STATE_MAXIMIZED,
+    XDG_TOPLEVEL_STATE_ACTIVATED};
+  uint32_t offset = 0, size, i = 0;
+  uint8_t *p = NULL;
+  while ((offset + MAX_BENCH_MESSAGE_SIZE) <= BATCH_SIZE) {
+    size = WAYLAND_HEADER_SIZE + 8 + ProtocolArraySize(sizeof(states));
+    p = ProtocolWriteHeader(dst + offset, 12, XDG_TOPLEVEL_CONFIGURE_EVENT,
+      size);
+    p = ProtocolWriteUint32(p, 640 + (i & 255));
+    p = ProtocolWriteUint32(p, 480 + (i & 127));
+    ProtocolWriteArray(p, states, sizeof(states));
+    offset += size;
+    p = ProtocolWriteHeader(dst + offset, 11, XDG_SURFACE_CONFIGURE_EVENT,
+      12);
+    ProtocolWriteUint32(p, i);
+    offset += 12;
+    i++;
+  }
+  *message_count = i * 2;
+  return offset;
+}
+
+static uint32_t DecodeConfigures(uint8_t *src, uint32_t size, uint64_t *sink) {
+  ParsedWaylandEvent e;
+  size_t offset = 0, payload_offset;
+  uint32_t count = 0, states_size, i;
+  while (offset < size) {
+    if (!ReadWaylandEvent(src, &offset, &e)) return 0;
+    payload_offset = 0;
+    count++;
+    if ((e.opcode == XDG_SURFACE_CONFIGURE_EVENT) && (e.payload_size == 4)) {
+      *sink += ReadUint32(e.payload, &payload_offset);
+      continue;
+    }
+    *sink += ReadUint32(e.payload, &payload_offset);
+    *sink += ReadUint32(e.payload, &payload_offset);
+    states_size = ReadUint32(e.payload, &payload_offset);
+    for (i = 0; i < (states_size / 4); i++) {
+      *sink += ReadUint32(e.payload, &payload_offset);
+    }
+  }
+  return count;
+}
+
+// wl_pointer.motion events, each followed by wl_pointer.frame, as sent while
+// the mouse moves over a surface.
+static uint32_t EncodePointerMotion(uint8_t *dst, uint32_t *message_count) {
+  uint32_t offset = 0, i = 0;
+  uint8_t *p = NULL;
+  while ((offset + MAX_BENCH_MESSAGE_SIZE) <= BATCH_SIZE) {
+    p = ProtocolWriteHeader(dst + offset, 20, WL_POINTER_MOTION_EVENT, 20);
+    p = ProtocolWriteUint32(p, i * 8);
+    // The coordinates are 24.8 fixed point.
+    p = ProtocolWriteUint32(p, (i & 1023) << 8);
+    ProtocolWriteUint32(p, ((i * 3) & 1023) << 8);
+    offset += 20;
+    ProtocolWriteHeader(dst + offset, 20, WL_POINTER_FRAME_EVENT, 8);
+    offset += 8;
+    i++;
+  }
+  *message_count = i * 2;
+  return offset;
+}
+
+static uint32_t DecodePointerMotion(uint8_t *src, uint32_t size,
+  uint64_t *sink) {
+  ParsedWaylandEvent e;
+  size_t offset = 0, payload_offset;
+  uint32_t count = 0;
+  while (offset < size) {
+    if (!ReadWaylandEvent(src, &offset, &e)) return 0;
+    count++;
+    if (e.opcode != WL_POINTER_MOTION_EVENT) continue;
+    payload_offset = 0;
+    *sink += ReadUint32(e.payload, &payload_offset);
+    *sink += ReadUint32(e.payload, &payload_offset) >> 8;
+    *sink += ReadUint32(e.payload, &payload_offset) >> 8;
+  }
+  return count;
+}
+
+// The events a client gets for each frame: wl_callback.done, then
+// wl_display.delete_id for the callback, and wl_buffer.release.
+static uint32_t EncodeFrameEvents(uint8_t *dst, uint32_t *message_count) {
+  uint32_t offset = 0, i = 0, callback_id;
+  uint8_t *p = NULL;
+  while ((offset + MAX_BENCH_MESSAGE_SIZE) <= BATCH_SIZE) {
+    callback_id = 13 + (i & 1);
+    p = ProtocolWriteHeader(dst + offset, callback_id, WL_CALLBACK_DONE_EVENT,
+      WL_CALLBACK_DONE_EVENT_SIZE);
+    ProtocolWriteUint32(p, i * 16);
+    offset += WL_CALLBACK_DONE_EVENT_SIZE;
+    p = ProtocolWriteHeader(dst + offset, 1, WL_DISPLAY_DELETE_ID_EVENT,
+      WL_DISPLAY_DELETE_ID_EVENT_SIZE);
+    ProtocolWriteUint32(p, callback_id);
+    offset += WL_DISPLAY_DELETE_ID_EVENT_SIZE;
+    ProtocolWriteHeader(dst + offset, 10 + (i % 3), WL_BUFFER_RELEASE_EVENT,
+      WAYLAND_HEADER_SIZE);
+    offset += WAYLAND_HEADER_SIZE;
+    i++;
+  }
+  *message_count = i * 3;
+  return offset;
+}
+
+static uint32_t DecodeFrameEvents(uint8_t *src, uint32_t size,
+  uint64_t *sink) {
+  ParsedWaylandEvent e;
+  size_t offset = 0, payload_offset;
+  uint32_t count = 0;
+  while (offset < size) {
+    if (!ReadWaylandEvent(src, &offset, &e)) return 0;
+    count++;
+    *sink += e.object_id;
+    if (e.payload_size != 4) continue;
+    payload_offset = 0;
+    *sink += ReadUint32(e.payload, &payload_offset);
+  }
+  return count;
+}
+
+// The requests RenderFrame sends to present a frame with partial damage.
+static uint32_t EncodeFrameRequests(uint8_t *dst, uint32_t *message_count) {
+  uint32_t offset = 0, i = 0;
+  while ((offset + MAX_BENCH_MESSAGE_SIZE) <= BATCH_SIZE) {
+    offset += WriteWlSurfaceAttach(dst + offset, 3, 10 + (i % 3), 0, 0);
+    offset += WriteWlSurfaceDamageBuffer(dst + offset, 3, i & 255, i & 127,
+      32, 32);
+    offset += WriteWlSurfaceDamageBuffer(dst + offset, 3, (i + 8) & 255,
+      i & 127, 32, 32);
+    offset += WriteWlSurfaceFrame(dst + offset, 3, 13 + (i & 1));
+    offset += WriteWlSurfaceCommit(dst + offset, 3);
+    i++;
+  }
+  *message_count = i * 5;
+  return offset;
+}
+
+// The wl_registry.bind requests a client sends while starting up.
+static uint32_t EncodeRegistryBinds(uint8_t *dst, uint32_t *message_count) {
+  uint32_t offset = 0, i = 0;
+  while ((offset + MAX_BENCH_MESSAGE_SIZE) <= BATCH_SIZE) {
+    offset += WriteWlRegistryBind(dst + offset, 2, i + 1,
+      global_interfaces[i % GLOBAL_INTERFACE_COUNT], 1 + (i % 5), i + 3);
+    i++;
+  }
+  *message_count = i;
+  return offset;
+}
+
+static const MessageMix message_mixes[] = {
+  {"registry_globals", EncodeRegistryGlobals, DecodeRegistryGlobals},
+  {"toplevel_configures", EncodeConfigures, DecodeConfigures},
+  {"pointer_motion", EncodePointerMotion, DecodePointerMotion},
+  {"frame_events", EncodeFrameEvents, DecodeFrameEvents},
+  {"frame_requests", EncodeFrameRequests, NULL},
+  {"registry_binds", EncodeRegistryBinds, NULL},
+};
+
+static void PrintResult(const BenchmarkResult *r) {
+  printf("%-28s %8.2f ns/msg %8.2f M msg/s %9.2f MB/s\n", r->name,
+    r->seconds * 1e9 / r->messages, r->messages / r->seconds / 1e6,
+    r->bytes / r->seconds / 1e6);
+}
+
+static void TimeEncode(const MessageMix *mix, uint8_t *buffer,
+  BenchmarkResult *r) {
+  uint32_t count, size;
+  double start = CurrentSeconds();
+  snprintf(r->name, sizeof(r->name), "encode_%s", mix->name);
+  r->messages = 0;
+  r->bytes = 0;
+  do {
+    size = mix->encode(buffer, &count);
+    r->messages += count;
+    r->bytes += size;
+    r->seconds = CurrentSeconds() - start;
+  } while (r->seconds < MIN_BENCHMARK_SECONDS);
+  bench_sink += buffer[size - 1];
+}
+
+// Returns 0 if the messages couldn't be decoded.
+static int TimeDecode(const MessageMix *mix, uint8_t *buffer,
+  BenchmarkResult *r) {
+  uint32_t count, size = mix->encode(buffer, &count);
+  uint64_t sink = 0;
+  double start;
+  snprintf(r->name, sizeof(r->name), "decode_%s", mix->name);
+  if (mix->decode(buffer, size, &sink) != count) {
+    printf("Decoding %s produced the wrong number of messages.\n", mix->name);
+    return 0;
+  }
+  r->messages = 0;
+  r->bytes = 0;
+  start = CurrentSeconds();
+  do {
+    r->messages += mix->decode(buffer, size, &sink);
+    r->bytes += size;
+    r->seconds = CurrentSeconds() - start;
+  } while (r->seconds < MIN_BENCHMARK_SECONDS);
+  bench_sink += sink;
+  return 1;
+}
+
+// Writes the results as JSON, one benchmark per line so that the comparison
+// below can read them back without a JSON parser. Returns 0 on error.
+static int WriteResults(const char *path, BenchmarkResult *results,
+  int count) {
+  FILE *f = fopen(path, "w");
+  BenchmarkResult *r = NULL;
+  int i;
+  if (!f) {
+    printf("Failed opening %s for writing.\n", path);
+    return 0;
+  }
+  fprintf(f, "{\n  \"benchmark\": \"wire\",\n  \"results\": [\n");
+  for (i = 0; i < count; i++) {
+    r = results + i;
+    fprintf(f, "    {\"name\": \"%s\", \"ns_per_message\": %.3f, "
+      "\"messages_per_second\": %.0f, \"bytes_per_second\": %.0f, "
+      "\"messages\": %llu, \"bytes\": %llu, \"seconds\": %.6f}%s\n", r->name,
+      r->seconds * 1e9 / r->messages, r->messages / r->seconds,
+      r->bytes / r->seconds, (unsigned long long) r->messages,
+      (unsigned long long) r->bytes, r->seconds, (i + 1) < count ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  if (fclose(f) != 0) {
+    printf("Failed writing %s.\n", path);
+    return 0;
+  }
+  printf("Wrote results to %s.\n", path);
+  return 1;
+}
+
+// Compares the results against a file written by WriteResults. Returns the
+// number of regressions, or -1 on error.
+static int CompareResults(const char *path, BenchmarkResult *results,
+  int count, double threshold_percent) {
+  FILE *f = fopen(path, "r");
+  char line[512], name[MAX_NAME_LENGTH];
+  double baseline, current, change;
+  int i, regressions = 0;
+  if (!f) {
+    printf("Failed opening baseline %s.\n", path);
+    return -1;
+  }
+  printf("Compared to %s:\n", path);
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, " {\"name\": \"%63[^\"]\", \"ns_per_message\": %lf",
+      name, &baseline) != 2) {
+      continue;
+    }
+    for (i = 0; i < count; i++) {
+      if (strcmp(results[i].name, name) == 0) break;
+    }
+    if ((i == count) || (baseline <= 0)) continue;
+    current = results[i].seconds * 1e9 / results[i].messages;
+    change = (current - baseline) * 100.0 / baseline;
+    printf("%-28s %8.2f -> %8.2f ns/msg %+7.1f%%%s\n", name, baseline,
+      current, change, (change > threshold_percent) ? "  REGRESSION" : "");
+    if (change > threshold_percent) regressions++;
+  }
+  fclose(f);
+  return regressions;
+}
+
+int main(int argc, char **argv) {
+  BenchmarkResult results[MAX_RESULTS];
+  const char *output_path = NULL, *baseline_path = NULL;
+  double threshold = DEFAULT_REGRESSION_PERCENT;
+  uint8_t *buffer = NULL;
+  int i, count = 0, regressions;
+
+  for (i = 1; i < argc; i++) {
+    if ((i + 1) >= argc) break;
+    if (strcmp(argv[i], "-o") == 0) {
+      output_path = argv[i + 1];
+    } else if (strcmp(argv[i], "-c") == 0) {
+      baseline_path = argv[i + 1];
+    } else if (strcmp(argv[i], "-t") == 0) {
+      threshold = strtod(argv[i + 1], NULL);
+    } else {
+      break;
+    }
+    i++;
+  }
+  if (i < argc) {
+    printf("Usage: %s [-o results.json] [-c baseline.json] [-t percent]\n",
+      argv[0]);
+    return 1;
+  }
+  buffer = (uint8_t *) aligned_alloc(64, BATCH_SIZE);
+  if (!buffer) {
+    printf("Failed allocating the message buffer.\n");
+    return 1;
+  }
+  for (i = 0; i < (sizeof(message_mixes) / sizeof(message_mixes[0])); i++) {
+    TimeEncode(message_mixes + i, buffer, results + count);
+    PrintResult(results + count);
+    count++;
+    if (!message_mixes[i].decode) continue;
+    if (!TimeDecode(message_mixes + i, buffer, results + count)) {
+      free(buffer);
+      return 1;
+    }
+    PrintResult(results + count);
+    count++;
+  }
+  free(buffer);
+  if (output_path && !WriteResults(output_path, results, count)) return 1;
+  if (!baseline_path) return 0;
+  regressions = CompareResults(baseline_path, results, count, threshold);
+  if (regressions < 0) return 1;
+  if (regressions > 0) {
+    printf("%d benchmarks regressed by more than %.1f%%.\n", regressions,
+      threshold);
+    return 2;
+  }
+  return 0;
+}
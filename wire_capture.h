@@ -0,0 +1,267 @@
+#ifndef WIRE_CAPTURE_H
+#define WIRE_CAPTURE_H
+// This is a header-only implementation of a compact binary log of the bytes
+// sent and received on a wayland connection, and of a reader for replaying
+// it.
+//
+// The file starts with WIRE_CAPTURE_MAGIC, followed by records. Each record is
+// a WireCaptureRecord header followed by size bytes of payload. Received and
+// sent records hold the bytes exactly as they were read from or written to the
+// socket, one record per syscall. An FD record follows the sent or received
+// record the FD went along with, and holds the size of the file it refers to
+// as a uint64_t, since the FD itself can't be captured.
+//
+// Records are buffered in memory and written out in blocks of
+// WIRE_CAPTURE_BUFFER_SIZE, so capturing costs a memcpy per syscall rather
+// than a write.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "latency_histogram.h"
+#include "log.h"
+
+#define WIRE_CAPTURE_MAGIC "WLCAPv1\n"
+#define WIRE_CAPTURE_MAGIC_SIZE (8)
+#define WIRE_CAPTURE_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+  WIRE_CAPTURE_RECEIVED = 1,
+  WIRE_CAPTURE_SENT = 2,
+  WIRE_CAPTURE_FD = 3,
+} WireCaptureType;
+
+typedef struct {
+  // Nanoseconds since the capture started.
+  uint64_t time;
+  uint32_t type;
+  // The number of payload bytes following this header.
+  uint32_t size;
+} WireCaptureRecord;
+
+typedef struct {
+  int fd;
+  uint8_t *buffer;
+  uint32_t buffered;
+  // The CLOCK_MONOTONIC time the capture started, in nanoseconds.
+  uint64_t start_time;
+  uint64_t records;
+  uint64_t bytes;
+} WireCapture;
+
+// A capture file mapped into memory for replay.
+typedef struct {
+  uint8_t *data;
+  uint64_t size;
+  uint64_t offset;
+  // The number of records returned so far.
+  uint64_t records;
+} WireReplay;
+
+// Sets up c so that WireCaptureClose is safe to call on it, and so that
+// WireCaptureActive returns 0.
+static void WireCaptureInit(WireCapture *c) {
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+}
+
+static int WireCaptureActive(WireCapture *c) {
+  return c->fd >= 0;
+}
+
+// Writes all of the given bytes to the capture file. Returns 0 on error.
+static int WireCaptureWriteAll(WireCapture *c, const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *) data;
+  ssize_t result;
+  while (size > 0) {
+    result = write(c->fd, p, size);
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      LOG_ERROR("Error writing the capture file: %s\n", strerror(errno));
+      return 0;
+    }
+    p += result;
+    size -= result;
+  }
+  return 1;
+}
+
+// Writes out any buffered records. Returns 0 on error.
+static int WireCaptureFlush(WireCapture *c) {
+  if (!WireCaptureWriteAll(c, c->buffer, c->buffered)) return 0;
+  c->buffered = 0;
+  return 1;
+}
+
+// Creates the capture file at path, replacing any existing file. Returns 0 on
+// error.
+static int WireCaptureOpen(WireCapture *c, const char *path) {
+  WireCaptureInit(c);
+  c->buffer = (uint8_t *) malloc(WIRE_CAPTURE_BUFFER_SIZE);
+  if (!c->buffer) {
+    LOG_ERROR("Failed allocating the capture buffer.\n");
+    return 0;
+  }
+  c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (c->fd < 0) {
+    LOG_ERROR("Error creating capture file %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  memcpy(c->buffer, WIRE_CAPTURE_MAGIC, WIRE_CAPTURE_MAGIC_SIZE);
+  c->buffered = WIRE_CAPTURE_MAGIC_SIZE;
+  c->start_time = MonotonicNanoseconds();
+  return 1;
+}
+
+// Writes out any buffered records and closes the file.
+static void WireCaptureClose(WireCapture *c) {
+  if (c->fd >= 0) {
+    WireCaptureFlush(c);
+    close(c->fd);
+  }
+  free(c->buffer);
+  WireCaptureInit(c);
+}
+
+// Appends size bytes to the buffer, flushing it as needed. Returns 0 on error.
+static int WireCaptureAppend(WireCapture *c, const void *data, size_t size) {
+  if ((c->buffered + size) > WIRE_CAPTURE_BUFFER_SIZE) {
+    if (!WireCaptureFlush(c)) return 0;
+    // Don't bother copying anything that won't fit anyway.
+    if (size > WIRE_CAPTURE_BUFFER_SIZE) {
+      return WireCaptureWriteAll(c, data, size);
+    }
+  }
+  memcpy(c->buffer + c->buffered, data, size);
+  c->buffered += size;
+  return 1;
+}
+
+// Records the first size bytes spread across the given regions, e.g. the
+// regions passed to recvmsg. Returns 0 on error.
+static int WireCaptureRegions(WireCapture *c, WireCaptureType type,
+  const struct iovec *regions, int region_count, uint32_t size) {
+  WireCaptureRecord record;
+  uint32_t remaining = size, n;
+  int i;
+  record.time = MonotonicNanoseconds() - c->start_time;
+  record.type = type;
+  record.size = size;
+  if (!WireCaptureAppend(c, &record, sizeof(record))) return 0;
+  for (i = 0; (i < region_count) && (remaining > 0); i++) {
+    n = regions[i].iov_len;
+    if (n > remaining) n = remaining;
+    if (!WireCaptureAppend(c, regions[i].iov_base, n)) return 0;
+    remaining -= n;
+  }
+  c->records++;
+  c->bytes += size;
+  return 1;
+}
+
+// Records size bytes of data. Returns 0 on error.
+static int WireCaptureData(WireCapture *c, WireCaptureType type,
+  const void *data, uint32_t size) {
+  struct iovec region;
+  region.iov_base = (void *) data;
+  region.iov_len = size;
+  return WireCaptureRegions(c, type, &region, 1, size);
+}
+
+// Records that fd was passed to or from the server. Returns 0 on error.
+static int WireCaptureFd(WireCapture *c, int fd) {
+  struct stat info;
+  uint64_t size = 0;
+  if (fstat(fd, &info) == 0) size = info.st_size;
+  return WireCaptureData(c, WIRE_CAPTURE_FD, &size, sizeof(size));
+}
+
+static void WireReplayInit(WireReplay *r) {
+  memset(r, 0, sizeof(*r));
+}
+
+static void WireReplayClose(WireReplay *r) {
+  if (r->data) munmap(r->data, r->size);
+  WireReplayInit(r);
+}
+
+// Maps the capture file at path and checks its header. Returns 0 on error.
+static int WireReplayOpen(WireReplay *r, const char *path) {
+  struct stat info;
+  int fd;
+  WireReplayInit(r);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG_ERROR("Error opening capture file %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  if (fstat(fd, &info) != 0) {
+    LOG_ERROR("Error getting the size of %s: %s\n", path, strerror(errno));
+    close(fd);
+    return 0;
+  }
+  if (info.st_size < WIRE_CAPTURE_MAGIC_SIZE) {
+    LOG_ERROR("%s is too small to be a capture file.\n", path);
+    close(fd);
+    return 0;
+  }
+  r->data = (uint8_t *) mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd,
+    0);
+  close(fd);
+  if (r->data == MAP_FAILED) {
+    LOG_ERROR("Error mapping %s: %s\n", path, strerror(errno));
+    r->data = NULL;
+    return 0;
+  }
+  r->size = info.st_size;
+  if (memcmp(r->data, WIRE_CAPTURE_MAGIC, WIRE_CAPTURE_MAGIC_SIZE) != 0) {
+    LOG_ERROR("%s isn't a capture file.\n", path);
+    WireReplayClose(r);
+    return 0;
+  }
+  r->offset = WIRE_CAPTURE_MAGIC_SIZE;
+  return 1;
+}
+
+// Sets *record and *payload to the next record in the file. Returns 0 at the
+// end of the file, or if the rest of the file is truncated.
+static int WireReplayNext(WireReplay *r, WireCaptureRecord *record,
+  const uint8_t **payload) {
+  if ((r->size - r->offset) < sizeof(*record)) {
+    if (r->offset != r->size) LOG_WARNING("The capture file is truncated.\n");
+    return 0;
+  }
+  memcpy(record, r->data + r->offset, sizeof(*record));
+  if ((r->size - r->offset - sizeof(*record)) < record->size) {
+    LOG_WARNING("The capture file is truncated.\n");
+    return 0;
+  }
+  *payload = r->data + r->offset + sizeof(*record);
+  r->offset += sizeof(*record) + record->size;
+  r->records++;
+  return 1;
+}
+
+// If the next record is an FD record, consumes it, sets *size to the size of
+// the file the FD referred to, and returns 1. Otherwise returns 0 and leaves
+// the record to WireReplayNext.
+static int WireReplayNextFd(WireReplay *r, uint64_t *size) {
+  WireCaptureRecord record;
+  if ((r->size - r->offset) < (sizeof(record) + sizeof(*size))) return 0;
+  memcpy(&record, r->data + r->offset, sizeof(record));
+  if ((record.type != WIRE_CAPTURE_FD) || (record.size != sizeof(*size))) {
+    return 0;
+  }
+  memcpy(size, r->data + r->offset + sizeof(record), sizeof(*size));
+  r->offset += sizeof(record) + sizeof(*size);
+  r->records++;
+  return 1;
+}
+
+#endif  // WIRE_CAPTURE_H